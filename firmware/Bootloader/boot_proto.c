@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "boot_proto.h"
+
+// uint32_t for the CRC unit and the half-word programming
+static uint32_t pageBuffer[FLASH_PAGE_SIZE / 4];
+static uint8_t payload[BOOT_MAX_PAYLOAD];
+
+// the descriptor is erased by the first write of an update
+static uint8_t imageErased;
+
+static uint16_t __crc16(uint16_t crc, uint8_t b)
+{
+    crc ^= b;
+    for (uint8_t i = 0; i < 8; ++i) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+static inline uint32_t __get_u32(const uint8_t* p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+        | ((uint32_t)p[3] << 24);
+}
+
+static inline void __put_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t __page_crc(uint8_t page)
+{
+    return boot_crc32((const uint32_t*)(BOOT_APP_ADDRESS 
+                                        + page * FLASH_PAGE_SIZE),
+                      FLASH_PAGE_SIZE / 4);
+}
+
+uint8_t boot_image_valid()
+{
+    const struct BootImage* img = (const struct BootImage*)BOOT_IMAGE_ADDRESS;
+
+    if ((img->magic != BOOT_IMAGE_MAGIC) || (img->check != ~BOOT_IMAGE_MAGIC)
+        || (img->length == 0) || (img->length > BOOT_APP_SIZE)
+        || (img->length % 4)) {
+        return 0;
+    }
+
+    return boot_crc32((const uint32_t*)BOOT_APP_ADDRESS, img->length / 4) 
+        == img->crc;
+}
+
+uint8_t boot_lz_decode(const uint8_t* src, uint16_t length, uint8_t* page)
+{
+    uint16_t in = 0;
+    uint16_t out = 0;
+
+    while (in < length) {
+        uint8_t c = src[in++];
+
+        if (c < 0x80) {
+            uint16_t n = c + 1;
+
+            if ((in + n > length) || (out + n > FLASH_PAGE_SIZE)) {
+                return 0;
+            }
+            while (n--) {
+                page[out++] = src[in++];
+            }
+        } else {
+            if (in == length) {
+                return 0;
+            }
+
+            uint16_t n = ((c >> 2) & 0x1F) + 3;
+            uint16_t offset = (((c & 0x03) << 8) | src[in++]) + 1;
+
+            if ((offset > out) || (out + n > FLASH_PAGE_SIZE)) {
+                return 0;
+            }
+            // may overlap, byte by byte on purpose
+            while (n--) {
+                page[out] = page[out - offset];
+                ++out;
+            }
+        }
+    }
+
+    return out == FLASH_PAGE_SIZE;
+}
+
+static void __reply(uint8_t status, const uint8_t* data, uint16_t length)
+{
+    uint8_t header[3] = { status, length & 0xFF, length >> 8 };
+    uint16_t crc = 0xFFFF;
+
+    for (uint8_t i = 0; i < 3; ++i) {
+        crc = __crc16(crc, header[i]);
+        boot_putc(header[i]);
+    }
+    for (uint16_t i = 0; i < length; ++i) {
+        crc = __crc16(crc, data[i]);
+        boot_putc(data[i]);
+    }
+
+    boot_putc(crc & 0xFF);
+    boot_putc(crc >> 8);
+}
+
+// 1 with a whole frame in payload, a corrupted one is answered here
+static uint8_t __receive(uint8_t* cmd, uint16_t* length)
+{
+    uint8_t header[3];
+    uint16_t crc = 0xFFFF;
+    int16_t c;
+
+    for (uint8_t i = 0; i < 3; ++i) {
+        c = boot_getc(i ? BOOT_BYTE_TIMEOUT_MS : 0);
+        if (c < 0) {
+            return 0;
+        }
+        header[i] = c;
+        crc = __crc16(crc, c);
+    }
+
+    *cmd = header[0];
+    *length = header[1] | (header[2] << 8);
+
+    // 2 more for the CRC
+    for (uint16_t i = 0; i < *length + 2; ++i) {
+        c = boot_getc(BOOT_BYTE_TIMEOUT_MS);
+        if (c < 0) {
+            return 0;
+        }
+        if (i < *length) {
+            if (*length > BOOT_MAX_PAYLOAD) {
+                // drained to keep in sync, rejected below
+                continue;
+            }
+            payload[i] = c;
+        }
+        crc = __crc16(crc, c);
+    }
+
+    // the CRC over the frame including its own CRC is zero
+    if ((crc != 0) || (*length > BOOT_MAX_PAYLOAD)) {
+        __reply(BOOT_ERR_FRAME, 0, 0);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void __info()
+{
+    uint8_t info[5] = {
+        BOOT_VERSION, 
+        FLASH_PAGE_SIZE & 0xFF, FLASH_PAGE_SIZE >> 8,
+        FLASH_APP_PAGES,
+        boot_image_valid()
+    };
+
+    __reply(BOOT_OK, info, sizeof(info));
+}
+
+static void __crcs()
+{
+    uint8_t* crcs = (uint8_t*)pageBuffer;
+
+    for (uint8_t page = 0; page < FLASH_APP_PAGES; ++page) {
+        __put_u32(&crcs[page * 4], __page_crc(page));
+    }
+
+    __reply(BOOT_OK, crcs, FLASH_APP_PAGES * 4);
+}
+
+static uint8_t __erase_image()
+{
+    if (!imageErased) {
+        if (!boot_flash_erase(BOOT_IMAGE_ADDRESS)) {
+            return 0;
+        }
+        imageErased = 1;
+    }
+    return 1;
+}
+
+static uint8_t __write(uint16_t length)
+{
+    if (length < 6) {
+        return BOOT_ERR_FRAME;
+    }
+
+    uint8_t page = payload[0];
+    uint32_t crc = __get_u32(&payload[1]);
+    uint32_t address = BOOT_APP_ADDRESS + page * FLASH_PAGE_SIZE;
+
+    if (page >= FLASH_APP_PAGES) {
+        return BOOT_ERR_PAGE;
+    }
+    if (!boot_lz_decode(&payload[5], length - 5, (uint8_t*)pageBuffer)) {
+        return BOOT_ERR_DECOMPRESS;
+    }
+    if (boot_crc32(pageBuffer, FLASH_PAGE_SIZE / 4) != crc) {
+        return BOOT_ERR_PAGE_CRC;
+    }
+
+    // from now on the image is incomplete until BOOT_CMD_DONE
+    if (!__erase_image()
+        || !boot_flash_erase(address)
+        || !boot_flash_program(address, (const uint16_t*)pageBuffer, 
+                               FLASH_PAGE_SIZE / 2)
+        || (__page_crc(page) != crc)) {
+        return BOOT_ERR_FLASH;
+    }
+
+    return BOOT_OK;
+}
+
+static uint8_t __done(uint16_t length)
+{
+    if (length != 8) {
+        return BOOT_ERR_FRAME;
+    }
+
+    struct BootImage img = {
+        .magic = BOOT_IMAGE_MAGIC,
+        .length = __get_u32(&payload[0]),
+        .crc = __get_u32(&payload[4]),
+        .check = ~BOOT_IMAGE_MAGIC
+    };
+
+    if ((img.length == 0) || (img.length > BOOT_APP_SIZE) 
+        || (img.length % 4)
+        || (boot_crc32((const uint32_t*)BOOT_APP_ADDRESS, img.length / 4)
+            != img.crc)) {
+        return BOOT_ERR_IMAGE;
+    }
+
+    // the check word goes last, see struct BootImage
+    if (!__erase_image()
+        || !boot_flash_program(BOOT_IMAGE_ADDRESS, (const uint16_t*)&img,
+                               sizeof(img) / 2)) {
+        return BOOT_ERR_FLASH;
+    }
+    imageErased = 0;
+
+    return boot_image_valid() ? BOOT_OK : BOOT_ERR_IMAGE;
+}
+
+void boot_proto_run()
+{
+    uint8_t cmd;
+    uint16_t length;
+
+    imageErased = 0;
+
+    for (;;) {
+        if (!__receive(&cmd, &length)) {
+            continue;
+        }
+
+        switch (cmd) {
+        case BOOT_CMD_INFO:
+            __info();
+            break;
+        case BOOT_CMD_CRCS:
+            __crcs();
+            break;
+        case BOOT_CMD_WRITE:
+            __reply(__write(length), 0, 0);
+            break;
+        case BOOT_CMD_DONE:
+            __reply(__done(length), 0, 0);
+            break;
+        case BOOT_CMD_RUN:
+            __reply(BOOT_OK, 0, 0);
+            boot_reset();
+            break;
+        default:
+            __reply(BOOT_ERR_COMMAND, 0, 0);
+            break;
+        }
+    }
+}
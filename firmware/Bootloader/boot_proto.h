@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _BOOT_PROTO_H_
+#define _BOOT_PROTO_H_
+
+#include "boot.h"
+
+#include <stdint.h>
+
+/*
+ Update protocol of the bootloader (see boot.h), kept apart from the
+ hardware so that it can run against a pty on the host.
+
+ Page compression, every page decompresses to exactly FLASH_PAGE_SIZE:
+    0x00-0x7F  literals, the next c + 1 bytes are copied
+    0x80-0xFF  match, length ((c >> 2) & 0x1F) + 3, the offset 
+               ((c & 0x03) << 8 | next byte) + 1 bytes back in the page
+ */
+
+// page, CRC32 and a page that did not compress at all
+#define BOOT_MAX_PAYLOAD (5 + FLASH_PAGE_SIZE + FLASH_PAGE_SIZE / 128)
+
+// a gap longer than this drops the frame
+#define BOOT_BYTE_TIMEOUT_MS 50
+
+// never returns, BOOT_CMD_RUN resets the MCU
+void boot_proto_run();
+
+uint8_t boot_image_valid();
+
+// 1 if src decompresses to exactly one page
+uint8_t boot_lz_decode(const uint8_t* src, uint16_t length, uint8_t* page);
+
+// the hardware, see bootloader.c
+// next received byte, -1 on timeout, 0 waits forever
+int16_t boot_getc(uint16_t timeout_ms);
+void boot_putc(uint8_t c);
+// STM32 CRC unit over 32-bit words
+uint32_t boot_crc32(const uint32_t* data, uint32_t words);
+// 1 on success
+uint8_t boot_flash_erase(uint32_t address);
+uint8_t boot_flash_program(uint32_t address, const uint16_t* data, 
+                           uint16_t count);
+// after the last byte went out
+void boot_reset();
+
+#endif // _BOOT_PROTO_H_
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Resident bootloader, see boot.h. Registers only, no HAL, it has to 
+ fit in FLASH_BOOT_PAGES. Checking the image at reset runs on the HSI
+ and costs a few ms, the clock and the USART are set up only when the
+ bootloader stays.
+ */
+
+#include "boot_proto.h"
+#include "main.h"
+
+#ifndef BOOT_BAUD
+#define BOOT_BAUD 460800
+#endif
+
+#define HSE_TIMEOUT 0x10000
+
+extern uint32_t _estack;
+extern uint32_t _sidata, _sdata, _edata, _sbss, _ebss;
+
+int main();
+
+void Reset_Handler()
+{
+    uint32_t* src = &_sidata;
+
+    for (uint32_t* dst = &_sdata; dst < &_edata; ) {
+        *dst++ = *src++;
+    }
+    for (uint32_t* dst = &_sbss; dst < &_ebss; ) {
+        *dst++ = 0;
+    }
+
+    main();
+}
+
+static void __fault()
+{
+    NVIC_SystemReset();
+}
+
+// the core exceptions only, no interrupt is used
+__attribute__((section(".isr_vector"), used))
+static void (* const vectors[16])() = {
+    (void (*)())&_estack,
+    Reset_Handler,
+    __fault,    // NMI
+    __fault,    // HardFault
+    __fault,    // MemManage
+    __fault,    // BusFault
+    __fault     // UsageFault
+};
+
+// ----------------------------------------
+// Hardware of the protocol
+// ----------------------------------------
+int16_t boot_getc(uint16_t timeout_ms)
+{
+    while (!(USART1->SR & USART_SR_RXNE)) {
+        if ((SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk)
+            && timeout_ms && (--timeout_ms == 0)) {
+            return -1;
+        }
+    }
+
+    return USART1->DR & 0xFF;
+}
+
+void boot_putc(uint8_t c)
+{
+    while (!(USART1->SR & USART_SR_TXE));
+    USART1->DR = c;
+}
+
+uint32_t boot_crc32(const uint32_t* data, uint32_t words)
+{
+    CRC->CR = CRC_CR_RESET;
+    while (words--) {
+        CRC->DR = *data++;
+    }
+    return CRC->DR;
+}
+
+static uint8_t __flash_wait()
+{
+    while (FLASH->SR & FLASH_SR_BSY);
+
+    uint8_t ok = !(FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR));
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+
+    return ok;
+}
+
+static void __flash_unlock()
+{
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+}
+
+uint8_t boot_flash_erase(uint32_t address)
+{
+    __flash_unlock();
+
+    FLASH->CR |= FLASH_CR_PER;
+    FLASH->AR = address;
+    FLASH->CR |= FLASH_CR_STRT;
+    uint8_t ok = __flash_wait();
+    FLASH->CR &= ~FLASH_CR_PER;
+
+    FLASH->CR |= FLASH_CR_LOCK;
+    return ok;
+}
+
+uint8_t boot_flash_program(uint32_t address, const uint16_t* data, 
+                           uint16_t count)
+{
+    uint8_t ok = 1;
+
+    __flash_unlock();
+
+    FLASH->CR |= FLASH_CR_PG;
+    for (uint16_t i = 0; ok && (i < count); ++i) {
+        *(volatile uint16_t*)(address + 2 * i) = data[i];
+        ok = __flash_wait();
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+
+    FLASH->CR |= FLASH_CR_LOCK;
+    return ok;
+}
+
+void boot_reset()
+{
+    while (!(USART1->SR & USART_SR_TC));
+    NVIC_SystemReset();
+}
+
+// ----------------------------------------
+// Start up
+// ----------------------------------------
+static uint8_t __update_requested()
+{
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN;
+    PWR->CR |= PWR_CR_DBP;
+
+    uint8_t requested = (BKP->DR1 == BOOT_REQUEST_MAGIC);
+    BKP->DR1 = 0;
+
+    PWR->CR &= ~PWR_CR_DBP;
+    RCC->APB1ENR &= ~(RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN);
+
+    return requested;
+}
+
+static void __jump()
+{
+    uint32_t sp = *(const uint32_t*)BOOT_APP_ADDRESS;
+    uint32_t pc = *(const uint32_t*)(BOOT_APP_ADDRESS + 4);
+
+    // back to the reset state for the application
+    RCC->AHBENR &= ~RCC_AHBENR_CRCEN;
+
+    SCB->VTOR = BOOT_APP_ADDRESS;
+    __set_MSP(sp);
+    ((void (*)())pc)();
+}
+
+// returns the system clock [Hz], 72 MHz from the HSE, the HSI without it
+static uint32_t __clock_init()
+{
+    RCC->CR |= RCC_CR_HSEON;
+    for (uint32_t i = 0; !(RCC->CR & RCC_CR_HSERDY); ++i) {
+        if (i == HSE_TIMEOUT) {
+            return HSI_VALUE;
+        }
+    }
+
+    FLASH->ACR = FLASH_ACR_PRFTBE | FLASH_ACR_LATENCY_2;
+    RCC->CFGR = RCC_CFGR_PLLSRC | RCC_CFGR_PLLMULL9 | RCC_CFGR_PPRE1_DIV2;
+    RCC->CR |= RCC_CR_PLLON;
+    while (!(RCC->CR & RCC_CR_PLLRDY));
+
+    RCC->CFGR |= RCC_CFGR_SW_PLL;
+    while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+
+    return 72000000UL;
+}
+
+static void __peripherals_init(uint32_t clock)
+{
+    RCC->APB2ENR |= RCC_APB2ENR_IOPAEN | RCC_APB2ENR_IOPCEN 
+        | RCC_APB2ENR_USART1EN;
+
+    // PA9 TX alternate push-pull, PA10 RX floating input
+    GPIOA->CRH = (GPIOA->CRH & ~0x00000FF0) | 0x000004B0;
+    // PC13 LED push-pull, on while in the bootloader
+    GPIOC->CRH = (GPIOC->CRH & ~0x00F00000) | 0x00200000;
+    LED_GPIO_Port->BRR = LED_Pin;
+
+    // USART1 sits on APB2, the same clock
+    USART1->BRR = (clock + BOOT_BAUD / 2) / BOOT_BAUD;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
+
+    // 1 ms tick for the timeouts, polled
+    SysTick->LOAD = clock / 1000 - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+int main()
+{
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+    if (!__update_requested() && boot_image_valid()) {
+        __jump();
+    }
+
+    __peripherals_init(__clock_init());
+
+    boot_proto_run();
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <stdint.h>
+
+/*
+ Astrom-Hagglund relay feedback experiment. The fan is switched between
+ two power levels around the setpoint, the ultimate gain and period are
+ measured from the resulting chamber temperature oscillation and PID gains
+ are derived using Ziegler-Nichols rules.
+ The fan power holding the setpoint is usually far from the middle of
+ the range, a relay switching between the limits gives a lopsided
+ oscillation much slower than the ultimate period. The relay starts at
+ the limits and is then centred on the mean power of the previous
+ cycle, the swing as wide as the range allows around it.
+ Temperatures are Q15.16 fixed point (see estimator.h).
+ */
+
+// relay power limits [%]
+#define AUTOTUNE_RELAY_LOW 0
+#define AUTOTUNE_RELAY_HIGH 100
+// smallest half swing around the centre [%]
+#define AUTOTUNE_SWING_MIN 10
+// relay hysteresis [C / 4]
+#define AUTOTUNE_HYST_QUARTERS 2
+// cycles centring the relay, the first one is a transient and they are
+// not measured
+#define AUTOTUNE_SETTLE_CYCLES 3
+// measured cycles
+#define AUTOTUNE_CYCLES 4
+#define AUTOTUNE_TIMEOUT_MS (3UL * 3600UL * 1000UL)
+
+enum AutotuneState
+{
+    AUTOTUNE_IDLE,
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE,
+    AUTOTUNE_FAILED
+};
+
+struct AutotuneResult
+{
+    uint16_t ku;  // ultimate gain [%/C * 100]
+    uint16_t tu;  // ultimate period [s]
+    uint16_t kp;  // proportional gain [%/C * 100]
+    uint16_t ti;  // integral time [s]
+    uint16_t td;  // derivative time [s]
+};
+
+void autotune_start(uint8_t setpoint, uint32_t now_ms);
+
+void autotune_abort();
+
+// feed a temperature sample, fanPower is the relay output to apply
+enum AutotuneState autotune_update(int32_t temp, uint32_t now_ms,
+                                   uint8_t* fanPower);
+
+enum AutotuneState autotune_state();
+
+// 0 - 99 [%]
+uint8_t autotune_progress();
+
+const struct AutotuneResult* autotune_result();
+
+#endif // _AUTOTUNE_H_
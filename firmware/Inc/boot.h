@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _BOOT_H_
+#define _BOOT_H_
+
+#include "flash.h"
+
+#include <stdint.h>
+
+/*
+ Resident serial bootloader, shared by the bootloader and the 
+ application.
+
+ Flash: 0x08000000 bootloader, 4 pages
+        0x08001000 image descriptor, 1 page
+        0x08001400 application, up to the crash log page
+
+ At reset the bootloader jumps to the application if the descriptor
+ is valid and the CRC of the image matches, otherwise, or if the 
+ application asked for it, it stays and serves the update protocol on
+ USART1 at BOOT_BAUD.
+
+ Protocol, request and response alike (little endian):
+    cmd/status u8, length u16, payload, CRC-16/MODBUS of all before
+ Commands:
+    BOOT_CMD_INFO  -> version u8, page size u16, app pages u8, valid u8
+    BOOT_CMD_CRCS  -> CRC32 of every application page, u32 each
+    BOOT_CMD_WRITE page u8, CRC32 u32, compressed page -> none
+                   the first write invalidates the descriptor
+    BOOT_CMD_DONE  length u32, CRC32 u32 -> none
+                   checks the whole image and writes the descriptor
+    BOOT_CMD_RUN   -> none, then resets into the application
+ A page is compressed on its own (see the LZ format in boot_proto.h),
+ the CRCs are the ones of the STM32 CRC unit. A transfer cut off is 
+ resumed by writing only the pages whose CRC still differs.
+
+ The image is checked by its CRC only, there is no room for a 
+ cryptographic signature in 4 pages.
+ */
+
+#define BOOT_VERSION 1
+
+#define BOOT_ADDRESS FLASH_PAGE_ADDRESS(FLASH_BOOT_FIRST_PAGE)
+#define BOOT_IMAGE_ADDRESS FLASH_PAGE_ADDRESS(FLASH_IMAGE_PAGE)
+#define BOOT_APP_ADDRESS FLASH_PAGE_ADDRESS(FLASH_APP_FIRST_PAGE)
+#define BOOT_APP_SIZE (FLASH_APP_PAGES * FLASH_PAGE_SIZE)
+
+#define BOOT_CMD_INFO 'I'
+#define BOOT_CMD_CRCS 'C'
+#define BOOT_CMD_WRITE 'W'
+#define BOOT_CMD_DONE 'D'
+#define BOOT_CMD_RUN 'R'
+
+enum BootStatus
+{
+    BOOT_OK,
+    BOOT_ERR_FRAME,
+    BOOT_ERR_COMMAND,
+    BOOT_ERR_PAGE,
+    BOOT_ERR_DECOMPRESS,
+    BOOT_ERR_PAGE_CRC,
+    BOOT_ERR_FLASH,
+    BOOT_ERR_IMAGE
+};
+
+#define BOOT_IMAGE_MAGIC 0x474D4954U // "TIMG"
+
+struct BootImage
+{
+    uint32_t magic;
+    uint32_t length;
+    uint32_t crc;
+    // ~magic, a half written descriptor is not valid
+    uint32_t check;
+};
+
+// backup register value asking the bootloader to stay
+#define BOOT_REQUEST_MAGIC 0xB007
+
+// the application asks for an update, the MCU resets into the 
+// bootloader
+static inline void boot_request_update()
+{
+    SET_BIT(RCC->APB1ENR, RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN);
+    SET_BIT(PWR->CR, PWR_CR_DBP);
+    BKP->DR1 = BOOT_REQUEST_MAGIC;
+
+    NVIC_SystemReset();
+}
+
+#endif // _BOOT_H_
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _BOOT_TIME_H_
+#define _BOOT_TIME_H_
+
+#include <stdint.h>
+
+/*
+ Boot phase timestamps taken from the DWT cycle counter. The counter is
+ started from Reset_Handler, so BOOT_MAIN covers the .data/.bss setup
+ and SystemInit. Cycles before BOOT_CLOCK run on HSI (8 MHz), 
+ afterwards on PLL (72 MHz).
+ */
+enum BootPhase
+{
+    BOOT_MAIN,
+    BOOT_HAL,
+    BOOT_CLOCK,
+    BOOT_GPIO,
+    BOOT_DMA,
+    BOOT_ADC,
+    BOOT_TIM3,
+    BOOT_LOGIC,
+    BOOT_CONTROL,
+    BOOT_USART,
+    BOOT_VFD,
+    BOOT_PHASES
+};
+
+// called from Reset_Handler, must not touch RAM
+void boot_time_start();
+
+void boot_time_mark(enum BootPhase phase);
+
+// one line with the cycle count of every phase
+void boot_time_report();
+
+#endif // _BOOT_TIME_H_
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _BUTTONS_H_
+#define _BUTTONS_H_
+
+#include <stdint.h>
+
+/*
+ EXTI driven buttons. An edge wakes up the debounce integrator which is 
+ sampled from the 1 ms SysTick until the button settles, an idle button
+ costs nothing. Events are queued per button and consumed by the main
+ loop.
+ */
+
+#define BTN_INTEGRATOR_MAX 10
+#define BTN_DOUBLE_CLICK_MS 300
+#define BTN_LONG_PRESS_MS 2000
+#define BTN_REPEAT_DELAY_MS 500
+#define BTN_REPEAT_MS 200
+
+#define BTN_QUEUE_SIZE 8
+
+enum ButtonId
+{
+    BTN_MODE,
+    BTN_SELECT,
+    BTN_COUNT
+};
+
+enum ButtonEvent
+{
+    BTN_EV_NONE,
+    BTN_EV_CLICK,
+    BTN_EV_DOUBLE_CLICK,
+    BTN_EV_LONG_PRESS,
+    BTN_EV_REPEAT
+};
+
+void buttons_init();
+
+// next queued event, BTN_EV_NONE if empty
+enum ButtonEvent buttons_get_event(enum ButtonId id);
+
+// interrupts
+void buttons_exti_int(uint16_t pin);
+void buttons_tick_int();
+
+#endif // _BUTTONS_H_
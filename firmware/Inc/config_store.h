@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _CONFIG_STORE_H_
+#define _CONFIG_STORE_H_
+
+#include "stm32f1xx_hal.h"
+#include <stdint.h>
+
+/*
+ Power-fail safe configuration storage. Two Flash pages are used as A/B
+ slots and every save goes to the slot which does not hold the newest
+ record, a reset in the middle of a write leaves the previous one intact.
+
+ Record: header | TLV payload | CRC32
+ The CRC32 is computed by the CRC unit over the header and the payload
+ and it is programmed last, so an interrupted write never validates.
+ The slot with the highest sequence number wins.
+
+ The payload is a list of tag, length, value entries described by 
+ a schema table. Unknown tags are skipped and missing ones keep their
+ defaults, fields can be added without reformatting the storage.
+ */
+
+#define CS_MAGIC 0x53464743 // "CGFS"
+#define CS_MAX_PAYLOAD 256
+
+// tag 0 terminates the payload
+#define CS_TAG_END 0
+
+struct ConfigField
+{
+    uint8_t tag;
+    uint8_t size;
+    uint16_t offset;
+};
+
+void config_store_init(CRC_HandleTypeDef* hcrc);
+
+// fills the fields of obj found in the newest valid record, 
+// returns the schema version of the record, 0 if there is none
+uint16_t config_store_load(const struct ConfigField* schema, uint8_t count,
+                           void* obj);
+
+HAL_StatusTypeDef config_store_save(const struct ConfigField* schema, 
+                                    uint8_t count, const void* obj,
+                                    uint16_t version);
+
+#endif // _CONFIG_STORE_H_
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _CRASH_H_
+#define _CRASH_H_
+
+#include <stdint.h>
+
+/*
+ Crash capture. The fault handlers snapshot the stacked registers, 
+ the fault status registers and return address candidates found on 
+ the stack into a no-init RAM record, switch the triac off and reset.
+ The next boot appends the record to a Flash page and reports it.
+
+ UART format, all numbers hex except the slot:
+   CRASH <slot> type <t> pc <pc> lr <lr> psr <psr> sp <sp>
+   CRASH <slot> cfsr <cfsr> hfsr <hfsr> mmfar <mmfar> bfar <bfar>
+   CRASH <slot> regs <r0> <r1> <r2> <r3> <r12>
+   CRASH <slot> stack <addr>...
+   CRASH <slot> uptime <ms>
+ tools/crash_symbolize.py resolves the addresses against the ELF.
+ */
+
+#define CRASH_MAGIC 0x48535243 // "CRSH"
+#define CRASH_STACK_DEPTH 8
+
+enum CrashType
+{
+    CRASH_HARD_FAULT = 1,
+    CRASH_MEM_MANAGE,
+    CRASH_BUS_FAULT,
+    CRASH_USAGE_FAULT,
+    // _Error_Handler, r0 is the file name, r1 the line
+    CRASH_ERROR
+};
+
+struct CrashRecord
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t r0, r1, r2, r3, r12, lr, pc, psr;
+    uint32_t cfsr, hfsr, mmfar, bfar;
+    uint32_t sp;
+    uint32_t uptime_ms;
+    uint32_t stack[CRASH_STACK_DEPTH];
+};
+
+// persists the record of the previous run, call right after HAL_Init()
+void crash_init();
+
+// reports the record of the previous run, if any, once the UART is up
+void crash_report();
+
+// the whole Flash log
+void crash_log_dump();
+
+void crash_error(const char* file, int line, uint32_t caller) 
+    __attribute__((noreturn));
+
+#endif // _CRASH_H_
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _ESTIMATOR_H_
+#define _ESTIMATOR_H_
+
+#include <stdint.h>
+
+// All values are signed Q15.16 fixed point
+#define EST_Q 16
+#define EST_ONE (1L << EST_Q)
+#define EST_FROM_INT(x) ((int32_t)(x) << EST_Q)
+#define EST_TO_INT(x) ((int32_t)((x) + (EST_ONE / 2)) >> EST_Q)
+
+// Chamber is pulled towards the ambient temperature by the fan, this is
+// the rate [1/s] at full power (1/120 s)
+#define EST_FAN_GAIN (EST_ONE / 120)
+
+// process noise of the temperature [C^2/s] and of the rate [(C/s)^2/s]
+#define EST_Q_TEMP (EST_ONE / 100)
+#define EST_Q_RATE (EST_ONE / 10000)
+
+// LM35 + ADC measurement noise [C^2]
+#define EST_R_TEMP (EST_ONE / 4)
+
+/*
+ 2-state Kalman filter estimating the chamber temperature and its rate 
+ of change. The commanded fan power and the ambient temperature are the 
+ model inputs.
+ */
+void estimator_init(int32_t temp);
+
+// propagate the state by dt_ms, fanPower in percents
+void estimator_predict(uint8_t fanPower, int32_t ambient, uint32_t dt_ms);
+
+// correct the state with a chamber temperature measurement
+void estimator_update(int32_t measured);
+
+// estimated chamber temperature [C]
+int32_t estimator_temp();
+
+// estimated rate of change [C/s]
+int32_t estimator_rate();
+
+#endif // _ESTIMATOR_H_
@@ -36,6 +36,22 @@ void fan_driver_init(TIM_HandleTypeDef* triac_timer_);
  */
 void fan_driver_set_power(uint8_t powerPercentage);
 
+// the last commanded power in percents
+uint8_t fan_driver_get_power();
+
+// mains half-waves seen so far, wraps
+uint32_t fan_driver_zero_cross_count();
+
+// DWT stamps of the last crossings, for the input recorder
+#define FAN_ZERO_CROSS_STAMPS 64
+
+// the stamp [cycles] of crossing n, counted as by 
+// fan_driver_zero_cross_count(), 0 if it is no longer kept
+uint8_t fan_driver_zero_cross_stamp(uint32_t n, uint32_t* cycles);
+
+// triac off and kept off, safe from the fault handlers
+void fan_driver_emergency_off();
+
 // interrupts
 void fan_driver_zero_cross_int();
 void fan_driver_launch_triac_int();
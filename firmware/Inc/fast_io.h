@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _FAST_IO_H_
+#define _FAST_IO_H_
+
+#include "stm32f1xx_hal.h"
+#include <stdint.h>
+
+/*
+ Thin IO layer for the hot code (ISRs, display multiplexing, buttons).
+ With FAST_IO defined (IO=LL in the Makefile) GPIOs are driven through
+ BSRR/IDR and timers through the LL driver, otherwise it falls back to
+ the HAL calls so both variants can be compared.
+
+ In the HAL variant every pin change of the hot code goes through
+ HAL_GPIO_WritePin(), resets before sets, which is the place to hook
+ a pin transition logger into when the drivers are built off target.
+ */
+
+#ifdef FAST_IO
+
+#include "stm32f1xx_ll_tim.h"
+
+static inline void fast_gpio_write(GPIO_TypeDef* port, uint16_t pin,
+                                   GPIO_PinState state)
+{
+    port->BSRR = (state == GPIO_PIN_SET) ? pin : ((uint32_t)pin << 16);
+}
+
+static inline uint8_t fast_gpio_read(GPIO_TypeDef* port, uint16_t pin)
+{
+    return (port->IDR & pin) != 0;
+}
+
+// sets the low and resets the high half-word pins in one write
+static inline void fast_gpio_bsrr(GPIO_TypeDef* port, uint32_t word)
+{
+    port->BSRR = word;
+}
+
+static inline void fast_tim_start_it(TIM_HandleTypeDef* htim)
+{
+    LL_TIM_EnableIT_UPDATE(htim->Instance);
+    LL_TIM_EnableCounter(htim->Instance);
+}
+
+static inline void fast_tim_stop_it(TIM_HandleTypeDef* htim)
+{
+    LL_TIM_DisableIT_UPDATE(htim->Instance);
+    LL_TIM_DisableCounter(htim->Instance);
+}
+
+// reloads the period and restarts the counter, no pending update left
+static inline void fast_tim_set_period(TIM_HandleTypeDef* htim, 
+                                       uint32_t period)
+{
+    htim->Init.Period = period;
+    LL_TIM_SetAutoReload(htim->Instance, period);
+    LL_TIM_GenerateEvent_UPDATE(htim->Instance);
+    LL_TIM_ClearFlag_UPDATE(htim->Instance);
+}
+
+// acknowledges the update interrupt, returns 0 if it was not pending
+static inline uint8_t fast_tim_ack_update(TIM_TypeDef* tim)
+{
+    if (!LL_TIM_IsActiveFlag_UPDATE(tim)) {
+        return 0;
+    }
+    LL_TIM_ClearFlag_UPDATE(tim);
+    return 1;
+}
+
+// acknowledges a pending EXTI line, returns 0 if it was not pending
+static inline uint8_t fast_exti_ack(uint16_t pin)
+{
+    if (!(EXTI->PR & pin)) {
+        return 0;
+    }
+    EXTI->PR = pin;
+    return 1;
+}
+
+// the last regular conversion of an ADC in continuous mode
+static inline uint16_t fast_adc_value(ADC_HandleTypeDef* hadc)
+{
+    return hadc->Instance->DR & 0x0FFF;
+}
+
+#else
+
+static inline void fast_gpio_write(GPIO_TypeDef* port, uint16_t pin,
+                                   GPIO_PinState state)
+{
+    HAL_GPIO_WritePin(port, pin, state);
+}
+
+static inline uint8_t fast_gpio_read(GPIO_TypeDef* port, uint16_t pin)
+{
+    return HAL_GPIO_ReadPin(port, pin) == GPIO_PIN_SET;
+}
+
+static inline void fast_gpio_bsrr(GPIO_TypeDef* port, uint32_t word)
+{
+    if (word >> 16) {
+        HAL_GPIO_WritePin(port, word >> 16, GPIO_PIN_RESET);
+    }
+    if (word & 0xFFFF) {
+        HAL_GPIO_WritePin(port, word & 0xFFFF, GPIO_PIN_SET);
+    }
+}
+
+static inline void fast_tim_start_it(TIM_HandleTypeDef* htim)
+{
+    HAL_TIM_Base_Start_IT(htim);
+}
+
+static inline void fast_tim_stop_it(TIM_HandleTypeDef* htim)
+{
+    HAL_TIM_Base_Stop_IT(htim);
+}
+
+static inline void fast_tim_set_period(TIM_HandleTypeDef* htim, 
+                                       uint32_t period)
+{
+    HAL_TIM_Base_DeInit(htim);
+    htim->Init.Period = period;
+    HAL_TIM_Base_Init(htim);
+}
+
+static inline uint16_t fast_adc_value(ADC_HandleTypeDef* hadc)
+{
+    if (HAL_ADC_PollForConversion(hadc, 200) != HAL_OK) {
+        return 0;
+    }
+    return HAL_ADC_GetValue(hadc);
+}
+
+#endif // FAST_IO
+
+#endif // _FAST_IO_H_
@@ -33,19 +33,45 @@
 #define FLASH_PAGE_START    0x8000000UL
 // F103 has 64k flash
 #define FLASH_NUM_PAGES     64
-// use the last flash page, only 1k EEPROM
+// resident bootloader, the image descriptor and the application, 
+// see boot.h
+#define FLASH_BOOT_FIRST_PAGE 0x00
+#define FLASH_BOOT_PAGES 4
+#define FLASH_IMAGE_PAGE 0x04
+#define FLASH_APP_FIRST_PAGE 0x05
+#define FLASH_APP_PAGES (FLASH_CRASH_PAGE - FLASH_APP_FIRST_PAGE)
+// the last two pages are the configuration A/B slots, see config_store.h
+#define FLASH_CONFIG_PAGE_A 0x3E
+#define FLASH_CONFIG_PAGE_B 0x3F
+// persistent crash log, see crash.h
+#define FLASH_CRASH_PAGE 0x39
+// ring of pages for the temperature history, see history.h
+#define FLASH_HISTORY_FIRST_PAGE 0x3A
+#define FLASH_HISTORY_PAGES 4
+// older images kept the raw configuration in the last page
 #define FLASH_EEPROM_PAGE   0x3F
 // the address
-#define FLASH_PAGE_ADDR (FLASH_PAGE_START + (FLASH_PAGE_SIZE * FLASH_EEPROM_PAGE))
+#define FLASH_PAGE_ADDRESS(page) (FLASH_PAGE_START + (FLASH_PAGE_SIZE * (page)))
 
-// max data size is 1k
+// erases the page and programs it, max data size is 1k
+// address: page address
+// data: half-word table
+// size: size of the data array
+// HAL_BUSY if another write is in progress, both writes take the same
+// single owner lock
+HAL_StatusTypeDef flash_write(uint32_t address, uint16_t* data, uint32_t size);
+
+// programs erased half-words without erasing the page
+// address: any half-word aligned address
 // data: half-word table
 // size: size of the data array
-HAL_StatusTypeDef flash_write(uint16_t* data, uint32_t size);
+HAL_StatusTypeDef flash_program(uint32_t address, uint16_t* data, 
+                                uint32_t size);
 
 // max data size is 1k
+// address: any half-word aligned address
 // data: half-word table
 // size: size of the data array
-void flash_read(uint16_t* data, uint32_t size);
+void flash_read(uint32_t address, uint16_t* data, uint32_t size);
 
 #endif // __FLASH_H__
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+
+/*
+ Temperature history in a ring of Flash pages. Every minute min/avg/max
+ of both temperatures and the average fan power are appended to a page
+ sized RAM staging buffer, the buffer is programmed when full or by
+ history_flush() when the supply fails.
+
+ The record is coarse: the min and max are kept as whole degrees below
+ and above the average, 15 at most, and change only by more than a 
+ degree, the fan power only by more than 4 %. The noise of the readings
+ and of the PID leaves most minutes equal to the previous one.
+ A record takes 6 bytes at most, a page is erased every 2.9 h at worst
+ (a sensor reading garbage). A noisy chamber under the PID fills a page
+ in about 3 days, the ring with the staging buffer holds two weeks of
+ it, a steady chamber fills a page in weeks. See Test/test_history.c.
+
+ Page: header | records... | 0xFF
+ Record tag byte:
+   0x00..0x1F - bit mask of the groups that changed, in this order:
+                0x01 - both averages as signed nibble deltas, chamber 
+                       in the high nibble
+                0x02 - both averages absolute, two bytes, instead of
+                       0x01 if a delta does not fit in the nibble
+                0x04 - chamber: avg - min in the high nibble, max - avg
+                       in the low one
+                0x08 - ambient, as the chamber
+                0x10 - fan power
+                the first record in a page is against all zeros
+   0x81..0xFE - the previous record repeated (tag & 0x7F) times
+   0xFF       - end of the page
+ A steady temperature costs one byte per two hours.
+ */
+
+#define HIST_MAGIC 0x32534948 // "HIS2"
+
+enum HistoryField
+{
+    HIST_CHAMBER_MIN,
+    HIST_CHAMBER_AVG,
+    HIST_CHAMBER_MAX,
+    HIST_AMBIENT_MIN,
+    HIST_AMBIENT_AVG,
+    HIST_AMBIENT_MAX,
+    HIST_FAN_AVG,
+    HIST_FIELDS
+};
+
+void history_init();
+
+// once per second
+void history_sample(uint8_t chamber, uint8_t ambient, uint8_t fan);
+
+// programs what is staged, from the main loop when the supply fails,
+// the history goes on in the next page
+void history_flush();
+
+// streams the whole history over UART, one line per history_dump_update()
+// call so the main loop is never blocked for long:
+//   H <seq> <boot> <minute>  page header, minutes since that boot
+//   M <fields>               record, see enum HistoryField
+//   R <n>                    previous record repeated n times
+//   E                        end of the dump
+void history_dump_start();
+uint8_t history_dump_update();
+
+#endif // _HISTORY_H_
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _ISR_TIMING_H_
+#define _ISR_TIMING_H_
+
+#include "stm32f1xx_hal.h"
+#include <stdint.h>
+
+/*
+ Per ISR cycle accounting based on the DWT cycle counter (started in
+ boot_time_start()). Compiled in with ISR_TIMING (BENCH=1 in the 
+ Makefile), otherwise the macros are empty.
+ */
+
+enum IsrId
+{
+    ISR_TIM3,
+    ISR_TIM4,
+    ISR_EXTI9_5,
+    ISR_DMA1_CH1,
+    ISR_USART1,
+    ISR_COUNT
+};
+
+struct IsrTiming
+{
+    uint32_t Count;
+    uint32_t Total;
+    uint32_t Max;
+};
+
+#ifdef ISR_TIMING
+
+extern struct IsrTiming isr_timings[ISR_COUNT];
+
+#define ISR_TIMING_BEGIN() uint32_t __isr_start = DWT->CYCCNT
+
+#define ISR_TIMING_END(id) \
+    { \
+        uint32_t c = DWT->CYCCNT - __isr_start; \
+        ++isr_timings[id].Count; \
+        isr_timings[id].Total += c; \
+        if (c > isr_timings[id].Max) isr_timings[id].Max = c; \
+    }
+
+#else
+
+#define ISR_TIMING_BEGIN()
+#define ISR_TIMING_END(id)
+
+#endif // ISR_TIMING
+
+// one line per ISR: count, average and max cycles since the previous
+// report, which starts a new period, no-op if disabled. TIM4 alone
+// would wrap the 32-bit total within about an hour.
+void isr_timing_report();
+
+#endif // _ISR_TIMING_H_
@@ -31,9 +31,14 @@
 #define VER_MAJOR 1
 #define VER_MINOR 5
 
-#define BRIGHTNESS_LEV_0 40
-#define BRIGHTNESS_LEV_1 60
-#define BRIGHTNESS_LEV_2 80
+// light [%], the higher the darker: full brightness up to LIGHT_FULL,
+// the dimmest level from LIGHT_MIN, even steps between
+#define BRIGHTNESS_LIGHT_FULL 40
+#define BRIGHTNESS_LIGHT_MIN 90
+// dead band [%] around a level change
+#define BRIGHTNESS_HYST 3
+// light filter weight 1/2^n, sampled every second
+#define BRIGHTNESS_EMA_SHIFT 3
 
 #define FAN_MIN 40
 #define FAN_MAX 100
@@ -43,6 +48,7 @@
 void logic_init(ADC_HandleTypeDef* adc_temp_, 
                 ADC_HandleTypeDef* adc_light_);
 
+// starts the selfcheck, it runs in the background of logic_update()
 void logic_init_selfcheck();
 
 void logic_update();
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _MENU_H_
+#define _MENU_H_
+
+#include <stdint.h>
+
+#include "buttons.h"
+
+/*
+ Table-driven menu. The items are const data describing which config
+ field is edited and how, the engine itself knows nothing about the
+ configuration. Values are edited on a working copy and written back
+ to the fields only when the menu is left.
+
+ Home:  MODE click opens the menu
+ Menu:  MODE click - next item, past the last one closes the menu
+        SELECT click/repeat - value + step, wraps to min
+        SELECT double click - value - step, wraps to max
+        MODE long press - close the menu discarding the changes
+        no input for timeout_ms - close the menu keeping the changes
+ */
+
+#define MENU_MAX_ITEMS 8
+
+enum MenuValueType
+{
+    MENU_U8,
+    MENU_U16
+};
+
+struct MenuItem
+{
+    // segments of the label shown on the leftmost digit
+    uint8_t label;
+    enum MenuValueType type;
+    void* value;
+    uint16_t min;
+    uint16_t max;
+    uint16_t step;
+    // optional upper bound depending on the state, overrides max
+    uint16_t (*max_fn)();
+};
+
+struct Menu
+{
+    const struct MenuItem* items;
+    // at most MENU_MAX_ITEMS
+    uint8_t count;
+    uint32_t timeout_ms;
+    // called when the menu is closed, changed is set if any field 
+    // was written back
+    void (*on_exit)(uint8_t changed);
+};
+
+void menu_init(const struct Menu* menu);
+
+uint8_t menu_active();
+
+// returns 1 if the event was consumed by the menu
+uint8_t menu_event(enum ButtonId id, enum ButtonEvent ev, uint32_t now_ms);
+
+// timeout and rendering, redraws the display only on a state change
+void menu_update(uint32_t now_ms);
+
+#endif // _MENU_H_
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _MODBUS_H_
+#define _MODBUS_H_
+
+#include <stdint.h>
+
+#include "uart_rx.h"
+
+/*
+ Modbus RTU slave. A frame is whatever arrived between two idle lines
+ (see uart_rx.h), it is checked and served in a single pass straight 
+ from the receive buffer. The registers are const tables provided by
+ the application, the engine knows nothing about what they hold.
+
+ Functions: 0x03 read holding, 0x04 read input, 0x06 write single,
+ 0x10 write multiple registers. A write request is validated as a 
+ whole before any register is touched. Broadcasts (address 0) are 
+ executed without a response.
+ */
+
+#define MODBUS_ADDRESS 1
+
+// a request for more is answered with an illegal value exception
+#define MODBUS_MAX_REGISTERS 32
+
+// while a master is polling the logs are muted, they would corrupt the
+// responses on the shared line
+#define MODBUS_QUIET_MS 10000
+
+// exception codes, also what modbus_register_write() returns
+#define EX_ILLEGAL_FUNCTION 0x01
+#define EX_ILLEGAL_ADDRESS 0x02
+#define EX_ILLEGAL_VALUE 0x03
+
+enum ModbusRegType
+{
+    MB_U8,
+    MB_U16,
+    // an int32_t split into two registers, high word first
+    MB_S32_HI,
+    MB_S32_LO,
+    // read only, the value comes from read_fn
+    MB_FN
+};
+
+struct ModbusRegister
+{
+    // for the shell, see shell.h
+    const char* name;
+    enum ModbusRegType type;
+    void* value;
+    uint16_t (*read_fn)();
+    // holding registers only, input registers are never written
+    uint8_t writable;
+    uint16_t min;
+    uint16_t max;
+    // optional upper bound depending on the state, overrides max
+    uint16_t (*max_fn)();
+};
+
+struct ModbusMap
+{
+    const struct ModbusRegister* input;
+    uint16_t inputCount;
+    const struct ModbusRegister* holding;
+    uint16_t holdingCount;
+    // called once after a request wrote any holding register
+    void (*on_write)(uint32_t now_ms);
+};
+
+void modbus_init(const struct ModbusMap* map);
+
+// serves the frame if it is a Modbus request, returns 0 otherwise
+uint8_t modbus_frame(const struct UartFrame* f, uint32_t now_ms);
+
+uint16_t modbus_crc16(const uint8_t* data, uint16_t length);
+
+// the same access a master gets, 0 or the Modbus exception code
+uint16_t modbus_register_read(const struct ModbusRegister* r);
+uint8_t modbus_register_write(const struct ModbusRegister* r, uint16_t v);
+
+#endif // _MODBUS_H_
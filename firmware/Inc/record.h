@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <stdint.h>
+
+/*
+ Input recorder for reproducing field behaviour off the device. While
+ on, everything logic.c reads from the outside world and what it drives
+ is written to the UART as text lines, mixed with the log:
+    ~S <tick>                      start, HAL_GetTick() [ms]
+    ~C <dt> <holding registers>    configuration, at the start and after
+                                   every external write
+    ~A <dt> <adc t1> <adc t2>      temperature conversion
+    ~L <dt> <adc light>
+    ~B <dt> <mode> <select>        button events, enum ButtonEvent
+    ~Z <dt> [x<lost>] <half-waves> mains, see below
+    ~F <dt> <fan power>            output, on change
+    ~D <dt> <5 sections, hex>      output, on change
+ dt is the time since the previous record [ms], so a replay drives 
+ HAL_GetTick() and the inputs at the recorded moments and compares the
+ outputs (Test/test_replay.c). A record is a raw write, it goes on while
+ a Modbus master mutes the log.
+
+ The intervals of ~Z are the time of each half-wave since the previous
+ one [us], the first since ~S. They follow a reference in decimal, the
+ mean of those in the previous ~Z, 10000 in the first. One within RECORD_ZC_RANGE of it is
+ a single character, RECORD_ZC_ZERO plus the difference ('?' to '}'),
+ a run of 3 or more of the same character is written once with the
+ count, one further off is '#' and the interval in decimal:
+    ~Z 480 10012^b]Y^3_#20031^...
+ is 10012, 10016, 10011, 10007, 10012 three times, 10013, 20031, 10012
+ and so on. A stalled main loop loses the stamps of the oldest 
+ crossings, x<lost> counts them and the interval after spans them. 
+
+ A minute takes about 10 kB with the +-30 us jitter of the mains in 
+ test_replay.c, mostly the crossings, 1.5% of the line at 115200, less
+ on a steadier mains where runs form.
+
+ Started from the shell the recording misses the state before it,
+ "record boot" starts it at every boot until "record off", with the
+ configuration the MCU loads.
+ */
+
+// a ~Z line every RECORD_ZC_BATCH crossings, or sooner after 
+// RECORD_ZC_MAX_MS, before fan_driver.c reuses the stamps
+#define RECORD_ZC_BATCH 48
+#define RECORD_ZC_MAX_MS 500
+
+// a half-wave within RECORD_ZC_RANGE [us] of the reference is the 
+// character RECORD_ZC_ZERO plus the difference
+#define RECORD_ZC_RANGE 31
+#define RECORD_ZC_ZERO '^'
+
+void record_start();
+// stops the recording at boot too
+void record_stop();
+uint8_t record_active();
+
+// a backup register asks for the recording at every boot
+void record_boot_request();
+uint8_t record_boot_requested();
+
+// inputs
+void record_temps(uint16_t adc_t1, uint16_t adc_t2);
+void record_light(uint16_t adc_light);
+void record_buttons(uint8_t mode, uint8_t select);
+void record_config(const uint16_t* values, uint8_t count);
+
+// zero crossings and the outputs, once per main loop pass
+void record_update();
+
+#endif // _RECORD_H_
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _SHELL_H_
+#define _SHELL_H_
+
+#include <stdint.h>
+
+#include "uart_rx.h"
+
+/*
+ Line oriented command shell. The characters stay where the DMA put 
+ them (see uart_rx.h), a line is collected over as many frames as it
+ takes and tokenized in place, a token is only an offset and a length
+ in the receive buffer. No copies, no heap.
+
+ Commands are a const table sorted by name, looked up by a binary 
+ search. The output goes through the buffered USART (see usart.h), a
+ handler never waits for the line unless it prints more than fits.
+
+ Input is taken as typed, there is no echo nor line editing, use the
+ local echo of the terminal.
+ */
+
+#define SHELL_MAX_LINE 64
+// the command and its arguments
+#define SHELL_MAX_TOKENS 4
+
+struct ShellToken
+{
+    uint8_t start;
+    uint8_t length;
+};
+
+struct ShellArgs
+{
+    uint8_t count;
+    // tokens[0] is the command
+    struct ShellToken tokens[SHELL_MAX_TOKENS];
+};
+
+struct ShellCommand
+{
+    const char* name;
+    const char* help;
+    // the number of arguments is checked by the handler
+    void (*run)(const struct ShellArgs* args);
+};
+
+// commands sorted by name, as strcmp orders them
+void shell_init(const struct ShellCommand* commands, uint8_t count);
+
+// a frame that is not a Modbus request
+void shell_frame(const struct UartFrame* f);
+
+// strcmp of the token against s
+int8_t shell_token_cmp(const struct ShellToken* t, const char* s);
+
+// decimal value of the token, 0 if it is not a number
+uint8_t shell_token_uint(const struct ShellToken* t, uint32_t* value);
+
+// the help of every command
+void shell_help();
+
+#endif // _SHELL_H_
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+/*
+ Rolling statistics, O(1) per sample and a fixed RAM budget.
+
+ Each window is split into buckets. The min/max over the last window
+ comes from a monotonic deque holding at most one entry per bucket, so
+ it is exact up to the bucket granularity. The mean, the standard 
+ deviation (Welford) and the 95th percentile (P^2 estimator) are 
+ accumulated over the current window period and reported for the last
+ complete period, or for the current one until the first is complete.
+
+ All values are in tenths of the unit, i.e. [0.1 C] and [0.1 %].
+ */
+
+enum StatsChannel
+{
+    STATS_CHAMBER,
+    STATS_FAN,
+    STATS_CHANNELS
+};
+
+enum StatsWindow
+{
+    STATS_HOUR,
+    STATS_DAY,
+    STATS_WINDOWS
+};
+
+// 1 h of 1 min buckets, 24 h of 30 min buckets
+#define STATS_HOUR_BUCKET_MS (60UL * 1000UL)
+#define STATS_HOUR_BUCKETS 60
+#define STATS_DAY_BUCKET_MS (30UL * 60UL * 1000UL)
+#define STATS_DAY_BUCKETS 48
+
+struct StatsSummary
+{
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+    int16_t stddev;
+    int16_t p95;
+    uint32_t count;
+};
+
+void stats_init();
+
+void stats_sample(enum StatsChannel ch, int16_t value, uint32_t now_ms);
+
+// count is 0 if there are no samples yet
+void stats_summary(enum StatsChannel ch, enum StatsWindow win, 
+                   struct StatsSummary* out);
+
+// all channels and windows over UART, for the "stats" shell command,
+// not sent on its own, the UART is shared with the Modbus master
+void stats_report();
+
+#endif // _STATS_H_
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _THERMAL_MODEL_H_
+#define _THERMAL_MODEL_H_
+
+#include <stdint.h>
+
+/*
+ First order thermal model of the chamber identified online with 
+ recursive least squares:
+
+   dT/dt = q + k0 * (Ta - T) + kf * u * (Ta - T)
+
+ q - internal heat load [C/min], k0 - passive losses, kf - fan losses,
+ u - fan power [0..1]. The gradient (Ta - T) is normalised by 
+ TM_GRAD_SCALE to keep the fixed point regressors close to 1.
+ Temperatures and parameters are Q15.16 fixed point (see estimator.h).
+ */
+
+#define TM_PARAMS 3
+#define TM_GRAD_SCALE 32
+
+// parameters drift (random walk) and measurement noise, they replace
+// the forgetting factor which does not behave well in fixed point
+#define TM_DRIFT (EST_ONE / 16384)
+#define TM_NOISE (EST_ONE)
+
+// number of samples before the model is trusted
+#define TM_MIN_SAMPLES 120
+
+// initialise with previously learned parameters, NULL for defaults
+void thermal_model_init(const int32_t* params);
+
+// temp, rate and ambient as provided by the estimator, rate in [C/s]
+void thermal_model_update(int32_t temp, int32_t rate, int32_t ambient,
+                          uint8_t fanPower);
+
+uint8_t thermal_model_valid();
+
+// fan power [%] that keeps the chamber at the setpoint
+uint8_t thermal_model_feed_forward(int32_t setpoint, int32_t ambient);
+
+const int32_t* thermal_model_params();
+
+#endif // _THERMAL_MODEL_H_
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "stm32f1xx_hal.h"
+#include "isr_timing.h"
+#include <stdint.h>
+
+/*
+ Event trace in a RAM ring: ISR entry/exit, main loop task begin/end
+ and markers, 8 bytes each, timestamped with the DWT cycle counter.
+ Compiled in with TRACE (TRACE=1 in the Makefile), otherwise the 
+ macros are empty. A record costs about 30 cycles.
+
+ The main loop stages are recorded only when they did something, an
+ idle pass leaves no record. The display's TIM4 (12k interrupts a 
+ second) is left out unless built with TRACE_VFD (TRACE_VFD=1), it
+ would fill the ring within 20 ms. Without it the mains interrupts 
+ dominate, about 400 records a second with the fan phase controlled.
+
+ The ring records until one of the armed triggers fires, then goes on
+ for TRACE_POST_TRIGGER records and freezes, the rest of the ring is
+ what led to it. The shell command "trace" arms them ("trace fan", 
+ "trace all", ...) and, once frozen, streams the ring, oldest first,
+ the recording starts over after it. tools/trace_export.py turns the
+ log into a Chrome/Perfetto trace:
+    TS <records> <cpu clock [Hz]>
+    T <cycles> <type << 24 | id << 16 | arg>   (both 0x%08x)
+    TE
+ The counter wraps every ~60 s at 72 MHz, the converter unwraps it 
+ assuming no gap between two records is longer than half of it.
+ */
+
+// records, a power of 2
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 512
+#endif
+
+// recorded after the trigger, before the ring freezes
+#define TRACE_POST_TRIGGER (TRACE_BUFFER_SIZE / 4)
+
+enum TraceType
+{
+    TRACE_ISR_ENTER,
+    TRACE_ISR_EXIT,
+    TRACE_TASK_BEGIN,
+    TRACE_TASK_END,
+    TRACE_MARK
+};
+
+// the ISRs are identified by enum IsrId
+enum TraceTask
+{
+    TRACE_SAMPLING,
+    TRACE_CONTROL,
+    TRACE_UI,
+    TRACE_UART,
+    TRACE_FLASH,
+    TRACE_TASK_COUNT
+};
+
+enum TraceMark
+{
+    TRACE_MARK_FAN_POWER,
+    TRACE_MARK_CONFIG_SAVE,
+    // arg: enum TraceTrigger
+    TRACE_MARK_TRIGGER,
+    TRACE_MARK_COUNT
+};
+
+enum TraceTrigger
+{
+    // the fan power changes by TRACE_FAN_STEP or more
+    TRACE_TRIG_FAN_STEP,
+    // an erase or a program
+    TRACE_TRIG_FLASH,
+    // a mains half-wave without its zero cross
+    TRACE_TRIG_ZERO_CROSS,
+    TRACE_TRIG_COUNT
+};
+
+#define TRACE_TRIG_ALL ((1 << TRACE_TRIG_COUNT) - 1)
+
+// [%]
+#define TRACE_FAN_STEP 20
+
+struct TraceRecord
+{
+    uint32_t cycles;
+    uint8_t type;
+    uint8_t id;
+    uint16_t arg;
+};
+
+#ifdef TRACE
+
+void trace_record(uint8_t type, uint8_t id, uint16_t arg);
+// the task ran from begin [cycles] until now
+void trace_span(uint8_t task, uint32_t begin);
+// freezes the ring TRACE_POST_TRIGGER records later if armed
+void trace_trigger(uint8_t trigger);
+
+#ifdef TRACE_VFD
+#define TRACE_ISR_TRACED(isr) 1
+#else
+#define TRACE_ISR_TRACED(isr) ((isr) != ISR_TIM4)
+#endif
+
+#define TRACE_ISR_ENTER(isr) \
+    do { \
+        if (TRACE_ISR_TRACED(isr)) { \
+            trace_record(TRACE_ISR_ENTER, isr, 0); \
+        } \
+    } while (0)
+#define TRACE_ISR_EXIT(isr) \
+    do { \
+        if (TRACE_ISR_TRACED(isr)) { \
+            trace_record(TRACE_ISR_EXIT, isr, 0); \
+        } \
+    } while (0)
+#define TRACE_BEGIN(task) trace_record(TRACE_TASK_BEGIN, task, 0)
+#define TRACE_END(task) trace_record(TRACE_TASK_END, task, 0)
+#define TRACE_MARK(mark, arg) trace_record(TRACE_MARK, mark, arg)
+
+// a stage recorded only if it did something, e.g.
+//     TRACE_SPAN_START(t);
+//     ...
+//     TRACE_SPAN(TRACE_UI, t, redrawn);
+#define TRACE_SPAN_START(var) uint32_t var = DWT->CYCCNT
+#define TRACE_SPAN(task, var, worked) \
+    do { \
+        if (worked) { \
+            trace_span(task, var); \
+        } \
+    } while (0)
+
+#define TRACE_TRIGGER(trigger) trace_trigger(trigger)
+
+#else
+
+#define TRACE_ISR_ENTER(isr)
+#define TRACE_ISR_EXIT(isr)
+#define TRACE_BEGIN(task)
+#define TRACE_END(task)
+#define TRACE_MARK(mark, arg)
+#define TRACE_SPAN_START(var)
+#define TRACE_SPAN(task, var, worked) ((void)(worked))
+#define TRACE_TRIGGER(trigger)
+
+#endif // TRACE
+
+// the triggers which freeze the ring, a mask of 1 << enum TraceTrigger,
+// all armed at the start
+void trace_arm(uint8_t triggers);
+
+// streams the frozen ring over UART, one line per trace_dump_update(),
+// the recording starts over afterwards, armed as before. Only a note
+// while no trigger fired, only "TE" if disabled.
+void trace_dump_start();
+uint8_t trace_dump_update();
+
+#endif // _TRACE_H_
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _UART_RX_H_
+#define _UART_RX_H_
+
+#include "stm32f1xx_hal.h"
+
+#include <stdint.h>
+
+/*
+ USART1 reception. The DMA writes every received byte into a circular
+ buffer on its own, the only interrupt is the USART idle line, one 
+ character time of silence after the last byte. It closes the frame
+ received since the previous one, the main loop then gets the whole
+ frame at once and reads it in place, nothing is copied.
+
+ The buffer is 256 bytes so that uint8_t offsets wrap by themselves. 
+ A frame stays valid until the DMA comes round again, the main loop
+ has to consume it within 256 character times (22 ms at 115200).
+ */
+
+#define UART_RX_BUFFER_SIZE 256
+#define UART_RX_QUEUE_SIZE 4
+
+struct UartFrame
+{
+    // offset of the first byte in the circular buffer
+    uint8_t start;
+    uint16_t length;
+};
+
+extern uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
+
+void uart_rx_init(UART_HandleTypeDef* huart);
+
+// next received frame, 0 if there is none
+uint8_t uart_rx_frame(struct UartFrame* f);
+
+static inline uint8_t uart_rx_byte(const struct UartFrame* f, uint16_t i)
+{
+    return uart_rx_buffer[(uint8_t)(f->start + i)];
+}
+
+// interrupts
+void uart_rx_idle_int();
+
+#endif // _UART_RX_H_
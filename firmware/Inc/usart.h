@@ -39,9 +39,25 @@
     { send_string(m); send_int(i); send_string(", "); \
     send_int(j); send_string(", "); send_int(k); send_ln(); }
 
+/*
+ The output is buffered and sent by the DMA in the background, a LOG
+ costs only the copy. With the buffer full the caller waits for room,
+ except in an interrupt where the text is dropped.
+ */
+#define USART_TX_BUFFER_SIZE 512
+
 void usart_config(UART_HandleTypeDef* huart);
+// room left in the transmit buffer [bytes]
+uint16_t usart_tx_free();
+// drops the log output for a while, raw writes still go through,
+// those already buffered included
+void usart_mute(uint32_t duration_ms);
+// waits until everything buffered has left the shift register
+void usart_flush();
+void usart_write(const uint8_t* data, uint16_t size);
 void send_char(char c);
 void send_int(uint32_t val);
+void send_hex(uint32_t val);
 void send_ln();
 void send_string(const char* s);
 void send_string_int(const char* s, uint32_t val);
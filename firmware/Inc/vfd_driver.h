@@ -28,6 +28,9 @@
 
 #include <stdint.h>
 
+// four digits and the dots
+#define VFD_SECTIONS 5
+
 void vfd_driver_init();
 
 enum VfdSegment
@@ -53,8 +56,14 @@ void vfd_driver_light_dots(uint8_t dots);
 void vfd_driver_print_left(uint8_t num);
 void vfd_driver_print_right(uint8_t num);
 
+// label segments on the leftmost digit, num on the other three
+void vfd_driver_print_labeled(uint8_t label, uint8_t num);
+
 void vfd_driver_clear();
 
+// copies the VFD_SECTIONS segment patterns as they are lit
+void vfd_driver_get_sections(uint8_t* sections);
+
 enum VfdBrightness
 {
     VFD_BRID_MIN,
@@ -63,8 +72,16 @@ enum VfdBrightness
     VFD_BRID_MAX
 };
 
+// jumps to the level of the enum, for the selfcheck
 void vfd_driver_set_brightness(enum VfdBrightness b);
 
+// brightness levels, perceptually even, 0 is the dimmest
+#define VFD_LEVELS 32
+
+// fades to the level in VFD_FADE_TICKS, vfd_driver_set_level() jumps
+void vfd_driver_fade_to(uint8_t level);
+void vfd_driver_set_level(uint8_t level);
+
 void vfd_driver_int();
 
 #endif // _VFD_DRIVER_H
\ No newline at end of file
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _VFD_LAYOUT_H_
+#define _VFD_LAYOUT_H_
+
+#include <stdint.h>
+
+/*
+ Layout of the temperature readings on the four digits. The dots 
+ section sits between the left pair (digits 3, 2) and the right pair
+ (digits 1, 0), its lower dot is the decimal point.
+
+ Both values, one per pair   "23 41"   -9..99 each
+ The right value alone       "23.4°"   -9.9..99.9
+                             " 105"    -99..999, "-12"
+                             "HI"/"LO" beyond
+ The pairs are used as long as both values fit, otherwise the right
+ value (the chamber) takes all four digits. There is no toggling 
+ between the two.
+
+ A shown value stays until the reading is more than half a display
+ unit (a degree in the pairs, a tenth in "23.4°") plus VFD_LAYOUT_HYST
+ percent of a unit away from it, then it takes the reading rounded. A
+ reading jittering around a rounding edge does not flicker, one that
+ drifts slowly is shown once it is past the edge by the margin. Back
+ to the pairs when both values are a degree inside their range.
+ */
+
+// [% of a display unit]
+#define VFD_LAYOUT_HYST 30
+
+struct VfdLayout
+{
+    // as shown [hundredths of a degree], a whole number of units
+    int32_t left;
+    int32_t right;
+    uint8_t valid;
+    uint8_t single;
+};
+
+void vfd_layout_init(struct VfdLayout* layout);
+
+// the values in signed fixed point with frac_bits fraction bits
+void vfd_layout_render(struct VfdLayout* layout, int32_t left, 
+                       int32_t right, uint8_t frac_bits);
+
+#endif // _VFD_LAYOUT_H_
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _VFD_PINMAP_H_
+#define _VFD_PINMAP_H_
+
+#include "main.h"
+#include "vfd_driver.h"
+
+/*
+ The VFD wiring, pin names refer to the *_Pin / *_GPIO_Port definitions
+ in main.h. The port set/reset words used by the multiplexing are
+ generated from these lists at compile time, all pins have to be 
+ placed on GPIOA or GPIOB.
+
+ X(pin name, bit in the section value, ...)
+ */
+
+#define VFD_DIGIT_ANODES(X, ...) \
+    X(C_ANODES_A, VFD_SEG_A, __VA_ARGS__) \
+    X(C_ANODES_B, VFD_SEG_B, __VA_ARGS__) \
+    X(C_ANODES_C, VFD_SEG_C, __VA_ARGS__) \
+    X(C_ANODES_D, VFD_SEG_D, __VA_ARGS__) \
+    X(C_ANODES_E, VFD_SEG_E, __VA_ARGS__) \
+    X(C_ANODES_F, VFD_SEG_F, __VA_ARGS__) \
+    X(C_ANODES_G, VFD_SEG_G, __VA_ARGS__)
+
+#define VFD_DOT_ANODES(X, ...) \
+    X(C_ANODE_DOT_H, VFD_DOT_H, __VA_ARGS__) \
+    X(C_ANODE_DOT_L, VFD_DOT_L, __VA_ARGS__)
+
+// X(pin name, section index, ...), section 2 holds the dots
+#define VFD_GRIDS(X, ...) \
+    X(C_GRID_SEC_1, 0, __VA_ARGS__) \
+    X(C_GRID_SEC_2, 1, __VA_ARGS__) \
+    X(C_GRID_SEC_3, 2, __VA_ARGS__) \
+    X(C_GRID_SEC_4, 3, __VA_ARGS__) \
+    X(C_GRID_SEC_5, 4, __VA_ARGS__)
+
+#define VFD_DOTS_SECTION 2
+
+/*
+ Multiplexing calibration, in TIM4 ticks (~83 us). A section stays lit
+ for its dwell plus an extra depending on the number of lit segments,
+ a digit with many segments lit looks dimmer as they share the grid
+ current. The dots section has two small segments only. Between two
+ sections all grids are off for VFD_BLANK_TICKS before the anodes
+ change.
+ */
+#define VFD_SECTION_DWELL { 4, 4, 2, 4, 4 }
+// by the number of lit segments, 0 to 7
+#define VFD_SEGMENT_DWELL { 0, 0, 0, 0, 0, 1, 1, 1 }
+#define VFD_BLANK_TICKS 1
+
+// a brightness fade over the whole range, ~500 ms
+#define VFD_FADE_TICKS 6000
+
+#endif // _VFD_PINMAP_H_
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _VFD_TEXT_H_
+#define _VFD_TEXT_H_
+
+#include <stdint.h>
+
+/*
+ Text on the four 7-segment digits. The font covers printable ASCII,
+ letters get their usual 7-segment shapes (some are approximations:
+ K, M, W, X).
+
+ Messages go through a small queue, the one with the highest priority
+ is shown, the oldest first among equal ones. A message equal to one
+ still queued is not queued again, repeated writes of a Modbus master
+ give one "SEt", not a queue full of them. A message is turned into
+ glyph codes when posted, the renderer only copies four of them per
+ step. Up to four characters stand still, longer ones scroll as a 
+ marquee. Nothing waits, vfd_text_update() is called every main loop
+ pass and redraws only when a step is due.
+ */
+
+#define VFD_TEXT_MAX 16
+#define VFD_TEXT_QUEUE 4
+#define VFD_TEXT_SCROLL_MS 300
+
+enum VfdTextPriority
+{
+    VFD_TEXT_INFO,
+    VFD_TEXT_NOTICE,
+    VFD_TEXT_ERROR
+};
+
+// segments of an ASCII character, blank if there is no glyph
+uint8_t vfd_text_glyph(char c);
+
+// the first four characters at once, outside of the queue
+void vfd_text_show(const char* text);
+
+// shown for duration_ms once it gets the display, 0 if the queue is 
+// full of messages with a higher priority, 1 without a change if the
+// same text with the same priority is queued already
+uint8_t vfd_text_post(const char* text, enum VfdTextPriority priority,
+                      uint16_t duration_ms);
+
+uint8_t vfd_text_active();
+
+// paused while something else owns the display (the menu), returns 1
+// when the last message is gone and the display has to be redrawn
+uint8_t vfd_text_update(uint32_t now_ms, uint8_t paused);
+
+#endif // _VFD_TEXT_H_
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _WATCHDOG_H_
+#define _WATCHDOG_H_
+
+#include "stm32f1xx_hal.h"
+#include <stdint.h>
+
+/*
+ IWDG supervisor. Activities check in, the SysTick checks the deadlines
+ and the main loop refreshes the IWDG only if every one of them checked
+ in within its deadline. A stuck activity lets the IWDG reset the MCU,
+ the next boot reports which one it was together with the RCC_CSR reset
+ flags. The deadlines are checked from the interrupt, a main loop hung
+ in a busy wait is recorded as well.
+ */
+
+enum WatchdogTask
+{
+    WDG_ACQUISITION,
+    WDG_CONTROL,
+    WDG_DISPLAY,
+    WDG_UI,
+    WDG_TASKS
+};
+
+extern volatile uint8_t watchdog_checkins[WDG_TASKS];
+
+// a single byte store, callable from the interrupts
+static inline void watchdog_checkin(enum WatchdogTask t)
+{
+    watchdog_checkins[t] = 1;
+}
+
+// latches and clears the reset flags, call right after HAL_Init()
+void watchdog_boot();
+
+// the IWDG is already running, check-ins are due from now on
+void watchdog_start(IWDG_HandleTypeDef* hiwdg);
+
+// SysTick, evaluates the deadlines and records the late tasks
+void watchdog_tick_int(uint32_t now_ms);
+
+// main loop, refreshes the IWDG unless a task is late
+void watchdog_update();
+
+// reset reason over UART
+void watchdog_report();
+
+#endif // _WATCHDOG_H_
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "autotune.h"
+#include "estimator.h"
+
+#define HYST (EST_ONE * AUTOTUNE_HYST_QUARTERS / 4)
+// pi * 1000
+#define PI_1000 3142
+
+static enum AutotuneState state = AUTOTUNE_IDLE;
+static struct AutotuneResult result;
+
+static int32_t setpoint_q;
+static uint8_t relayHigh;
+static uint32_t start_ms;
+
+// relay centre and half swing [%], the power integral of the cycle
+static uint8_t centre;
+static uint8_t swing;
+static uint32_t powerSum;
+static uint32_t last_ms;
+
+// oscillation tracking
+static uint8_t cycles;
+static uint32_t cycleStart_ms;
+static int32_t tMax;
+static int32_t tMin;
+
+// sums over the measured cycles
+static uint32_t periodSum_ms;
+static int64_t amplitudeSum;
+
+static uint32_t __isqrt(uint64_t v)
+{
+    uint64_t r = 0;
+    uint64_t b = 1ULL << 62;
+
+    while (b > v) {
+        b >>= 2;
+    }
+
+    while (b) {
+        if (v >= r + b) {
+            v -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+
+    return (uint32_t)r;
+}
+
+static void __compute_gains()
+{
+    uint8_t n = AUTOTUNE_CYCLES;
+    int64_t a = amplitudeSum / n;
+    uint32_t tu = (periodSum_ms / n + 500) / 1000;
+
+    // correct the describing function for the relay hysteresis
+    int64_t a2 = a * a - (int64_t)HYST * HYST;
+    if (a2 <= 0 || tu == 0) {
+        state = AUTOTUNE_FAILED;
+        return;
+    }
+    int64_t a_eff = __isqrt(a2);
+
+    // Ku = 4 * d / (pi * a), d is the half of the relay swing
+    int64_t d = swing;
+    int64_t ku = (4 * d * 100 * 1000 * EST_ONE) / (PI_1000 * a_eff);
+
+    if (ku > 0xFFFF) {
+        ku = 0xFFFF;
+    }
+
+    result.ku = ku;
+    result.tu = tu;
+    // Ziegler-Nichols PID
+    result.kp = ku * 6 / 10;
+    result.ti = (tu > 1) ? tu / 2 : 1;
+    result.td = tu / 8;
+
+    state = AUTOTUNE_DONE;
+}
+
+void autotune_start(uint8_t setpoint, uint32_t now_ms)
+{
+    setpoint_q = EST_FROM_INT(setpoint);
+    relayHigh = 1;
+    start_ms = now_ms;
+
+    cycles = 0;
+    cycleStart_ms = now_ms;
+    tMax = INT32_MIN;
+    tMin = INT32_MAX;
+
+    periodSum_ms = 0;
+    amplitudeSum = 0;
+
+    centre = (AUTOTUNE_RELAY_HIGH + AUTOTUNE_RELAY_LOW) / 2;
+    swing = (AUTOTUNE_RELAY_HIGH - AUTOTUNE_RELAY_LOW) / 2;
+    powerSum = 0;
+    last_ms = now_ms;
+
+    state = AUTOTUNE_RUNNING;
+}
+
+static inline uint8_t __relay_power()
+{
+    return relayHigh ? centre + swing : centre - swing;
+}
+
+// centres the relay on the mean power of the cycle that just ended
+static void __centre_relay(uint32_t now_ms)
+{
+    uint32_t mean = powerSum / (now_ms - cycleStart_ms);
+
+    if (mean < AUTOTUNE_RELAY_LOW + AUTOTUNE_SWING_MIN) {
+        mean = AUTOTUNE_RELAY_LOW + AUTOTUNE_SWING_MIN;
+    } else if (mean > AUTOTUNE_RELAY_HIGH - AUTOTUNE_SWING_MIN) {
+        mean = AUTOTUNE_RELAY_HIGH - AUTOTUNE_SWING_MIN;
+    }
+
+    centre = mean;
+    swing = (mean - AUTOTUNE_RELAY_LOW < AUTOTUNE_RELAY_HIGH - mean)
+        ? mean - AUTOTUNE_RELAY_LOW : AUTOTUNE_RELAY_HIGH - mean;
+}
+
+void autotune_abort()
+{
+    state = AUTOTUNE_IDLE;
+}
+
+enum AutotuneState autotune_update(int32_t temp, uint32_t now_ms,
+                                   uint8_t* fanPower)
+{
+    if (state != AUTOTUNE_RUNNING) {
+        *fanPower = AUTOTUNE_RELAY_LOW;
+        return state;
+    }
+
+    if (now_ms - start_ms > AUTOTUNE_TIMEOUT_MS) {
+        state = AUTOTUNE_FAILED;
+        *fanPower = AUTOTUNE_RELAY_LOW;
+        return state;
+    }
+
+    powerSum += (uint32_t)__relay_power() * (now_ms - last_ms);
+    last_ms = now_ms;
+
+    if (temp > tMax) tMax = temp;
+    if (temp < tMin) tMin = temp;
+
+    if (relayHigh && (temp < setpoint_q - HYST)) {
+        relayHigh = 0;
+    } else if (!relayHigh && (temp > setpoint_q + HYST)) {
+        // a full cycle ends when the fan is switched on again
+        relayHigh = 1;
+
+        if (cycles < AUTOTUNE_SETTLE_CYCLES) {
+            __centre_relay(now_ms);
+        } else if (cycles > AUTOTUNE_SETTLE_CYCLES) {
+            // the one after the last centring still settles
+            periodSum_ms += now_ms - cycleStart_ms;
+            amplitudeSum += (tMax - tMin) / 2;
+        }
+
+        ++cycles;
+        cycleStart_ms = now_ms;
+        powerSum = 0;
+        tMax = temp;
+        tMin = temp;
+
+        if (cycles > AUTOTUNE_SETTLE_CYCLES + AUTOTUNE_CYCLES) {
+            __compute_gains();
+        }
+    }
+
+    *fanPower = (state == AUTOTUNE_RUNNING) 
+        ? __relay_power() : AUTOTUNE_RELAY_LOW;
+
+    return state;
+}
+
+enum AutotuneState autotune_state()
+{
+    return state;
+}
+
+uint8_t autotune_progress()
+{
+    if (state == AUTOTUNE_DONE) {
+        return 99;
+    }
+
+    return cycles * 100 / (AUTOTUNE_SETTLE_CYCLES + AUTOTUNE_CYCLES + 2);
+}
+
+const struct AutotuneResult* autotune_result()
+{
+    return &result;
+}
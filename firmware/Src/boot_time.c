@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "boot_time.h"
+#include "stm32f1xx_hal.h"
+#include "usart.h"
+
+static uint32_t stamps[BOOT_PHASES];
+
+static const char* const names[BOOT_PHASES] = {
+    "main=", "hal=", "clock=", "gpio=", "dma=", "adc=", "tim3=",
+    "logic=", "control=", "usart=", "vfd="
+};
+
+void boot_time_start()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void boot_time_mark(enum BootPhase phase)
+{
+    stamps[phase] = DWT->CYCCNT;
+}
+
+void boot_time_report()
+{
+    send_string("Boot [cycles]: ");
+
+    for (uint8_t i = 0; i < BOOT_PHASES; ++i) {
+        send_string(names[i]);
+        send_int(stamps[i]);
+        send_string((i + 1 < BOOT_PHASES) ? ", " : "");
+    }
+
+    send_ln();
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "buttons.h"
+#include "fast_io.h"
+
+struct Button
+{
+    GPIO_TypeDef* Gpio;
+    uint16_t Gpio_pin;
+
+    // debouncing
+    volatile uint8_t active;
+    uint8_t integrator;
+    uint8_t pressed;
+
+    // press tracking in ticks [ms]
+    uint16_t held_ms;
+    uint16_t released_ms;
+    uint8_t clicks;
+    uint8_t consumed;
+
+    // event queue, written by the tick, read by the main loop
+    uint8_t queue[BTN_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+};
+
+static struct Button buttons[BTN_COUNT] = {
+    { .Gpio = MODE_GPIO_Port, .Gpio_pin = MODE_Pin },
+    { .Gpio = SELECT_GPIO_Port, .Gpio_pin = SELECT_Pin }
+};
+
+static void __push(struct Button* btn, enum ButtonEvent ev)
+{
+    uint8_t next = (btn->head + 1) % BTN_QUEUE_SIZE;
+
+    if (next == btn->tail) {
+        // full, drop the event
+        return;
+    }
+
+    btn->queue[btn->head] = ev;
+    btn->head = next;
+}
+
+static void __debounce(struct Button* btn)
+{
+    if (!fast_gpio_read(btn->Gpio, btn->Gpio_pin)) {
+        // active low
+        if (btn->integrator < BTN_INTEGRATOR_MAX) {
+            ++btn->integrator;
+        }
+    } else if (btn->integrator > 0) {
+        --btn->integrator;
+    }
+}
+
+static void __on_press(struct Button* btn)
+{
+    btn->pressed = 1;
+    btn->held_ms = 0;
+    btn->consumed = 0;
+}
+
+static void __on_release(struct Button* btn)
+{
+    btn->pressed = 0;
+    btn->released_ms = 0;
+
+    if (btn->consumed) {
+        // long press or auto-repeat, not a click
+        btn->clicks = 0;
+        return;
+    }
+
+    if (++btn->clicks >= 2) {
+        btn->clicks = 0;
+        __push(btn, BTN_EV_DOUBLE_CLICK);
+    }
+}
+
+static void __held(struct Button* btn)
+{
+    uint16_t t = ++btn->held_ms;
+
+    if (t == BTN_LONG_PRESS_MS) {
+        __push(btn, BTN_EV_LONG_PRESS);
+        btn->consumed = 1;
+    }
+
+    if ((t >= BTN_REPEAT_DELAY_MS)
+        && ((t - BTN_REPEAT_DELAY_MS) % BTN_REPEAT_MS == 0)) {
+        __push(btn, BTN_EV_REPEAT);
+        btn->consumed = 1;
+    }
+
+    if (t == 0xFFFF) {
+        // saturate, no more events until released
+        btn->held_ms = BTN_LONG_PRESS_MS + 1;
+    }
+}
+
+static void __button_tick(struct Button* btn)
+{
+    __debounce(btn);
+
+    if (!btn->pressed && (btn->integrator == BTN_INTEGRATOR_MAX)) {
+        __on_press(btn);
+    } else if (btn->pressed && (btn->integrator == 0)) {
+        __on_release(btn);
+    }
+
+    if (btn->pressed) {
+        __held(btn);
+        return;
+    }
+
+    if (btn->clicks && (++btn->released_ms >= BTN_DOUBLE_CLICK_MS)) {
+        // no second click in time
+        btn->clicks = 0;
+        __push(btn, BTN_EV_CLICK);
+    }
+
+    // settled and nothing pending, sleep until the next edge
+    if ((btn->integrator == 0) && !btn->clicks) {
+        btn->active = 0;
+    }
+}
+
+void buttons_init()
+{
+    for (uint8_t i = 0; i < BTN_COUNT; ++i) {
+        // sample once in case a button is held during the boot
+        buttons[i].active = 1;
+    }
+}
+
+enum ButtonEvent buttons_get_event(enum ButtonId id)
+{
+    struct Button* btn = &buttons[id];
+
+    if (btn->tail == btn->head) {
+        return BTN_EV_NONE;
+    }
+
+    enum ButtonEvent ev = btn->queue[btn->tail];
+    btn->tail = (btn->tail + 1) % BTN_QUEUE_SIZE;
+
+    return ev;
+}
+
+void buttons_exti_int(uint16_t pin)
+{
+    for (uint8_t i = 0; i < BTN_COUNT; ++i) {
+        if (buttons[i].Gpio_pin == pin) {
+            buttons[i].active = 1;
+        }
+    }
+}
+
+void buttons_tick_int()
+{
+    for (uint8_t i = 0; i < BTN_COUNT; ++i) {
+        if (buttons[i].active) {
+            __button_tick(&buttons[i]);
+        }
+    }
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "config_store.h"
+#include "flash.h"
+
+#include <string.h>
+
+struct RecordHeader
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t version;
+    uint16_t length; // payload [bytes], multiple of 4
+};
+
+#define HEADER_WORDS (sizeof(struct RecordHeader) / sizeof(uint32_t))
+#define RECORD_WORDS (HEADER_WORDS + CS_MAX_PAYLOAD / sizeof(uint32_t) + 1)
+
+#define SLOTS 2
+
+static const uint32_t slots[SLOTS] = {
+    FLASH_PAGE_ADDRESS(FLASH_CONFIG_PAGE_A),
+    FLASH_PAGE_ADDRESS(FLASH_CONFIG_PAGE_B)
+};
+
+static CRC_HandleTypeDef* crc = NULL;
+
+// the slot holding the newest valid record, -1 when both are empty
+static int8_t newest = -1;
+static uint32_t newestSeq = 0;
+
+// header, payload and CRC, shared by load and save
+static uint32_t record[RECORD_WORDS];
+
+static uint8_t __read_slot(uint8_t slot)
+{
+    struct RecordHeader* h = (struct RecordHeader*)record;
+
+    flash_read(slots[slot], (uint16_t*)record, 
+               sizeof(struct RecordHeader) / sizeof(uint16_t));
+
+    if ((h->magic != CS_MAGIC) || (h->length > CS_MAX_PAYLOAD)
+        || (h->length % sizeof(uint32_t) != 0)) {
+        return 0;
+    }
+
+    uint32_t words = HEADER_WORDS + h->length / sizeof(uint32_t);
+
+    flash_read(slots[slot], (uint16_t*)record, 
+               (words + 1) * sizeof(uint32_t) / sizeof(uint16_t));
+
+    return HAL_CRC_Calculate(crc, record, words) == record[words];
+}
+
+static void __decode(const struct ConfigField* schema, uint8_t count,
+                     void* obj)
+{
+    const struct RecordHeader* h = (const struct RecordHeader*)record;
+    const uint8_t* p = (const uint8_t*)&record[HEADER_WORDS];
+    uint16_t pos = 0;
+
+    while (pos + 2 <= h->length) {
+        uint8_t tag = p[pos];
+        uint8_t len = p[pos + 1];
+        pos += 2;
+
+        if ((tag == CS_TAG_END) || (pos + len > h->length)) {
+            break;
+        }
+
+        for (uint8_t i = 0; i < count; ++i) {
+            if (schema[i].tag == tag) {
+                // a field that has grown keeps the extra bytes default
+                uint8_t n = (len < schema[i].size) ? len : schema[i].size;
+                memcpy((uint8_t*)obj + schema[i].offset, &p[pos], n);
+                break;
+            }
+        }
+
+        pos += len;
+    }
+}
+
+void config_store_init(CRC_HandleTypeDef* hcrc)
+{
+    crc = hcrc;
+    newest = -1;
+
+    for (uint8_t i = 0; i < SLOTS; ++i) {
+        if (!__read_slot(i)) {
+            continue;
+        }
+
+        uint32_t seq = ((struct RecordHeader*)record)->seq;
+
+        if ((newest < 0) || ((int32_t)(seq - newestSeq) > 0)) {
+            newest = i;
+            newestSeq = seq;
+        }
+    }
+}
+
+uint16_t config_store_load(const struct ConfigField* schema, uint8_t count,
+                           void* obj)
+{
+    if ((newest < 0) || !__read_slot(newest)) {
+        return 0;
+    }
+
+    __decode(schema, count, obj);
+
+    return ((struct RecordHeader*)record)->version;
+}
+
+HAL_StatusTypeDef config_store_save(const struct ConfigField* schema, 
+                                    uint8_t count, const void* obj,
+                                    uint16_t version)
+{
+    struct RecordHeader* h = (struct RecordHeader*)record;
+    uint8_t* p = (uint8_t*)&record[HEADER_WORDS];
+    uint16_t len = 0;
+
+    for (uint8_t i = 0; i < count; ++i) {
+        if (len + 2 + schema[i].size > CS_MAX_PAYLOAD) {
+            return HAL_ERROR;
+        }
+
+        p[len++] = schema[i].tag;
+        p[len++] = schema[i].size;
+        memcpy(&p[len], (const uint8_t*)obj + schema[i].offset, 
+               schema[i].size);
+        len += schema[i].size;
+    }
+
+    while (len % sizeof(uint32_t) != 0) {
+        p[len++] = CS_TAG_END;
+    }
+
+    h->magic = CS_MAGIC;
+    h->seq = newestSeq + 1;
+    h->version = version;
+    h->length = len;
+
+    uint32_t words = HEADER_WORDS + len / sizeof(uint32_t);
+    record[words] = HAL_CRC_Calculate(crc, record, words);
+
+    // never touch the newest record
+    uint8_t target = (newest == 0) ? 1 : 0;
+
+    HAL_StatusTypeDef ret = flash_write(slots[target], (uint16_t*)record,
+        (words + 1) * sizeof(uint32_t) / sizeof(uint16_t));
+
+    if (ret == HAL_OK) {
+        newest = target;
+        newestSeq = h->seq;
+    }
+
+    return ret;
+}
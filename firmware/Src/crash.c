@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "crash.h"
+#include "flash.h"
+#include "fan_driver.h"
+#include "usart.h"
+#include "main.h"
+
+#define LOG_SLOTS (FLASH_PAGE_SIZE / sizeof(struct CrashRecord))
+
+// survives the reset, not touched by the startup code
+static struct CrashRecord crashRecord __attribute__((section(".noinit")));
+
+// the record of the previous run, slot in the Flash log
+static int8_t crashSlot = -1;
+
+// linker script symbols
+extern uint32_t _etext;
+extern uint32_t _estack;
+
+static const struct CrashRecord* __log_slot(uint8_t slot)
+{
+    return (const struct CrashRecord*)(FLASH_PAGE_ADDRESS(FLASH_CRASH_PAGE)
+        + slot * sizeof(struct CrashRecord));
+}
+
+static uint8_t __is_code(uint32_t addr)
+{
+    // thumb return addresses are odd
+    return (addr & 1) && (addr >= FLASH_PAGE_START)
+        && (addr < (uint32_t)&_etext);
+}
+
+static void __scan_stack(const uint32_t* sp)
+{
+    uint8_t n = 0;
+
+    while ((sp < &_estack) && (n < CRASH_STACK_DEPTH)) {
+        if (__is_code(*sp)) {
+            crashRecord.stack[n++] = *sp;
+        }
+        ++sp;
+    }
+
+    while (n < CRASH_STACK_DEPTH) {
+        crashRecord.stack[n++] = 0;
+    }
+}
+
+static void __reset() __attribute__((noreturn));
+
+static void __reset()
+{
+    fan_driver_emergency_off();
+
+    crashRecord.uptime_ms = HAL_GetTick();
+    crashRecord.magic = CRASH_MAGIC;
+
+    NVIC_SystemReset();
+    while (1);
+}
+
+// called from the fault handlers with the stacked frame
+void crash_capture(uint32_t* frame, uint32_t type) 
+    __attribute__((used, noreturn));
+
+void crash_capture(uint32_t* frame, uint32_t type)
+{
+    __disable_irq();
+
+    crashRecord.type = type;
+    crashRecord.r0 = frame[0];
+    crashRecord.r1 = frame[1];
+    crashRecord.r2 = frame[2];
+    crashRecord.r3 = frame[3];
+    crashRecord.r12 = frame[4];
+    crashRecord.lr = frame[5];
+    crashRecord.pc = frame[6];
+    crashRecord.psr = frame[7];
+
+    crashRecord.cfsr = SCB->CFSR;
+    crashRecord.hfsr = SCB->HFSR;
+    crashRecord.mmfar = SCB->MMFAR;
+    crashRecord.bfar = SCB->BFAR;
+
+    // the basic frame is 8 words, plus one when it was realigned
+    crashRecord.sp = (uint32_t)(frame + 8) + ((frame[7] & (1 << 9)) ? 4 : 0);
+    __scan_stack((const uint32_t*)crashRecord.sp);
+
+    __reset();
+}
+
+void crash_error(const char* file, int line, uint32_t caller)
+{
+    uint32_t sp;
+
+    __disable_irq();
+    __asm volatile ("mov %0, sp" : "=r" (sp));
+
+    crashRecord.type = CRASH_ERROR;
+    crashRecord.r0 = (uint32_t)file;
+    crashRecord.r1 = line;
+    crashRecord.r2 = crashRecord.r3 = crashRecord.r12 = 0;
+    crashRecord.lr = caller;
+    crashRecord.pc = caller;
+    crashRecord.psr = 0;
+    crashRecord.cfsr = crashRecord.hfsr = 0;
+    crashRecord.mmfar = crashRecord.bfar = 0;
+    crashRecord.sp = sp;
+    __scan_stack((const uint32_t*)sp);
+
+    __reset();
+}
+
+// ----------------------------------------
+// Fault handlers, naked so that the stack pointer still points
+// to the stacked frame
+// ----------------------------------------
+#define __CRASH_ENTRY(type) \
+    __asm volatile ( \
+        "tst lr, #4         \n" \
+        "ite eq             \n" \
+        "mrseq r0, msp      \n" \
+        "mrsne r0, psp      \n" \
+        "movs r1, %0        \n" \
+        "b crash_capture    \n" \
+        : : "i" (type))
+
+__attribute__((naked)) void HardFault_Handler(void)
+{
+    __CRASH_ENTRY(CRASH_HARD_FAULT);
+}
+
+__attribute__((naked)) void MemManage_Handler(void)
+{
+    __CRASH_ENTRY(CRASH_MEM_MANAGE);
+}
+
+__attribute__((naked)) void BusFault_Handler(void)
+{
+    __CRASH_ENTRY(CRASH_BUS_FAULT);
+}
+
+__attribute__((naked)) void UsageFault_Handler(void)
+{
+    __CRASH_ENTRY(CRASH_USAGE_FAULT);
+}
+
+// ----------------------------------------
+// Persistent log
+// ----------------------------------------
+void crash_init()
+{
+    // dedicated handlers instead of everything escalating to HardFault
+    SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk | SCB_SHCSR_BUSFAULTENA_Msk
+        | SCB_SHCSR_USGFAULTENA_Msk;
+
+    if (crashRecord.magic != CRASH_MAGIC) {
+        return;
+    }
+
+    // consumed, a later reset must not log it again
+    crashRecord.magic = 0;
+
+    // first erased slot
+    uint8_t slot = 0;
+    while ((slot < LOG_SLOTS) && (__log_slot(slot)->magic != 0xFFFFFFFF)) {
+        ++slot;
+    }
+
+    struct CrashRecord rec = crashRecord;
+    rec.magic = CRASH_MAGIC;
+
+    HAL_StatusTypeDef s;
+    if (slot < LOG_SLOTS) {
+        s = flash_program((uint32_t)__log_slot(slot), (uint16_t*)&rec,
+                          sizeof(rec) / sizeof(uint16_t));
+    } else {
+        // full, start over
+        slot = 0;
+        s = flash_write((uint32_t)__log_slot(slot), (uint16_t*)&rec,
+                        sizeof(rec) / sizeof(uint16_t));
+    }
+
+    if (s == HAL_OK) {
+        crashSlot = slot;
+    }
+}
+
+static void __send_hex(const char* s, uint32_t v)
+{
+    send_string(s);
+    send_hex(v);
+}
+
+static void __dump_record(uint8_t slot)
+{
+    const struct CrashRecord* r = __log_slot(slot);
+
+    send_string_int("CRASH ", slot);
+    send_string_int(" type ", r->type);
+    __send_hex(" pc ", r->pc);
+    __send_hex(" lr ", r->lr);
+    __send_hex(" psr ", r->psr);
+    __send_hex(" sp ", r->sp);
+    send_ln();
+
+    send_string_int("CRASH ", slot);
+    __send_hex(" cfsr ", r->cfsr);
+    __send_hex(" hfsr ", r->hfsr);
+    __send_hex(" mmfar ", r->mmfar);
+    __send_hex(" bfar ", r->bfar);
+    send_ln();
+
+    send_string_int("CRASH ", slot);
+    __send_hex(" regs ", r->r0);
+    __send_hex(" ", r->r1);
+    __send_hex(" ", r->r2);
+    __send_hex(" ", r->r3);
+    __send_hex(" ", r->r12);
+    send_ln();
+
+    send_string_int("CRASH ", slot);
+    send_string(" stack");
+    for (uint8_t i = 0; (i < CRASH_STACK_DEPTH) && r->stack[i]; ++i) {
+        __send_hex(" ", r->stack[i]);
+    }
+    send_ln();
+
+    send_string_int("CRASH ", slot);
+    send_string_int_ln(" uptime ", r->uptime_ms);
+}
+
+void crash_report()
+{
+    if (crashSlot >= 0) {
+        LOG("Recovered from a crash");
+        __dump_record(crashSlot);
+    }
+}
+
+void crash_log_dump()
+{
+    for (uint8_t slot = 0; slot < LOG_SLOTS; ++slot) {
+        if (__log_slot(slot)->magic == CRASH_MAGIC) {
+            __dump_record(slot);
+        }
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "estimator.h"
+
+// state: x0 - temperature, x1 - rate not explained by the fan
+static int32_t x0;
+static int32_t x1;
+
+// rate caused by the fan in the last prediction
+static int32_t fanRate;
+
+// covariance, symmetric so p10 == p01
+static int32_t p00;
+static int32_t p01;
+static int32_t p11;
+
+static inline int32_t __mul(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a * b) >> EST_Q);
+}
+
+static inline int32_t __div(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a << EST_Q) / b);
+}
+
+void estimator_init(int32_t temp)
+{
+    x0 = temp;
+    x1 = 0;
+    fanRate = 0;
+
+    p00 = EST_R_TEMP;
+    p01 = 0;
+    p11 = EST_ONE / 100;
+}
+
+void estimator_predict(uint8_t fanPower, int32_t ambient, uint32_t dt_ms)
+{
+    int32_t dt = (int32_t)((((int64_t)dt_ms) << EST_Q) / 1000);
+
+    // fan driven heat exchange with the ambient
+    int32_t fan = __mul(EST_FAN_GAIN, EST_FROM_INT(fanPower) / 100);
+    fanRate = __mul(fan, ambient - x0);
+
+    x0 += __mul(x1 + fanRate, dt);
+
+    // P = F * P * F' + Q, F = [1 dt; 0 1]
+    int32_t dtp11 = __mul(dt, p11);
+    p00 += 2 * __mul(dt, p01) + __mul(dt, dtp11) + __mul(EST_Q_TEMP, dt);
+    p01 += dtp11;
+    p11 += __mul(EST_Q_RATE, dt);
+}
+
+void estimator_update(int32_t measured)
+{
+    int32_t s = p00 + EST_R_TEMP;
+    int32_t k0 = __div(p00, s);
+    int32_t k1 = __div(p01, s);
+    int32_t y = measured - x0;
+
+    x0 += __mul(k0, y);
+    x1 += __mul(k1, y);
+
+    // P = (I - K * H) * P, H = [1 0]
+    p11 -= __mul(k1, p01);
+    p01 -= __mul(k0, p01);
+    p00 -= __mul(k0, p00);
+
+    // keep the covariance positive despite the rounding
+    if (p00 < 1) p00 = 1;
+    if (p11 < 1) p11 = 1;
+}
+
+int32_t estimator_temp()
+{
+    return x0;
+}
+
+int32_t estimator_rate()
+{
+    return x1 + fanRate;
+}
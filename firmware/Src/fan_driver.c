@@ -24,24 +24,34 @@
  */
 
 #include "fan_driver.h"
+#include "fast_io.h"
+#include "trace.h"
 
 #include "usart.h"
 
+#include <stdlib.h>
+
 static TIM_HandleTypeDef* triac_timer = NULL;
 static volatile uint8_t manual_drive = 0;
 static uint8_t prevPowerPerc = 0;
+static volatile uint32_t zeroCrossCount = 0;
+static volatile uint32_t zeroCrossStamps[FAN_ZERO_CROSS_STAMPS];
+static volatile uint32_t lastZeroCross_ms = 0;
 
 #define TIMER_DELAY_MIN 0
 #define TIMER_DELAY_MAX 80
 
+// a half-wave is 10 ms, 8.3 ms at 60 Hz, longer and one was missed
+#define ZERO_CROSS_GAP_MS 15
+
 static inline void __fan_on()
 {
-    HAL_GPIO_WritePin(DRIVE_GPIO_Port, DRIVE_Pin, GPIO_PIN_SET);
+    fast_gpio_write(DRIVE_GPIO_Port, DRIVE_Pin, GPIO_PIN_SET);
 }
 
 static inline void __fan_off()
 {
-    HAL_GPIO_WritePin(DRIVE_GPIO_Port, DRIVE_Pin, GPIO_PIN_RESET);
+    fast_gpio_write(DRIVE_GPIO_Port, DRIVE_Pin, GPIO_PIN_RESET);
 }
 
 void fan_driver_init(TIM_HandleTypeDef* triac_timer_)
@@ -56,11 +66,15 @@ void fan_driver_set_power(uint8_t powerPercentage)
     if (powerPercentage == prevPowerPerc) {
         return;
     } else {
+        if (abs(powerPercentage - prevPowerPerc) >= TRACE_FAN_STEP) {
+            TRACE_TRIGGER(TRACE_TRIG_FAN_STEP);
+        }
         prevPowerPerc = powerPercentage;
     }
+
+    TRACE_MARK(TRACE_MARK_FAN_POWER, powerPercentage);
     
-    HAL_TIM_Base_Stop_IT(triac_timer);
-    HAL_TIM_Base_DeInit(triac_timer);
+    fast_tim_stop_it(triac_timer);
 
     if (powerPercentage == 0) {
         manual_drive = 1;
@@ -75,25 +89,66 @@ void fan_driver_set_power(uint8_t powerPercentage)
         uint32_t period = TIMER_DELAY_MIN + (TIMER_DELAY_MAX - TIMER_DELAY_MIN) 
             * inv / 100;
         LOG2("FAN DRIVER period= ", period);
-        triac_timer->Init.Period = period;
-        HAL_TIM_Base_Init(triac_timer);
+        fast_tim_set_period(triac_timer, period);
+    }
+}
+
+void fan_driver_emergency_off()
+{
+    // no LOG, the UART may be the culprit
+    manual_drive = 1;
+    if (triac_timer) {
+        fast_tim_stop_it(triac_timer);
     }
+    __fan_off();
+}
+
+uint8_t fan_driver_get_power()
+{
+    return prevPowerPerc;
+}
+
+uint32_t fan_driver_zero_cross_count()
+{
+    return zeroCrossCount;
+}
+
+uint8_t fan_driver_zero_cross_stamp(uint32_t n, uint32_t* cycles)
+{
+    uint32_t count = zeroCrossCount;
+
+    // the oldest slot may be overwritten right now
+    if ((count - n - 1) >= FAN_ZERO_CROSS_STAMPS - 1) {
+        return 0;
+    }
+
+    *cycles = zeroCrossStamps[n % FAN_ZERO_CROSS_STAMPS];
+    return 1;
 }
 
 void fan_driver_zero_cross_int()
 {
+    uint32_t now_ms = HAL_GetTick();
+
+    if (zeroCrossCount && (now_ms - lastZeroCross_ms > ZERO_CROSS_GAP_MS)) {
+        TRACE_TRIGGER(TRACE_TRIG_ZERO_CROSS);
+    }
+    lastZeroCross_ms = now_ms;
+    zeroCrossStamps[zeroCrossCount % FAN_ZERO_CROSS_STAMPS] = DWT->CYCCNT;
+    ++zeroCrossCount;
+
     if (manual_drive) {
         return;
     }
     
     __fan_off();
     
-    HAL_TIM_Base_Start_IT(triac_timer);
+    fast_tim_start_it(triac_timer);
 }
 
 void fan_driver_launch_triac_int()
 {
-    HAL_TIM_Base_Stop_IT(triac_timer);
+    fast_tim_stop_it(triac_timer);
     
     __fan_on();
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
  */
 
 #include "flash.h"
+#include "trace.h"
 
 #define WAIT_TIMEOUT 5
 
@@ -35,6 +36,22 @@
     if (stat != HAL_OK) \
         goto clean;
 
+// the controller has a single owner, a writer breaking into another
+// one's erase/program sequence would mix PER and PG or lock the Flash
+// under it
+static volatile uint8_t owned = 0;
+
+static uint8_t __take()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t taken = !owned;
+    owned = 1;
+    __set_PRIMASK(primask);
+
+    return taken;
+}
+
 static inline void __flash_page_erase(uint32_t pageAddress)
 {
     SET_BIT(FLASH->CR, FLASH_CR_PER);
@@ -61,7 +78,8 @@ static inline HAL_StatusTypeDef __flash_program_halfword(uint32_t address,
     return ret;
 }
  
-HAL_StatusTypeDef flash_write(uint16_t* data, uint32_t size)
+static HAL_StatusTypeDef __flash_write(uint32_t address, uint16_t* data,
+                                       uint32_t size)
 {
     HAL_StatusTypeDef ret;
     
@@ -71,14 +89,32 @@ HAL_StatusTypeDef flash_write(uint16_t* data, uint32_t size)
     ret = FLASH_WaitForLastOperation(WAIT_TIMEOUT);
     CLEAN_IF_FAILURE(ret);
 
-    __flash_page_erase(FLASH_PAGE_ADDR);
+    __flash_page_erase(address);
 
     ret = FLASH_WaitForLastOperation(WAIT_TIMEOUT);
     CLEAN_IF_FAILURE(ret);
 
     FLASH->CR &= ~FLASH_CR_PER; // Page Erase Clear
     
-    ret = __flash_program_halfword(FLASH_PAGE_ADDR, data, size);
+    ret = __flash_program_halfword(address, data, size);
+    CLEAN_IF_FAILURE(ret);
+    
+    return HAL_FLASH_Lock();
+
+clean:
+    HAL_FLASH_Lock();
+    return ret;
+}
+
+static HAL_StatusTypeDef __flash_program(uint32_t address, uint16_t* data, 
+                                         uint32_t size)
+{
+    HAL_StatusTypeDef ret;
+    
+    ret = HAL_FLASH_Unlock();
+    GO_IF_SUCCESS(ret);
+
+    ret = __flash_program_halfword(address, data, size);
     CLEAN_IF_FAILURE(ret);
     
     return HAL_FLASH_Lock();
@@ -87,11 +123,45 @@ clean:
     HAL_FLASH_Lock();
     return ret;
 }
+
+// both stall the CPU, traced as a task
+HAL_StatusTypeDef flash_write(uint32_t address, uint16_t* data, uint32_t size)
+{
+    if (!__take()) {
+        return HAL_BUSY;
+    }
+
+    TRACE_BEGIN(TRACE_FLASH);
+    TRACE_TRIGGER(TRACE_TRIG_FLASH);
+    HAL_StatusTypeDef ret = __flash_write(address, data, size);
+    TRACE_END(TRACE_FLASH);
+
+    owned = 0;
+
+    return ret;
+}
+
+HAL_StatusTypeDef flash_program(uint32_t address, uint16_t* data, 
+                                uint32_t size)
+{
+    if (!__take()) {
+        return HAL_BUSY;
+    }
+
+    TRACE_BEGIN(TRACE_FLASH);
+    TRACE_TRIGGER(TRACE_TRIG_FLASH);
+    HAL_StatusTypeDef ret = __flash_program(address, data, size);
+    TRACE_END(TRACE_FLASH);
+
+    owned = 0;
+
+    return ret;
+}
  
-void flash_read(uint16_t* data, uint32_t size)
+void flash_read(uint32_t address, uint16_t* data, uint32_t size)
 {
     for (uint32_t i = 0; i < size; ++i) {
-        data[i] = *(__IO uint16_t*)(FLASH_PAGE_ADDR + i * 2);
+        data[i] = *(__IO uint16_t*)(address + i * 2);
     }
  
 }
\ No newline at end of file
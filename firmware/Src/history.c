@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "history.h"
+#include "flash.h"
+#include "usart.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLES_PER_RECORD 60
+
+#define TAG_RUN 0x80
+#define TAG_END 0xFF
+#define MAX_RUN 126
+
+// the groups of a record, in the order they follow the tag
+#define GROUP_DELTA 0x01
+#define GROUP_ABSOLUTE 0x02
+#define GROUP_CHAMBER 0x04
+#define GROUP_AMBIENT 0x08
+#define GROUP_FAN 0x10
+
+// tag, both averages absolute, two spreads and the fan
+#define MAX_RECORD 6
+
+#define SPREAD_MAX 15
+// the noise of a reading moves min/max by a degree and the PID the fan
+// by a few percent every minute, those are not stored
+#define SPREAD_BAND 1
+#define FAN_BAND 4
+
+struct PageHeader
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t boot;
+    uint16_t reserved;
+    uint32_t minute; // of the first record
+};
+
+// ----------------------------------------
+// Aggregation of the samples
+// ----------------------------------------
+static uint8_t samples;
+static uint8_t chamberMin, chamberMax, ambientMin, ambientMax;
+static uint16_t chamberSum, ambientSum, fanSum;
+static uint32_t minute;
+// the last record, the dead bands apply to it across the pages
+static uint8_t kept[HIST_FIELDS];
+static uint8_t keptValid;
+
+// ----------------------------------------
+// Encoder
+// ----------------------------------------
+static uint8_t staging[FLASH_PAGE_SIZE];
+static uint16_t stagingPos;
+static uint8_t prev[HIST_FIELDS];
+static uint8_t run;
+
+static uint8_t nextPage;
+static uint32_t nextSeq;
+static uint16_t boot;
+
+static uint32_t __page_address(uint8_t page)
+{
+    return FLASH_PAGE_ADDRESS(FLASH_HISTORY_FIRST_PAGE + page);
+}
+
+static const struct PageHeader* __page_header(uint8_t page)
+{
+    const struct PageHeader* h = 
+        (const struct PageHeader*)__page_address(page);
+
+    return (h->magic == HIST_MAGIC) ? h : NULL;
+}
+
+static void __new_page()
+{
+    struct PageHeader* h = (struct PageHeader*)staging;
+
+    h->magic = HIST_MAGIC;
+    h->seq = nextSeq;
+    h->boot = boot;
+    h->reserved = 0;
+    h->minute = minute;
+
+    stagingPos = sizeof(struct PageHeader);
+    memset(prev, 0, sizeof(prev));
+    run = 0;
+}
+
+static void __write_page()
+{
+    // the end mark, also pads to a half-word
+    staging[stagingPos++] = TAG_END;
+    if (stagingPos % 2) {
+        staging[stagingPos++] = TAG_END;
+    }
+
+    HAL_StatusTypeDef s = flash_write(__page_address(nextPage), 
+        (uint16_t*)staging, stagingPos / sizeof(uint16_t));
+
+    if (s != HAL_OK) {
+        LOG2("Unable to save history to Flash: ", s);
+    }
+
+    nextPage = (nextPage + 1) % FLASH_HISTORY_PAGES;
+    ++nextSeq;
+}
+
+static void __flush_run()
+{
+    if (run) {
+        staging[stagingPos++] = TAG_RUN | run;
+        run = 0;
+    }
+}
+
+// min below and max above the average in the nibbles of a byte
+static uint8_t __spread(const uint8_t* rec, uint8_t min)
+{
+    return ((rec[min + 1] - rec[min]) << 4) | (rec[min + 2] - rec[min + 1]);
+}
+
+static uint8_t __fits_nibble(int16_t delta)
+{
+    return (delta >= -8) && (delta <= 7);
+}
+
+static void __append(const uint8_t* rec)
+{
+    uint8_t first = (stagingPos == sizeof(struct PageHeader));
+
+    if (!first && (memcmp(rec, prev, HIST_FIELDS) == 0) && (run < MAX_RUN)) {
+        ++run;
+        return;
+    }
+
+    __flush_run();
+
+    // room for the record, a run tag, the end mark and the padding
+    if (stagingPos + MAX_RECORD + 3 > FLASH_PAGE_SIZE) {
+        __write_page();
+        __new_page();
+    }
+
+    uint8_t tag = 0;
+    uint16_t tagPos = stagingPos++;
+    int16_t chamber = (int16_t)rec[HIST_CHAMBER_AVG] - prev[HIST_CHAMBER_AVG];
+    int16_t ambient = (int16_t)rec[HIST_AMBIENT_AVG] - prev[HIST_AMBIENT_AVG];
+
+    if (__fits_nibble(chamber) && __fits_nibble(ambient)) {
+        if (chamber || ambient) {
+            tag |= GROUP_DELTA;
+            staging[stagingPos++] = ((chamber & 0x0F) << 4) | (ambient & 0x0F);
+        }
+    } else {
+        tag |= GROUP_ABSOLUTE;
+        staging[stagingPos++] = rec[HIST_CHAMBER_AVG];
+        staging[stagingPos++] = rec[HIST_AMBIENT_AVG];
+    }
+
+    uint8_t spread = __spread(rec, HIST_CHAMBER_MIN);
+    if (spread != __spread(prev, HIST_CHAMBER_MIN)) {
+        tag |= GROUP_CHAMBER;
+        staging[stagingPos++] = spread;
+    }
+
+    spread = __spread(rec, HIST_AMBIENT_MIN);
+    if (spread != __spread(prev, HIST_AMBIENT_MIN)) {
+        tag |= GROUP_AMBIENT;
+        staging[stagingPos++] = spread;
+    }
+
+    if (rec[HIST_FAN_AVG] != prev[HIST_FAN_AVG]) {
+        tag |= GROUP_FAN;
+        staging[stagingPos++] = rec[HIST_FAN_AVG];
+    }
+
+    staging[tagPos] = tag;
+    memcpy(prev, rec, HIST_FIELDS);
+}
+
+void history_flush()
+{
+    __flush_run();
+    if (stagingPos == sizeof(struct PageHeader)) {
+        return;
+    }
+
+    __write_page();
+    __new_page();
+}
+
+void history_init()
+{
+    const struct PageHeader* newest = NULL;
+    uint8_t newestPage = 0;
+
+    for (uint8_t i = 0; i < FLASH_HISTORY_PAGES; ++i) {
+        const struct PageHeader* h = __page_header(i);
+
+        if (h && (!newest || ((int32_t)(h->seq - newest->seq) > 0))) {
+            newest = h;
+            newestPage = i;
+        }
+    }
+
+    if (newest) {
+        nextPage = (newestPage + 1) % FLASH_HISTORY_PAGES;
+        nextSeq = newest->seq + 1;
+        boot = newest->boot + 1;
+    } else {
+        nextPage = 0;
+        nextSeq = 0;
+        boot = 0;
+    }
+
+    minute = 0;
+    keptValid = 0;
+    samples = 0;
+    __new_page();
+}
+
+// v, or the kept value if v is within the band around it
+static uint8_t __band(uint8_t v, uint8_t keptV, uint8_t band)
+{
+    return (keptValid && abs((int16_t)v - keptV) <= band) ? keptV : v;
+}
+
+// min/avg/max as stored: the min and the max below and above the 
+// average, saturated and kept within the band
+static void __levels(uint8_t* rec, uint8_t min, uint8_t lo, uint16_t sum,
+                     uint8_t hi)
+{
+    uint8_t avg = sum / SAMPLES_PER_RECORD;
+    uint8_t below = __band(avg - lo, kept[min + 1] - kept[min], SPREAD_BAND);
+    uint8_t above = __band(hi - avg, kept[min + 2] - kept[min + 1], 
+                           SPREAD_BAND);
+
+    below = (below > SPREAD_MAX) ? SPREAD_MAX : below;
+    above = (above > SPREAD_MAX) ? SPREAD_MAX : above;
+    rec[min] = (below > avg) ? 0 : avg - below;
+    rec[min + 1] = avg;
+    rec[min + 2] = (above > 0xFF - avg) ? 0xFF : avg + above;
+}
+
+void history_sample(uint8_t chamber, uint8_t ambient, uint8_t fan)
+{
+    if (samples == 0) {
+        chamberMin = chamberMax = chamber;
+        ambientMin = ambientMax = ambient;
+        chamberSum = ambientSum = fanSum = 0;
+    }
+
+    if (chamber < chamberMin) chamberMin = chamber;
+    if (chamber > chamberMax) chamberMax = chamber;
+    if (ambient < ambientMin) ambientMin = ambient;
+    if (ambient > ambientMax) ambientMax = ambient;
+
+    chamberSum += chamber;
+    ambientSum += ambient;
+    fanSum += fan;
+
+    if (++samples < SAMPLES_PER_RECORD) {
+        return;
+    }
+
+    uint8_t rec[HIST_FIELDS];
+    __levels(rec, HIST_CHAMBER_MIN, chamberMin, chamberSum, chamberMax);
+    __levels(rec, HIST_AMBIENT_MIN, ambientMin, ambientSum, ambientMax);
+    rec[HIST_FAN_AVG] = __band(fanSum / SAMPLES_PER_RECORD, 
+                               kept[HIST_FAN_AVG], FAN_BAND);
+    memcpy(kept, rec, HIST_FIELDS);
+    keptValid = 1;
+
+    __append(rec);
+
+    samples = 0;
+    ++minute;
+}
+
+// ----------------------------------------
+// Dump, the decoder walks the pages from the oldest one and ends
+// with the staging buffer
+// ----------------------------------------
+// "M" and HIST_FIELDS of " -32768" with the line end
+#define DUMP_LINE_MAX (1 + HIST_FIELDS * 7 + 2)
+
+static uint8_t dumping = 0;
+static uint8_t dumpPage;
+static const uint8_t* dumpData;
+static uint16_t dumpPos;
+static uint16_t dumpEnd;
+static uint8_t dumpRec[HIST_FIELDS];
+static uint8_t dumpSpread[2];
+// the repeats not yet in the staging buffer
+static uint8_t dumpRun;
+
+static void __dump_open_page()
+{
+    // FLASH_HISTORY_PAGES stands for the staging buffer
+    while (dumpPage < FLASH_HISTORY_PAGES) {
+        uint8_t page = (nextPage + dumpPage) % FLASH_HISTORY_PAGES;
+        const struct PageHeader* h = __page_header(page);
+
+        if (h) {
+            dumpData = (const uint8_t*)h;
+            dumpEnd = FLASH_PAGE_SIZE;
+            break;
+        }
+        ++dumpPage;
+    }
+
+    if (dumpPage == FLASH_HISTORY_PAGES) {
+        dumpData = staging;
+        dumpEnd = stagingPos;
+        dumpRun = run;
+    }
+
+    const struct PageHeader* h = (const struct PageHeader*)dumpData;
+
+    send_string_int("H ", h->seq);
+    send_string_int(" ", h->boot);
+    send_string_int_ln(" ", h->minute);
+
+    dumpPos = sizeof(struct PageHeader);
+    memset(dumpRec, 0, sizeof(dumpRec));
+    memset(dumpSpread, 0, sizeof(dumpSpread));
+}
+
+// the next byte of the record, a truncated one reads as zeros
+static uint8_t __dump_byte()
+{
+    return (dumpPos < dumpEnd) ? dumpData[dumpPos++] : 0;
+}
+
+static void __dump_levels(uint8_t min, uint8_t spread)
+{
+    uint8_t avg = dumpRec[min + 1];
+
+    dumpRec[min] = avg - (spread >> 4);
+    dumpRec[min + 2] = avg + (spread & 0x0F);
+}
+
+static uint8_t __dump_next_page()
+{
+    if (dumpPage == FLASH_HISTORY_PAGES) {
+        if (dumpRun) {
+            send_string_int_ln("R ", dumpRun);
+            dumpRun = 0;
+            return 1;
+        }
+
+        // with the staging buffer done
+        send_string("E");
+        send_ln();
+        dumping = 0;
+        return 0;
+    }
+
+    ++dumpPage;
+    __dump_open_page();
+    return 1;
+}
+
+void history_dump_start()
+{
+    dumping = 1;
+    dumpPage = 0;
+    __dump_open_page();
+}
+
+uint8_t history_dump_update()
+{
+    if (!dumping) {
+        return 0;
+    }
+
+    // never wait for the UART, the line goes with a later call
+    if (usart_tx_free() < DUMP_LINE_MAX) {
+        return 1;
+    }
+
+    if ((dumpPos >= dumpEnd) || (dumpData[dumpPos] == TAG_END)) {
+        return __dump_next_page();
+    }
+
+    uint8_t tag = dumpData[dumpPos++];
+
+    if (tag & TAG_RUN) {
+        send_string_int_ln("R ", tag & ~TAG_RUN);
+        return 1;
+    }
+
+    if (tag & GROUP_DELTA) {
+        uint8_t b = __dump_byte();
+        // the nibbles sign extended
+        dumpRec[HIST_CHAMBER_AVG] += (int8_t)(b & 0xF0) >> 4;
+        dumpRec[HIST_AMBIENT_AVG] += (int8_t)(b << 4) >> 4;
+    }
+    if (tag & GROUP_ABSOLUTE) {
+        dumpRec[HIST_CHAMBER_AVG] = __dump_byte();
+        dumpRec[HIST_AMBIENT_AVG] = __dump_byte();
+    }
+    if (tag & GROUP_CHAMBER) {
+        dumpSpread[0] = __dump_byte();
+    }
+    if (tag & GROUP_AMBIENT) {
+        dumpSpread[1] = __dump_byte();
+    }
+    if (tag & GROUP_FAN) {
+        dumpRec[HIST_FAN_AVG] = __dump_byte();
+    }
+    __dump_levels(HIST_CHAMBER_MIN, dumpSpread[0]);
+    __dump_levels(HIST_AMBIENT_MIN, dumpSpread[1]);
+
+    send_string("M");
+    for (uint8_t i = 0; i < HIST_FIELDS; ++i) {
+        send_string_int(" ", dumpRec[i]);
+    }
+    send_ln();
+
+    return 1;
+}
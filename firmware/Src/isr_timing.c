@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "isr_timing.h"
+#include "usart.h"
+
+#ifdef ISR_TIMING
+
+struct IsrTiming isr_timings[ISR_COUNT];
+
+static const char* const names[ISR_COUNT] = {
+    "TIM3 [n, avg, max]: ",
+    "TIM4 [n, avg, max]: ",
+    "EXTI9_5 [n, avg, max]: ",
+    "DMA1_CH1 [n, avg, max]: ",
+    "USART1 [n, avg, max]: "
+};
+
+void isr_timing_report()
+{
+    for (uint8_t i = 0; i < ISR_COUNT; ++i) {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        struct IsrTiming t = isr_timings[i];
+        isr_timings[i].Count = 0;
+        isr_timings[i].Total = 0;
+        isr_timings[i].Max = 0;
+        __set_PRIMASK(primask);
+
+        uint32_t avg = t.Count ? t.Total / t.Count : 0;
+
+        LOG4(names[i], t.Count, avg, t.Max);
+    }
+}
+
+#else
+
+void isr_timing_report()
+{
+}
+
+#endif // ISR_TIMING
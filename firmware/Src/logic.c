@@ -26,24 +26,61 @@
 #include "logic.h"
 #include "vfd_driver.h"
 #include "fan_driver.h"
+#include "estimator.h"
+#include "autotune.h"
+#include "thermal_model.h"
+#include "fast_io.h"
+#include "isr_timing.h"
+#include "buttons.h"
+#include "menu.h"
+#include "vfd_text.h"
+#include "vfd_layout.h"
+#include "history.h"
+#include "stats.h"
+#include "watchdog.h"
+#include "uart_rx.h"
+#include "modbus.h"
+#include "shell.h"
+#include "crash.h"
+#include "boot.h"
+#include "trace.h"
+#include "record.h"
 
 #include "usart.h"
 #include "flash.h"
+#include "config_store.h"
+
+#include <string.h>
+#include <stddef.h>
 
 // ----------------------------------------
 // ADC light and temps
 // ----------------------------------------
 #define V_REF 3.3
 #define ADC_RES 4095
+// both channels take microseconds, anything longer is a stuck ADC/DMA
+#define ADC_CONV_TIMEOUT_MS 10
 
 static uint8_t ambient_t = 0;
 static uint8_t chamber_t = 0;
 
+// the same readings in the estimator's fixed point format
+static int32_t ambient_q = 0;
+static int32_t chamber_q = 0;
+static uint8_t estimatorReady = 0;
+
 static volatile uint8_t convCompleted = 0;
 
 static ADC_HandleTypeDef* adc_temp = NULL;
 static ADC_HandleTypeDef* adc_light = NULL;
 
+// last light reading [%], filtered in 1/256 % and the VFD level it
+// selected
+static uint8_t lightLevel = 0;
+static uint16_t lightFiltered = 0;
+static uint8_t lightFilterReady = 0;
+static uint8_t brightness = VFD_LEVELS - 1;
+
 // ----------------------------------------
 // Timer
 // ----------------------------------------
@@ -64,173 +101,509 @@ static int __timer_update(struct Timer* t, uint32_t now_ms)
     return 0;
 }
 
+static struct Timer tim6h = { .Period_ms = 6UL * 3600UL * 1000UL, .Prev_ms = 0};
 static struct Timer tim5s = { .Period_ms = 5000, .Prev_ms = 0};
+static struct Timer tim1s = { .Period_ms = 1000, .Prev_ms = 0};
 static struct Timer tim05s = { .Period_ms = 500, .Prev_ms = 0};
-static struct Timer tim5ms = { .Period_ms = 5, .Prev_ms = 0};
 
 // ----------------------------------------
 // Configuration
 // ----------------------------------------
 
+// raw configuration of older images, migrated at the first boot
 #define MAGIC_CONF_NUM1 0xfa
 #define MAGIC_CONF_NUM2 0xcd
 
 #define CONF_FAN_SLOW 0
 #define CONF_FAN_NORMAL 1
 #define CONF_FAN_FAST 2
+// available only when the PID gains are tuned
+#define CONF_FAN_PID 3
 
 #define CONF_DEFAULT_TEMP_TH 70
 
+// erased flash, older images did not store the gains
+#define CONF_PID_NOT_TUNED 0xFFFF
+
+#define CONF_MODEL_NOT_SAVED 0xFFFF
+#define CONF_MODEL_SAVED 0x0001
+
+// skip the visual part of the selfcheck, erased flash means off
+#define CONF_FAST_BOOT_ON 0x0001
+#define CONF_FAST_BOOT_OFF 0x0000
+
+// bump when the meaning of a stored field changes, 
+// a new field only needs a new tag
+#define CONF_SCHEMA_VERSION 1
+
 struct Configuration
+{
+    uint8_t fanSpeed;
+    uint8_t tempThreshold;
+    uint16_t fastBoot;
+    // PID gains found by the auto-tuner
+    uint16_t pidKp; // [%/C * 100]
+    uint16_t pidTi; // [s]
+    uint16_t pidTd; // [s]
+    // learned thermal model for the feed-forward
+    uint16_t modelSaved;
+    int32_t model[TM_PARAMS];
+};
+
+struct LegacyConfiguration
 {
     uint8_t magicNum1;
     uint8_t fanSpeed;
     uint8_t tempThreshold;
     uint8_t magicNum2;
+    uint16_t pidKp;
+    uint16_t pidTi;
+    uint16_t pidTd;
+    uint16_t modelSaved;
+    int32_t model[TM_PARAMS];
+    uint16_t fastBoot;
+};
+
+// stored tags, never reuse a tag of a removed field
+enum ConfigTag
+{
+    CONF_TAG_FAN_SPEED = 1,
+    CONF_TAG_TEMP_TH,
+    CONF_TAG_PID_KP,
+    CONF_TAG_PID_TI,
+    CONF_TAG_PID_TD,
+    CONF_TAG_MODEL_SAVED,
+    CONF_TAG_MODEL,
+    CONF_TAG_FAST_BOOT
+};
+
+#define CONF_FIELD(tag, field) \
+    { tag, sizeof(((struct Configuration*)0)->field), \
+      offsetof(struct Configuration, field) }
+
+static const struct ConfigField configSchema[] = {
+    CONF_FIELD(CONF_TAG_FAN_SPEED, fanSpeed),
+    CONF_FIELD(CONF_TAG_TEMP_TH, tempThreshold),
+    CONF_FIELD(CONF_TAG_PID_KP, pidKp),
+    CONF_FIELD(CONF_TAG_PID_TI, pidTi),
+    CONF_FIELD(CONF_TAG_PID_TD, pidTd),
+    CONF_FIELD(CONF_TAG_MODEL_SAVED, modelSaved),
+    CONF_FIELD(CONF_TAG_MODEL, model),
+    CONF_FIELD(CONF_TAG_FAST_BOOT, fastBoot)
 };
 
+#define CONF_SCHEMA_SIZE (sizeof(configSchema) / sizeof(configSchema[0]))
+
+// quiet period after the last change before it goes to Flash
+#define CONF_SAVE_DELAY_MS 5000
+
 static struct Configuration currentConfig;
-static uint8_t configChanged = 0;
+// what the newest record in Flash holds
+static struct Configuration storedConfig;
+
+// changes are kept in RAM and coalesced into a single Flash write
+static volatile uint8_t configDirty = 0;
+static uint32_t configChanged_ms;
+// set by the PVD interrupt, the main loop writes the pending change
+// without waiting for the quiet period
+static volatile uint8_t powerFailing = 0;
 
 static void __save_configuration(struct Configuration* cfg)
 {
-    HAL_StatusTypeDef s = flash_write((uint16_t *)cfg, 
-                sizeof(struct Configuration) / sizeof(uint16_t));
+    HAL_StatusTypeDef s = config_store_save(configSchema, CONF_SCHEMA_SIZE,
+                                            cfg, CONF_SCHEMA_VERSION);
 
     if (s != HAL_OK) {
         LOG2("Unable to save data to Flash: ", s);
+        vfd_text_post("Err CFG", VFD_TEXT_ERROR, 5000);
+        return;
+    }
+
+    TRACE_MARK(TRACE_MARK_CONFIG_SAVE, 0);
+    storedConfig = *cfg;
+}
+
+static void __config_changed(uint32_t now_ms)
+{
+    configDirty = 1;
+    configChanged_ms = now_ms;
+}
+
+static void __commit_configuration()
+{
+    configDirty = 0;
+
+    // an erase/program cycle stalls the CPU, skip it if nothing changed
+    if (memcmp(&storedConfig, &currentConfig, 
+               sizeof(struct Configuration)) != 0) {
+        __save_configuration(&currentConfig);
+    }
+}
+
+static void __update_configuration(uint32_t now_ms)
+{
+    if (powerFailing) {
+        // written or nothing to write, if the supply recovers the
+        // changes are coalesced again
+        powerFailing = 0;
+        if (configDirty) {
+            __commit_configuration();
+        }
+    } else if (configDirty 
+               && (now_ms - configChanged_ms >= CONF_SAVE_DELAY_MS)) {
+        __commit_configuration();
+    }
+}
+
+static uint8_t __pid_tuned(struct Configuration* cfg)
+{
+    return (cfg->pidKp != CONF_PID_NOT_TUNED) && (cfg->pidTi != 0);
+}
+
+static void __default_configuration(struct Configuration* cfg)
+{
+    memset(cfg, 0, sizeof(struct Configuration));
+    cfg->fanSpeed = CONF_FAN_FAST;
+    cfg->tempThreshold = CONF_DEFAULT_TEMP_TH;
+    cfg->pidKp = CONF_PID_NOT_TUNED;
+    cfg->pidTi = CONF_PID_NOT_TUNED;
+    cfg->pidTd = CONF_PID_NOT_TUNED;
+    cfg->modelSaved = CONF_MODEL_NOT_SAVED;
+    cfg->fastBoot = CONF_FAST_BOOT_OFF;
+}
+
+static uint8_t __load_legacy_configuration(struct Configuration* cfg)
+{
+    struct LegacyConfiguration old;
+
+    flash_read(FLASH_PAGE_ADDRESS(FLASH_EEPROM_PAGE), (uint16_t*)&old,
+               sizeof(struct LegacyConfiguration) / sizeof(uint16_t));
+
+    if ((old.magicNum1 != MAGIC_CONF_NUM1)
+        || (old.magicNum2 != MAGIC_CONF_NUM2)) {
+        return 0;
+    }
+
+    // older images stored fewer fields and the rest reads as erased
+    // Flash, only what holds a valid value is taken over
+    __default_configuration(cfg);
+
+    if (old.fanSpeed <= CONF_FAN_PID) {
+        cfg->fanSpeed = old.fanSpeed;
+    }
+    if (old.tempThreshold <= 100) {
+        cfg->tempThreshold = old.tempThreshold;
+    }
+    if ((old.pidKp != CONF_PID_NOT_TUNED) && (old.pidTi != CONF_PID_NOT_TUNED)
+        && (old.pidTd != CONF_PID_NOT_TUNED)) {
+        cfg->pidKp = old.pidKp;
+        cfg->pidTi = old.pidTi;
+        cfg->pidTd = old.pidTd;
+    }
+    if (old.modelSaved == CONF_MODEL_SAVED) {
+        cfg->modelSaved = old.modelSaved;
+        memcpy(cfg->model, old.model, sizeof(cfg->model));
     }
+    if ((old.fastBoot == CONF_FAST_BOOT_OFF) 
+        || (old.fastBoot == CONF_FAST_BOOT_ON)) {
+        cfg->fastBoot = old.fastBoot;
+    }
+
+    return 1;
 }
 
 static void __load_configuration()
 {
-    struct Configuration fromFlash;
-    
     LOG("__load_configuration");
 
-    flash_read((uint16_t*)&fromFlash, 
-                sizeof(struct Configuration) / sizeof(uint16_t));
+    __default_configuration(&currentConfig);
+    __default_configuration(&storedConfig);
 
-    // check magics
-    if ((fromFlash.magicNum1 == MAGIC_CONF_NUM1)
-        && (fromFlash.magicNum2 == MAGIC_CONF_NUM2)) {
-        // valid config
-        currentConfig = fromFlash;
+    uint16_t version = config_store_load(configSchema, CONF_SCHEMA_SIZE,
+                                         &currentConfig);
+
+    if (version == CONF_SCHEMA_VERSION) {
         LOG("Reading configuration from Flash");
+        storedConfig = currentConfig;
+    } else if (version != 0) {
+        // fields missing in the record keep their defaults
+        LOG2("Migrating configuration from schema ", version);
+        __save_configuration(&currentConfig);
+    } else if (__load_legacy_configuration(&currentConfig)) {
+        LOG("Migrating legacy configuration");
+        __save_configuration(&currentConfig);
     } else {
         // first time
-        currentConfig.magicNum1 = MAGIC_CONF_NUM1;
-        currentConfig.fanSpeed = CONF_FAN_FAST;
-        currentConfig.tempThreshold = CONF_DEFAULT_TEMP_TH;
-        currentConfig.magicNum2 = MAGIC_CONF_NUM2;
         __save_configuration(&currentConfig);
         LOG("First run - default configuration saved to Flash");
-        LOG3("Magic nums ", fromFlash.magicNum1, fromFlash.magicNum2);        
+    }
+
+    if ((currentConfig.fanSpeed == CONF_FAN_PID)
+        && !__pid_tuned(&currentConfig)) {
+        currentConfig.fanSpeed = CONF_FAN_FAST;
     }
 }
 
 // ----------------------------------------
 // User interface
 // ----------------------------------------
-enum ButtonStates
+// segments of the menu labels
+#define LABEL_F (VFD_SEG_A | VFD_SEG_E | VFD_SEG_F | VFD_SEG_G)
+#define LABEL_t (VFD_SEG_D | VFD_SEG_E | VFD_SEG_F | VFD_SEG_G)
+#define LABEL_b (VFD_SEG_C | VFD_SEG_D | VFD_SEG_E | VFD_SEG_F | VFD_SEG_G)
+#define LABEL_H (VFD_SEG_B | VFD_SEG_C | VFD_SEG_E | VFD_SEG_F | VFD_SEG_G)
+#define LABEL_d (VFD_SEG_B | VFD_SEG_C | VFD_SEG_D | VFD_SEG_E | VFD_SEG_G)
+
+// "v1-5", the macros expanded first
+#define __VER_TEXT(major, minor) "v" #major "-" #minor
+#define VER_TEXT(major, minor) __VER_TEXT(major, minor)
+
+#define MENU_TIMEOUT_MS 10000
+
+static uint16_t __fan_speed_max()
 {
-    BTN_RELEASED,
-    BTN_PRESSED
+    return __pid_tuned(&currentConfig) ? CONF_FAN_PID : CONF_FAN_FAST;
+}
+
+static const struct MenuItem menuItems[] = {
+    { .label = LABEL_F, .type = MENU_U8, .value = &currentConfig.fanSpeed,
+      .min = CONF_FAN_SLOW, .max = CONF_FAN_FAST, .step = 1,
+      .max_fn = __fan_speed_max },
+    { .label = LABEL_t, .type = MENU_U8, 
+      .value = &currentConfig.tempThreshold,
+      .min = 0, .max = 100, .step = 5, .max_fn = NULL },
+    { .label = LABEL_b, .type = MENU_U16, .value = &currentConfig.fastBoot,
+      .min = CONF_FAST_BOOT_OFF, .max = CONF_FAST_BOOT_ON, .step = 1,
+      .max_fn = NULL }
 };
 
-enum ButtonEvents
-{
-    BTN_EV_NONE,
-    BTN_EV_PRESSED,
-    BTN_EV_RELEASED
+// the menu edits the values on a working copy of MENU_MAX_ITEMS
+_Static_assert(sizeof(menuItems) / sizeof(menuItems[0]) <= MENU_MAX_ITEMS,
+               "menuItems exceeds MENU_MAX_ITEMS");
+
+static void __menu_exit(uint8_t changed);
+
+static const struct Menu mainMenu = {
+    .items = menuItems,
+    .count = sizeof(menuItems) / sizeof(menuItems[0]),
+    .timeout_ms = MENU_TIMEOUT_MS,
+    .on_exit = __menu_exit
 };
 
-struct Button
+// stats screens, SELECT on the home screen steps through them
+#define STATS_SCREEN_TIMEOUT_MS 5000
+
+struct StatsScreen
 {
-    GPIO_TypeDef* Gpio;
-    uint16_t Gpio_pin;
+    uint8_t label;
+    uint8_t dots;
+    enum StatsChannel channel;
+    enum StatsWindow window;
+};
 
-    enum ButtonStates prevState;
+// H - last hour, d - last day
+// upper dot - chamber peak [C], lower dot - mean fan power [%]
+static const struct StatsScreen statsScreens[] = {
+    { LABEL_H, VFD_DOT_H, STATS_CHAMBER, STATS_HOUR },
+    { LABEL_d, VFD_DOT_H, STATS_CHAMBER, STATS_DAY },
+    { LABEL_H, VFD_DOT_L, STATS_FAN, STATS_HOUR },
+    { LABEL_d, VFD_DOT_L, STATS_FAN, STATS_DAY }
 };
 
-static enum ButtonEvents __button_update(struct Button* btn)
+#define STATS_SCREENS (sizeof(statsScreens) / sizeof(statsScreens[0]))
+
+// 0 is the home screen
+static uint8_t statsScreen = 0;
+static uint32_t statsScreen_ms;
+
+// ----------------------------------------
+// Modbus registers
+// ----------------------------------------
+static uint16_t __mb_estimated_t()
 {
-    enum ButtonEvents ret = BTN_EV_NONE;
+    // [C * 10]
+    return (int16_t)((estimator_temp() * 10) >> EST_Q);
+}
 
-    uint8_t pressed = 
-        (GPIO_PIN_RESET == HAL_GPIO_ReadPin(btn->Gpio, btn->Gpio_pin));
+static uint16_t __mb_fan_power()
+{
+    return fan_driver_get_power();
+}
 
-    if (pressed && (btn->prevState == BTN_RELEASED)) {
-        ret = BTN_EV_PRESSED;
-    } else if (!pressed && (btn->prevState == BTN_PRESSED)) {
-        ret = BTN_EV_RELEASED;
-    }
+#define MB_INPUT_U8(n, v) { .name = n, .type = MB_U8, .value = &(v) }
+#define MB_INPUT_FN(n, fn) { .name = n, .type = MB_FN, .read_fn = fn }
 
-    if (ret != BTN_EV_NONE) {
-        btn->prevState = pressed ? BTN_PRESSED : BTN_RELEASED;
-    }
+static const struct ModbusRegister modbusInput[] = {
+    MB_INPUT_U8("ambient", ambient_t),          // 0 [C]
+    MB_INPUT_U8("chamber", chamber_t),          // 1 [C]
+    MB_INPUT_FN("estimated", __mb_estimated_t), // 2 [C * 10]
+    MB_INPUT_FN("fan", __mb_fan_power),         // 3 [%]
+    MB_INPUT_U8("light", lightLevel),           // 4 [%]
+    MB_INPUT_U8("brightness", brightness)       // 5 VFD level, 0-31
+};
 
-    return ret;
-}
+#define MB_HOLDING(n, t, v, lo, hi) \
+    { .name = n, .type = t, .value = &(v), .writable = 1, \
+      .min = lo, .max = hi }
+#define MB_HOLDING_RO(n, t, v) { .name = n, .type = t, .value = &(v) }
+
+// every field of struct Configuration, written the same way as 
+// from the menu, the save is deferred
+static const struct ModbusRegister modbusHolding[] = {
+    // 0
+    { .name = "fan_speed", .type = MB_U8, .value = &currentConfig.fanSpeed,
+      .writable = 1, .min = CONF_FAN_SLOW, .max = CONF_FAN_FAST, 
+      .max_fn = __fan_speed_max },
+    MB_HOLDING("threshold", MB_U8, currentConfig.tempThreshold, 0, 100),
+    MB_HOLDING("fast_boot", MB_U16, currentConfig.fastBoot, 
+               CONF_FAST_BOOT_OFF, CONF_FAST_BOOT_ON),
+    // 3, 0xFFFF - not tuned, Ti is a divisor
+    MB_HOLDING("pid_kp", MB_U16, currentConfig.pidKp, 0, 0xFFFF),
+    MB_HOLDING("pid_ti", MB_U16, currentConfig.pidTi, 1, 0xFFFF),
+    MB_HOLDING("pid_td", MB_U16, currentConfig.pidTd, 0, 0xFFFF),
+    // 6, the model is learned, read only
+    MB_HOLDING_RO("model_saved", MB_U16, currentConfig.modelSaved),
+    MB_HOLDING_RO("model_q_hi", MB_S32_HI, currentConfig.model[0]),
+    MB_HOLDING_RO("model_q_lo", MB_S32_LO, currentConfig.model[0]),
+    MB_HOLDING_RO("model_k0_hi", MB_S32_HI, currentConfig.model[1]),
+    MB_HOLDING_RO("model_k0_lo", MB_S32_LO, currentConfig.model[1]),
+    MB_HOLDING_RO("model_kf_hi", MB_S32_HI, currentConfig.model[2]),
+    MB_HOLDING_RO("model_kf_lo", MB_S32_LO, currentConfig.model[2])
+};
 
-static struct Button Btn1 = { 
-    .Gpio = MODE_GPIO_Port, 
-    .Gpio_pin = MODE_Pin,
-    .prevState = BTN_RELEASED
+static void __modbus_write(uint32_t now_ms);
+static void __record_config();
+static void __init_shell();
+
+static const struct ModbusMap modbusMap = {
+    .input = modbusInput,
+    .inputCount = sizeof(modbusInput) / sizeof(modbusInput[0]),
+    .holding = modbusHolding,
+    .holdingCount = sizeof(modbusHolding) / sizeof(modbusHolding[0]),
+    .on_write = __modbus_write
 };
 
-static struct Button Btn2 = { 
-    .Gpio = SELECT_GPIO_Port, 
-    .Gpio_pin = SELECT_Pin,
-    .prevState = BTN_RELEASED
+// ----------------------------------------
+// Selfcheck
+// ----------------------------------------
+enum SelfcheckStep
+{
+    SC_IDLE,
+    SC_ALL_ON,
+    SC_ALL_OFF,
+    SC_VERSION,
+    SC_VERSION_OFF,
+    SC_BRIGHTNESS,
+    SC_FAN_FULL,
+    SC_FAN_SWEEP,
+    SC_SENSORS,
+    SC_FINISHED
 };
 
+static enum SelfcheckStep selfcheckStep = SC_IDLE;
+static uint32_t selfcheckSince_ms;
+static uint32_t selfcheckWait_ms;
+static uint8_t selfcheckCounter;
+
+static uint8_t __selfcheck_owns_display()
+{
+    return selfcheckStep != SC_IDLE;
+}
+
+static uint8_t __selfcheck_owns_fan()
+{
+    return (selfcheckStep == SC_FAN_SWEEP) || (selfcheckStep == SC_SENSORS);
+}
+
 // ----------------------------------------
 // Display logic
 // ----------------------------------------
 
-static uint8_t tempToogle = 0;
+static struct VfdLayout tempLayout;
 
-static void __display_temp(uint8_t t1, uint8_t t2)
+static void __display_temp()
 {
-    vfd_driver_clear();
-    
-    if ((t1 < 100) && (t2 < 100)) {
-        vfd_driver_print_left(t1);
+    // ambient on the left, the chamber alone if they do not both fit
+    vfd_layout_render(&tempLayout, ambient_q, chamber_q, EST_Q);
+}
+
+static void __display_stats()
+{
+    const struct StatsScreen* scr = &statsScreens[statsScreen - 1];
+    struct StatsSummary sum;
+
+    stats_summary(scr->channel, scr->window, &sum);
+
+    int16_t v = (scr->channel == STATS_CHAMBER) ? sum.max : sum.mean;
+    v = (v + 5) / 10;
+
+    vfd_driver_print_labeled(scr->label, (v < 0) ? 0 : (v > 0xFF) ? 0xFF : v);
+    vfd_driver_light_dots(scr->dots);
+}
+
+static void __display(uint8_t t1, uint8_t t2)
+{
+    if (__selfcheck_owns_display() || menu_active() || vfd_text_active()) {
+        return;
+    }
+
+    if (statsScreen) {
+        __display_stats();
+    } else if (autotune_state() == AUTOTUNE_RUNNING) {
+        // tuning progress, dots mark the auto-tune mode
+        vfd_driver_clear();
+        vfd_driver_print_left(autotune_progress());
         vfd_driver_print_right(t2);
+        vfd_driver_light_dots(VFD_DOT_H | VFD_DOT_L);
     } else {
-        // toogle mode
-        uint8_t t = (tempToogle) ? t1 : t2;
-        tempToogle ^= 0x01;
-
-        if (t >= 100) {
-            // we assume that the temp is 1xy celcius deg
-            // so print 1
-            vfd_driver_light_cust(1, VFD_SEG_B | VFD_SEG_C);
-            vfd_driver_print_right(t - 100);
-        } else {
-            vfd_driver_print_right(t);
-        }
+        __display_temp();
     }
 }
 
-static void __display(uint8_t t1, uint8_t t2)
+// light in 1/256 %
+static uint8_t __light_to_level(int32_t light)
 {
-    if (!configChanged) {
-        __display_temp(t1, t2);
-    } else {
-        vfd_driver_print_left(currentConfig.fanSpeed);
-        vfd_driver_print_right(currentConfig.tempThreshold);
+    const int32_t full = BRIGHTNESS_LIGHT_FULL << 8;
+    const int32_t min = BRIGHTNESS_LIGHT_MIN << 8;
+
+    if (light <= full) {
+        return VFD_LEVELS - 1;
     }
+    if (light >= min) {
+        return 0;
+    }
+    return (VFD_LEVELS - 1) * (min - light) / (min - full);
 }
 
-static void __adjust_brightness(uint8_t level) {
-    if (level < BRIGHTNESS_LEV_0) {
-        vfd_driver_set_brightness(VFD_BRID_MAX);
-    } else if (level < BRIGHTNESS_LEV_1) {
-        vfd_driver_set_brightness(VFD_BRID_50);
-    } else if (level < BRIGHTNESS_LEV_2) {
-        vfd_driver_set_brightness(VFD_BRID_25);
+static void __adjust_brightness(uint8_t light)
+{
+    uint16_t sample = (uint16_t)light << 8;
+
+    if (!lightFilterReady) {
+        lightFiltered = sample;
+        lightFilterReady = 1;
+    } else {
+        lightFiltered += ((int32_t)sample - lightFiltered) 
+            >> BRIGHTNESS_EMA_SHIFT;
+    }
+
+    // a change has to hold for the whole dead band, brighter for the
+    // darker edge and the other way round
+    const int32_t hyst = BRIGHTNESS_HYST << 8;
+    uint8_t up = __light_to_level((int32_t)lightFiltered + hyst);
+    uint8_t down = __light_to_level((int32_t)lightFiltered - hyst);
+
+    if (up > brightness) {
+        brightness = up;
+    } else if (down < brightness) {
+        brightness = down;
+    } else {
+        return;
+    }
+
+    // the selfcheck steps through the levels on its own
+    if (selfcheckStep != SC_BRIGHTNESS) {
+        vfd_driver_fade_to(brightness);
     }
 }
 
@@ -251,6 +624,23 @@ void logic_init(ADC_HandleTypeDef* adc_temp_,
     HAL_ADC_Start(adc_light);
 
     __load_configuration();
+
+    buttons_init();
+    vfd_layout_init(&tempLayout);
+    menu_init(&mainMenu);
+    modbus_init(&modbusMap);
+    __init_shell();
+    history_init();
+    stats_init();
+
+    thermal_model_init((currentConfig.modelSaved == CONF_MODEL_SAVED)
+        ? currentConfig.model : NULL);
+
+    // from the first reading on, a replay starts where the MCU did
+    if (record_boot_requested()) {
+        record_start();
+        __record_config();
+    }
 }
 
 static uint8_t __conv_temp(uint16_t adc)
@@ -261,101 +651,224 @@ static uint8_t __conv_temp(uint16_t adc)
     return t;
 }
 
-static void __get_temp_lm35()
+static int32_t __conv_temp_q(uint16_t adc)
+{
+    return (int32_t)(((int64_t)adc * (int64_t)(100 * V_REF * EST_ONE)) 
+        / ADC_RES);
+}
+
+// returns 0 if the conversion did not complete, the readings are kept
+static uint8_t __get_temp_lm35()
 {
     uint16_t rawValues[2];
     rawValues[0] = 0;
     rawValues[1] = 0;
     convCompleted = 0;
     HAL_ADC_Start_DMA(adc_temp, (uint32_t*)rawValues, 2);
-    while (!convCompleted);
+
+    uint32_t start_ms = HAL_GetTick();
+    while (!convCompleted) {
+        if (HAL_GetTick() - start_ms > ADC_CONV_TIMEOUT_MS) {
+            HAL_ADC_Stop_DMA(adc_temp);
+            LOG("ADC conversion timeout");
+            return 0;
+        }
+    }
     HAL_Delay(1);
     HAL_ADC_Stop_DMA(adc_temp);
 
     uint16_t adc_t1 = rawValues[0];
     ambient_t = __conv_temp(adc_t1);
+    ambient_q = __conv_temp_q(adc_t1);
 
     uint16_t adc_t2 = rawValues[1];
     chamber_t = __conv_temp(adc_t2);
+    chamber_q = __conv_temp_q(adc_t2);
+
+    record_temps(adc_t1, adc_t2);
+
+    return 1;
 }
 
-static uint8_t __get_light()
+static void __estimate_temp(uint32_t dt_ms)
 {
-    HAL_StatusTypeDef r = HAL_ADC_PollForConversion(adc_light, 200);
+    if (!estimatorReady) {
+        estimator_init(chamber_q);
+        estimatorReady = 1;
+        return;
+    }
+
+    estimator_predict(fan_driver_get_power(), ambient_q, dt_ms);
+    estimator_update(chamber_q);
+}
+
+static uint8_t __estimated_temp()
+{
+    int32_t t = EST_TO_INT(estimator_temp());
 
-    if (r == HAL_ERROR) {
+    if (t < 0) {
         return 0;
-    } else if (r == HAL_TIMEOUT) {
-        return 1;
+    } else if (t > 0xFF) {
+        return 0xFF;
     }
 
-    uint16_t adc_l = HAL_ADC_GetValue(adc_light);
+    return t;
+}
+
+static uint8_t __get_light()
+{
+    uint16_t adc_l = fast_adc_value(adc_light);
+    record_light(adc_l);
     return 100 * ((float)adc_l) / ADC_RES;
 }
 
-void logic_init_selfcheck()
+// ----------------------------------------
+// PID & auto-tuning
+// ----------------------------------------
+static int32_t pidIntegral = 0;
+
+static uint8_t __feed_forward()
 {
-    LOG("Selfcheck");
-    fan_driver_set_power(0);
-    // print all
-    LOG("Print all");
-    vfd_driver_light_cust(0, 0xFF);
-    vfd_driver_light_cust(1, 0xFF);
-    vfd_driver_light_cust(2, 0xFF);
-    vfd_driver_light_cust(3, 0xFF);
-    vfd_driver_light_dots(0xf);
-    HAL_Delay(2000);
-
-    vfd_driver_clear();
-    HAL_Delay(200);
-
-    // print version
-    LOG("Version");
-    vfd_driver_print_left(VER_MAJOR);
-    vfd_driver_print_right(VER_MINOR);
-    HAL_Delay(2000);
-
-    vfd_driver_clear();
-    HAL_Delay(200);
-    LOG("Brightness");
-    // test brightness
-    for (uint8_t i = VFD_BRID_MIN; i <= VFD_BRID_MAX; ++i) {        
-        vfd_driver_set_brightness(i);
-        vfd_driver_light_cust(0, VFD_SEG_G);
-        vfd_driver_light_cust(1, VFD_SEG_G);
-        vfd_driver_print_right(__get_light());
-        HAL_Delay(1000);
-        vfd_driver_clear();
+    return thermal_model_feed_forward(
+        EST_FROM_INT(currentConfig.tempThreshold), ambient_q);
+}
+
+static void __save_thermal_model()
+{
+    const int32_t* params = thermal_model_params();
+    uint8_t changed = (currentConfig.modelSaved != CONF_MODEL_SAVED);
+
+    if (!thermal_model_valid()) {
+        return;
     }
-    vfd_driver_set_brightness(VFD_BRID_MAX);
-    // test motor driver
-    LOG("Motor driver");
-    fan_driver_set_power(100);
-    HAL_Delay(1000);
-
-    for (uint8_t i = 100;; i -= 5) {
-        fan_driver_set_power(i);
-        vfd_driver_print_left(i);
-        HAL_Delay(50);
-        if (i == 0) {
-            break;
-        }
+
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        changed |= (currentConfig.model[i] != params[i]);
+        currentConfig.model[i] = params[i];
+    }
+
+    if (changed) {
+        LOG4("Thermal model [q, k0, kf]: ", params[0], params[1], params[2]);
+        currentConfig.modelSaved = CONF_MODEL_SAVED;
+        __config_changed(HAL_GetTick());
+    }
+}
+
+// bias is the feed-forward power [%]
+static uint8_t __pid_fan_power(uint32_t dt_ms, uint8_t bias)
+{
+    int32_t e = estimator_temp() - EST_FROM_INT(currentConfig.tempThreshold);
+    int32_t dI = (int32_t)(((int64_t)e * dt_ms) / 1000);
+
+    // ideal form: Kp * (e + 1/Ti * integral(e) + Td * de/dt)
+    int32_t u = e 
+        + (pidIntegral + dI) / currentConfig.pidTi
+        + estimator_rate() * currentConfig.pidTd;
+    int32_t power = bias + (int32_t)(((int64_t)u * currentConfig.pidKp / 100)
+        >> EST_Q);
+
+    // conditional integration as anti-windup
+    if ((power > 100 && dI > 0) || (power < 0 && dI < 0)) {
+        dI = 0;
+    }
+    pidIntegral += dI;
+
+    if (power > 100) {
+        return 100;
+    } else if (power < 0) {
+        return 0;
     }
-    // test temperature sensors
-    LOG("Temp sensors");
-    vfd_driver_clear();
-    __get_temp_lm35();
-    vfd_driver_print_left(ambient_t);
-    vfd_driver_print_right(chamber_t);
-    HAL_Delay(2000);
 
-    LOG("Selftests finished");
+    return power;
+}
+
+static void __start_autotune(uint32_t now_ms)
+{
+    LOG2("Auto-tune started, setpoint ", currentConfig.tempThreshold);
+    autotune_start(currentConfig.tempThreshold, now_ms);
+    __display(ambient_t, chamber_t);
+}
+
+static void __stop_autotune()
+{
+    LOG("Auto-tune aborted");
+    autotune_abort();
+    __display(ambient_t, chamber_t);
+}
+
+static void __update_autotune(uint32_t now_ms)
+{
+    uint8_t power;
+    enum AutotuneState st = autotune_update(estimator_temp(), now_ms, &power);
+
+    fan_driver_set_power(power);
+
+    if (st == AUTOTUNE_DONE) {
+        const struct AutotuneResult* r = autotune_result();
+        LOG3("Auto-tune [Ku*100, Tu]: ", r->ku, r->tu);
+        LOG4("Auto-tune [Kp*100, Ti, Td]: ", r->kp, r->ti, r->td);
+
+        currentConfig.pidKp = r->kp;
+        currentConfig.pidTi = r->ti;
+        currentConfig.pidTd = r->td;
+        currentConfig.fanSpeed = CONF_FAN_PID;
+        pidIntegral = 0;
+        __config_changed(now_ms);
+        __display(ambient_t, chamber_t);
+    } else if (st == AUTOTUNE_FAILED) {
+        LOG("Auto-tune failed");
+        __display(ambient_t, chamber_t);
+    }
+}
+
+static void __menu_exit(uint8_t changed)
+{
+    if (changed) {
+        LOG3("Config [fan, th]: ", currentConfig.fanSpeed, 
+             currentConfig.tempThreshold);
+        pidIntegral = 0;
+        __commit_configuration();
+    }
+    __display(ambient_t, chamber_t);
+}
+
+// one "SEt" per period at most, a master writing all the time still
+// leaves the readings on the display most of it
+#define SET_NOTICE_PERIOD_MS 5000
+
+static uint8_t setNoticed = 0;
+static uint32_t setNotice_ms;
+
+static void __modbus_write(uint32_t now_ms)
+{
+    // clearing the gains leaves nothing to run the PID with
+    if ((currentConfig.fanSpeed == CONF_FAN_PID)
+        && !__pid_tuned(&currentConfig)) {
+        currentConfig.fanSpeed = CONF_FAN_FAST;
+    }
+    pidIntegral = 0;
+    __config_changed(now_ms);
+
+    // an input from the outside like the sensors
+    __record_config();
+
+    if (!setNoticed || (now_ms - setNotice_ms >= SET_NOTICE_PERIOD_MS)) {
+        vfd_text_post("SEt", VFD_TEXT_NOTICE, 1000);
+        setNoticed = 1;
+        setNotice_ms = now_ms;
+    }
 }
 
 static void __adjust_fan_speed(uint8_t chamber_t)
 {
     uint8_t t1 = currentConfig.tempThreshold;
     uint8_t t2 = currentConfig.tempThreshold + TEMP_DELTA_MAX;
+
+    if (currentConfig.fanSpeed == CONF_FAN_PID) {
+        fan_driver_set_power(__pid_fan_power(tim5s.Period_ms, 
+                                             __feed_forward()));
+        return;
+    }
     
     if (chamber_t < t1) {
         return;
@@ -375,26 +888,490 @@ static void __adjust_fan_speed(uint8_t chamber_t)
     float t = (chamber_t - t1) / (t2 - t1);
     if (t > 1) t = 1.0; 
 
-    fan_driver_set_power(FAN_MIN + t * (FAN_MAX - FAN_MIN));
+    uint8_t power = FAN_MIN + t * (FAN_MAX - FAN_MIN);
+    uint8_t ff = __feed_forward();
+
+    fan_driver_set_power((ff > power) ? ff : power);
+}
+
+// ----------------------------------------
+// Selfcheck steps, each one is executed once its predecessor's wait
+// time elapsed, nothing blocks the main loop
+// ----------------------------------------
+static void __selfcheck_next(enum SelfcheckStep next, uint32_t wait_ms)
+{
+    selfcheckStep = next;
+    selfcheckWait_ms = wait_ms;
+}
+
+static void __selfcheck_update(uint32_t now_ms)
+{
+    if ((selfcheckStep == SC_IDLE)
+        || (now_ms - selfcheckSince_ms < selfcheckWait_ms)) {
+        return;
+    }
+
+    selfcheckSince_ms = now_ms;
+
+    switch (selfcheckStep) {
+    case SC_IDLE:
+        break;
+    case SC_ALL_ON:
+        LOG("Print all");
+        vfd_driver_light_cust(0, 0xFF);
+        vfd_driver_light_cust(1, 0xFF);
+        vfd_driver_light_cust(2, 0xFF);
+        vfd_driver_light_cust(3, 0xFF);
+        vfd_driver_light_dots(0xf);
+        __selfcheck_next(SC_ALL_OFF, 2000);
+        break;
+    case SC_ALL_OFF:
+    case SC_VERSION_OFF:
+        vfd_driver_clear();
+        __selfcheck_next(selfcheckStep + 1, 200);
+        selfcheckCounter = VFD_BRID_MIN;
+        break;
+    case SC_VERSION:
+        LOG("Version");
+        vfd_text_show(VER_TEXT(VER_MAJOR, VER_MINOR));
+        __selfcheck_next(SC_VERSION_OFF, 2000);
+        break;
+    case SC_BRIGHTNESS:
+        if (selfcheckCounter == VFD_BRID_MIN) {
+            LOG("Brightness");
+        }
+        if (selfcheckCounter > VFD_BRID_MAX) {
+            vfd_driver_clear();
+            vfd_driver_set_level(brightness);
+            __selfcheck_next(SC_FAN_FULL, 0);
+            break;
+        }
+        vfd_driver_clear();
+        vfd_driver_set_brightness(selfcheckCounter);
+        vfd_driver_light_cust(0, VFD_SEG_G);
+        vfd_driver_light_cust(1, VFD_SEG_G);
+        vfd_driver_print_right(__get_light());
+        ++selfcheckCounter;
+        __selfcheck_next(SC_BRIGHTNESS, 1000);
+        break;
+    case SC_FAN_FULL:
+        LOG("Motor driver");
+        fan_driver_set_power(100);
+        selfcheckCounter = 100;
+        __selfcheck_next(SC_FAN_SWEEP, 1000);
+        break;
+    case SC_FAN_SWEEP:
+        fan_driver_set_power(selfcheckCounter);
+        vfd_driver_print_left(selfcheckCounter);
+        if (selfcheckCounter == 0) {
+            __selfcheck_next(SC_SENSORS, 50);
+        } else {
+            selfcheckCounter -= 5;
+            __selfcheck_next(SC_FAN_SWEEP, 50);
+        }
+        break;
+    case SC_SENSORS:
+        LOG("Temp sensors");
+        vfd_driver_clear();
+        vfd_driver_print_left(ambient_t);
+        vfd_driver_print_right(chamber_t);
+        // the fan is back under control
+        __adjust_fan_speed(__estimated_temp());
+        __selfcheck_next(SC_FINISHED, 2000);
+        break;
+    case SC_FINISHED:
+        LOG("Selftests finished");
+        selfcheckStep = SC_IDLE;
+        __display(ambient_t, chamber_t);
+        break;
+    }
+}
+
+static void __handle_buttons(enum ButtonEvent mode, 
+                             enum ButtonEvent select, uint32_t now_ms)
+{
+    uint8_t tuning = (autotune_state() == AUTOTUNE_RUNNING);
+
+    if (tuning && (mode == BTN_EV_CLICK || mode == BTN_EV_LONG_PRESS)) {
+        __stop_autotune();
+    } else if (!menu_event(BTN_MODE, mode, now_ms)
+               && (mode == BTN_EV_LONG_PRESS)) {
+        __start_autotune(now_ms);
+    }
+
+    if (menu_active()) {
+        statsScreen = 0;
+    }
+
+    if (menu_event(BTN_SELECT, select, now_ms)) {
+        // consumed by the menu
+    } else if (select == BTN_EV_LONG_PRESS) {
+        LOG("History dump");
+        history_dump_start();
+    } else if (select == BTN_EV_CLICK) {
+        statsScreen = (statsScreen + 1) % (STATS_SCREENS + 1);
+        statsScreen_ms = now_ms;
+        __display(ambient_t, chamber_t);
+    }
+}
+
+// ----------------------------------------
+// Shell commands, the registers are the Modbus ones
+// ----------------------------------------
+#define MB_COUNT(regs) (sizeof(regs) / sizeof(regs[0]))
+
+static const struct ModbusRegister* __find_register(
+    const struct ShellToken* name, const struct ModbusRegister* regs,
+    uint16_t count)
+{
+    for (uint16_t i = 0; i < count; ++i) {
+        if (shell_token_cmp(name, regs[i].name) == 0) {
+            return &regs[i];
+        }
+    }
+    return NULL;
+}
+
+static void __print_register(const struct ModbusRegister* r)
+{
+    send_string(r->name);
+    send_string_int_ln(" = ", modbus_register_read(r));
+}
+
+static void __print_registers(const struct ModbusRegister* regs, 
+                              uint16_t count)
+{
+    for (uint16_t i = 0; i < count; ++i) {
+        __print_register(&regs[i]);
+    }
+}
+
+static void __record_config()
+{
+    uint16_t values[MB_COUNT(modbusHolding)];
+
+    for (uint8_t i = 0; i < MB_COUNT(modbusHolding); ++i) {
+        values[i] = modbus_register_read(&modbusHolding[i]);
+    }
+    record_config(values, MB_COUNT(modbusHolding));
+}
+
+static void __cmd_config(const struct ShellArgs* args)
+{
+    __print_registers(modbusHolding, MB_COUNT(modbusHolding));
+}
+
+static void __cmd_crash(const struct ShellArgs* args)
+{
+    crash_log_dump();
+}
+
+static void __cmd_get(const struct ShellArgs* args)
+{
+    if (args->count != 2) {
+        LOG("Usage: get <name>");
+        return;
+    }
+
+    const struct ModbusRegister* r = __find_register(&args->tokens[1],
+        modbusHolding, MB_COUNT(modbusHolding));
+    if (!r) {
+        r = __find_register(&args->tokens[1], 
+                            modbusInput, MB_COUNT(modbusInput));
+    }
+
+    if (!r) {
+        LOG("Unknown name, see config and status");
+        return;
+    }
+
+    __print_register(r);
+}
+
+static void __cmd_help(const struct ShellArgs* args)
+{
+    shell_help();
+}
+
+static void __cmd_history(const struct ShellArgs* args)
+{
+    LOG("History dump");
+    history_dump_start();
+}
+
+static void __cmd_isr(const struct ShellArgs* args)
+{
+#ifdef ISR_TIMING
+    isr_timing_report();
+#else
+    LOG("ISR timing is built with BENCH=1");
+#endif
+}
+
+static void __cmd_record(const struct ShellArgs* args)
+{
+    if ((args->count == 2) && !shell_token_cmp(&args->tokens[1], "on")) {
+        record_start();
+        __record_config();
+    } else if ((args->count == 2) 
+               && !shell_token_cmp(&args->tokens[1], "off")) {
+        record_stop();
+    } else if ((args->count == 2) 
+               && !shell_token_cmp(&args->tokens[1], "boot")) {
+        // the replay loads the configuration the MCU boots with
+        if (configDirty) {
+            __commit_configuration();
+        }
+
+        LOG("Recording from the next boot on");
+        usart_flush();
+        record_boot_request();
+        NVIC_SystemReset();
+    } else {
+        LOG("Usage: record on|off|boot");
+    }
+}
+
+static void __cmd_selftest(const struct ShellArgs* args)
+{
+    if (__selfcheck_owns_display()) {
+        LOG("Selfcheck already running");
+    } else if (autotune_state() == AUTOTUNE_RUNNING) {
+        LOG("Auto-tune running, the fan is taken");
+    } else {
+        logic_init_selfcheck();
+    }
+}
+
+static void __cmd_set(const struct ShellArgs* args)
+{
+    uint32_t v;
+
+    if (args->count != 3) {
+        LOG("Usage: set <name> <value>");
+        return;
+    }
+
+    const struct ModbusRegister* r = __find_register(&args->tokens[1],
+        modbusHolding, MB_COUNT(modbusHolding));
+
+    if (!r) {
+        LOG("Unknown name, see config");
+        return;
+    }
+
+    if (!shell_token_uint(&args->tokens[2], &v) || v > 0xFFFF) {
+        LOG("Not a number");
+        return;
+    }
+
+    switch (modbus_register_write(r, v)) {
+    case 0:
+        __modbus_write(HAL_GetTick());
+        __print_register(r);
+        break;
+    case EX_ILLEGAL_ADDRESS:
+        LOG("Read only");
+        break;
+    default:
+        LOG("Out of range");
+        break;
+    }
+}
+
+static void __cmd_stats(const struct ShellArgs* args)
+{
+    stats_report();
+}
+
+static void __cmd_status(const struct ShellArgs* args)
+{
+    __print_registers(modbusInput, MB_COUNT(modbusInput));
+}
+
+static void __cmd_trace(const struct ShellArgs* args)
+{
+    // enum TraceTrigger
+    static const char* const triggers[TRACE_TRIG_COUNT] = { 
+        "fan", "flash", "zc" 
+    };
+
+    if (args->count == 1) {
+        trace_dump_start();
+        return;
+    }
+
+    if (args->count == 2) {
+        if (!shell_token_cmp(&args->tokens[1], "all")) {
+            trace_arm(TRACE_TRIG_ALL);
+            return;
+        }
+        if (!shell_token_cmp(&args->tokens[1], "off")) {
+            trace_arm(0);
+            return;
+        }
+        for (uint8_t i = 0; i < TRACE_TRIG_COUNT; ++i) {
+            if (!shell_token_cmp(&args->tokens[1], triggers[i])) {
+                trace_arm(1 << i);
+                return;
+            }
+        }
+    }
+
+    LOG("Usage: trace [fan|flash|zc|all|off]");
+}
+
+static void __cmd_update(const struct ShellArgs* args)
+{
+    // a pending change would be lost with the reset
+    if (configDirty) {
+        __commit_configuration();
+    }
+
+    LOG("Entering the bootloader");
+    usart_flush();
+    boot_request_update();
+}
+
+// sorted by name
+static const struct ShellCommand shellCommands[] = {
+    { "config", "configuration", __cmd_config },
+    { "crash", "crash log", __cmd_crash },
+    { "get", "get <name>", __cmd_get },
+    { "help", "this list", __cmd_help },
+    { "history", "temperature history dump", __cmd_history },
+    { "isr", "ISR timings", __cmd_isr },
+    { "record", "record on|off|boot, inputs and outputs to UART", 
+      __cmd_record },
+    { "selftest", "run the selfcheck", __cmd_selftest },
+    { "set", "set <name> <value>, saved after 5 s", __cmd_set },
+    { "stats", "last hour and day statistics", __cmd_stats },
+    { "status", "readings", __cmd_status },
+    { "trace", "trace [trigger], event trace dump, build with TRACE=1", 
+      __cmd_trace },
+    { "update", "reset into the bootloader", __cmd_update }
+};
+
+static void __init_shell()
+{
+    shell_init(shellCommands,
+               sizeof(shellCommands) / sizeof(shellCommands[0]));
+}
+
+// the frames handled
+static uint8_t __handle_uart(uint32_t now_ms)
+{
+    struct UartFrame f;
+    uint8_t frames = 0;
+
+    while (uart_rx_frame(&f)) {
+        if (!modbus_frame(&f, now_ms)) {
+            shell_frame(&f);
+        }
+        ++frames;
+    }
+
+    return frames;
+}
+
+static void __update_stats(uint32_t now_ms)
+{
+    stats_sample(STATS_CHAMBER, 
+                 (int16_t)((estimator_temp() * 10) >> EST_Q), now_ms);
+    stats_sample(STATS_FAN, fan_driver_get_power() * 10, now_ms);
+
+    if (statsScreen && (now_ms - statsScreen_ms >= STATS_SCREEN_TIMEOUT_MS)) {
+        statsScreen = 0;
+    }
+}
+
+void logic_init_selfcheck()
+{
+    LOG("Selfcheck");
+
+    selfcheckSince_ms = HAL_GetTick();
+    selfcheckWait_ms = 0;
+
+    if (currentConfig.fastBoot == CONF_FAST_BOOT_ON) {
+        // skip the visual part
+        LOG("Fast boot");
+        selfcheckStep = SC_FAN_FULL;
+    } else {
+        selfcheckStep = SC_ALL_ON;
+    }
 }
 
 void logic_update()
 {
     uint32_t now_ms = HAL_GetTick();
 
+    // the supply is going down, the pending change goes first, then
+    // the minutes staged for the history
+    if (powerFailing) {
+        __update_configuration(now_ms);
+        history_flush();
+    }
+
+    __selfcheck_update(now_ms);
+
+    // every second
+    if (__timer_update(&tim1s, now_ms)) {
+        TRACE_BEGIN(TRACE_SAMPLING);
+
+        // no check-in without readings, a dead ADC ends in the IWDG
+        // reset with the acquisition reported
+        if (__get_temp_lm35()) {
+            watchdog_checkin(WDG_ACQUISITION);
+        }
+
+        __estimate_temp(tim1s.Period_ms);
+
+        lightLevel = __get_light();
+        __adjust_brightness(lightLevel);
+
+        history_sample(chamber_t, ambient_t, fan_driver_get_power());
+
+        if (autotune_state() == AUTOTUNE_RUNNING) {
+            __update_autotune(now_ms);
+        }
+
+        TRACE_END(TRACE_SAMPLING);
+    }
+
     // every 5 seconds
     if (__timer_update(&tim5s, now_ms)) {
-        __get_temp_lm35();
+        TRACE_BEGIN(TRACE_CONTROL);
 
-        __display(ambient_t, chamber_t);
+        if (estimatorReady) {
+            __update_stats(now_ms);
+        }
 
-        uint8_t l = __get_light();
+        __display(ambient_t, chamber_t);
 
-        __adjust_brightness(l);
+        uint8_t l = lightLevel;
+        uint8_t est_t = __estimated_temp();
 
         LOG4("Readings [t1, t2, l]: ", ambient_t, chamber_t, l);
+        LOG2("Estimated t2: ", est_t);
+        isr_timing_report();
+
+        if (estimatorReady) {
+            thermal_model_update(estimator_temp(), estimator_rate(),
+                                 ambient_q, fan_driver_get_power());
+        }
 
-        __adjust_fan_speed(chamber_t);
+        if ((autotune_state() != AUTOTUNE_RUNNING)
+            && !__selfcheck_owns_fan()) {
+            __adjust_fan_speed(est_t);
+        }
+
+        watchdog_checkin(WDG_CONTROL);
+        TRACE_END(TRACE_CONTROL);
+    }
+
+    // every 6 hours
+    if (__timer_update(&tim6h, now_ms)) {
+        __save_thermal_model();
     }
 
     // every 0.5 second
@@ -402,44 +1379,64 @@ void logic_update()
         HAL_GPIO_TogglePin(LED_GPIO_Port, LED_Pin);
     }
 
-    // every 5 ms
-    if (__timer_update(&tim5ms, now_ms)) {
+    TRACE_SPAN_START(uiStart);
 
-        enum ButtonEvents ev = __button_update(&Btn1);
+    // buttons, dropped while the selfcheck owns the display
+    enum ButtonEvent mode = buttons_get_event(BTN_MODE);
+    enum ButtonEvent select = buttons_get_event(BTN_SELECT);
 
-        if (ev == BTN_EV_RELEASED) {
-            configChanged = 1;
-            ++currentConfig.fanSpeed;
-            if (currentConfig.fanSpeed > CONF_FAN_FAST) {
-                currentConfig.fanSpeed = CONF_FAN_SLOW;
-            }
-        }
+    if ((mode != BTN_EV_NONE) || (select != BTN_EV_NONE)) {
+        record_buttons(mode, select);
+    }
 
-        ev = __button_update(&Btn2);
+    if (!__selfcheck_owns_display()) {
+        __handle_buttons(mode, select, now_ms);
+    }
 
-        if (ev == BTN_EV_RELEASED) {
-            configChanged = 1;
-            currentConfig.tempThreshold += 5;
-            if (currentConfig.tempThreshold > 100) {
-                currentConfig.tempThreshold = 0;
-            }
-        }
+    menu_update(now_ms);
 
-        if (configChanged) {
-            __display(0, 0);
-            __save_configuration(&currentConfig);
-            configChanged = 0;
-        }
+    // messages stay on top of the readings, the display is redrawn
+    // once the last one is gone
+    uint8_t redraw = vfd_text_update(now_ms, 
+        __selfcheck_owns_display() || menu_active());
+    if (redraw) {
+        __display(ambient_t, chamber_t);
     }
+
+    TRACE_SPAN(TRACE_UI, uiStart, (mode != BTN_EV_NONE) 
+               || (select != BTN_EV_NONE) || menu_active() || redraw);
+
+    TRACE_SPAN_START(uartStart);
+    uint8_t frames = __handle_uart(now_ms);
+    TRACE_SPAN(TRACE_UART, uartStart, frames);
+
+    // a line at a time
+    history_dump_update();
+    trace_dump_update();
+    record_update();
+
+    watchdog_checkin(WDG_UI);
+    watchdog_update();
+
+    __update_configuration(now_ms);
 }
 
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
-    if (GPIO_Pin == GPIO_PIN_5) {
+    if (GPIO_Pin == ZERO_CROSS_Pin) {
         fan_driver_zero_cross_int();
+    } else {
+        buttons_exti_int(GPIO_Pin);
     }
 }
 
+void HAL_PWR_PVDCallback()
+{
+    // no Flash from here, it could break into a write of the main loop,
+    // the next logic_update() flushes what is pending
+    powerFailing = 1;
+}
+
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
     if(htim->Instance == TIM3) {
@@ -46,6 +46,12 @@
 #include "fan_driver.h"
 #include "logic.h"
 #include "usart.h"
+#include "boot_time.h"
+#include "config_store.h"
+#include "crash.h"
+#include "watchdog.h"
+#include "uart_rx.h"
+#include "record.h"
 
 /* USER CODE END Includes */
 
@@ -54,10 +60,16 @@ ADC_HandleTypeDef hadc1;
 ADC_HandleTypeDef hadc2;
 DMA_HandleTypeDef hdma_adc1;
 
+CRC_HandleTypeDef hcrc;
+
+IWDG_HandleTypeDef hiwdg;
+
 TIM_HandleTypeDef htim3;
 TIM_HandleTypeDef htim4;
 
 UART_HandleTypeDef huart1;
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
@@ -73,6 +85,8 @@ static void MX_TIM3_Init(void);
 static void MX_ADC2_Init(void);
 static void MX_USART1_UART_Init(void);
 static void MX_TIM4_Init(void);
+static void MX_CRC_Init(void);
+static void MX_IWDG_Init(void);
 
 /* USER CODE BEGIN PFP */
 /* Private function prototypes -----------------------------------------------*/
@@ -92,6 +106,8 @@ int main(void)
 {
   /* USER CODE BEGIN 1 */
 
+  boot_time_mark(BOOT_MAIN);
+
   /* USER CODE END 1 */
 
   /* MCU Configuration----------------------------------------------------------*/
@@ -101,6 +117,10 @@ int main(void)
 
   /* USER CODE BEGIN Init */
 
+  boot_time_mark(BOOT_HAL);
+  watchdog_boot();
+  crash_init();
+
   /* USER CODE END Init */
 
   /* Configure the system clock */
@@ -108,30 +128,69 @@ int main(void)
 
   /* USER CODE BEGIN SysInit */
 
+  boot_time_mark(BOOT_CLOCK);
+
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  boot_time_mark(BOOT_GPIO);
   MX_DMA_Init();
+  boot_time_mark(BOOT_DMA);
   MX_ADC1_Init();
-  MX_TIM3_Init();
   MX_ADC2_Init();
-  MX_USART1_UART_Init();
-  MX_TIM4_Init();
+  boot_time_mark(BOOT_ADC);
+  MX_TIM3_Init();
+  boot_time_mark(BOOT_TIM3);
   /* USER CODE BEGIN 2 */
 
+  // USART1, TIM4, CRC and IWDG calls are not generated (see the .ioc
+  // function list), they are placed below in the order they are needed
+
+  // fan & temperature path first, VFD and UART come up after
+  // the first control decision, logs sent before are dropped
+  // unless the input recorder runs, it needs the UART from the first
+  // reading on
+  uint8_t recording = record_boot_requested();
+
+  if (recording) {
+    MX_USART1_UART_Init();
+    usart_config(&huart1);
+  }
+
   vfd_driver_init();
   fan_driver_init(&htim3);
-  usart_config(&huart1);
+  MX_CRC_Init();
+  config_store_init(&hcrc);
   logic_init(&hadc1, &hadc2);
-  
+  boot_time_mark(BOOT_LOGIC);
+
+  logic_update();
+  boot_time_mark(BOOT_CONTROL);
+
+  if (!recording) {
+    MX_USART1_UART_Init();
+    usart_config(&huart1);
+  }
+  uart_rx_init(&huart1);
+  watchdog_report();
+  crash_report();
+  boot_time_mark(BOOT_USART);
+
+  MX_TIM4_Init();
   // HAL_TIM_Base_Start_IT(&htim3);
   HAL_TIM_Base_Start_IT(&htim4);
+  boot_time_mark(BOOT_VFD);
 
   LOG("Initialized");
+  boot_time_report();
 
   logic_init_selfcheck();
 
+  // from now on a stuck activity resets the MCU
+  MX_IWDG_Init();
+  watchdog_start(&hiwdg);
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -316,6 +375,32 @@ static void MX_TIM3_Init(void)
 
 }
 
+/* CRC init function */
+static void MX_CRC_Init(void)
+{
+
+  hcrc.Instance = CRC;
+  if (HAL_CRC_Init(&hcrc) != HAL_OK)
+  {
+    _Error_Handler(__FILE__, __LINE__);
+  }
+
+}
+
+/* IWDG init function */
+static void MX_IWDG_Init(void)
+{
+
+  hiwdg.Instance = IWDG;
+  hiwdg.Init.Prescaler = IWDG_PRESCALER_64;
+  hiwdg.Init.Reload = 2500;
+  if (HAL_IWDG_Init(&hiwdg) != HAL_OK)
+  {
+    _Error_Handler(__FILE__, __LINE__);
+  }
+
+}
+
 /* TIM4 init function */
 static void MX_TIM4_Init(void)
 {
@@ -354,14 +439,14 @@ static void MX_USART1_UART_Init(void)
 {
 
   huart1.Instance = USART1;
-  huart1.Init.BaudRate = 9600;
+  huart1.Init.BaudRate = 115200;
   huart1.Init.WordLength = UART_WORDLENGTH_8B;
   huart1.Init.StopBits = UART_STOPBITS_1;
   huart1.Init.Parity = UART_PARITY_NONE;
-  huart1.Init.Mode = UART_MODE_TX;
+  huart1.Init.Mode = UART_MODE_TX_RX;
   huart1.Init.HwFlowCtl = UART_HWCONTROL_NONE;
   huart1.Init.OverSampling = UART_OVERSAMPLING_16;
-  if (HAL_HalfDuplex_Init(&huart1) != HAL_OK)
+  if (HAL_UART_Init(&huart1) != HAL_OK)
   {
     _Error_Handler(__FILE__, __LINE__);
   }
@@ -380,6 +465,12 @@ static void MX_DMA_Init(void)
   /* DMA1_Channel1_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+  /* DMA1_Channel4_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+  /* DMA1_Channel5_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel5_IRQn);
 
 }
 
@@ -437,7 +528,7 @@ static void MX_GPIO_Init(void)
 
   /*Configure GPIO pins : MODE_Pin SELECT_Pin */
   GPIO_InitStruct.Pin = MODE_Pin|SELECT_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
@@ -454,6 +545,12 @@ static void MX_GPIO_Init(void)
   HAL_GPIO_Init(DRIVE_GPIO_Port, &GPIO_InitStruct);
 
   /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI3_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+
+  HAL_NVIC_SetPriority(EXTI4_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+
   HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
 
@@ -473,9 +570,7 @@ void _Error_Handler(char *file, int line)
 {
   /* USER CODE BEGIN Error_Handler_Debug */
   /* User can add his own implementation to report the HAL error return state */
-  while(1)
-  {
-  }
+  crash_error(file, line, (uint32_t)__builtin_return_address(0));
   /* USER CODE END Error_Handler_Debug */
 }
 
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "menu.h"
+#include "vfd_driver.h"
+
+#include <stddef.h>
+
+static const struct Menu* menu = NULL;
+
+static uint8_t active = 0;
+static uint8_t current;
+static uint8_t redraw;
+static uint32_t lastInput_ms;
+
+// working copy, written back on exit
+static uint16_t values[MENU_MAX_ITEMS];
+
+static uint16_t __read(const struct MenuItem* item)
+{
+    if (item->type == MENU_U8) {
+        return *(uint8_t*)item->value;
+    }
+    return *(uint16_t*)item->value;
+}
+
+static uint8_t __write(const struct MenuItem* item, uint16_t v)
+{
+    if (__read(item) == v) {
+        return 0;
+    }
+
+    if (item->type == MENU_U8) {
+        *(uint8_t*)item->value = v;
+    } else {
+        *(uint16_t*)item->value = v;
+    }
+    return 1;
+}
+
+static uint16_t __max(const struct MenuItem* item)
+{
+    return (item->max_fn != NULL) ? item->max_fn() : item->max;
+}
+
+static void __open(uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < menu->count; ++i) {
+        values[i] = __read(&menu->items[i]);
+    }
+
+    active = 1;
+    current = 0;
+    redraw = 1;
+    lastInput_ms = now_ms;
+}
+
+static void __close(uint8_t keep)
+{
+    uint8_t changed = 0;
+
+    active = 0;
+
+    if (keep) {
+        for (uint8_t i = 0; i < menu->count; ++i) {
+            changed |= __write(&menu->items[i], values[i]);
+        }
+    }
+
+    if (menu->on_exit != NULL) {
+        menu->on_exit(changed);
+    }
+}
+
+static void __step(int8_t dir)
+{
+    const struct MenuItem* item = &menu->items[current];
+    uint16_t max = __max(item);
+    int32_t v = (int32_t)values[current] + dir * item->step;
+
+    if (v > max) {
+        v = item->min;
+    } else if (v < item->min) {
+        v = max;
+    }
+
+    values[current] = v;
+}
+
+static void __render()
+{
+    // the menu values never exceed 255
+    vfd_driver_print_labeled(menu->items[current].label, values[current]);
+}
+
+void menu_init(const struct Menu* menu_)
+{
+    menu = menu_;
+    active = 0;
+}
+
+uint8_t menu_active()
+{
+    return active;
+}
+
+uint8_t menu_event(enum ButtonId id, enum ButtonEvent ev, uint32_t now_ms)
+{
+    if (ev == BTN_EV_NONE) {
+        return 0;
+    }
+
+    if (!active) {
+        if ((id == BTN_MODE) && (ev == BTN_EV_CLICK)) {
+            __open(now_ms);
+            return 1;
+        }
+        return 0;
+    }
+
+    lastInput_ms = now_ms;
+    redraw = 1;
+
+    if (id == BTN_MODE) {
+        if (ev == BTN_EV_LONG_PRESS) {
+            __close(0);
+        } else if (ev == BTN_EV_CLICK) {
+            if (++current >= menu->count) {
+                __close(1);
+            }
+        }
+    } else if (ev == BTN_EV_CLICK || ev == BTN_EV_REPEAT) {
+        __step(1);
+    } else if (ev == BTN_EV_DOUBLE_CLICK) {
+        __step(-1);
+    }
+
+    // every event is swallowed while the menu is open
+    return 1;
+}
+
+void menu_update(uint32_t now_ms)
+{
+    if (!active) {
+        return;
+    }
+
+    if (now_ms - lastInput_ms >= menu->timeout_ms) {
+        __close(1);
+        return;
+    }
+
+    if (redraw) {
+        __render();
+        redraw = 0;
+    }
+}
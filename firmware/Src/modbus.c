@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "modbus.h"
+#include "usart.h"
+
+#define FC_READ_HOLDING 0x03
+#define FC_READ_INPUT 0x04
+#define FC_WRITE_SINGLE 0x06
+#define FC_WRITE_MULTIPLE 0x10
+
+#define BROADCAST_ADDRESS 0
+
+// address, function, CRC
+#define MIN_FRAME 4
+
+// address, function, byte count, registers, CRC
+static uint8_t response[3 + 2 * MODBUS_MAX_REGISTERS + 2];
+
+static const struct ModbusMap* _map;
+
+// CRC-16/MODBUS, reflected 0x8005
+static const uint16_t crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+static inline uint16_t __crc_step(uint16_t crc, uint8_t b)
+{
+    return (crc >> 8) ^ crc_table[(crc ^ b) & 0xFF];
+}
+
+uint16_t modbus_crc16(const uint8_t* data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t i = 0; i < length; ++i) {
+        crc = __crc_step(crc, data[i]);
+    }
+
+    return crc;
+}
+
+// the CRC over a frame including its own CRC is zero
+static uint16_t __frame_crc(const struct UartFrame* f)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t i = 0; i < f->length; ++i) {
+        crc = __crc_step(crc, uart_rx_byte(f, i));
+    }
+
+    return crc;
+}
+
+static inline uint16_t __frame_u16(const struct UartFrame* f, uint16_t i)
+{
+    return ((uint16_t)uart_rx_byte(f, i) << 8) | uart_rx_byte(f, i + 1);
+}
+
+static inline void __put_u16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static uint16_t __read_register(const struct ModbusRegister* r)
+{
+    switch (r->type) {
+    case MB_U8:
+        return *(uint8_t*)r->value;
+    case MB_U16:
+        return *(uint16_t*)r->value;
+    case MB_S32_HI:
+        return (uint32_t)*(int32_t*)r->value >> 16;
+    case MB_S32_LO:
+        return (uint32_t)*(int32_t*)r->value & 0xFFFF;
+    case MB_FN:
+        return r->read_fn();
+    }
+
+    return 0;
+}
+
+static void __write_register(const struct ModbusRegister* r, uint16_t v)
+{
+    uint32_t u;
+
+    switch (r->type) {
+    case MB_U8:
+        *(uint8_t*)r->value = v;
+        break;
+    case MB_U16:
+        *(uint16_t*)r->value = v;
+        break;
+    case MB_S32_HI:
+        u = (uint32_t)*(int32_t*)r->value;
+        *(int32_t*)r->value = (int32_t)((u & 0x0000FFFF) | ((uint32_t)v << 16));
+        break;
+    case MB_S32_LO:
+        u = (uint32_t)*(int32_t*)r->value;
+        *(int32_t*)r->value = (int32_t)((u & 0xFFFF0000) | v);
+        break;
+    case MB_FN:
+        break;
+    }
+}
+
+// 0 if the value may be written, the exception code otherwise
+static uint8_t __check_write(const struct ModbusRegister* r, uint16_t v)
+{
+    if (!r->writable || r->type == MB_FN) {
+        return EX_ILLEGAL_ADDRESS;
+    }
+
+    uint16_t max = r->max_fn ? r->max_fn() : r->max;
+
+    if (v < r->min || v > max) {
+        return EX_ILLEGAL_VALUE;
+    }
+
+    return 0;
+}
+
+static void __send(uint8_t length)
+{
+    uint16_t crc = modbus_crc16(response, length);
+
+    // low byte first, unlike the data
+    response[length] = crc & 0xFF;
+    response[length + 1] = crc >> 8;
+
+    usart_write(response, length + 2);
+}
+
+// response length, 0 for none
+static uint8_t __exception(uint8_t function, uint8_t code)
+{
+    response[1] = function | 0x80;
+    response[2] = code;
+    return 3;
+}
+
+static uint8_t __read_registers(const struct UartFrame* f, uint8_t function,
+                                const struct ModbusRegister* regs, 
+                                uint16_t count)
+{
+    if (f->length != 8) {
+        return __exception(function, EX_ILLEGAL_VALUE);
+    }
+
+    uint16_t start = __frame_u16(f, 2);
+    uint16_t n = __frame_u16(f, 4);
+
+    if (n == 0 || n > MODBUS_MAX_REGISTERS) {
+        return __exception(function, EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)start + n > count) {
+        return __exception(function, EX_ILLEGAL_ADDRESS);
+    }
+
+    response[2] = 2 * n;
+    for (uint16_t i = 0; i < n; ++i) {
+        __put_u16(&response[3 + 2 * i], __read_register(&regs[start + i]));
+    }
+
+    return 3 + 2 * n;
+}
+
+static uint8_t __write_single(const struct UartFrame* f, uint32_t now_ms)
+{
+    if (f->length != 8) {
+        return __exception(FC_WRITE_SINGLE, EX_ILLEGAL_VALUE);
+    }
+
+    uint16_t address = __frame_u16(f, 2);
+    uint16_t v = __frame_u16(f, 4);
+
+    if (address >= _map->holdingCount) {
+        return __exception(FC_WRITE_SINGLE, EX_ILLEGAL_ADDRESS);
+    }
+
+    uint8_t ex = __check_write(&_map->holding[address], v);
+    if (ex) {
+        return __exception(FC_WRITE_SINGLE, ex);
+    }
+
+    __write_register(&_map->holding[address], v);
+    _map->on_write(now_ms);
+
+    // the response echoes the request
+    __put_u16(&response[2], address);
+    __put_u16(&response[4], v);
+    return 6;
+}
+
+static uint8_t __write_multiple(const struct UartFrame* f, uint32_t now_ms)
+{
+    if (f->length < 9) {
+        return __exception(FC_WRITE_MULTIPLE, EX_ILLEGAL_VALUE);
+    }
+
+    uint16_t start = __frame_u16(f, 2);
+    uint16_t n = __frame_u16(f, 4);
+    uint8_t bytes = uart_rx_byte(f, 6);
+
+    if (n == 0 || n > MODBUS_MAX_REGISTERS || bytes != 2 * n
+        || f->length != 9 + bytes) {
+        return __exception(FC_WRITE_MULTIPLE, EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)start + n > _map->holdingCount) {
+        return __exception(FC_WRITE_MULTIPLE, EX_ILLEGAL_ADDRESS);
+    }
+
+    // all or nothing
+    for (uint16_t i = 0; i < n; ++i) {
+        uint8_t ex = __check_write(&_map->holding[start + i],
+                                   __frame_u16(f, 7 + 2 * i));
+        if (ex) {
+            return __exception(FC_WRITE_MULTIPLE, ex);
+        }
+    }
+
+    for (uint16_t i = 0; i < n; ++i) {
+        __write_register(&_map->holding[start + i], 
+                         __frame_u16(f, 7 + 2 * i));
+    }
+    _map->on_write(now_ms);
+
+    __put_u16(&response[2], start);
+    __put_u16(&response[4], n);
+    return 6;
+}
+
+void modbus_init(const struct ModbusMap* map)
+{
+    _map = map;
+}
+
+uint16_t modbus_register_read(const struct ModbusRegister* r)
+{
+    return __read_register(r);
+}
+
+uint8_t modbus_register_write(const struct ModbusRegister* r, uint16_t v)
+{
+    uint8_t ex = __check_write(r, v);
+
+    if (!ex) {
+        __write_register(r, v);
+    }
+
+    return ex;
+}
+
+uint8_t modbus_frame(const struct UartFrame* f, uint32_t now_ms)
+{
+    if (f->length < MIN_FRAME || __frame_crc(f) != 0) {
+        return 0;
+    }
+
+    uint8_t address = uart_rx_byte(f, 0);
+    uint8_t function = uart_rx_byte(f, 1);
+
+    if (address != MODBUS_ADDRESS && address != BROADCAST_ADDRESS) {
+        // someone else's
+        return 1;
+    }
+
+    usart_mute(MODBUS_QUIET_MS);
+
+    response[0] = address;
+    response[1] = function;
+
+    uint8_t length;
+
+    switch (function) {
+    case FC_READ_HOLDING:
+        length = __read_registers(f, function, _map->holding, 
+                                  _map->holdingCount);
+        break;
+    case FC_READ_INPUT:
+        length = __read_registers(f, function, _map->input, 
+                                  _map->inputCount);
+        break;
+    case FC_WRITE_SINGLE:
+        length = __write_single(f, now_ms);
+        break;
+    case FC_WRITE_MULTIPLE:
+        length = __write_multiple(f, now_ms);
+        break;
+    default:
+        length = __exception(function, EX_ILLEGAL_FUNCTION);
+        break;
+    }
+
+    if (address != BROADCAST_ADDRESS) {
+        __send(length);
+    }
+
+    return 1;
+}
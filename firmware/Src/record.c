@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "record.h"
+#include "stm32f1xx_hal.h"
+#include "fan_driver.h"
+#include "vfd_driver.h"
+#include "usart.h"
+
+#include <string.h>
+
+// backup register value, the recording goes on across resets
+#define RECORD_BOOT_MAGIC 0x2EC0
+
+#define LINE_MAX 96
+
+// the reference of the first ~Z, 50 Hz, the next ones follow the mains
+#define ZC_FIRST_REF_US 10000
+
+_Static_assert(RECORD_ZC_BATCH < FAN_ZERO_CROSS_STAMPS - 1,
+               "the zero cross stamps are reused before they are recorded");
+
+static uint8_t active = 0;
+static uint32_t last_ms;
+
+// the next crossing to record and the stamp the interval of it
+// is measured from
+static uint32_t zeroCross;
+static uint32_t zeroCrossStamp;
+static uint32_t zeroCross_ms;
+// [us], see record.h
+static uint32_t zeroCrossRef;
+
+static uint8_t fanPower;
+static uint8_t sections[VFD_SECTIONS];
+
+// a record goes out in one raw write, the log is muted while a Modbus 
+// master talks and the recording must not be
+static char line[LINE_MAX];
+static uint8_t lineLength;
+
+static void __put_char(char c)
+{
+    // room for the line end
+    if (lineLength < LINE_MAX - 2) {
+        line[lineLength++] = c;
+    }
+}
+
+static void __put_digits(uint32_t val)
+{
+    char buff[16];
+
+    for (char* p = my_itoa(val, buff); *p; ++p) {
+        __put_char(*p);
+    }
+}
+
+static void __put_int(uint32_t val)
+{
+    __put_char(' ');
+    __put_digits(val);
+}
+
+// a run of the same half-wave, the count goes after it from 3 on
+static void __put_run(char c, uint8_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    __put_char(c);
+    if (length == 2) {
+        __put_char(c);
+    } else if (length > 2) {
+        __put_digits(length);
+    }
+}
+
+// tag and the time since the previous record
+static void __begin(char tag, uint32_t now_ms)
+{
+    lineLength = 0;
+    __put_char('~');
+    __put_char(tag);
+    __put_int(now_ms - last_ms);
+    last_ms = now_ms;
+}
+
+static void __end()
+{
+    line[lineLength++] = '\r';
+    line[lineLength++] = '\n';
+    usart_write((const uint8_t*)line, lineLength);
+}
+
+static void __display(uint32_t now_ms)
+{
+    static const char digit[] = "0123456789abcdef";
+
+    __begin('D', now_ms);
+    __put_char(' ');
+    for (uint8_t i = 0; i < VFD_SECTIONS; ++i) {
+        __put_char(digit[sections[i] >> 4]);
+        __put_char(digit[sections[i] & 0xF]);
+    }
+    __end();
+}
+
+static void __zero_crosses(uint32_t now_ms)
+{
+    uint32_t count = fan_driver_zero_cross_count();
+    uint32_t pending = count - zeroCross;
+
+    if ((pending < RECORD_ZC_BATCH) 
+        && ((pending == 0) || (now_ms - zeroCross_ms < RECORD_ZC_MAX_MS))) {
+        return;
+    }
+
+    uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+    uint32_t stamp;
+
+    __begin('Z', now_ms);
+
+    // a stalled loop, the oldest ones went without a stamp
+    uint32_t lost = 0;
+    while ((zeroCross != count) 
+           && !fan_driver_zero_cross_stamp(zeroCross, &stamp)) {
+        ++zeroCross;
+        ++lost;
+    }
+    if (lost) {
+        __put_char(' ');
+        __put_char('x');
+        __put_digits(lost);
+    }
+
+    // the reference, then each interval as its offset from it, the 
+    // next line's reference is the mean of those
+    uint8_t started = 0;
+    uint64_t sum = 0;
+    uint8_t n = 0;
+    uint32_t us = 0;
+    char run = 0;
+    uint8_t runLength = 0;
+
+    // room for a run and "#4294967295"
+    for (; (zeroCross != count) && (lineLength < LINE_MAX - 16) 
+         && fan_driver_zero_cross_stamp(zeroCross, &stamp); ++zeroCross) {
+        us = (stamp - zeroCrossStamp) / cyclesPerUs;
+        // the remainder stays in, the intervals add up to the stamps
+        zeroCrossStamp += us * cyclesPerUs;
+
+        if (!started) {
+            __put_int(zeroCrossRef);
+            started = 1;
+        }
+
+        int32_t offset = (int32_t)(us - zeroCrossRef);
+
+        if ((offset >= -RECORD_ZC_RANGE) && (offset <= RECORD_ZC_RANGE)) {
+            char c = RECORD_ZC_ZERO + offset;
+
+            if (c != run) {
+                __put_run(run, runLength);
+                run = c;
+                runLength = 0;
+            }
+            ++runLength;
+            sum += us;
+            ++n;
+        } else {
+            __put_run(run, runLength);
+            run = 0;
+            runLength = 0;
+            __put_char('#');
+            __put_digits(us);
+        }
+    }
+    __put_run(run, runLength);
+    __end();
+
+    // follows the mains, or jumps to it when all were off
+    if (n) {
+        zeroCrossRef = (sum + n / 2) / n;
+    } else if (us) {
+        zeroCrossRef = us;
+    }
+
+    // a full line, the rest goes with the next pass
+    if (zeroCross == count) {
+        zeroCross_ms = now_ms;
+    }
+}
+
+void record_start()
+{
+    active = 1;
+    last_ms = HAL_GetTick();
+    lineLength = 0;
+    __put_char('~');
+    __put_char('S');
+    __put_int(last_ms);
+    __end();
+
+    zeroCross = fan_driver_zero_cross_count();
+    zeroCrossStamp = DWT->CYCCNT;
+    zeroCross_ms = last_ms;
+    zeroCrossRef = ZC_FIRST_REF_US;
+
+    // the outputs as they are now
+    fanPower = fan_driver_get_power();
+    __begin('F', last_ms);
+    __put_int(fanPower);
+    __end();
+
+    vfd_driver_get_sections(sections);
+    __display(last_ms);
+}
+
+void record_stop()
+{
+    active = 0;
+
+    if (record_boot_requested()) {
+        SET_BIT(PWR->CR, PWR_CR_DBP);
+        BKP->DR2 = 0;
+        CLEAR_BIT(PWR->CR, PWR_CR_DBP);
+    }
+}
+
+uint8_t record_active()
+{
+    return active;
+}
+
+void record_boot_request()
+{
+    SET_BIT(RCC->APB1ENR, RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN);
+    SET_BIT(PWR->CR, PWR_CR_DBP);
+    BKP->DR2 = RECORD_BOOT_MAGIC;
+    CLEAR_BIT(PWR->CR, PWR_CR_DBP);
+}
+
+uint8_t record_boot_requested()
+{
+    SET_BIT(RCC->APB1ENR, RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN);
+    return BKP->DR2 == RECORD_BOOT_MAGIC;
+}
+
+void record_temps(uint16_t adc_t1, uint16_t adc_t2)
+{
+    if (!active) {
+        return;
+    }
+
+    __begin('A', HAL_GetTick());
+    __put_int(adc_t1);
+    __put_int(adc_t2);
+    __end();
+}
+
+void record_light(uint16_t adc_light)
+{
+    if (!active) {
+        return;
+    }
+
+    __begin('L', HAL_GetTick());
+    __put_int(adc_light);
+    __end();
+}
+
+void record_buttons(uint8_t mode, uint8_t select)
+{
+    if (!active) {
+        return;
+    }
+
+    __begin('B', HAL_GetTick());
+    __put_int(mode);
+    __put_int(select);
+    __end();
+}
+
+void record_config(const uint16_t* values, uint8_t count)
+{
+    if (!active) {
+        return;
+    }
+
+    __begin('C', HAL_GetTick());
+    for (uint8_t i = 0; i < count; ++i) {
+        __put_int(values[i]);
+    }
+    __end();
+}
+
+void record_update()
+{
+    if (!active) {
+        return;
+    }
+
+    // HAL_GetTick() everywhere, the records are in time order
+    uint32_t now_ms = HAL_GetTick();
+
+    __zero_crosses(now_ms);
+
+    uint8_t power = fan_driver_get_power();
+
+    if (power != fanPower) {
+        fanPower = power;
+        __begin('F', now_ms);
+        __put_int(fanPower);
+        __end();
+    }
+
+    uint8_t now[VFD_SECTIONS];
+
+    vfd_driver_get_sections(now);
+    if (memcmp(now, sections, VFD_SECTIONS) != 0) {
+        memcpy(sections, now, VFD_SECTIONS);
+        __display(now_ms);
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "shell.h"
+#include "usart.h"
+
+#include <stddef.h>
+
+static const struct ShellCommand* _commands;
+static uint8_t _count;
+
+// the line being collected, contiguous in the receive buffer
+static uint8_t lineStart;
+static uint16_t lineLength;
+// where the line continues, another frame in between breaks it
+static uint8_t lineNext;
+static uint8_t lineOverflow;
+
+static inline uint8_t __byte(uint8_t offset)
+{
+    return uart_rx_buffer[offset];
+}
+
+static inline uint8_t __is_space(uint8_t c)
+{
+    return (c == ' ') || (c == '\t');
+}
+
+int8_t shell_token_cmp(const struct ShellToken* t, const char* s)
+{
+    for (uint8_t i = 0; i < t->length; ++i, ++s) {
+        uint8_t c = __byte(t->start + i);
+
+        if (*s == '\0' || c > (uint8_t)*s) {
+            return 1;
+        } else if (c < (uint8_t)*s) {
+            return -1;
+        }
+    }
+
+    return (*s == '\0') ? 0 : -1;
+}
+
+uint8_t shell_token_uint(const struct ShellToken* t, uint32_t* value)
+{
+    uint32_t v = 0;
+
+    // 9 digits cannot overflow
+    if (t->length == 0 || t->length > 9) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < t->length; ++i) {
+        uint8_t c = __byte(t->start + i);
+
+        if (c < '0' || c > '9') {
+            return 0;
+        }
+        v = v * 10 + (c - '0');
+    }
+
+    *value = v;
+    return 1;
+}
+
+void shell_help()
+{
+    for (uint8_t i = 0; i < _count; ++i) {
+        send_string(_commands[i].name);
+        send_string(" - ");
+        send_string(_commands[i].help);
+        send_ln();
+    }
+}
+
+static uint8_t __tokenize(struct ShellArgs* args)
+{
+    uint8_t pos = lineStart;
+    uint8_t end = lineStart + lineLength;
+
+    args->count = 0;
+
+    while (pos != end) {
+        if (__is_space(__byte(pos))) {
+            ++pos;
+            continue;
+        }
+
+        if (args->count == SHELL_MAX_TOKENS) {
+            return 0;
+        }
+
+        struct ShellToken* t = &args->tokens[args->count++];
+        t->start = pos;
+        t->length = 0;
+
+        while ((pos != end) && !__is_space(__byte(pos))) {
+            ++t->length;
+            ++pos;
+        }
+    }
+
+    return 1;
+}
+
+static const struct ShellCommand* __find(const struct ShellToken* name)
+{
+    int16_t lo = 0;
+    int16_t hi = _count - 1;
+
+    while (lo <= hi) {
+        int16_t mid = (lo + hi) / 2;
+        int8_t c = shell_token_cmp(name, _commands[mid].name);
+
+        if (c == 0) {
+            return &_commands[mid];
+        } else if (c < 0) {
+            hi = mid - 1;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void __execute()
+{
+    struct ShellArgs args;
+
+    if (!__tokenize(&args)) {
+        LOG("Too many arguments");
+        return;
+    }
+
+    if (args.count == 0) {
+        return;
+    }
+
+    const struct ShellCommand* cmd = __find(&args.tokens[0]);
+
+    if (!cmd) {
+        LOG("Unknown command, try help");
+        return;
+    }
+
+    cmd->run(&args);
+}
+
+void shell_init(const struct ShellCommand* commands, uint8_t count)
+{
+    _commands = commands;
+    _count = count;
+    lineStart = 0;
+    lineLength = 0;
+    lineNext = 0;
+    lineOverflow = 0;
+}
+
+void shell_frame(const struct UartFrame* f)
+{
+    if (f->start != lineNext) {
+        lineStart = f->start;
+        lineLength = 0;
+        lineOverflow = 0;
+    }
+
+    for (uint16_t i = 0; i < f->length; ++i) {
+        uint8_t c = uart_rx_byte(f, i);
+
+        if (c == '\r' || c == '\n') {
+            if (lineOverflow) {
+                LOG("Line too long");
+            } else if (lineLength) {
+                __execute();
+            }
+
+            lineStart = f->start + i + 1;
+            lineLength = 0;
+            lineOverflow = 0;
+        } else if (lineLength < SHELL_MAX_LINE) {
+            ++lineLength;
+        } else {
+            lineOverflow = 1;
+        }
+    }
+
+    lineNext = f->start + f->length;
+}
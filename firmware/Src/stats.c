@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "stats.h"
+#include "usart.h"
+
+#include <math.h>
+#include <string.h>
+
+#define P2_QUANTILE 0.95f
+#define P2_MARKERS 5
+
+struct DequeEntry
+{
+    uint16_t bucket;
+    int16_t value;
+};
+
+// ring of at most one entry per bucket, monotonic from the front
+struct Deque
+{
+    struct DequeEntry* e;
+    uint8_t cap;
+    uint8_t head;
+    uint8_t len;
+};
+
+struct Welford
+{
+    uint32_t n;
+    float mean;
+    float m2;
+};
+
+struct P2
+{
+    uint32_t count;
+    float q[P2_MARKERS];
+    float n[P2_MARKERS];
+    float np[P2_MARKERS];
+};
+
+struct Period
+{
+    struct Welford w;
+    struct P2 p;
+};
+
+struct Stats
+{
+    struct Deque minQ;
+    struct Deque maxQ;
+    struct Period current;
+    struct Period last;
+    uint8_t lastValid;
+    uint32_t period;
+};
+
+struct WindowDef
+{
+    uint32_t bucket_ms;
+    uint8_t buckets;
+    const char* name;
+};
+
+static const struct WindowDef windows[STATS_WINDOWS] = {
+    { STATS_HOUR_BUCKET_MS, STATS_HOUR_BUCKETS, "1h" },
+    { STATS_DAY_BUCKET_MS, STATS_DAY_BUCKETS, "24h" }
+};
+
+static const char* const channelNames[STATS_CHANNELS] = {
+    "chamber", "fan"
+};
+
+static const float p2Increments[P2_MARKERS] = {
+    0.0f, P2_QUANTILE / 2, P2_QUANTILE, (1.0f + P2_QUANTILE) / 2, 1.0f
+};
+
+// the whole RAM budget, min and max deques of every channel and window
+#define POOL_SIZE (STATS_CHANNELS * 2 * (STATS_HOUR_BUCKETS + STATS_DAY_BUCKETS))
+
+static struct DequeEntry pool[POOL_SIZE];
+static struct Stats stats[STATS_CHANNELS][STATS_WINDOWS];
+
+// ----------------------------------------
+// Monotonic deque, sign 1 keeps the min, -1 the max
+// ----------------------------------------
+static void __deque_push(struct Deque* d, uint16_t bucket, int16_t v, 
+                         int8_t sign)
+{
+    // drop the buckets which left the window
+    while (d->len 
+           && ((uint16_t)(bucket - d->e[d->head].bucket) >= d->cap)) {
+        d->head = (d->head + 1) % d->cap;
+        --d->len;
+    }
+
+    // drop what v dominates, a better value in the same bucket
+    // expires together with v
+    while (d->len) {
+        struct DequeEntry* back = &d->e[(d->head + d->len - 1) % d->cap];
+
+        if (sign * (back->value - v) < 0) {
+            if (back->bucket == bucket) {
+                return;
+            }
+            break;
+        }
+        --d->len;
+    }
+
+    struct DequeEntry* e = &d->e[(d->head + d->len) % d->cap];
+    e->bucket = bucket;
+    e->value = v;
+    ++d->len;
+}
+
+// ----------------------------------------
+// Welford
+// ----------------------------------------
+static void __welford_add(struct Welford* w, float x)
+{
+    float d = x - w->mean;
+
+    ++w->n;
+    w->mean += d / w->n;
+    w->m2 += d * (x - w->mean);
+}
+
+static float __welford_stddev(const struct Welford* w)
+{
+    return (w->n > 1) ? sqrtf(w->m2 / (w->n - 1)) : 0.0f;
+}
+
+// ----------------------------------------
+// P^2 quantile estimator, Jain & Chlamtac
+// ----------------------------------------
+static void __p2_add(struct P2* p, float x)
+{
+    uint8_t k;
+
+    if (p->count < P2_MARKERS) {
+        // insertion sort of the first samples
+        k = p->count++;
+        while (k > 0 && p->q[k - 1] > x) {
+            p->q[k] = p->q[k - 1];
+            --k;
+        }
+        p->q[k] = x;
+
+        if (p->count == P2_MARKERS) {
+            for (k = 0; k < P2_MARKERS; ++k) {
+                p->n[k] = k + 1;
+                p->np[k] = 1 + 4 * p2Increments[k];
+            }
+        }
+        return;
+    }
+
+    ++p->count;
+
+    if (x < p->q[0]) {
+        p->q[0] = x;
+        k = 0;
+    } else if (x >= p->q[P2_MARKERS - 1]) {
+        p->q[P2_MARKERS - 1] = x;
+        k = P2_MARKERS - 2;
+    } else {
+        k = 0;
+        while (x >= p->q[k + 1]) {
+            ++k;
+        }
+    }
+
+    for (uint8_t i = k + 1; i < P2_MARKERS; ++i) {
+        p->n[i] += 1;
+    }
+    for (uint8_t i = 0; i < P2_MARKERS; ++i) {
+        p->np[i] += p2Increments[i];
+    }
+
+    for (uint8_t i = 1; i < P2_MARKERS - 1; ++i) {
+        float d = p->np[i] - p->n[i];
+
+        if (!((d >= 1 && p->n[i + 1] - p->n[i] > 1)
+              || (d <= -1 && p->n[i - 1] - p->n[i] < -1))) {
+            continue;
+        }
+
+        float s = (d > 0) ? 1.0f : -1.0f;
+        float qp = p->q[i] + s / (p->n[i + 1] - p->n[i - 1]) 
+            * ((p->n[i] - p->n[i - 1] + s) * (p->q[i + 1] - p->q[i])
+                   / (p->n[i + 1] - p->n[i])
+               + (p->n[i + 1] - p->n[i] - s) * (p->q[i] - p->q[i - 1])
+                   / (p->n[i] - p->n[i - 1]));
+
+        if ((p->q[i - 1] < qp) && (qp < p->q[i + 1])) {
+            p->q[i] = qp;
+        } else {
+            // the parabola overshoots, linear instead
+            int8_t j = i + (int8_t)s;
+            p->q[i] += s * (p->q[j] - p->q[i]) / (p->n[j] - p->n[i]);
+        }
+        p->n[i] += s;
+    }
+}
+
+static float __p2_value(const struct P2* p)
+{
+    if (p->count == 0) {
+        return 0.0f;
+    }
+
+    if (p->count < P2_MARKERS) {
+        return p->q[(uint8_t)((p->count - 1) * P2_QUANTILE + 0.5f)];
+    }
+
+    return p->q[2];
+}
+
+// ----------------------------------------
+// Stats
+// ----------------------------------------
+void stats_init()
+{
+    struct DequeEntry* e = pool;
+
+    memset(stats, 0, sizeof(stats));
+
+    for (uint8_t c = 0; c < STATS_CHANNELS; ++c) {
+        for (uint8_t w = 0; w < STATS_WINDOWS; ++w) {
+            struct Stats* s = &stats[c][w];
+
+            s->minQ.e = e;
+            s->minQ.cap = windows[w].buckets;
+            e += windows[w].buckets;
+
+            s->maxQ.e = e;
+            s->maxQ.cap = windows[w].buckets;
+            e += windows[w].buckets;
+        }
+    }
+}
+
+void stats_sample(enum StatsChannel ch, int16_t value, uint32_t now_ms)
+{
+    for (uint8_t w = 0; w < STATS_WINDOWS; ++w) {
+        struct Stats* s = &stats[ch][w];
+        uint32_t bucket = now_ms / windows[w].bucket_ms;
+        uint32_t period = bucket / windows[w].buckets;
+
+        if (period != s->period) {
+            // a complete period is reported until the next one ends
+            if (s->current.w.n) {
+                s->last = s->current;
+                s->lastValid = 1;
+            }
+            memset(&s->current, 0, sizeof(s->current));
+            s->period = period;
+        }
+
+        __deque_push(&s->minQ, bucket, value, 1);
+        __deque_push(&s->maxQ, bucket, value, -1);
+
+        __welford_add(&s->current.w, value);
+        __p2_add(&s->current.p, value);
+    }
+}
+
+void stats_summary(enum StatsChannel ch, enum StatsWindow win, 
+                   struct StatsSummary* out)
+{
+    const struct Stats* s = &stats[ch][win];
+    const struct Period* p = s->lastValid ? &s->last : &s->current;
+
+    memset(out, 0, sizeof(struct StatsSummary));
+
+    if (!s->minQ.len) {
+        return;
+    }
+
+    out->min = s->minQ.e[s->minQ.head].value;
+    out->max = s->maxQ.e[s->maxQ.head].value;
+    out->mean = (int16_t)lroundf(p->w.mean);
+    out->stddev = (int16_t)lroundf(__welford_stddev(&p->w));
+    out->p95 = (int16_t)lroundf(__p2_value(&p->p));
+    out->count = p->w.n;
+}
+
+void stats_report()
+{
+    struct StatsSummary sum;
+
+    for (uint8_t c = 0; c < STATS_CHANNELS; ++c) {
+        for (uint8_t w = 0; w < STATS_WINDOWS; ++w) {
+            stats_summary(c, w, &sum);
+
+            send_string("Stats ");
+            send_string(channelNames[c]);
+            send_string(" ");
+            send_string(windows[w].name);
+            send_string_int(" [min, max, mean, sd, p95]: ", sum.min);
+            send_string_int(", ", sum.max);
+            send_string_int(", ", sum.mean);
+            send_string_int(", ", sum.stddev);
+            send_string_int_ln(", ", sum.p95);
+        }
+    }
+}
@@ -38,7 +38,16 @@
 /* USER CODE BEGIN 0 */
 
 #include "vfd_driver.h"
+#include "fan_driver.h"
+#include "buttons.h"
 #include "logic.h"
+#include "fast_io.h"
+#include "isr_timing.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "uart_rx.h"
+
+// HardFault, MemManage, BusFault and UsageFault handlers are in crash.c
 
 /* USER CODE END 0 */
 
@@ -46,6 +55,9 @@
 extern DMA_HandleTypeDef hdma_adc1;
 extern TIM_HandleTypeDef htim3;
 extern TIM_HandleTypeDef htim4;
+extern DMA_HandleTypeDef hdma_usart1_rx;
+extern DMA_HandleTypeDef hdma_usart1_tx;
+extern UART_HandleTypeDef huart1;
 
 /******************************************************************************/
 /*            Cortex-M3 Processor Interruption and Exception Handlers         */ 
@@ -65,78 +77,6 @@ void NMI_Handler(void)
   /* USER CODE END NonMaskableInt_IRQn 1 */
 }
 
-/**
-* @brief This function handles Hard fault interrupt.
-*/
-void HardFault_Handler(void)
-{
-  /* USER CODE BEGIN HardFault_IRQn 0 */
-
-  /* USER CODE END HardFault_IRQn 0 */
-  while (1)
-  {
-    /* USER CODE BEGIN W1_HardFault_IRQn 0 */
-    /* USER CODE END W1_HardFault_IRQn 0 */
-  }
-  /* USER CODE BEGIN HardFault_IRQn 1 */
-
-  /* USER CODE END HardFault_IRQn 1 */
-}
-
-/**
-* @brief This function handles Memory management fault.
-*/
-void MemManage_Handler(void)
-{
-  /* USER CODE BEGIN MemoryManagement_IRQn 0 */
-
-  /* USER CODE END MemoryManagement_IRQn 0 */
-  while (1)
-  {
-    /* USER CODE BEGIN W1_MemoryManagement_IRQn 0 */
-    /* USER CODE END W1_MemoryManagement_IRQn 0 */
-  }
-  /* USER CODE BEGIN MemoryManagement_IRQn 1 */
-
-  /* USER CODE END MemoryManagement_IRQn 1 */
-}
-
-/**
-* @brief This function handles Prefetch fault, memory access fault.
-*/
-void BusFault_Handler(void)
-{
-  /* USER CODE BEGIN BusFault_IRQn 0 */
-
-  /* USER CODE END BusFault_IRQn 0 */
-  while (1)
-  {
-    /* USER CODE BEGIN W1_BusFault_IRQn 0 */
-    /* USER CODE END W1_BusFault_IRQn 0 */
-  }
-  /* USER CODE BEGIN BusFault_IRQn 1 */
-
-  /* USER CODE END BusFault_IRQn 1 */
-}
-
-/**
-* @brief This function handles Undefined instruction or illegal state.
-*/
-void UsageFault_Handler(void)
-{
-  /* USER CODE BEGIN UsageFault_IRQn 0 */
-
-  /* USER CODE END UsageFault_IRQn 0 */
-  while (1)
-  {
-    /* USER CODE BEGIN W1_UsageFault_IRQn 0 */
-    /* USER CODE END W1_UsageFault_IRQn 0 */
-  }
-  /* USER CODE BEGIN UsageFault_IRQn 1 */
-
-  /* USER CODE END UsageFault_IRQn 1 */
-}
-
 /**
 * @brief This function handles System service call via SWI instruction.
 */
@@ -188,6 +128,9 @@ void SysTick_Handler(void)
   HAL_SYSTICK_IRQHandler();
   /* USER CODE BEGIN SysTick_IRQn 1 */
 
+  buttons_tick_int();
+  watchdog_tick_int(HAL_GetTick());
+
   /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -198,6 +141,20 @@ void SysTick_Handler(void)
 /* please refer to the startup file (startup_stm32f1xx.s).                    */
 /******************************************************************************/
 
+/**
+* @brief This function handles PVD interrupt through EXTI line 16.
+*/
+void PVD_IRQHandler(void)
+{
+  /* USER CODE BEGIN PVD_IRQn 0 */
+
+  /* USER CODE END PVD_IRQn 0 */
+  HAL_PWR_PVD_IRQHandler();
+  /* USER CODE BEGIN PVD_IRQn 1 */
+
+  /* USER CODE END PVD_IRQn 1 */
+}
+
 /**
 * @brief This function handles DMA1 channel1 global interrupt.
 */
@@ -205,15 +162,89 @@ void DMA1_Channel1_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Channel1_IRQn 0 */
 
+  ISR_TIMING_BEGIN();
+  TRACE_ISR_ENTER(ISR_DMA1_CH1);
+
   /* USER CODE END DMA1_Channel1_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_adc1);
   /* USER CODE BEGIN DMA1_Channel1_IRQn 1 */
 
   dma_conv_int();
 
+  TRACE_ISR_EXIT(ISR_DMA1_CH1);
+  ISR_TIMING_END(ISR_DMA1_CH1);
+
   /* USER CODE END DMA1_Channel1_IRQn 1 */
 }
 
+/**
+* @brief This function handles EXTI line3 interrupt.
+*/
+void EXTI3_IRQHandler(void)
+{
+  /* USER CODE BEGIN EXTI3_IRQn 0 */
+
+#ifdef FAST_IO
+  if (fast_exti_ack(MODE_Pin)) {
+    buttons_exti_int(MODE_Pin);
+  }
+#else
+  /* USER CODE END EXTI3_IRQn 0 */
+  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_3);
+  /* USER CODE BEGIN EXTI3_IRQn 1 */
+#endif
+
+  /* USER CODE END EXTI3_IRQn 1 */
+}
+
+/**
+* @brief This function handles EXTI line4 interrupt.
+*/
+void EXTI4_IRQHandler(void)
+{
+  /* USER CODE BEGIN EXTI4_IRQn 0 */
+
+#ifdef FAST_IO
+  if (fast_exti_ack(SELECT_Pin)) {
+    buttons_exti_int(SELECT_Pin);
+  }
+#else
+  /* USER CODE END EXTI4_IRQn 0 */
+  HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_4);
+  /* USER CODE BEGIN EXTI4_IRQn 1 */
+#endif
+
+  /* USER CODE END EXTI4_IRQn 1 */
+}
+
+/**
+* @brief This function handles DMA1 channel4 global interrupt.
+*/
+void DMA1_Channel4_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Channel4_IRQn 0 */
+
+  /* USER CODE END DMA1_Channel4_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_usart1_tx);
+  /* USER CODE BEGIN DMA1_Channel4_IRQn 1 */
+
+  /* USER CODE END DMA1_Channel4_IRQn 1 */
+}
+
+/**
+* @brief This function handles DMA1 channel5 global interrupt.
+*/
+void DMA1_Channel5_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Channel5_IRQn 0 */
+
+  /* USER CODE END DMA1_Channel5_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_usart1_rx);
+  /* USER CODE BEGIN DMA1_Channel5_IRQn 1 */
+
+  /* USER CODE END DMA1_Channel5_IRQn 1 */
+}
+
 /**
 * @brief This function handles EXTI line[9:5] interrupts.
 */
@@ -221,9 +252,21 @@ void EXTI9_5_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI9_5_IRQn 0 */
 
+  ISR_TIMING_BEGIN();
+  TRACE_ISR_ENTER(ISR_EXTI9_5);
+
+#ifdef FAST_IO
+  if (fast_exti_ack(ZERO_CROSS_Pin)) {
+    fan_driver_zero_cross_int();
+  }
+#else
   /* USER CODE END EXTI9_5_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_5);
   /* USER CODE BEGIN EXTI9_5_IRQn 1 */
+#endif
+
+  TRACE_ISR_EXIT(ISR_EXTI9_5);
+  ISR_TIMING_END(ISR_EXTI9_5);
 
   /* USER CODE END EXTI9_5_IRQn 1 */
 }
@@ -235,10 +278,21 @@ void TIM3_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM3_IRQn 0 */
 
+  ISR_TIMING_BEGIN();
+  TRACE_ISR_ENTER(ISR_TIM3);
 
+#ifdef FAST_IO
+  if (fast_tim_ack_update(TIM3)) {
+    fan_driver_launch_triac_int();
+  }
+#else
   /* USER CODE END TIM3_IRQn 0 */
   HAL_TIM_IRQHandler(&htim3);
   /* USER CODE BEGIN TIM3_IRQn 1 */
+#endif
+
+  TRACE_ISR_EXIT(ISR_TIM3);
+  ISR_TIMING_END(ISR_TIM3);
 
   /* USER CODE END TIM3_IRQn 1 */
 }
@@ -250,15 +304,50 @@ void TIM4_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM4_IRQn 0 */
 
-  // vfd_driver_int();
+  ISR_TIMING_BEGIN();
+  TRACE_ISR_ENTER(ISR_TIM4);
 
+#ifdef FAST_IO
+  if (fast_tim_ack_update(TIM4)) {
+    vfd_driver_int();
+  }
+#else
   /* USER CODE END TIM4_IRQn 0 */
   HAL_TIM_IRQHandler(&htim4);
   /* USER CODE BEGIN TIM4_IRQn 1 */
+#endif
+
+  TRACE_ISR_EXIT(ISR_TIM4);
+  ISR_TIMING_END(ISR_TIM4);
+
+  watchdog_checkin(WDG_DISPLAY);
 
   /* USER CODE END TIM4_IRQn 1 */
 }
 
+/**
+* @brief This function handles USART1 global interrupt.
+*/
+void USART1_IRQHandler(void)
+{
+  /* USER CODE BEGIN USART1_IRQn 0 */
+
+  ISR_TIMING_BEGIN();
+  TRACE_ISR_ENTER(ISR_USART1);
+
+  // the only reception interrupt, the DMA takes the bytes
+  uart_rx_idle_int();
+
+  /* USER CODE END USART1_IRQn 0 */
+  HAL_UART_IRQHandler(&huart1);
+  /* USER CODE BEGIN USART1_IRQn 1 */
+
+  TRACE_ISR_EXIT(ISR_USART1);
+  ISR_TIMING_END(ISR_USART1);
+
+  /* USER CODE END USART1_IRQn 1 */
+}
+
 /* USER CODE BEGIN 1 */
 
 /* USER CODE END 1 */
@@ -110,7 +110,9 @@
 /*!< Uncomment the following line if you need to relocate your vector Table in
      Internal SRAM. */ 
 /* #define VECT_TAB_SRAM */
-#define VECT_TAB_OFFSET  0x00000000U /*!< Vector Table base offset field. 
+#define VECT_TAB_OFFSET  0x00001400U /*!< Vector Table base offset field, 
+                                  the application is behind the bootloader,
+                                  see boot.h. 
                                   This value must be a multiple of 0x200. */
 
 
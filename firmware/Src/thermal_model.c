@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "thermal_model.h"
+#include "estimator.h"
+
+// initial covariance for unknown and for restored parameters
+#define P_INIT (16 * EST_ONE)
+#define P_RESTORED (EST_ONE / 4)
+// covariance blow-up guard when the input is not exciting
+#define P_MAX (64 * EST_ONE)
+
+static int32_t theta[TM_PARAMS];
+static int32_t P[TM_PARAMS][TM_PARAMS];
+static uint16_t samples;
+
+static inline int32_t __mul(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a * b) >> EST_Q);
+}
+
+void thermal_model_init(const int32_t* params)
+{
+    int32_t p0 = P_INIT;
+
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        theta[i] = params ? params[i] : 0;
+    }
+
+    if (params) {
+        p0 = P_RESTORED;
+        samples = TM_MIN_SAMPLES;
+    } else {
+        samples = 0;
+    }
+
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        for (uint8_t j = 0; j < TM_PARAMS; ++j) {
+            P[i][j] = (i == j) ? p0 : 0;
+        }
+    }
+}
+
+void thermal_model_update(int32_t temp, int32_t rate, int32_t ambient,
+                          uint8_t fanPower)
+{
+    int32_t grad = (ambient - temp) / TM_GRAD_SCALE;
+    int32_t u = EST_FROM_INT(fanPower) / 100;
+
+    int32_t phi[TM_PARAMS] = { EST_ONE, grad, __mul(u, grad) };
+    // per minute
+    int32_t y = rate * 60;
+
+    int32_t Pphi[TM_PARAMS];
+    int32_t den = TM_NOISE;
+    int32_t e = y;
+
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        int64_t acc = 0;
+        for (uint8_t j = 0; j < TM_PARAMS; ++j) {
+            acc += (int64_t)P[i][j] * phi[j];
+        }
+        Pphi[i] = (int32_t)(acc >> EST_Q);
+    }
+
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        den += __mul(phi[i], Pphi[i]);
+        e -= __mul(phi[i], theta[i]);
+    }
+
+    int32_t K[TM_PARAMS];
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        K[i] = (int32_t)(((int64_t)Pphi[i] << EST_Q) / den);
+        theta[i] += __mul(K[i], e);
+    }
+
+    // P = P - K * Pphi' + Q, kept symmetric against the rounding
+    for (uint8_t i = 0; i < TM_PARAMS; ++i) {
+        for (uint8_t j = i; j < TM_PARAMS; ++j) {
+            P[i][j] -= __mul(K[i], Pphi[j]);
+            P[j][i] = P[i][j];
+        }
+
+        P[i][i] += TM_DRIFT;
+        if (P[i][i] > P_MAX) {
+            P[i][i] = P_MAX;
+        } else if (P[i][i] < TM_DRIFT) {
+            P[i][i] = TM_DRIFT;
+        }
+    }
+
+    if (samples < TM_MIN_SAMPLES) {
+        ++samples;
+    }
+}
+
+uint8_t thermal_model_valid()
+{
+    // the fan has to cool the chamber down, kf > 0
+    return (samples >= TM_MIN_SAMPLES) && (theta[2] > 0);
+}
+
+uint8_t thermal_model_feed_forward(int32_t setpoint, int32_t ambient)
+{
+    if (!thermal_model_valid()) {
+        return 0;
+    }
+
+    int32_t grad = (ambient - setpoint) / TM_GRAD_SCALE;
+
+    // 0 = q + k0 * grad + kf * u * grad
+    int32_t heat = theta[0] + __mul(theta[1], grad);
+    int32_t fan = __mul(theta[2], grad);
+
+    if (fan >= 0 || heat <= 0) {
+        // ambient above the setpoint or no heat to remove
+        return 0;
+    }
+
+    int32_t u = (int32_t)(((int64_t)heat * 100) / -fan);
+
+    return (u > 100) ? 100 : u;
+}
+
+const int32_t* thermal_model_params()
+{
+    return theta;
+}
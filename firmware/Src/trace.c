@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "trace.h"
+#include "usart.h"
+
+#ifdef TRACE
+
+// "TS" and two decimals or "T" and two 0x%08x, and the line end
+#define DUMP_LINE_MAX (2 + 2 * 11 + 2)
+
+static struct TraceRecord records[TRACE_BUFFER_SIZE];
+// records ever written, the ring holds the last TRACE_BUFFER_SIZE
+static volatile uint32_t recordCount;
+static volatile uint8_t frozen;
+
+static volatile uint8_t armed = TRACE_TRIG_ALL;
+// recordCount at which the ring freezes, 0 until a trigger fired
+static volatile uint32_t freezeAt;
+
+static uint8_t dumping = 0;
+static uint32_t dumpPos;
+
+// a dump line goes out in one raw write, the log is muted while a 
+// Modbus master talks and the dump must not be, it unfreezes the ring
+static char line[DUMP_LINE_MAX];
+static uint8_t lineLength;
+
+static void __put_char(char c)
+{
+    line[lineLength++] = c;
+}
+
+static void __put_string(const char* s)
+{
+    while (*s) {
+        __put_char(*s++);
+    }
+}
+
+static void __put_int(uint32_t val)
+{
+    char buff[16];
+
+    __put_char(' ');
+    __put_string(my_itoa(val, buff));
+}
+
+static void __put_hex(uint32_t val)
+{
+    static const char digit[] = "0123456789abcdef";
+
+    __put_string(" 0x");
+    for (uint8_t i = 0; i < 8; ++i) {
+        __put_char(digit[(val >> (28 - 4 * i)) & 0xF]);
+    }
+}
+
+static void __begin(const char* tag)
+{
+    lineLength = 0;
+    __put_string(tag);
+}
+
+static void __end()
+{
+    __put_string("\r\n");
+    usart_write((const uint8_t*)line, lineLength);
+}
+
+// with the interrupts disabled
+static void __put(uint32_t cycles, uint8_t type, uint8_t id, uint16_t arg)
+{
+    if (frozen) {
+        return;
+    }
+
+    struct TraceRecord* r = &records[recordCount & (TRACE_BUFFER_SIZE - 1)];
+    ++recordCount;
+
+    r->cycles = cycles;
+    r->type = type;
+    r->id = id;
+    r->arg = arg;
+
+    if (freezeAt && (recordCount == freezeAt)) {
+        frozen = 1;
+    }
+}
+
+void trace_record(uint8_t type, uint8_t id, uint16_t arg)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    __put(DWT->CYCCNT, type, id, arg);
+
+    __set_PRIMASK(primask);
+}
+
+// the begin goes after the interrupts which came meanwhile, 
+// trace_export.py orders the records by time
+void trace_span(uint8_t task, uint32_t begin)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    __put(begin, TRACE_TASK_BEGIN, task, 0);
+    __put(DWT->CYCCNT, TRACE_TASK_END, task, 0);
+
+    __set_PRIMASK(primask);
+}
+
+void trace_trigger(uint8_t trigger)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (!frozen && !freezeAt && (armed & (1 << trigger))) {
+        __put(DWT->CYCCNT, TRACE_MARK, TRACE_MARK_TRIGGER, trigger);
+        freezeAt = recordCount + TRACE_POST_TRIGGER;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+void trace_arm(uint8_t triggers)
+{
+    armed = triggers;
+}
+
+void trace_dump_start()
+{
+    if (!frozen) {
+        send_string_int_ln("Trace not triggered, armed ", armed);
+        return;
+    }
+
+    dumping = 1;
+    dumpPos = (recordCount > TRACE_BUFFER_SIZE) 
+        ? recordCount - TRACE_BUFFER_SIZE : 0;
+
+    __begin("TS");
+    __put_int(recordCount - dumpPos);
+    __put_int(SystemCoreClock);
+    __end();
+}
+
+uint8_t trace_dump_update()
+{
+    if (!dumping) {
+        return 0;
+    }
+
+    // never wait for the UART, the line goes with a later call
+    if (usart_tx_free() < DUMP_LINE_MAX) {
+        return 1;
+    }
+
+    if (dumpPos == recordCount) {
+        __begin("TE");
+        __end();
+        dumping = 0;
+        freezeAt = 0;
+        frozen = 0;
+        return 0;
+    }
+
+    const struct TraceRecord* r = &records[dumpPos & (TRACE_BUFFER_SIZE - 1)];
+    ++dumpPos;
+
+    __begin("T");
+    __put_hex(r->cycles);
+    __put_hex(((uint32_t)r->type << 24) | ((uint32_t)r->id << 16) | r->arg);
+    __end();
+
+    return 1;
+}
+
+#else
+
+void trace_arm(uint8_t triggers)
+{
+}
+
+void trace_dump_start()
+{
+    usart_write((const uint8_t*)"TE\r\n", 4);
+}
+
+uint8_t trace_dump_update()
+{
+    return 0;
+}
+
+#endif // TRACE
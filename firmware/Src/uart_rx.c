@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "uart_rx.h"
+
+uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
+
+static UART_HandleTypeDef* _huart;
+
+// where the next frame starts, updated by the idle interrupt
+static uint8_t frameStart;
+
+// closed frames, written by the interrupt, read by the main loop
+static struct UartFrame queue[UART_RX_QUEUE_SIZE];
+static volatile uint8_t head;
+static volatile uint8_t tail;
+
+void uart_rx_init(UART_HandleTypeDef* huart)
+{
+    _huart = huart;
+    frameStart = 0;
+    head = 0;
+    tail = 0;
+
+    // no half/full transfer interrupts, the DMA just keeps going round
+    HAL_DMA_Start(huart->hdmarx, (uint32_t)&huart->Instance->DR,
+                  (uint32_t)uart_rx_buffer, UART_RX_BUFFER_SIZE);
+    SET_BIT(huart->Instance->CR3, USART_CR3_DMAR);
+
+    __HAL_UART_CLEAR_IDLEFLAG(huart);
+    __HAL_UART_ENABLE_IT(huart, UART_IT_IDLE);
+}
+
+uint8_t uart_rx_frame(struct UartFrame* f)
+{
+    if (tail == head) {
+        return 0;
+    }
+
+    *f = queue[tail];
+    tail = (tail + 1) % UART_RX_QUEUE_SIZE;
+
+    return 1;
+}
+
+void uart_rx_idle_int()
+{
+    if (!_huart || !__HAL_UART_GET_FLAG(_huart, UART_FLAG_IDLE)) {
+        return;
+    }
+
+    // reading SR then DR clears the idle and the overrun flags
+    __HAL_UART_CLEAR_IDLEFLAG(_huart);
+
+    uint8_t end = UART_RX_BUFFER_SIZE 
+        - __HAL_DMA_GET_COUNTER(_huart->hdmarx);
+    uint8_t length = end - frameStart;
+
+    if (length == 0) {
+        // a whole buffer or nothing, either way there is no valid frame
+        return;
+    }
+
+    uint8_t next = (head + 1) % UART_RX_QUEUE_SIZE;
+
+    if (next != tail) {
+        queue[head].start = frameStart;
+        queue[head].length = length;
+        head = next;
+    }
+    // else the main loop is late, the frame is dropped
+
+    frameStart = end;
+}
@@ -28,21 +28,172 @@
 
 static UART_HandleTypeDef* _huart;
 
+static uint8_t muted;
+static uint32_t mutedSince_ms;
+static uint32_t mutedFor_ms;
+
+// written by the main loop, drained by the DMA
+static uint8_t txBuffer[USART_TX_BUFFER_SIZE];
+static volatile uint16_t txHead;
+static volatile uint16_t txTail;
+// bytes handed to the running transfer
+static volatile uint16_t txChunk;
+static volatile uint8_t txBusy;
+// where the last raw write ended, a mute keeps what is before it
+static uint16_t rawEnd;
+
+// with the USART interrupt unable to run, it has to be called
+// with the interrupts masked or from the interrupt itself
+static void __tx_start()
+{
+	if (txBusy || (txHead == txTail)) {
+		return;
+	}
+
+	// up to the wrap, the rest goes with the next transfer
+	uint16_t end = (txHead > txTail) ? txHead : USART_TX_BUFFER_SIZE;
+
+	txChunk = end - txTail;
+	txBusy = 1;
+	if (HAL_UART_Transmit_DMA(_huart, &txBuffer[txTail], txChunk) 
+		!= HAL_OK) {
+		// retried with the next write
+		txBusy = 0;
+	}
+}
+
+static void __tx_kick()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	__tx_start();
+	__set_PRIMASK(primask);
+}
+
+static uint8_t __tx_can_wait()
+{
+	// nothing drains the buffer from an interrupt or with them masked
+	return (__get_IPSR() == 0) && (__get_PRIMASK() == 0);
+}
+
+// bytes from the tail to i, in the order they go out
+static uint16_t __tx_distance(uint16_t i)
+{
+	return (i + USART_TX_BUFFER_SIZE - txTail) % USART_TX_BUFFER_SIZE;
+}
+
+static void __tx_put(uint8_t c)
+{
+	uint16_t next = (txHead + 1) % USART_TX_BUFFER_SIZE;
+
+	if (next == txTail) {
+		if (!__tx_can_wait()) {
+			return;
+		}
+
+		__tx_kick();
+		while (next == txTail);
+	}
+
+	txBuffer[txHead] = c;
+	txHead = next;
+}
+
 void usart_config(UART_HandleTypeDef* huart)
 {
 	_huart = huart;
 }
 
+uint16_t usart_tx_free()
+{
+	return (txTail + USART_TX_BUFFER_SIZE - txHead - 1) 
+		% USART_TX_BUFFER_SIZE;
+}
+
+static uint8_t __log_muted()
+{
+	if (muted) {
+		if (HAL_GetTick() - mutedSince_ms < mutedFor_ms) {
+			return 1;
+		}
+		muted = 0;
+	}
+
+	return 0;
+}
+
+void usart_mute(uint32_t duration_ms)
+{
+	// muted already, what is waiting are raw writes (the previous
+	// responses), only the log text from before the mute is dropped
+	uint8_t drop = !__log_muted();
+
+	muted = 1;
+	mutedSince_ms = HAL_GetTick();
+	mutedFor_ms = duration_ms;
+
+	if (!drop) {
+		return;
+	}
+
+	// only the running transfer and the raw writes go out
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint16_t keep = txBusy 
+		? (txTail + txChunk) % USART_TX_BUFFER_SIZE : txTail;
+	if ((__tx_distance(rawEnd) <= __tx_distance(txHead))
+		&& (__tx_distance(rawEnd) > __tx_distance(keep))) {
+		keep = rawEnd;
+	}
+	txHead = keep;
+	__set_PRIMASK(primask);
+}
+
+void usart_flush()
+{
+	if (!_huart || !__tx_can_wait()) {
+		return;
+	}
+
+	__tx_kick();
+	while (txBusy || (txHead != txTail));
+	while (!__HAL_UART_GET_FLAG(_huart, UART_FLAG_TC));
+}
+
+void usart_write(const uint8_t* data, uint16_t size)
+{
+	if (!_huart) {
+		return;
+	}
+
+	while (size--) {
+		__tx_put(*data++);
+	}
+	rawEnd = txHead;
+	__tx_kick();
+}
+
 void send_char(char c)
 {
-	HAL_UART_Transmit(_huart, (uint8_t*)&c, sizeof(char), HAL_MAX_DELAY);
+	if (!_huart || __log_muted()) {
+		// not initialized yet or muted
+		return;
+	}
+
+	__tx_put(c);
+	__tx_kick();
 }
 
 void send_string(const char* s)
 {
+	if (!_huart || __log_muted()) {
+		return;
+	}
+
 	while (*s) {
-		send_char(*s++);
+		__tx_put(*s++);
 	}
+	__tx_kick();
 }
 
 void send_int(uint32_t val)
@@ -52,6 +203,19 @@ void send_int(uint32_t val)
 	send_string(buff);
 }
 
+void send_hex(uint32_t val)
+{
+	char const digit[] = "0123456789abcdef";
+	char buff[11] = "0x";
+
+	for (uint8_t i = 0; i < 8; ++i) {
+		buff[2 + i] = digit[(val >> (28 - 4 * i)) & 0xF];
+	}
+	buff[10] = '\0';
+
+	send_string(buff);
+}
+
 void send_ln()
 {
 	send_string("\r\n");
@@ -92,3 +256,14 @@ char* my_itoa(uint32_t i, char b[])
 
 	return b;
 }
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
+{
+	if (huart != _huart) {
+		return;
+	}
+
+	txTail = (txTail + txChunk) % USART_TX_BUFFER_SIZE;
+	txBusy = 0;
+	__tx_start();
+}
@@ -24,9 +24,14 @@
  */
 
 #include "vfd_driver.h"
-#include "stm32f1xx_hal.h"
+#include "vfd_pinmap.h"
+#include "fast_io.h"
 
-#define SECTIONS 5
+#define SECTIONS VFD_SECTIONS
+
+#if VFD_BLANK_TICKS < 1
+#error "the anodes change in the blanking interval, it takes a tick at least"
+#endif
 
 static uint8_t vfd_sections[SECTIONS];
 
@@ -40,15 +45,60 @@ static const uint8_t num_lookup_table[16] = {
     0x6F, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71
 };
 
+static const uint8_t section_dwell[SECTIONS] = VFD_SECTION_DWELL;
+static const uint8_t segment_dwell[8] = VFD_SEGMENT_DWELL;
+
+// lit segments in a nibble
+static const uint8_t nibble_bits[16] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+/*
+ Dark ticks per lit one in 1/16, by the level. The relative brightness
+ r = 1 / (1 + dark) follows the gamma 2.2 curve over the 5:1 range of
+ the old brightness steps, r = 0.2 + 0.8 * (level / 31)^2.2, so the
+ levels look evenly spaced:
+    dark = round(16 * (1 / r - 1))
+ */
+static const uint8_t level_dark[VFD_LEVELS] = {
+    64, 64, 63, 62, 61, 59, 56, 53, 50, 47, 44, 41, 37, 34, 31, 28,
+    25, 23, 20, 18, 16, 14, 12, 10,  8,  7,  6,  4,  3,  2,  1,  0
+};
+
+// level change per tick in 1/256 of a level, in 1/16
+#define FADE_STEP ((VFD_LEVELS - 1) * 256UL * 16 / VFD_FADE_TICKS)
+
+#if FADE_STEP < 1
+#error "VFD_FADE_TICKS too long for the fade resolution"
+#endif
+
 static uint8_t current_section;
 
-static volatile uint8_t skip_every_int;
-static uint8_t skip_counter;
+// level in 1/256, the ISR walks fade_level towards fade_target once
+// per frame
+static volatile uint16_t fade_target;
+static volatile uint8_t fade_jump;
+static uint16_t fade_level;
+static uint8_t fade_rest;
+static uint16_t frame_ticks;
+
+// dark ticks for every lit one in 1/16, the brightness of the frame
+static uint8_t dark_per_tick;
+static uint8_t dark_rest;
+
+// ticks left in the lit or dark phase of the current section
+static uint8_t phase_ticks;
+static uint8_t section_lit;
+static uint8_t dwell;
 
 void vfd_driver_init()
 {
-    skip_every_int = VFD_BRID_MAX;
-    skip_counter = 0;
+    fade_target = (VFD_LEVELS - 1) << 8;
+    fade_level = fade_target;
+    fade_jump = 0;
+    dark_per_tick = 0;
+    phase_ticks = 0;
+    section_lit = 0;
 }
 
 void vfd_driver_light_cust(uint8_t dig_num, uint8_t segs)
@@ -91,6 +141,18 @@ void vfd_driver_print_right(uint8_t num)
     __vfd_driver_print(num, 1, 0);
 }
 
+void vfd_driver_print_labeled(uint8_t label, uint8_t num)
+{
+    vfd_driver_clear();
+    vfd_driver_light_cust(3, label);
+
+    if (num >= 100) {
+        vfd_driver_light_cust(2, num_lookup_table[num / 100]);
+        num %= 100;
+    }
+    vfd_driver_print_right(num);
+}
+
 void vfd_driver_clear()
 {
     vfd_sections[0] = 0;
@@ -100,141 +162,207 @@ void vfd_driver_clear()
     vfd_sections[4] = 0;
 }
 
-#define SET_VFD(pin) \
-HAL_GPIO_WritePin(C_ANODES_##pin##_GPIO_Port, C_ANODES_##pin##_Pin, GPIO_PIN_SET);
-
-#define RESET_VFD(pin) \
-HAL_GPIO_WritePin(C_ANODES_##pin##_GPIO_Port, C_ANODES_##pin##_Pin, GPIO_PIN_RESET);
-
-static void __clear_all_sections()
-{
-    HAL_GPIO_WritePin(C_GRID_SEC_1_GPIO_Port, C_GRID_SEC_1_Pin, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(C_GRID_SEC_2_GPIO_Port, C_GRID_SEC_2_Pin, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(C_GRID_SEC_3_GPIO_Port, C_GRID_SEC_3_Pin, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(C_GRID_SEC_4_GPIO_Port, C_GRID_SEC_4_Pin, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(C_GRID_SEC_5_GPIO_Port, C_GRID_SEC_5_Pin, GPIO_PIN_RESET);
-}
-
-static void __select_section(uint8_t s)
-{
-    switch (s) {
-    case 0:        
-        HAL_GPIO_WritePin(C_GRID_SEC_2_GPIO_Port, C_GRID_SEC_2_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_3_GPIO_Port, C_GRID_SEC_3_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_4_GPIO_Port, C_GRID_SEC_4_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_5_GPIO_Port, C_GRID_SEC_5_Pin, GPIO_PIN_RESET);
-
-        HAL_GPIO_WritePin(C_GRID_SEC_1_GPIO_Port, C_GRID_SEC_1_Pin, GPIO_PIN_SET);
-        break;
-    case 1:
-        HAL_GPIO_WritePin(C_GRID_SEC_1_GPIO_Port, C_GRID_SEC_1_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_3_GPIO_Port, C_GRID_SEC_3_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_4_GPIO_Port, C_GRID_SEC_4_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_5_GPIO_Port, C_GRID_SEC_5_Pin, GPIO_PIN_RESET);
-
-        HAL_GPIO_WritePin(C_GRID_SEC_2_GPIO_Port, C_GRID_SEC_2_Pin, GPIO_PIN_SET);
-        break;
-    case 2:
-        HAL_GPIO_WritePin(C_GRID_SEC_1_GPIO_Port, C_GRID_SEC_1_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_2_GPIO_Port, C_GRID_SEC_2_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_4_GPIO_Port, C_GRID_SEC_4_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_5_GPIO_Port, C_GRID_SEC_5_Pin, GPIO_PIN_RESET);
-
-        HAL_GPIO_WritePin(C_GRID_SEC_3_GPIO_Port, C_GRID_SEC_3_Pin, GPIO_PIN_SET);
-        break;
-    case 3:
-        HAL_GPIO_WritePin(C_GRID_SEC_1_GPIO_Port, C_GRID_SEC_1_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_2_GPIO_Port, C_GRID_SEC_2_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_3_GPIO_Port, C_GRID_SEC_3_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_5_GPIO_Port, C_GRID_SEC_5_Pin, GPIO_PIN_RESET);
-
-        HAL_GPIO_WritePin(C_GRID_SEC_4_GPIO_Port, C_GRID_SEC_4_Pin, GPIO_PIN_SET);
-        break;
-    case 4:
-        HAL_GPIO_WritePin(C_GRID_SEC_1_GPIO_Port, C_GRID_SEC_1_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_2_GPIO_Port, C_GRID_SEC_2_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_3_GPIO_Port, C_GRID_SEC_3_Pin, GPIO_PIN_RESET);
-        HAL_GPIO_WritePin(C_GRID_SEC_4_GPIO_Port, C_GRID_SEC_4_Pin, GPIO_PIN_RESET);
-        
-        HAL_GPIO_WritePin(C_GRID_SEC_5_GPIO_Port, C_GRID_SEC_5_Pin, GPIO_PIN_SET);
-        break;
+void vfd_driver_get_sections(uint8_t* sections)
+{
+    for (uint8_t i = 0; i < SECTIONS; ++i) {
+        sections[i] = vfd_sections[i];
     }
 }
 
-#define ENCODE_VFD_BIT(value, bit, seg) \
-    if (value & bit) { \
-        SET_VFD(seg); \
-    } else { \
-        RESET_VFD(seg); \
-    }
+// ----------------------------------------
+// Port words generated from vfd_pinmap.h
+// ----------------------------------------
+
+// BSRR word setting (on) or resetting the pin if it belongs to the port
+#define __PIN_WORD(name, on, port) \
+    ((name##_GPIO_Port != (port)) ? 0UL \
+        : (on) ? (uint32_t)name##_Pin : ((uint32_t)name##_Pin << 16))
+
+#define __ANODE_WORD(name, bit, port, value) \
+    | __PIN_WORD(name, (value) & (bit), port)
+
+#define __GRID_WORD(name, sec, port, s) \
+    | __PIN_WORD(name, (sec) == (s), port)
+
+#define __GRID_OFF_WORD(name, sec, port, unused) \
+    | __PIN_WORD(name, 0, port)
+
+#define __DIGIT_WORD(port, value) \
+    (0 VFD_DIGIT_ANODES(__ANODE_WORD, port, value) \
+       VFD_DOT_ANODES(__ANODE_WORD, port, 0))
+
+#define __DOTS_WORD(port, value) \
+    (0 VFD_DIGIT_ANODES(__ANODE_WORD, port, 0) \
+       VFD_DOT_ANODES(__ANODE_WORD, port, value))
+
+struct PortWords
+{
+    uint32_t A;
+    uint32_t B;
+};
+
+#define __DIGIT_ROW(v) { __DIGIT_WORD(GPIOA, v), __DIGIT_WORD(GPIOB, v) },
+#define __DIGIT_ROW4(v) \
+    __DIGIT_ROW(v) __DIGIT_ROW(v + 1) __DIGIT_ROW(v + 2) __DIGIT_ROW(v + 3)
+#define __DIGIT_ROW16(v) \
+    __DIGIT_ROW4(v) __DIGIT_ROW4(v + 4) __DIGIT_ROW4(v + 8) __DIGIT_ROW4(v + 12)
+#define __DIGIT_ROW64(v) \
+    __DIGIT_ROW16(v) __DIGIT_ROW16(v + 16) \
+    __DIGIT_ROW16(v + 32) __DIGIT_ROW16(v + 48)
+
+// anodes for every segment combination, the dots anodes are off
+static const struct PortWords digit_words[0x80] = {
+    __DIGIT_ROW64(0)
+    __DIGIT_ROW64(64)
+};
+
+// dots anodes, the digit anodes are off
+static const struct PortWords dots_words[4] = {
+    { __DOTS_WORD(GPIOA, 0), __DOTS_WORD(GPIOB, 0) },
+    { __DOTS_WORD(GPIOA, 1), __DOTS_WORD(GPIOB, 1) },
+    { __DOTS_WORD(GPIOA, 2), __DOTS_WORD(GPIOB, 2) },
+    { __DOTS_WORD(GPIOA, 3), __DOTS_WORD(GPIOB, 3) }
+};
+
+#define __SECTION_ROW(s) \
+    { (0 VFD_GRIDS(__GRID_WORD, GPIOA, s)), (0 VFD_GRIDS(__GRID_WORD, GPIOB, s)) }
+
+// selected grid on, the others off
+static const struct PortWords grid_words[SECTIONS] = {
+    __SECTION_ROW(0),
+    __SECTION_ROW(1),
+    __SECTION_ROW(2),
+    __SECTION_ROW(3),
+    __SECTION_ROW(4)
+};
+
+static const struct PortWords grids_off = {
+    (0 VFD_GRIDS(__GRID_OFF_WORD, GPIOA, 0)),
+    (0 VFD_GRIDS(__GRID_OFF_WORD, GPIOB, 0))
+};
 
+static inline void __clear_all_sections()
+{
+    fast_gpio_bsrr(GPIOA, grids_off.A);
+    fast_gpio_bsrr(GPIOB, grids_off.B);
+}
 
-static void __encode_section(uint8_t value)
+// the grids are spread over both ports, all anodes are settled before
+// the grid goes on, otherwise the anodes of the other port would still
+// show the previous section on the new grid for a moment
+static inline void __light_section(uint8_t s, uint8_t value)
 {
-    ENCODE_VFD_BIT(value, 0x1, A);
-    ENCODE_VFD_BIT(value, 0x2, B);
-    ENCODE_VFD_BIT(value, 0x4, C);
-    ENCODE_VFD_BIT(value, 0x8, D);
-    ENCODE_VFD_BIT(value, 0x10, E);
-    ENCODE_VFD_BIT(value, 0x20, F);
-    ENCODE_VFD_BIT(value, 0x40, G);
+    const struct PortWords* anodes = (s == VFD_DOTS_SECTION)
+        ? &dots_words[value & 0x03] : &digit_words[value & 0x7F];
+    const struct PortWords* grid = &grid_words[s];
+
+    fast_gpio_bsrr(GPIOA, anodes->A);
+    fast_gpio_bsrr(GPIOB, anodes->B);
+    fast_gpio_bsrr(GPIOA, grid->A);
+    fast_gpio_bsrr(GPIOB, grid->B);
 }
 
 void vfd_driver_set_brightness(enum VfdBrightness b)
 {
-    switch (b) {
-    case VFD_BRID_MIN:
-        skip_every_int = 4;
-        break;
-    case VFD_BRID_25:
-        skip_every_int = 3;
-        break;
-    case VFD_BRID_50:
-        skip_every_int = 2;
-        break;
-    case VFD_BRID_MAX:
-        skip_every_int = 0;
-        break;
+    if (b > VFD_BRID_MAX) {
+        b = VFD_BRID_MAX;
+    }
+    vfd_driver_set_level(b * (VFD_LEVELS - 1) / VFD_BRID_MAX);
+}
+
+void vfd_driver_fade_to(uint8_t level)
+{
+    if (level >= VFD_LEVELS) {
+        level = VFD_LEVELS - 1;
+    }
+    fade_target = (uint16_t)level << 8;
+}
+
+void vfd_driver_set_level(uint8_t level)
+{
+    vfd_driver_fade_to(level);
+    fade_jump = 1;
+}
+
+// once per frame, moves the level by the ticks the frame took and
+// interpolates the curve between two levels
+static inline void __fade_frame()
+{
+    // the flag first, the target is set before it
+    uint8_t jump = fade_jump;
+    uint16_t target = fade_target;
+
+    if (jump) {
+        fade_jump = 0;
+        fade_level = target;
+    } else if (fade_level != target) {
+        uint16_t step = frame_ticks * FADE_STEP + fade_rest;
+        fade_rest = step & 0x0F;
+        step >>= 4;
+
+        if (fade_level < target) {
+            fade_level = (target - fade_level > step) 
+                ? fade_level + step : target;
+        } else {
+            fade_level = (fade_level - target > step) 
+                ? fade_level - step : target;
+        }
+    }
+    frame_ticks = 0;
+
+    uint8_t i = fade_level >> 8;
+    uint8_t frac = fade_level & 0xFF;
+    uint8_t dark = level_dark[i];
+
+    if (frac) {
+        dark -= ((dark - level_dark[i + 1]) * frac) >> 8;
     }
+    dark_per_tick = dark;
+}
+
+static inline uint8_t __dwell(uint8_t s, uint8_t value)
+{
+    uint8_t segments = nibble_bits[value & 0x0F] 
+        + nibble_bits[(value >> 4) & 0x07];
+
+    return section_dwell[s] + segment_dwell[segments];
 }
 
+/*
+ Per section: lit for its dwell, then the grids go off for the blanking
+ interval and, below the full brightness, for the dwell times
+ dark_per_tick more, the fraction carried to the next section. The
+ anodes change only with all grids off.
+ */
 void vfd_driver_int()
 {
-    __clear_all_sections();
-    
-    if (skip_counter >= skip_every_int) {
-        skip_counter = 0;
-    } else {
-        ++skip_counter;
+    ++frame_ticks;
+
+    if (phase_ticks) {
+        --phase_ticks;
+        return;
+    }
+
+    if (section_lit) {
+        __clear_all_sections();
+        section_lit = 0;
+        uint16_t dark = dwell * dark_per_tick + dark_rest;
+        dark_rest = dark & 0x0F;
+        phase_ticks = VFD_BLANK_TICKS + (dark >> 4) - 1;
         return;
     }
 
     ++current_section;
     current_section = current_section % SECTIONS;
 
-    if (current_section == 2) {
-        if (vfd_sections[2] & VFD_DOT_H) {
-            HAL_GPIO_WritePin(C_ANODE_DOT_H_GPIO_Port, 
-                              C_ANODE_DOT_H_Pin, 
-                              GPIO_PIN_SET);
-        } else {
-            HAL_GPIO_WritePin(C_ANODE_DOT_H_GPIO_Port, 
-                              C_ANODE_DOT_H_Pin, 
-                              GPIO_PIN_RESET);
-        }
-
-        if (vfd_sections[2] & VFD_DOT_L) {
-            HAL_GPIO_WritePin(C_ANODE_DOT_L_GPIO_Port, 
-                              C_ANODE_DOT_L_Pin, 
-                              GPIO_PIN_SET);
-        } else {
-            HAL_GPIO_WritePin(C_ANODE_DOT_L_GPIO_Port, 
-                              C_ANODE_DOT_L_Pin, 
-                              GPIO_PIN_RESET);
-        }
-    } else {
-        __encode_section(vfd_sections[current_section]);
+    if (current_section == 0) {
+        __fade_frame();
     }
 
-    __select_section(current_section);
-}
\ No newline at end of file
+    uint8_t value = vfd_sections[current_section];
+
+    dwell = __dwell(current_section, value);
+    __light_section(current_section, value);
+    section_lit = 1;
+    phase_ticks = dwell - 1;
+}
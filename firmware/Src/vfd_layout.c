@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "vfd_layout.h"
+#include "vfd_driver.h"
+#include "vfd_text.h"
+
+#define PAIR_MIN -9
+#define PAIR_MAX 99
+
+#define SEG_DEGREE (VFD_SEG_A | VFD_SEG_B | VFD_SEG_F | VFD_SEG_G)
+
+void vfd_layout_init(struct VfdLayout* layout)
+{
+    layout->valid = 0;
+    layout->single = 0;
+}
+
+// display units [hundredths of a degree]
+#define UNIT_TENTH 10
+#define UNIT_DEGREE 100
+
+static int32_t __hundredths(int32_t value, uint8_t frac_bits)
+{
+    int64_t h = ((int64_t)value * 100 + ((int64_t)1 << frac_bits >> 1)) 
+        >> frac_bits;
+
+    return (h < -99999) ? -99999 : (h > 99999) ? 99999 : h;
+}
+
+// to the nearest whole unit, halves away from zero
+static int32_t __round(int32_t hundredths, int32_t unit)
+{
+    int32_t half = unit / 2;
+
+    return ((hundredths >= 0) ? (hundredths + half) / unit 
+            : -((half - hundredths) / unit)) * unit;
+}
+
+// the unit of the right value alone, tenths as long as they fit
+static int32_t __single_unit(int32_t hundredths)
+{
+    int32_t tenths = __round(hundredths, UNIT_TENTH);
+
+    return ((tenths >= -990) && (tenths <= 9990)) ? UNIT_TENTH : UNIT_DEGREE;
+}
+
+static void __filter(int32_t* shown, int32_t value, int32_t unit, 
+                     uint8_t valid)
+{
+    int32_t d = value - *shown;
+    int32_t limit = unit / 2 + unit * VFD_LAYOUT_HYST / 100;
+
+    // a unit which was not the shown value's moves it at once
+    if (!valid || (*shown % unit) || (d > limit) || (d < -limit)) {
+        *shown = __round(value, unit);
+    }
+}
+
+static inline uint8_t __digit(uint8_t d)
+{
+    return vfd_text_glyph('0' + d);
+}
+
+// a pair from its left digit, the integer part only
+static void __pair(uint8_t digit, int16_t v)
+{
+    if (v < 0) {
+        vfd_driver_light_cust(digit, vfd_text_glyph('-'));
+        vfd_driver_light_cust(digit - 1, __digit(-v));
+    } else {
+        vfd_driver_light_cust(digit, __digit(v / 10));
+        vfd_driver_light_cust(digit - 1, __digit(v % 10));
+    }
+}
+
+static void __single(int16_t tenths)
+{
+    uint16_t a = (tenths < 0) ? -tenths : tenths;
+    int16_t v = __round(tenths * 10, UNIT_DEGREE) / UNIT_DEGREE;
+
+    // "-" takes the tens digit
+    if ((tenths >= 0) ? (a <= 999) : (a <= 99)) {
+        uint8_t whole = a / 10;
+
+        if (tenths < 0) {
+            vfd_driver_light_cust(3, vfd_text_glyph('-'));
+        } else if (whole >= 10) {
+            vfd_driver_light_cust(3, __digit(whole / 10));
+        }
+        vfd_driver_light_cust(2, __digit(whole % 10));
+        vfd_driver_light_dots(VFD_DOT_L);
+        vfd_driver_light_cust(1, __digit(a % 10));
+        vfd_driver_light_cust(0, SEG_DEGREE);
+    } else if ((v >= -99) && (v <= 999)) {
+        uint16_t n = (v < 0) ? -v : v;
+        uint8_t digit = 0;
+
+        do {
+            vfd_driver_light_cust(digit++, __digit(n % 10));
+            n /= 10;
+        } while (n);
+
+        if (v < 0) {
+            vfd_driver_light_cust(digit, vfd_text_glyph('-'));
+        }
+    } else {
+        vfd_driver_light_cust(3, vfd_text_glyph((v > 0) ? 'H' : 'L'));
+        vfd_driver_light_cust(2, vfd_text_glyph((v > 0) ? 'I' : 'O'));
+    }
+}
+
+static uint8_t __pair_fits(int32_t hundredths, int8_t margin)
+{
+    int32_t v = __round(hundredths, UNIT_DEGREE) / UNIT_DEGREE;
+
+    return (v >= PAIR_MIN + margin) && (v <= PAIR_MAX - margin);
+}
+
+void vfd_layout_render(struct VfdLayout* layout, int32_t left, 
+                       int32_t right, uint8_t frac_bits)
+{
+    int32_t l = __hundredths(left, frac_bits);
+    int32_t r = __hundredths(right, frac_bits);
+
+    // a degree of hysteresis on the way back to the pairs
+    uint8_t margin = layout->single ? 1 : 0;
+
+    layout->single = !__pair_fits(l, margin) || !__pair_fits(r, margin);
+
+    // the left value is kept in degrees for the pairs to come back to
+    __filter(&layout->left, l, UNIT_DEGREE, layout->valid);
+    if (!layout->single) {
+        __filter(&layout->right, r, UNIT_DEGREE, layout->valid);
+    } else {
+        int32_t unit = layout->valid 
+            ? __single_unit(layout->right) : __single_unit(r);
+
+        __filter(&layout->right, r, unit, layout->valid);
+        // past the end of the tenths, or back into them
+        if (__single_unit(layout->right) != unit) {
+            layout->right = __round(r, __single_unit(layout->right));
+        }
+    }
+    layout->valid = 1;
+
+    vfd_driver_clear();
+
+    if (layout->single) {
+        __single(layout->right / UNIT_TENTH);
+    } else {
+        __pair(3, layout->left / UNIT_DEGREE);
+        __pair(1, layout->right / UNIT_DEGREE);
+    }
+}
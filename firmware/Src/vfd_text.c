@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "vfd_text.h"
+#include "vfd_driver.h"
+
+#define DIGITS 4
+// blank digits between the end of a scrolling text and its start
+#define SCROLL_GAP 3
+
+// printable ASCII from ' ', segments A (bit 0) to G (bit 6)
+static const uint8_t font[0x7F - ' '] = {
+    0x00, 0x06, 0x22, 0x7E, 0x6D, 0x52, 0x46, 0x20, //   ! " # $ % & '
+    0x39, 0x0F, 0x63, 0x70, 0x0C, 0x40, 0x08, 0x52, // ( ) * + , - . /
+    0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, // 0 1 2 3 4 5 6 7
+    0x7F, 0x6F, 0x09, 0x0D, 0x61, 0x48, 0x43, 0x53, // 8 9 : ; < = > ?
+    0x5F, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71, 0x3D, // @ A B C D E F G
+    0x76, 0x30, 0x1E, 0x75, 0x38, 0x37, 0x37, 0x3F, // H I J K L M N O
+    0x73, 0x67, 0x31, 0x6D, 0x78, 0x3E, 0x3E, 0x7E, // P Q R S T U V W
+    0x76, 0x6E, 0x5B, 0x39, 0x64, 0x0F, 0x23, 0x08, // X Y Z [ \ ] ^ _
+    0x02, 0x5F, 0x7C, 0x58, 0x5E, 0x7B, 0x71, 0x6F, // ` a b c d e f g
+    0x74, 0x10, 0x0E, 0x75, 0x30, 0x54, 0x54, 0x5C, // h i j k l m n o
+    0x73, 0x67, 0x50, 0x6D, 0x78, 0x1C, 0x1C, 0x1C, // p q r s t u v w
+    0x76, 0x6E, 0x5B, 0x46, 0x30, 0x70, 0x01, // x y z { | } ~
+};
+
+struct Message
+{
+    uint8_t glyphs[VFD_TEXT_MAX];
+    uint8_t length;
+    uint8_t priority;
+    uint16_t duration_ms;
+};
+
+// oldest first
+static struct Message queue[VFD_TEXT_QUEUE];
+static uint8_t queued = 0;
+
+// the message on the display, VFD_TEXT_QUEUE if none
+static uint8_t shown = VFD_TEXT_QUEUE;
+static uint32_t shownSince_ms;
+static uint32_t step_ms;
+static uint8_t position;
+
+uint8_t vfd_text_glyph(char c)
+{
+    if ((c < ' ') || (c >= 0x7F)) {
+        return 0;
+    }
+    return font[c - ' '];
+}
+
+void vfd_text_show(const char* text)
+{
+    vfd_driver_clear();
+    for (uint8_t d = 0; (d < DIGITS) && *text; ++d) {
+        vfd_driver_light_cust(DIGITS - 1 - d, vfd_text_glyph(*text++));
+    }
+}
+
+static void __remove(uint8_t i)
+{
+    for (; i + 1 < queued; ++i) {
+        queue[i] = queue[i + 1];
+    }
+    --queued;
+}
+
+// the same text with the same priority
+static uint8_t __equal(const struct Message* m, const char* text,
+                       uint8_t priority)
+{
+    uint8_t i = 0;
+
+    if (m->priority != priority) {
+        return 0;
+    }
+    for (; (i < m->length) && text[i]; ++i) {
+        if (m->glyphs[i] != vfd_text_glyph(text[i])) {
+            return 0;
+        }
+    }
+    // longer texts are cut at VFD_TEXT_MAX
+    return (i == m->length) && (!text[i] || (i == VFD_TEXT_MAX));
+}
+
+uint8_t vfd_text_post(const char* text, enum VfdTextPriority priority,
+                      uint16_t duration_ms)
+{
+    for (uint8_t i = 0; i < queued; ++i) {
+        if (__equal(&queue[i], text, priority)) {
+            return 1;
+        }
+    }
+
+    if (queued == VFD_TEXT_QUEUE) {
+        // the oldest of the lowest priority makes room, not the one on
+        // the display
+        uint8_t victim = VFD_TEXT_QUEUE;
+
+        for (uint8_t i = 0; i < queued; ++i) {
+            if ((i != shown) && (queue[i].priority <= priority)
+                && ((victim == VFD_TEXT_QUEUE) 
+                    || (queue[i].priority < queue[victim].priority))) {
+                victim = i;
+            }
+        }
+        if (victim == VFD_TEXT_QUEUE) {
+            return 0;
+        }
+
+        __remove(victim);
+        if ((shown != VFD_TEXT_QUEUE) && (shown > victim)) {
+            --shown;
+        }
+    }
+
+    struct Message* m = &queue[queued++];
+
+    m->length = 0;
+    while (*text && (m->length < VFD_TEXT_MAX)) {
+        m->glyphs[m->length++] = vfd_text_glyph(*text++);
+    }
+    m->priority = priority;
+    m->duration_ms = duration_ms;
+
+    return 1;
+}
+
+uint8_t vfd_text_active()
+{
+    return queued != 0;
+}
+
+static uint8_t __next()
+{
+    uint8_t best = 0;
+
+    for (uint8_t i = 1; i < queued; ++i) {
+        if (queue[i].priority > queue[best].priority) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void __render(const struct Message* m)
+{
+    uint8_t span = (m->length > DIGITS) ? m->length + SCROLL_GAP : DIGITS;
+
+    vfd_driver_clear();
+    // digit 3 is the leftmost one
+    for (uint8_t d = 0; d < DIGITS; ++d) {
+        uint8_t i = (position + d) % span;
+
+        vfd_driver_light_cust(DIGITS - 1 - d, 
+                              (i < m->length) ? m->glyphs[i] : 0);
+    }
+}
+
+uint8_t vfd_text_update(uint32_t now_ms, uint8_t paused)
+{
+    if (!queued) {
+        return 0;
+    }
+
+    // the display was taken over, the message starts over afterwards
+    if (paused) {
+        shown = VFD_TEXT_QUEUE;
+        return 0;
+    }
+
+    if ((shown != VFD_TEXT_QUEUE)
+        && (now_ms - shownSince_ms >= queue[shown].duration_ms)) {
+        __remove(shown);
+        shown = VFD_TEXT_QUEUE;
+
+        if (!queued) {
+            return 1;
+        }
+    }
+
+    // a higher priority message takes over at once, the one it
+    // replaced starts over when its turn comes again
+    uint8_t next = __next();
+
+    if (next != shown) {
+        shown = next;
+        shownSince_ms = now_ms;
+        step_ms = now_ms;
+        position = 0;
+        __render(&queue[shown]);
+        return 0;
+    }
+
+    const struct Message* m = &queue[shown];
+
+    if ((m->length > DIGITS) && (now_ms - step_ms >= VFD_TEXT_SCROLL_MS)) {
+        step_ms += VFD_TEXT_SCROLL_MS;
+        position = (position + 1) % (m->length + SCROLL_GAP);
+        __render(m);
+    }
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "watchdog.h"
+#include "usart.h"
+
+#define STARVED_MAGIC 0x57444f47 // "WDOG"
+
+struct TaskDef
+{
+    const char* name;
+    uint32_t deadline_ms;
+};
+
+static const struct TaskDef tasks[WDG_TASKS] = {
+    { "acquisition", 3000 },
+    { "control", 12000 },
+    { "display", 1000 },
+    { "ui", 1000 }
+};
+
+struct ResetFlag
+{
+    uint8_t flag;
+    const char* name;
+};
+
+static const struct ResetFlag resetFlags[] = {
+    { RCC_FLAG_LPWRRST, "low power" },
+    { RCC_FLAG_WWDGRST, "WWDG" },
+    { RCC_FLAG_IWDGRST, "IWDG" },
+    { RCC_FLAG_SFTRST, "software" },
+    { RCC_FLAG_PORRST, "power on" },
+    { RCC_FLAG_PINRST, "pin" }
+};
+
+#define RESET_FLAGS (sizeof(resetFlags) / sizeof(resetFlags[0]))
+
+volatile uint8_t watchdog_checkins[WDG_TASKS];
+
+static IWDG_HandleTypeDef* volatile iwdg = NULL;
+static uint32_t lastSeen_ms[WDG_TASKS];
+// tasks past their deadline, evaluated by the SysTick
+static volatile uint8_t late = 0;
+static uint8_t resetCause;
+static uint8_t iwdgReset;
+
+// tasks which missed their deadline before the IWDG reset
+static struct
+{
+    uint32_t magic;
+    uint8_t tasks;
+} starved __attribute__((section(".noinit")));
+
+static uint8_t starvedTasks;
+
+void watchdog_boot()
+{
+    resetCause = 0;
+    for (uint8_t i = 0; i < RESET_FLAGS; ++i) {
+        if (__HAL_RCC_GET_FLAG(resetFlags[i].flag)) {
+            resetCause |= 1 << i;
+        }
+    }
+    iwdgReset = __HAL_RCC_GET_FLAG(RCC_FLAG_IWDGRST) != 0;
+    __HAL_RCC_CLEAR_RESET_FLAGS();
+
+    starvedTasks = (starved.magic == STARVED_MAGIC) ? starved.tasks : 0;
+    starved.magic = 0;
+}
+
+void watchdog_start(IWDG_HandleTypeDef* hiwdg)
+{
+    uint32_t now_ms = HAL_GetTick();
+
+    for (uint8_t i = 0; i < WDG_TASKS; ++i) {
+        watchdog_checkins[i] = 0;
+        lastSeen_ms[i] = now_ms;
+    }
+    late = 0;
+    // last, the SysTick starts evaluating from here
+    iwdg = hiwdg;
+}
+
+void watchdog_tick_int(uint32_t now_ms)
+{
+    uint8_t l = 0;
+
+    if (!iwdg) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < WDG_TASKS; ++i) {
+        if (watchdog_checkins[i]) {
+            watchdog_checkins[i] = 0;
+            lastSeen_ms[i] = now_ms;
+        } else if (now_ms - lastSeen_ms[i] > tasks[i].deadline_ms) {
+            l |= 1 << i;
+        }
+    }
+
+    // recorded here, a main loop stuck in a busy wait never gets to it
+    if (l) {
+        starved.tasks = l;
+        starved.magic = STARVED_MAGIC;
+    } else {
+        starved.magic = 0;
+    }
+    late = l;
+}
+
+void watchdog_update()
+{
+    if (!iwdg || late) {
+        // no refresh, the IWDG resets the MCU
+        return;
+    }
+
+    HAL_IWDG_Refresh(iwdg);
+}
+
+void watchdog_report()
+{
+    send_string("Reset:");
+    for (uint8_t i = 0; i < RESET_FLAGS; ++i) {
+        if (resetCause & (1 << i)) {
+            send_string(" ");
+            send_string(resetFlags[i].name);
+        }
+    }
+    send_ln();
+
+    if (iwdgReset && starvedTasks) {
+        send_string("Watchdog starved by:");
+        for (uint8_t i = 0; i < WDG_TASKS; ++i) {
+            if (starvedTasks & (1 << i)) {
+                send_string(" ");
+                send_string(tasks[i].name);
+            }
+        }
+        send_ln();
+    }
+}
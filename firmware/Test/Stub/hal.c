@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "stm32f1xx_hal.h"
+
+#include <stdlib.h>
+
+GPIO_TypeDef stub_gpioa, stub_gpiob, stub_gpioc;
+TIM_TypeDef stub_tim3, stub_tim4;
+ADC_TypeDef stub_adc1, stub_adc2;
+USART_TypeDef stub_usart1;
+EXTI_TypeDef stub_exti;
+DMA_Channel_TypeDef stub_dma1_channel4, stub_dma1_channel5;
+RCC_TypeDef stub_rcc;
+PWR_TypeDef stub_pwr;
+BKP_TypeDef stub_bkp;
+DWT_Type stub_dwt;
+
+uint32_t SystemCoreClock = 72000000;
+
+uint32_t stub_tick = 0;
+uint32_t stub_ipsr = 0;
+static uint32_t primask = 0;
+
+uint8_t stub_uart_tx[STUB_UART_TX_SIZE];
+uint16_t stub_uart_tx_length = 0;
+static uint8_t txRunning = 0;
+
+void (*stub_gpio_hook)(GPIO_TypeDef* port, uint16_t pin,
+                       GPIO_PinState state) = NULL;
+void (*stub_reset)(void) = NULL;
+void (*stub_adc_hook)(ADC_HandleTypeDef* hadc, uint16_t* data,
+                      uint32_t length) = NULL;
+void (*stub_uart_tx_hook)(const uint8_t* data, uint16_t size) = NULL;
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state)
+{
+    if (state == GPIO_PIN_SET) {
+        port->ODR |= pin;
+    } else {
+        port->ODR &= ~(uint32_t)pin;
+    }
+
+    if (stub_gpio_hook) {
+        stub_gpio_hook(port, pin, state);
+    }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin)
+{
+    return (port->IDR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef* port, uint16_t pin)
+{
+    HAL_GPIO_WritePin(port, pin,
+                      (port->ODR & pin) ? GPIO_PIN_RESET : GPIO_PIN_SET);
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef* htim)
+{
+    htim->Instance->PSC = htim->Init.Prescaler;
+    htim->Instance->ARR = htim->Init.Period;
+    htim->Instance->CNT = 0;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_DeInit(TIM_HandleTypeDef* htim)
+{
+    htim->Instance->CR1 &= ~TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef* htim)
+{
+    htim->Instance->DIER |= TIM_DIER_UIE;
+    htim->Instance->CR1 |= TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef* htim)
+{
+    htim->Instance->DIER &= ~TIM_DIER_UIE;
+    htim->Instance->CR1 &= ~TIM_CR1_CEN;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef* hadc,
+                                            uint32_t timeout)
+{
+    UNUSED(hadc);
+    UNUSED(timeout);
+    return HAL_OK;
+}
+
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef* hadc)
+{
+    if (stub_adc_hook) {
+        uint16_t value;
+
+        stub_adc_hook(hadc, &value, 1);
+        return value;
+    }
+
+    return hadc->Instance->DR;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef* hadc)
+{
+    UNUSED(hadc);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* data,
+                                    uint32_t length)
+{
+    if (stub_adc_hook) {
+        stub_adc_hook(hadc, (uint16_t*)data, length);
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef* hadc)
+{
+    UNUSED(hadc);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_IWDG_Refresh(IWDG_HandleTypeDef* hiwdg)
+{
+    UNUSED(hiwdg);
+    return HAL_OK;
+}
+
+uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef* hcrc, uint32_t* buffer,
+                           uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    UNUSED(hcrc);
+    for (uint32_t i = 0; i < length; ++i) {
+        crc ^= buffer[i];
+        for (int b = 0; b < 32; ++b) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef* hdma, uint32_t src,
+                                uint32_t dst, uint32_t length)
+{
+    hdma->Instance->CPAR = src;
+    hdma->Instance->CMAR = dst;
+    hdma->Instance->CNDTR = length;
+    hdma->Instance->CCR |= 1;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart,
+                                        uint8_t* data, uint16_t size)
+{
+    if (stub_uart_tx_hook) {
+        stub_uart_tx_hook(data, size);
+        huart->Instance->SR |= USART_SR_TC;
+        HAL_UART_TxCpltCallback(huart);
+        return HAL_OK;
+    }
+
+    if (txRunning) {
+        return HAL_BUSY;
+    }
+
+    for (uint16_t i = 0; i < size; ++i) {
+        if (stub_uart_tx_length < STUB_UART_TX_SIZE) {
+            stub_uart_tx[stub_uart_tx_length++] = data[i];
+        }
+    }
+    huart->Instance->SR &= ~USART_SR_TC;
+    txRunning = 1;
+    return HAL_OK;
+}
+
+// weak as in the HAL, usart.c has its own
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
+{
+    UNUSED(huart);
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return stub_tick;
+}
+
+void HAL_Delay(uint32_t ms)
+{
+    stub_tick += ms;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return primask;
+}
+
+void __set_PRIMASK(uint32_t primask_)
+{
+    primask = primask_;
+}
+
+uint32_t __get_IPSR(void)
+{
+    return stub_ipsr;
+}
+
+void __disable_irq(void)
+{
+    primask = 1;
+}
+
+void __enable_irq(void)
+{
+    primask = 0;
+}
+
+void NVIC_SystemReset(void)
+{
+    if (stub_reset) {
+        stub_reset();
+    }
+    abort();
+}
+
+void stub_uart_receive(UART_HandleTypeDef* huart, const uint8_t* data,
+                       uint16_t size)
+{
+    DMA_Channel_TypeDef* dma = huart->hdmarx->Instance;
+    // the length given to HAL_DMA_Start, the channel is circular
+    static uint32_t length = 0;
+
+    if (length < dma->CNDTR) {
+        length = dma->CNDTR;
+    }
+
+    for (uint16_t i = 0; i < size; ++i) {
+        uint8_t* buffer = (uint8_t*)(uintptr_t)dma->CMAR;
+        buffer[length - dma->CNDTR] = data[i];
+        if (--dma->CNDTR == 0) {
+            dma->CNDTR = length;
+        }
+    }
+}
+
+void stub_uart_idle(UART_HandleTypeDef* huart)
+{
+    huart->Instance->SR |= USART_SR_IDLE;
+}
+
+uint8_t stub_uart_tx_complete(UART_HandleTypeDef* huart)
+{
+    if (!txRunning) {
+        return 0;
+    }
+
+    txRunning = 0;
+    huart->Instance->SR |= USART_SR_TC;
+    HAL_UART_TxCpltCallback(huart);
+    return 1;
+}
+
+void stub_gpio_input(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state)
+{
+    if (state == GPIO_PIN_SET) {
+        port->IDR |= pin;
+    } else {
+        port->IDR &= ~(uint32_t)pin;
+    }
+}
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _STUB_STM32F1XX_HAL_H_
+#define _STUB_STM32F1XX_HAL_H_
+
+#include "main.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ The part of the HAL the firmware modules use, for building them on the
+ host. Peripherals are plain memory, the HAL calls act on it or on the
+ simulation state below, the tests drive and observe them through the
+ stub_* API at the end. Only what the tested modules need is here.
+ */
+
+#define __IO volatile
+#define __I volatile const
+#define __STATIC_INLINE static inline
+
+typedef enum
+{
+    HAL_OK,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+    GPIO_PIN_RESET,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+    __IO uint32_t CRL, CRH, IDR, ODR, BSRR, BRR, LCKR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT,
+        PSC, ARR;
+} TIM_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t SR, CR1, CR2, SMPR1, SMPR2, JOFR1, JOFR2, JOFR3, JOFR4,
+        HTR, LTR, SQR1, SQR2, SQR3, JSQR, JDR1, JDR2, JDR3, JDR4, DR;
+} ADC_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t SR, DR, BRR, CR1, CR2, CR3, GTPR;
+} USART_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t IMR, EMR, RTSR, FTSR, SWIER, PR;
+} EXTI_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR, CFGR, CIR, APB2RSTR, APB1RSTR, AHBENR, APB2ENR,
+        APB1ENR, BDCR, CSR;
+} RCC_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR, CSR;
+} PWR_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t DR1, DR2;
+} BKP_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+extern GPIO_TypeDef stub_gpioa, stub_gpiob, stub_gpioc;
+extern TIM_TypeDef stub_tim3, stub_tim4;
+extern ADC_TypeDef stub_adc1, stub_adc2;
+extern USART_TypeDef stub_usart1;
+extern EXTI_TypeDef stub_exti;
+extern DMA_Channel_TypeDef stub_dma1_channel4, stub_dma1_channel5;
+extern RCC_TypeDef stub_rcc;
+extern PWR_TypeDef stub_pwr;
+extern BKP_TypeDef stub_bkp;
+extern DWT_Type stub_dwt;
+
+#define GPIOA (&stub_gpioa)
+#define GPIOB (&stub_gpiob)
+#define GPIOC (&stub_gpioc)
+#define TIM3 (&stub_tim3)
+#define TIM4 (&stub_tim4)
+#define ADC1 (&stub_adc1)
+#define ADC2 (&stub_adc2)
+#define USART1 (&stub_usart1)
+#define EXTI (&stub_exti)
+#define DMA1_Channel4 (&stub_dma1_channel4)
+#define DMA1_Channel5 (&stub_dma1_channel5)
+#define RCC (&stub_rcc)
+#define PWR (&stub_pwr)
+#define BKP (&stub_bkp)
+#define DWT (&stub_dwt)
+
+// the core clock [Hz], what the DWT counts
+extern uint32_t SystemCoreClock;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+typedef struct
+{
+    uint32_t Prescaler;
+    uint32_t CounterMode;
+    uint32_t Period;
+    uint32_t ClockDivision;
+    uint32_t RepetitionCounter;
+    uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct
+{
+    TIM_TypeDef* Instance;
+    TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+typedef struct
+{
+    ADC_TypeDef* Instance;
+} ADC_HandleTypeDef;
+
+typedef struct
+{
+    void* Instance;
+} CRC_HandleTypeDef;
+
+typedef struct
+{
+    void* Instance;
+} IWDG_HandleTypeDef;
+
+typedef struct
+{
+    DMA_Channel_TypeDef* Instance;
+} DMA_HandleTypeDef;
+
+typedef struct
+{
+    uint32_t BaudRate;
+    uint32_t Mode;
+} UART_InitTypeDef;
+
+typedef struct
+{
+    USART_TypeDef* Instance;
+    UART_InitTypeDef Init;
+    DMA_HandleTypeDef* hdmatx;
+    DMA_HandleTypeDef* hdmarx;
+} UART_HandleTypeDef;
+
+#define USART_SR_IDLE 0x0010U
+#define USART_SR_TC 0x0040U
+#define USART_CR1_IDLEIE 0x0010U
+#define USART_CR3_DMAR 0x0040U
+
+#define UART_FLAG_IDLE USART_SR_IDLE
+#define UART_FLAG_TC USART_SR_TC
+#define UART_IT_IDLE USART_CR1_IDLEIE
+
+#define __HAL_UART_GET_FLAG(h, f) (((h)->Instance->SR & (f)) == (f))
+// SR then DR read on the target
+#define __HAL_UART_CLEAR_IDLEFLAG(h) ((h)->Instance->SR &= ~USART_SR_IDLE)
+#define __HAL_UART_ENABLE_IT(h, i) ((h)->Instance->CR1 |= (i))
+#define __HAL_DMA_GET_COUNTER(h) ((h)->Instance->CNDTR)
+
+#define SET_BIT(r, b) ((r) |= (b))
+#define CLEAR_BIT(r, b) ((r) &= ~(b))
+
+// reset flags, the bits of RCC->CSR
+#define RCC_FLAG_PINRST 26U
+#define RCC_FLAG_PORRST 27U
+#define RCC_FLAG_SFTRST 28U
+#define RCC_FLAG_IWDGRST 29U
+#define RCC_FLAG_WWDGRST 30U
+#define RCC_FLAG_LPWRRST 31U
+
+#define __HAL_RCC_GET_FLAG(f) ((RCC->CSR >> (f)) & 1U)
+#define __HAL_RCC_CLEAR_RESET_FLAGS() (RCC->CSR &= 0x00FFFFFFU)
+
+#define RCC_APB1ENR_BKPEN 0x08000000U
+#define RCC_APB1ENR_PWREN 0x10000000U
+#define PWR_CR_DBP 0x0100U
+
+#define TIM_CR1_CEN 0x0001U
+#define TIM_DIER_UIE 0x0001U
+#define TIM_SR_UIF 0x0001U
+
+#define FLASH_PAGE_SIZE 0x400U
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+#define UNUSED(x) ((void)(x))
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin);
+void HAL_GPIO_TogglePin(GPIO_TypeDef* port, uint16_t pin);
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_DeInit(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef* htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef* htim);
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef* hadc,
+                                            uint32_t timeout);
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef* hadc);
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef* hadc, uint32_t* data,
+                                    uint32_t length);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef* hadc);
+
+HAL_StatusTypeDef HAL_IWDG_Refresh(IWDG_HandleTypeDef* hiwdg);
+
+// the CRC unit, CRC-32/MPEG-2 over 32-bit words
+uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef* hcrc, uint32_t* buffer,
+                           uint32_t length);
+
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef* hdma, uint32_t src,
+                                uint32_t dst, uint32_t length);
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* huart,
+                                        uint8_t* data, uint16_t size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+
+// no interrupts on the host, only the state
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+uint32_t __get_IPSR(void);
+void __disable_irq(void);
+void __enable_irq(void);
+
+// the EXTI callback of the application
+void HAL_GPIO_EXTI_Callback(uint16_t pin);
+
+// the test decides what a reset is, see stub_reset
+void NVIC_SystemReset(void);
+
+// host side
+
+// HAL_GetTick() [ms], advanced by the test
+extern uint32_t stub_tick;
+
+// called on every HAL_GPIO_WritePin() after the output changed, the
+// pin transition logger of the drivers
+extern void (*stub_gpio_hook)(GPIO_TypeDef* port, uint16_t pin,
+                              GPIO_PinState state);
+
+// drives an input pin
+void stub_gpio_input(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+
+// the conversions of HAL_ADC_Start_DMA() (the DMA's half-words, its
+// interrupt is the test's to call) and of HAL_ADC_GetValue(), the data
+// register is read without it
+extern void (*stub_adc_hook)(ADC_HandleTypeDef* hadc, uint16_t* data,
+                             uint32_t length);
+
+// the interrupt being run, __get_IPSR(), set by the test around the
+// calls of the handlers
+extern uint32_t stub_ipsr;
+
+// called by NVIC_SystemReset(), must not return
+extern void (*stub_reset)(void);
+
+// bytes arriving on the line, written by the receive DMA
+void stub_uart_receive(UART_HandleTypeDef* huart, const uint8_t* data,
+                       uint16_t size);
+// the line went idle, sets the flag for the idle interrupt
+void stub_uart_idle(UART_HandleTypeDef* huart);
+
+// what the transmit DMA sent, the running transfer completes with
+// stub_uart_tx_complete()
+#define STUB_UART_TX_SIZE 4096
+extern uint8_t stub_uart_tx[STUB_UART_TX_SIZE];
+extern uint16_t stub_uart_tx_length;
+uint8_t stub_uart_tx_complete(UART_HandleTypeDef* huart);
+
+// takes the transmitted bytes instead, every transfer completes at once
+extern void (*stub_uart_tx_hook)(const uint8_t* data, uint16_t size);
+
+#endif // _STUB_STM32F1XX_HAL_H_
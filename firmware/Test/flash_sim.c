@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "flash_sim.h"
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+uint8_t* flash_sim_mem = NULL;
+
+static int32_t budget = -1;
+static uint8_t dead = 0;
+static uint32_t ops = 0;
+static uint32_t seed = 1;
+
+static uint16_t* __halfword(uint32_t address)
+{
+    return (uint16_t*)&flash_sim_mem[address - FLASH_PAGE_START];
+}
+
+// counts an operation, 0 if the power goes down during it
+static uint8_t __op()
+{
+    if (dead) {
+        return 0;
+    }
+
+    ++ops;
+    if (budget >= 0 && budget-- == 0) {
+        dead = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static HAL_StatusTypeDef __program(uint32_t address, uint16_t* data,
+                                   uint32_t size)
+{
+    for (uint32_t i = 0; i < size; ++i) {
+        uint16_t* hw = __halfword(address + i * 2);
+
+        if (dead) {
+            return HAL_ERROR;
+        }
+        if (*hw != 0xFFFF && data[i] != 0) {
+            // PGERR, only erased half-words can be programmed
+            return HAL_ERROR;
+        }
+        if (!__op()) {
+            *hw &= data[i] | (uint16_t)test_rand(&seed);
+            return HAL_ERROR;
+        }
+        *hw &= data[i];
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef flash_write(uint32_t address, uint16_t* data, uint32_t size)
+{
+    uint8_t* page = &flash_sim_mem[address - FLASH_PAGE_START];
+
+    if (!__op()) {
+        if (dead) {
+            for (uint32_t i = 0; i < FLASH_PAGE_SIZE; ++i) {
+                page[i] |= (uint8_t)test_rand(&seed);
+            }
+        }
+        return HAL_ERROR;
+    }
+    memset(page, 0xFF, FLASH_PAGE_SIZE);
+
+    return __program(address, data, size);
+}
+
+HAL_StatusTypeDef flash_program(uint32_t address, uint16_t* data, 
+                                uint32_t size)
+{
+    return __program(address, data, size);
+}
+
+void flash_read(uint32_t address, uint16_t* data, uint32_t size)
+{
+    memcpy(data, __halfword(address), size * sizeof(uint16_t));
+}
+
+void flash_sim_init()
+{
+    if (!flash_sim_mem) {
+        // a non-PIE executable leaves the low addresses free
+        void* mem = mmap((void*)FLASH_PAGE_START, FLASH_SIM_SIZE,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                         -1, 0);
+        if (mem != (void*)FLASH_PAGE_START) {
+            fprintf(stderr, "cannot map the Flash at 0x%08lX\n",
+                    FLASH_PAGE_START);
+            exit(1);
+        }
+        flash_sim_mem = mem;
+    }
+    memset(flash_sim_mem, 0xFF, FLASH_SIM_SIZE);
+    flash_sim_power_on();
+}
+
+void flash_sim_cut_after(int32_t ops_, uint32_t seed_)
+{
+    budget = ops_;
+    seed = seed_ ? seed_ : 1;
+}
+
+uint8_t flash_sim_dead()
+{
+    return dead;
+}
+
+uint32_t flash_sim_ops()
+{
+    return ops;
+}
+
+void flash_sim_power_on()
+{
+    budget = -1;
+    dead = 0;
+    ops = 0;
+}
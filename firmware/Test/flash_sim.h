@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _FLASH_SIM_H_
+#define _FLASH_SIM_H_
+
+#include "flash.h"
+
+#include <stdint.h>
+
+/*
+ The Flash of flash.h in RAM, for the modules storing data on the host.
+ Programming only clears bits as the real one, an erase sets the whole
+ page. A power cut can be scheduled: after the given number of half-word
+ programs and page erases the operation in progress is left half done,
+ an erase with random content, a half-word with only some of its bits
+ cleared, and nothing is written any more until flash_sim_power_on().
+ The memory is mapped at FLASH_PAGE_START, code reading the Flash
+ through pointers as on the target works unchanged.
+ */
+
+#define FLASH_SIM_SIZE (FLASH_NUM_PAGES * FLASH_PAGE_SIZE)
+
+extern uint8_t* flash_sim_mem;
+
+// all erased, the power on
+void flash_sim_init();
+
+// cut the power after ops programs and erases, -1 never
+void flash_sim_cut_after(int32_t ops, uint32_t seed);
+
+// the power is cut
+uint8_t flash_sim_dead();
+
+// the programs and erases done since the power on
+uint32_t flash_sim_ops();
+
+void flash_sim_power_on();
+
+#endif // _FLASH_SIM_H_
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "plant.h"
+#include "test.h"
+#include "estimator.h"
+
+#include <math.h>
+
+// LM35 10 mV/C, 3.3 V reference, as logic.c
+#define V_REF 3.3
+#define ADC_RES 4095
+
+#define SUBSTEPS 10
+
+void plant_init(struct Plant* p, double temp, double ambient, double rise,
+                double tau, double fanFactor, uint8_t delay)
+{
+    p->temp = temp;
+    p->ambient = ambient;
+    p->rise = rise;
+    p->tau = tau;
+    p->fanFactor = fanFactor;
+    p->delay = (delay < PLANT_DELAY_MAX) ? delay : PLANT_DELAY_MAX - 1;
+    p->time = 0;
+
+    for (int i = 0; i < PLANT_DELAY_MAX; ++i) {
+        p->history[i] = temp;
+    }
+}
+
+void plant_step(struct Plant* p, double fanPower)
+{
+    double u = fanPower / 100.0;
+    double dt = 1.0 / SUBSTEPS;
+
+    for (int i = 0; i < SUBSTEPS; ++i) {
+        double loss = (1 + p->fanFactor * u) * (p->temp - p->ambient);
+        p->temp += dt * (p->rise - loss) / p->tau;
+    }
+
+    ++p->time;
+    p->history[p->time % PLANT_DELAY_MAX] = p->temp;
+}
+
+double plant_sensed(const struct Plant* p)
+{
+    return p->history[(p->time - p->delay) % PLANT_DELAY_MAX];
+}
+
+uint16_t plant_adc(double temp, double noise, uint32_t* seed)
+{
+    double t = temp + noise * test_gauss(seed);
+    double adc = floor(t / (100 * V_REF) * ADC_RES + 0.5);
+
+    if (adc < 0) {
+        return 0;
+    } else if (adc > ADC_RES) {
+        return ADC_RES;
+    }
+    return (uint16_t)adc;
+}
+
+int32_t plant_adc_to_q(uint16_t adc)
+{
+    return (int32_t)(((int64_t)adc * (int64_t)(100 * V_REF * EST_ONE))
+        / ADC_RES);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _PLANT_H_
+#define _PLANT_H_
+
+#include <stdint.h>
+
+/*
+ Thermal plant of the chamber for the host tests, first order with the
+ fan multiplying the heat exchange with the ambient:
+
+   dT/dt = (rise - (1 + fanFactor * u) * (T - Ta)) / tau
+
+ rise - steady state rise above the ambient with the fan off [C],
+ tau - time constant with the fan off [s], u - fan power [0..1].
+ An optional transport delay models the sensor placement.
+ */
+
+#define PLANT_DELAY_MAX 64
+
+struct Plant
+{
+    double temp;
+    double ambient;
+    double rise;
+    double tau;
+    double fanFactor;
+
+    // sensor delay [s], whole seconds
+    uint8_t delay;
+    double history[PLANT_DELAY_MAX];
+    uint32_t time;
+};
+
+void plant_init(struct Plant* p, double temp, double ambient, double rise,
+                double tau, double fanFactor, uint8_t delay);
+
+// advances the plant by one second with the fan power [%]
+void plant_step(struct Plant* p, double fanPower);
+
+// chamber temperature as seen by the sensor
+double plant_sensed(const struct Plant* p);
+
+// LM35 reading through the 12-bit ADC, noise is its sigma [C]
+uint16_t plant_adc(double temp, double noise, uint32_t* seed);
+
+// ADC reading in the estimator's fixed point, as logic.c converts it
+int32_t plant_adc_to_q(uint16_t adc);
+
+#endif // _PLANT_H_
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ Minimal checks for the host tests. A failed check is reported and the
+ test goes on, test_result() gives the exit code of the test program.
+ */
+
+static int test_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+// compares two numbers, both are printed when it fails
+#define CHECK_CMP(a, op, b) \
+    do { \
+        double __a = (a); \
+        double __b = (b); \
+        if (!(__a op __b)) { \
+            printf("%s:%d: CHECK(%s %s %s) failed, %g vs %g\n", \
+                   __FILE__, __LINE__, #a, #op, #b, __a, __b); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+static inline int test_result(const char* name)
+{
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+    return test_failures ? 1 : 0;
+}
+
+// deterministic noise, the tests have to give the same result every run
+static inline uint32_t test_rand(uint32_t* seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+// approximately normal, zero mean, unit variance
+static inline double test_gauss(uint32_t* seed)
+{
+    double s = 0;
+    for (int i = 0; i < 12; ++i) {
+        s += test_rand(seed) / 4294967296.0;
+    }
+    return s - 6;
+}
+
+#endif // _TEST_H_
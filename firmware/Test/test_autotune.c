@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Relay auto-tune against the plant model. The experiment runs as in
+ logic.c, on the estimate once a second. The reference is the ultimate
+ gain and period of the same loop, plant, sensor delay and estimator,
+ found by bisection on a proportional controller around the power
+ holding the setpoint: the gain at which the oscillation neither grows
+ nor decays. The relay with hysteresis only approximates them, the
+ describing function ignores the harmonics and the hysteresis shifts
+ the phase, so the tolerance is loose, but the gains have to follow
+ the plant and be the Ziegler-Nichols ones.
+ */
+
+#include "test.h"
+#include "plant.h"
+#include "estimator.h"
+#include "autotune.h"
+
+#include <math.h>
+
+#define SETPOINT 70
+#define AMBIENT 25
+#define RISE 80
+#define NOISE 0.4
+
+// length of a proportional loop run finding the ultimate gain [s]
+#define KU_SIM_S 6000
+
+struct Case
+{
+    const char* name;
+    double tau;
+    double fanFactor;
+    // sensor delay [s]
+    uint8_t delay;
+};
+
+// proportional control of the noiseless loop kicked off the setpoint,
+// returns the ratio of the late to the early swing and the period
+static double __p_loop(const struct Case* c, double kc, double* period)
+{
+    struct Plant p;
+    double u0 = (RISE / (double)(SETPOINT - AMBIENT) - 1) / c->fanFactor;
+    double early = 0, late = 0, prev = 0;
+    uint32_t crossings = 0, first = 0, last = 0;
+
+    plant_init(&p, SETPOINT + 0.1, AMBIENT, RISE, c->tau, c->fanFactor,
+               c->delay);
+    estimator_init(EST_FROM_INT(SETPOINT));
+
+    // the loop has to stay linear to tell the growth, the plant takes
+    // the power unlimited, the estimator what the fan would do
+    for (uint32_t t = 1; t < KU_SIM_S; ++t) {
+        double e = (double)estimator_temp() / EST_ONE - SETPOINT;
+        double u = u0 * 100 + kc * e;
+        double fan = (u < 0) ? 0 : (u > 100) ? 100 : u;
+
+        plant_step(&p, u);
+        estimator_predict((uint8_t)(fan + 0.5), EST_FROM_INT(AMBIENT), 1000);
+        estimator_update((int32_t)(plant_sensed(&p) * EST_ONE));
+
+        if (fabs(e) > 2) {
+            // left the linear region, growing
+            return 1e9;
+        }
+
+        if (t < KU_SIM_S / 4) {
+            early = fmax(early, fabs(e));
+        } else if (t > KU_SIM_S * 3 / 4) {
+            late = fmax(late, fabs(e));
+        }
+
+        if (prev < 0 && e >= 0) {
+            if (!crossings) first = t;
+            last = t;
+            ++crossings;
+        }
+        prev = e;
+    }
+
+    *period = (crossings > 1) ? (double)(last - first) / (crossings - 1) : 0;
+    return late / early;
+}
+
+static void __ultimate(const struct Case* c, double* ku, double* tu)
+{
+    double lo = 0.1, hi = 10000;
+
+    for (int i = 0; i < 40; ++i) {
+        double kc = sqrt(lo * hi);
+        if (__p_loop(c, kc, tu) < 1) {
+            lo = kc;
+        } else {
+            hi = kc;
+        }
+    }
+
+    *ku = lo;
+    __p_loop(c, lo, tu);
+}
+
+static void __run(const struct Case* c)
+{
+    struct Plant p;
+    uint32_t seed = 0xC0FFEE;
+    uint8_t power = 0;
+
+    // start at the setpoint, logic.c lets the PID settle there first
+    plant_init(&p, SETPOINT, AMBIENT, RISE, c->tau, c->fanFactor, c->delay);
+    estimator_init(EST_FROM_INT(SETPOINT));
+    autotune_start(SETPOINT, 1000);
+
+    enum AutotuneState st = AUTOTUNE_RUNNING;
+    uint32_t t;
+
+    for (t = 1; st == AUTOTUNE_RUNNING; ++t) {
+        plant_step(&p, power);
+
+        int32_t chamber = plant_adc_to_q(
+            plant_adc(plant_sensed(&p), NOISE, &seed));
+        estimator_predict(power, EST_FROM_INT(AMBIENT), 1000);
+        estimator_update(chamber);
+
+        st = autotune_update(estimator_temp(), 1000 + t * 1000, &power);
+        CHECK(autotune_progress() < 100);
+    }
+
+    double ku, tu;
+    __ultimate(c, &ku, &tu);
+
+    const struct AutotuneResult* r = autotune_result();
+
+    printf("  %-22s %5u s, Ku %6.2f (%6.2f) %%/C, Tu %4u (%4.0f) s, "
+           "Kp %.2f Ti %u Td %u\n",
+           c->name, t, r->ku / 100.0, ku, r->tu, tu,
+           r->kp / 100.0, r->ti, r->td);
+
+    // the hysteresis shifts the relay's oscillation to a lower
+    // frequency, where the loop gain is higher, the error is on the safe
+    // side of lower gains and longer times
+    CHECK(st == AUTOTUNE_DONE);
+    CHECK_CMP(r->ku / 100.0, >, ku * 0.4);
+    CHECK_CMP(r->ku / 100.0, <, ku * 1.1);
+    CHECK_CMP(r->tu, >, tu * 0.8);
+    CHECK_CMP(r->tu, <, tu * 2);
+
+    // Ziegler-Nichols PID, Kp = 0.6 Ku, Ti = Tu / 2, Td = Tu / 8
+    CHECK_CMP(fabs(r->kp - r->ku * 0.6), <=, 1);
+    CHECK(r->ti == r->tu / 2);
+    CHECK(r->td == r->tu / 8);
+}
+
+static void test_plants()
+{
+    static const struct Case cases[] = {
+        { "tau 1200 s, delay 10 s", 1200, 10, 10 },
+        { "tau 300 s, delay 5 s", 300, 10, 5 },
+        { "tau 3600 s, delay 30 s", 3600, 10, 30 },
+        { "weak fan, delay 20 s", 1200, 4, 20 },
+        { "strong fan, delay 20 s", 1200, 20, 20 }
+    };
+
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        __run(&cases[i]);
+    }
+}
+
+// no oscillation, e.g. the heat load is gone, has to time out
+static void test_timeout()
+{
+    uint8_t power;
+    uint32_t t;
+
+    autotune_start(SETPOINT, 0);
+    for (t = 0; autotune_state() == AUTOTUNE_RUNNING; t += 1000) {
+        autotune_update(EST_FROM_INT(AMBIENT), t, &power);
+        CHECK(power == AUTOTUNE_RELAY_LOW || power == AUTOTUNE_RELAY_HIGH);
+    }
+
+    CHECK(autotune_state() == AUTOTUNE_FAILED);
+    CHECK_CMP(t, <=, AUTOTUNE_TIMEOUT_MS + 2000);
+    autotune_update(EST_FROM_INT(AMBIENT), t, &power);
+    CHECK(power == AUTOTUNE_RELAY_LOW);
+}
+
+int main()
+{
+    test_plants();
+    test_timeout();
+
+    return test_result("autotune");
+}
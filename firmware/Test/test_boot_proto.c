@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Bootloader protocol against the real uploader. boot_proto.c runs in a
+ thread as on the MCU, its USART is the master side of a pty and its
+ Flash the simulated one mapped at the target's address, the uploader
+ tools/boot_upload.py talks to the slave side as it would to the USB
+ adapter. The thread models the reset too: the bootloader checks the
+ image and either stays or "runs" the application, a loop which only
+ understands the shell command "update". A power cut stops the thread
+ in the middle of a page until the test powers it on again.
+
+ A pty does not care about the baud rate, the time of an update on the
+ target is computed from the bytes which went over the line and the
+ Flash operations done, at the datasheet's typical timings.
+ */
+
+// the pty functions
+#define _GNU_SOURCE
+
+#include "test.h"
+#include "flash_sim.h"
+#include "../Bootloader/boot_proto.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define BAUD 460800
+// tERASE and tPROG of the F103 datasheet, typical
+#define ERASE_US 20000
+#define PROGRAM_US 52.5
+// enter_bootloader() of the uploader waits for the reset
+#define RESET_S 0.2
+
+#define IMAGE_SIZE (40 * 1024)
+#define IMAGE_PAGES (IMAGE_SIZE / FLASH_PAGE_SIZE)
+
+#define UPLOADER "../tools/boot_upload.py"
+#define IMAGE_FILE "build/boot_image.bin"
+#define UPLOAD_LOG "build/boot_upload.log"
+
+static int master;
+static char slave[64];
+
+static jmp_buf resetJump;
+static volatile uint8_t appRunning;
+static volatile uint8_t bootloaderRunning;
+
+// what the MCU did during one upload
+static volatile uint32_t lineBytes;
+static volatile uint32_t appErases;
+static volatile uint32_t erases;
+static volatile uint32_t halfwords;
+
+static uint8_t image[IMAGE_SIZE];
+
+// the power went down, the MCU stops at once
+static void __check_power()
+{
+    if (flash_sim_dead()) {
+        longjmp(resetJump, 1);
+    }
+}
+
+int16_t boot_getc(uint16_t timeout_ms)
+{
+    struct pollfd p = { .fd = master, .events = POLLIN };
+    uint8_t c;
+
+    __check_power();
+    if ((poll(&p, 1, timeout_ms ? timeout_ms : -1) <= 0)
+        || (read(master, &c, 1) != 1)) {
+        return -1;
+    }
+    ++lineBytes;
+    return c;
+}
+
+void boot_putc(uint8_t c)
+{
+    __check_power();
+    if (write(master, &c, 1) == 1) {
+        ++lineBytes;
+    }
+}
+
+uint32_t boot_crc32(const uint32_t* data, uint32_t words)
+{
+    return HAL_CRC_Calculate(NULL, (uint32_t*)data, words);
+}
+
+uint8_t boot_flash_erase(uint32_t address)
+{
+    ++erases;
+    if (address >= BOOT_APP_ADDRESS) {
+        ++appErases;
+    }
+    return flash_write(address, NULL, 0) == HAL_OK;
+}
+
+uint8_t boot_flash_program(uint32_t address, const uint16_t* data,
+                           uint16_t count)
+{
+    halfwords += count;
+    return flash_program(address, (uint16_t*)data, count) == HAL_OK;
+}
+
+void boot_reset()
+{
+    NVIC_SystemReset();
+}
+
+static void __reset()
+{
+    longjmp(resetJump, 1);
+}
+
+// bytes sent while the MCU was off or resetting are lost
+static void __drain()
+{
+    struct pollfd p = { .fd = master, .events = POLLIN };
+    uint8_t c;
+
+    while ((poll(&p, 1, 0) > 0) && (read(master, &c, 1) == 1));
+}
+
+// the application, its shell knows one command
+static void __application()
+{
+    static const char cmd[] = "update\r";
+    uint8_t matched = 0;
+    struct pollfd p = { .fd = master, .events = POLLIN };
+    uint8_t c;
+
+    appRunning = 1;
+    for (;;) {
+        if ((poll(&p, 1, 10) <= 0) || (read(master, &c, 1) != 1)) {
+            continue;
+        }
+        matched = (c == cmd[matched]) ? matched + 1 : (c == cmd[0]);
+        if (!cmd[matched]) {
+            appRunning = 0;
+            boot_request_update();
+        }
+    }
+}
+
+// the main() of bootloader.c from the reset on
+static void* __mcu(void* arg)
+{
+    UNUSED(arg);
+
+    setjmp(resetJump);
+    appRunning = 0;
+    bootloaderRunning = 0;
+    while (flash_sim_dead()) {
+        usleep(1000);
+    }
+    __drain();
+
+    uint8_t requested = (BKP->DR1 == BOOT_REQUEST_MAGIC);
+    BKP->DR1 = 0;
+
+    if (!requested && boot_image_valid()) {
+        __application();
+    }
+
+    bootloaderRunning = 1;
+    boot_proto_run();
+    return NULL;
+}
+
+static double __now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static uint8_t __wait_for(volatile uint8_t* flag)
+{
+    for (int i = 0; i < 5000 && !*flag; ++i) {
+        usleep(1000);
+    }
+    return *flag;
+}
+
+static void __write_image()
+{
+    FILE* f = fopen(IMAGE_FILE, "wb");
+
+    fwrite(image, 1, sizeof(image), f);
+    fclose(f);
+}
+
+// runs the uploader on the image, 1 if it succeeded
+static uint8_t __upload(const char* name)
+{
+    char cmd[256];
+
+    __write_image();
+    lineBytes = appErases = erases = halfwords = 0;
+
+    snprintf(cmd, sizeof(cmd), "python3 " UPLOADER " -d %s " IMAGE_FILE
+             " > " UPLOAD_LOG " 2>&1", slave);
+    double start = __now();
+    int status = system(cmd);
+    double wall = __now() - start;
+
+    double line = lineBytes * 10.0 / BAUD;
+    double flash = (erases * ERASE_US + halfwords * PROGRAM_US) * 1e-6;
+
+    printf("  %-24s %2u pages, %5u bytes on the line, %.2f s on the "
+           "target (line %.2f s, Flash %.2f s), %.2f s here\n",
+           name, appErases, lineBytes, RESET_S + line + flash, line, flash,
+           wall);
+
+    return status == 0;
+}
+
+static uint8_t __flash_matches()
+{
+    return !memcmp((const void*)BOOT_APP_ADDRESS, image, sizeof(image));
+}
+
+static void test_update()
+{
+    // a blank chip, the bootloader has nothing to run
+    CHECK(__wait_for(&bootloaderRunning));
+    CHECK(__upload("full image"));
+    CHECK(appErases == IMAGE_PAGES);
+    CHECK(__flash_matches());
+    CHECK(boot_image_valid());
+    CHECK(__wait_for(&appRunning));
+
+    // the same image, only the descriptor is rewritten
+    CHECK(__upload("same image"));
+    CHECK(appErases == 0);
+    CHECK(__flash_matches());
+    CHECK(__wait_for(&appRunning));
+
+    // a small change, the rest of the code did not move
+    image[3 * FLASH_PAGE_SIZE + 100] ^= 0x55;
+    image[17 * FLASH_PAGE_SIZE + 7] ^= 0xAA;
+    CHECK(__upload("two pages changed"));
+    CHECK(appErases == 2);
+    CHECK(__flash_matches());
+    CHECK(__wait_for(&appRunning));
+}
+
+static void test_interrupted()
+{
+    uint32_t seed = 0xB007;
+
+    // a new version throughout, the power goes down in the middle of
+    // page 20, after the descriptor and 20 pages were erased and written
+    for (uint32_t i = 0; i < sizeof(image); i += 4) {
+        image[i] = test_rand(&seed);
+    }
+    flash_sim_cut_after(2 + 20 * (1 + FLASH_PAGE_SIZE / 2) + 100, seed);
+
+    CHECK(!__upload("cut at page 20"));
+    CHECK(flash_sim_dead());
+    CHECK(appErases == 21);
+    // nothing half written is run
+    CHECK(!boot_image_valid());
+
+    flash_sim_power_on();
+    CHECK(__wait_for(&bootloaderRunning));
+    CHECK(!appRunning);
+
+    // run again, the page cut off and the ones after it
+    CHECK(__upload("resumed"));
+    CHECK(appErases == IMAGE_PAGES - 20);
+    CHECK(__flash_matches());
+    CHECK(boot_image_valid());
+    CHECK(__wait_for(&appRunning));
+}
+
+int main()
+{
+    struct termios attr;
+    pthread_t mcu;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || grantpt(master) || unlockpt(master)) {
+        perror("pty");
+        return 1;
+    }
+    snprintf(slave, sizeof(slave), "%s", ptsname(master));
+
+    // kept open, the master sees no hang-up between the uploads, and raw
+    // from the start, no echo of what the bootloader sends
+    int fd = open(slave, O_RDWR | O_NOCTTY);
+    tcgetattr(fd, &attr);
+    cfmakeraw(&attr);
+    tcsetattr(fd, TCSANOW, &attr);
+
+    // machine code stands in for the firmware, this very executable
+    FILE* exe = fopen("/proc/self/exe", "rb");
+    memset(image, 0xFF, sizeof(image));
+    if (!exe || !fread(image, 1, sizeof(image), exe)) {
+        perror("/proc/self/exe");
+        return 1;
+    }
+    fclose(exe);
+
+    flash_sim_init();
+    stub_reset = __reset;
+    pthread_create(&mcu, NULL, __mcu, NULL);
+
+    test_update();
+    test_interrupted();
+
+    close(fd);
+    return test_result("boot_proto");
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Buttons against bouncing contacts. The pins are driven every 1 ms tick
+ as the SysTick samples them, with the EXTI called on every edge as the
+ rising/falling interrupt would, and the events are taken as the main
+ loop would, each tick. Every edge bounces for a while, a random level
+ each sample, the integrator has to turn it into one press and one
+ release and the click timing has to hold.
+ */
+
+#include "test.h"
+#include "buttons.h"
+#include "stm32f1xx_hal.h"
+
+#define BOUNCE_MS 5
+#define EVENTS_MAX 64
+
+struct Event
+{
+    enum ButtonEvent ev;
+    uint32_t t;
+};
+
+static GPIO_TypeDef* const ports[BTN_COUNT] = {
+    MODE_GPIO_Port, SELECT_GPIO_Port
+};
+static const uint16_t pins[BTN_COUNT] = { MODE_Pin, SELECT_Pin };
+
+static struct Event events[BTN_COUNT][EVENTS_MAX];
+static uint32_t count[BTN_COUNT];
+static uint32_t seed = 0xB0B0;
+static uint8_t poll = 1;
+
+// active low, the EXTI fires on both edges
+static void __level(enum ButtonId id, uint8_t pressed)
+{
+    GPIO_PinState level = pressed ? GPIO_PIN_RESET : GPIO_PIN_SET;
+
+    if (HAL_GPIO_ReadPin(ports[id], pins[id]) != level) {
+        stub_gpio_input(ports[id], pins[id], level);
+        buttons_exti_int(pins[id]);
+    }
+}
+
+static void __tick()
+{
+    ++stub_tick;
+    buttons_tick_int();
+
+    for (int id = 0; poll && id < BTN_COUNT; ++id) {
+        enum ButtonEvent ev;
+        while ((ev = buttons_get_event(id)) != BTN_EV_NONE) {
+            if (count[id] < EVENTS_MAX) {
+                events[id][count[id]].ev = ev;
+                events[id][count[id]].t = stub_tick;
+            }
+            ++count[id];
+        }
+    }
+}
+
+// holds the level for ms, the first BOUNCE_MS of it bouncing
+static void __hold(enum ButtonId id, uint8_t pressed, uint32_t ms)
+{
+    for (uint32_t i = 0; i < ms; ++i) {
+        if (i < BOUNCE_MS - 1) {
+            __level(id, test_rand(&seed) & 1);
+        } else {
+            __level(id, pressed);
+        }
+        __tick();
+    }
+}
+
+static void __reset()
+{
+    // settle whatever the previous test left
+    __hold(BTN_MODE, 0, 1000);
+    __hold(BTN_SELECT, 0, 1000);
+    for (int id = 0; id < BTN_COUNT; ++id) {
+        count[id] = 0;
+    }
+}
+
+static void test_click()
+{
+    __reset();
+
+    __hold(BTN_MODE, 1, 80);
+    uint32_t released = stub_tick;
+    __hold(BTN_MODE, 0, 1000);
+
+    CHECK(count[BTN_MODE] == 1);
+    CHECK(events[BTN_MODE][0].ev == BTN_EV_CLICK);
+    // after the release is settled and no second click came
+    CHECK_CMP(events[BTN_MODE][0].t, >=,
+              released + BTN_INTEGRATOR_MAX + BTN_DOUBLE_CLICK_MS);
+    CHECK_CMP(events[BTN_MODE][0].t, <=, released + BOUNCE_MS
+              + BTN_INTEGRATOR_MAX + BTN_DOUBLE_CLICK_MS);
+    CHECK(count[BTN_SELECT] == 0);
+}
+
+static void test_double_click()
+{
+    __reset();
+
+    __hold(BTN_MODE, 1, 80);
+    __hold(BTN_MODE, 0, 150);
+    __hold(BTN_MODE, 1, 80);
+    uint32_t released = stub_tick;
+    __hold(BTN_MODE, 0, 1000);
+
+    CHECK(count[BTN_MODE] == 1);
+    CHECK(events[BTN_MODE][0].ev == BTN_EV_DOUBLE_CLICK);
+    // at once, nothing to wait for
+    CHECK_CMP(events[BTN_MODE][0].t, <=,
+              released + BOUNCE_MS + BTN_INTEGRATOR_MAX);
+
+    // too slow for a double click, two clicks
+    __reset();
+    __hold(BTN_MODE, 1, 80);
+    __hold(BTN_MODE, 0, BTN_DOUBLE_CLICK_MS + 100);
+    __hold(BTN_MODE, 1, 80);
+    __hold(BTN_MODE, 0, 1000);
+
+    CHECK(count[BTN_MODE] == 2);
+    CHECK(events[BTN_MODE][0].ev == BTN_EV_CLICK);
+    CHECK(events[BTN_MODE][1].ev == BTN_EV_CLICK);
+}
+
+static void test_long_press()
+{
+    __reset();
+
+    uint32_t pressed = stub_tick;
+    __hold(BTN_SELECT, 1, 2450);
+    __hold(BTN_SELECT, 0, 1000);
+
+    uint32_t repeats = 0, longs = 0, last = 0;
+    for (uint32_t i = 0; i < count[BTN_SELECT] && i < EVENTS_MAX; ++i) {
+        const struct Event* e = &events[BTN_SELECT][i];
+        uint32_t held = e->t - pressed;
+
+        if (e->ev == BTN_EV_REPEAT) {
+            // first after the delay, then at the repeat rate
+            if (!repeats) {
+                CHECK_CMP(held, >=, BTN_REPEAT_DELAY_MS + BTN_INTEGRATOR_MAX);
+                CHECK_CMP(held, <=, BTN_REPEAT_DELAY_MS + BOUNCE_MS
+                          + BTN_INTEGRATOR_MAX);
+            } else {
+                CHECK(e->t - last == BTN_REPEAT_MS);
+            }
+            last = e->t;
+            ++repeats;
+        } else if (e->ev == BTN_EV_LONG_PRESS) {
+            CHECK_CMP(held, >=, BTN_LONG_PRESS_MS + BTN_INTEGRATOR_MAX);
+            CHECK_CMP(held, <=, BTN_LONG_PRESS_MS + BOUNCE_MS
+                      + BTN_INTEGRATOR_MAX);
+            ++longs;
+        } else {
+            // the release after a long press is not a click
+            CHECK(0);
+        }
+    }
+
+    CHECK(longs == 1);
+    // 500, 700, ... 2300 ms
+    CHECK(repeats == 10);
+    CHECK(count[BTN_MODE] == 0);
+}
+
+// spikes shorter than the integrator, e.g. the fan's triac switching
+// next to the wires, no press and no release
+static void test_glitches()
+{
+    __reset();
+
+    for (int i = 0; i < 20; ++i) {
+        __level(BTN_MODE, 1);
+        for (int j = 0; j < BTN_INTEGRATOR_MAX / 2 - 1; ++j) {
+            __tick();
+        }
+        __level(BTN_MODE, 0);
+        for (int j = 0; j < 20; ++j) {
+            __tick();
+        }
+    }
+    __hold(BTN_MODE, 0, 1000);
+    CHECK(count[BTN_MODE] == 0);
+
+    // released for a moment while held, still one click
+    __hold(BTN_MODE, 1, 50);
+    for (int i = 0; i < 5; ++i) {
+        __level(BTN_MODE, 0);
+        __tick();
+        __tick();
+        __level(BTN_MODE, 1);
+        for (int j = 0; j < 40; ++j) {
+            __tick();
+        }
+    }
+    __hold(BTN_MODE, 0, 1000);
+    CHECK(count[BTN_MODE] == 1);
+    CHECK(events[BTN_MODE][0].ev == BTN_EV_CLICK);
+}
+
+static void test_both()
+{
+    __reset();
+
+    // overlapping presses, each its own click
+    for (uint32_t i = 0; i < 600; ++i) {
+        if (i < BOUNCE_MS - 1 || (i >= 50 && i < 50 + BOUNCE_MS - 1)) {
+            __level(BTN_MODE, test_rand(&seed) & 1);
+            __level(BTN_SELECT, test_rand(&seed) & 1);
+        } else {
+            __level(BTN_MODE, i < 100);
+            __level(BTN_SELECT, i >= 50 && i < 200);
+        }
+        __tick();
+    }
+    __hold(BTN_MODE, 0, 1000);
+
+    CHECK(count[BTN_MODE] == 1);
+    CHECK(count[BTN_SELECT] == 1);
+    CHECK(events[BTN_MODE][0].ev == BTN_EV_CLICK);
+    CHECK(events[BTN_SELECT][0].ev == BTN_EV_CLICK);
+}
+
+// an idle button is not sampled, only an edge wakes it up
+static void test_sleep()
+{
+    __reset();
+
+    // pin changed behind the EXTI's back
+    stub_gpio_input(MODE_GPIO_Port, MODE_Pin, GPIO_PIN_RESET);
+    for (int i = 0; i < 100; ++i) {
+        __tick();
+    }
+    stub_gpio_input(MODE_GPIO_Port, MODE_Pin, GPIO_PIN_SET);
+    __hold(BTN_MODE, 0, 1000);
+    CHECK(count[BTN_MODE] == 0);
+
+    // held during the boot, no edge to see
+    stub_gpio_input(MODE_GPIO_Port, MODE_Pin, GPIO_PIN_RESET);
+    buttons_init();
+    for (int i = 0; i < 100; ++i) {
+        __tick();
+    }
+    __hold(BTN_MODE, 0, 1000);
+    CHECK(count[BTN_MODE] == 1);
+}
+
+// nobody reads the events, the queue keeps the first ones
+static void test_queue_full()
+{
+    __reset();
+
+    poll = 0;
+    __hold(BTN_MODE, 1, 5000);
+    __hold(BTN_MODE, 0, 100);
+    poll = 1;
+
+    uint32_t n = 0;
+    while (buttons_get_event(BTN_MODE) != BTN_EV_NONE) {
+        ++n;
+    }
+    CHECK(n == BTN_QUEUE_SIZE - 1);
+}
+
+int main()
+{
+    // released, pulled up
+    stub_gpio_input(MODE_GPIO_Port, MODE_Pin, GPIO_PIN_SET);
+    stub_gpio_input(SELECT_GPIO_Port, SELECT_Pin, GPIO_PIN_SET);
+    buttons_init();
+
+    test_click();
+    test_double_click();
+    test_long_press();
+    test_glitches();
+    test_both();
+    test_sleep();
+    test_queue_full();
+
+    return test_result("buttons");
+}
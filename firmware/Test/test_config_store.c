@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Configuration storage against power cuts. The store runs on the
+ simulated Flash, a save is cut after a random number of programs and
+ erases, the next boot has to find the last complete record, never a
+ torn one, and a complete save has to be the one found. Then the schema
+ evolution: unknown tags are skipped, missing and grown fields keep
+ their defaults.
+ */
+
+#include "test.h"
+#include "flash_sim.h"
+#include "config_store.h"
+
+#include <string.h>
+
+#define VERSION 3
+#define FUZZ_SAVES 5000
+
+struct Settings
+{
+    uint8_t mode;
+    uint8_t threshold;
+    uint16_t gain;
+    uint32_t counter;
+    int32_t model[3];
+    uint16_t flags;
+    uint16_t spare;
+};
+
+#define FIELD(tag, field) \
+    { tag, sizeof(((struct Settings*)0)->field), \
+      offsetof(struct Settings, field) }
+
+static const struct ConfigField schema[] = {
+    FIELD(1, mode),
+    FIELD(2, threshold),
+    FIELD(3, gain),
+    FIELD(4, counter),
+    FIELD(5, model),
+    FIELD(6, flags),
+    FIELD(8, spare)
+};
+
+#define SCHEMA_SIZE (sizeof(schema) / sizeof(schema[0]))
+
+static CRC_HandleTypeDef hcrc;
+
+static void __random(struct Settings* s, uint32_t* seed)
+{
+    uint8_t* p = (uint8_t*)s;
+
+    // no padding, the settings are compared as memory
+    for (unsigned i = 0; i < sizeof(*s); ++i) {
+        p[i] = (uint8_t)test_rand(seed);
+    }
+}
+
+static void __defaults(struct Settings* s)
+{
+    memset(s, 0x5A, sizeof(*s));
+}
+
+// the reset, what the next boot loads
+static uint16_t __boot(struct Settings* s)
+{
+    flash_sim_power_on();
+    config_store_init(&hcrc);
+
+    __defaults(s);
+    return config_store_load(schema, SCHEMA_SIZE, s);
+}
+
+static void test_power_cut()
+{
+    uint32_t seed = 0xF1A5;
+    struct Settings next, committed, loaded;
+    uint8_t haveCommitted = 0;
+    uint32_t cuts = 0, erases = 0, lucky = 0;
+
+    // the cost of a save, the erase and the half-words
+    flash_sim_init();
+    config_store_init(&hcrc);
+    __random(&next, &seed);
+    CHECK(config_store_save(schema, SCHEMA_SIZE, &next, VERSION) == HAL_OK);
+    uint32_t saveOps = flash_sim_ops();
+
+    flash_sim_init();
+    CHECK(__boot(&loaded) == 0);
+
+    for (int i = 0; i < FUZZ_SAVES; ++i) {
+        __random(&next, &seed);
+
+        // a third of the saves complete
+        uint32_t cut = test_rand(&seed) % (saveOps * 3 / 2);
+        flash_sim_cut_after((cut < saveOps) ? (int32_t)cut : -1,
+                            test_rand(&seed));
+
+        HAL_StatusTypeDef s = config_store_save(schema, SCHEMA_SIZE, &next,
+                                                VERSION);
+
+        uint8_t dead = flash_sim_dead();
+        if (dead) {
+            ++cuts;
+            erases += (cut == 0);
+        } else {
+            CHECK(s == HAL_OK);
+            committed = next;
+            haveCommitted = 1;
+        }
+
+        uint16_t version = __boot(&loaded);
+
+        if (dead && (version == VERSION)
+            && (memcmp(&loaded, &next, sizeof(loaded)) == 0)) {
+            // cut in the last half-word of the CRC, which happened to
+            // read as programmed, the record is complete
+            committed = next;
+            haveCommitted = 1;
+            ++lucky;
+        }
+
+        if (haveCommitted) {
+            CHECK(version == VERSION);
+            CHECK(memcmp(&loaded, &committed, sizeof(loaded)) == 0);
+        } else {
+            CHECK(version == 0);
+        }
+    }
+
+    printf("  %u saves, %u cut, %u of them in the erase, %u complete "
+           "anyway, %u ops a save\n", FUZZ_SAVES, cuts, erases, lucky,
+           saveOps);
+    CHECK_CMP(cuts, >, FUZZ_SAVES / 2);
+    CHECK_CMP(erases, >, 0);
+}
+
+// an older image wrote other fields, a newer one reads them
+static void test_schema()
+{
+    struct Old
+    {
+        uint8_t mode;
+        uint8_t removed;
+        uint8_t gain;
+    } old = { 2, 0xAB, 0x34 };
+
+    static const struct ConfigField oldSchema[] = {
+        { 1, 1, offsetof(struct Old, mode) },
+        // a field the newer image does not know
+        { 7, 1, offsetof(struct Old, removed) },
+        // a field that has grown since
+        { 3, 1, offsetof(struct Old, gain) }
+    };
+
+    flash_sim_init();
+    config_store_init(&hcrc);
+    CHECK(config_store_save(oldSchema, 3, &old, 1) == HAL_OK);
+
+    struct Settings s, defaults;
+    __defaults(&defaults);
+    CHECK(__boot(&s) == 1);
+
+    CHECK(s.mode == 2);
+    CHECK(s.threshold == defaults.threshold);
+    // the low byte from the record, the high one default
+    CHECK(s.gain == ((defaults.gain & 0xFF00) | 0x34));
+    CHECK(s.counter == defaults.counter);
+    CHECK(memcmp(s.model, defaults.model, sizeof(s.model)) == 0);
+    CHECK(s.flags == defaults.flags);
+
+    // written back in the new schema, the old record stays as the
+    // fallback
+    s.threshold = 55;
+    CHECK(config_store_save(schema, SCHEMA_SIZE, &s, VERSION) == HAL_OK);
+    struct Settings again;
+    CHECK(__boot(&again) == VERSION);
+    CHECK(memcmp(&again, &s, sizeof(s)) == 0);
+}
+
+int main()
+{
+    test_power_cut();
+    test_schema();
+
+    return test_result("config_store");
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Kalman estimator against the plant model. The estimator runs as in
+ logic.c, once a second on the noisy, quantised LM35 readings, the
+ estimate is compared with the plant temperature and rate it cannot
+ see. Plants differ in the time constant, in the fan effect (the
+ estimator assumes EST_FAN_GAIN) and in the sensor delay.
+ */
+
+#include "test.h"
+#include "plant.h"
+#include "estimator.h"
+
+#include <math.h>
+
+#define NOISE 0.4
+#define WARMUP_S 120
+
+struct Case
+{
+    const char* name;
+    double tau;
+    double fanFactor;
+    uint8_t delay;
+    // required estimate to raw RMS error ratio
+    double ratio;
+};
+
+// fan and ambient profile, heat-up, full cooling, partial cooling, an
+// ambient step and the fan off again
+static void __profile(uint32_t t, uint8_t* fan, double* ambient)
+{
+    *ambient = (t < 4800) ? 25 : 30;
+
+    if (t < 1800) {
+        *fan = 0;
+    } else if (t < 3000) {
+        *fan = 100;
+    } else if (t < 6000) {
+        *fan = 40;
+    } else {
+        *fan = 0;
+    }
+}
+
+static void __run(const struct Case* c)
+{
+    struct Plant p;
+    uint32_t seed = 0x1234567;
+    plant_init(&p, 25, 25, 80, c->tau, c->fanFactor, c->delay);
+
+    double rawSq = 0, estSq = 0, estSum = 0, rateSq = 0, rateTrueSq = 0;
+    uint32_t n = 0;
+    double prev = p.temp;
+
+    estimator_init(plant_adc_to_q(plant_adc(plant_sensed(&p), NOISE, &seed)));
+
+    for (uint32_t t = 1; t < 7200; ++t) {
+        uint8_t fan;
+        double ambient;
+        __profile(t, &fan, &ambient);
+
+        p.ambient = ambient;
+        plant_step(&p, fan);
+
+        int32_t chamber = plant_adc_to_q(
+            plant_adc(plant_sensed(&p), NOISE, &seed));
+        int32_t amb = plant_adc_to_q(plant_adc(ambient, NOISE, &seed));
+
+        estimator_predict(fan, amb, 1000);
+        estimator_update(chamber);
+
+        double truth = p.temp;
+        double rate = truth - prev;
+        prev = truth;
+
+        if (t < WARMUP_S) {
+            continue;
+        }
+
+        double raw = (double)chamber / EST_ONE - truth;
+        double est = (double)estimator_temp() / EST_ONE - truth;
+        double rateErr = (double)estimator_rate() / EST_ONE - rate;
+
+        rawSq += raw * raw;
+        estSq += est * est;
+        estSum += est;
+        rateSq += rateErr * rateErr;
+        rateTrueSq += rate * rate;
+        ++n;
+    }
+
+    double rawRms = sqrt(rawSq / n);
+    double estRms = sqrt(estSq / n);
+    double bias = estSum / n;
+    double rateRms = sqrt(rateSq / n);
+    double rateTrueRms = sqrt(rateTrueSq / n);
+
+    printf("  %-24s raw %.3f C, estimate %.3f C, bias %+.3f C, "
+           "rate error %.4f C/s of %.4f C/s\n",
+           c->name, rawRms, estRms, bias, rateRms, rateTrueRms);
+
+    // the point of the filter, well below the raw noise, the sensor
+    // delay it cannot see takes a part of the margin
+    CHECK_CMP(estRms, <, rawRms * c->ratio);
+    // and not paid for by a lag
+    CHECK_CMP(fabs(bias), <, 0.15);
+    // the rate is good enough for the derivative term
+    CHECK_CMP(rateRms, <, rateTrueRms / 2);
+}
+
+static void test_plants()
+{
+    static const struct Case cases[] = {
+        { "matching fan, tau 1200 s", 1200, 10, 0, 0.5 },
+        { "fast chamber, tau 300 s", 300, 2.5, 0, 0.5 },
+        { "slow chamber, tau 3600 s", 3600, 30, 0, 0.5 },
+        { "weak fan, tau 1200 s", 1200, 4, 0, 0.5 },
+        { "strong fan, tau 1200 s", 1200, 20, 0, 0.5 },
+        { "sensor delay 10 s", 1200, 10, 10, 0.9 }
+    };
+
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        __run(&cases[i]);
+    }
+}
+
+// the estimate has to settle on a constant reading, no drift of the
+// rate state on rounding
+static void test_steady()
+{
+    estimator_init(EST_FROM_INT(50));
+
+    for (int i = 0; i < 20000; ++i) {
+        estimator_predict(0, EST_FROM_INT(25), 1000);
+        estimator_update(EST_FROM_INT(50));
+    }
+
+    CHECK_CMP(fabs((double)estimator_temp() / EST_ONE - 50), <, 0.01);
+    CHECK_CMP(fabs((double)estimator_rate() / EST_ONE), <, 0.001);
+}
+
+int main()
+{
+    test_plants();
+    test_steady();
+
+    return test_result("estimator");
+}
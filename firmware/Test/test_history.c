@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Temperature history on the simulated Flash. The samples come once per
+ second as from logic_update(), the test keeps what every minute should
+ store, coarsened by the rules of history.h, and checks the dump against
+ it: the pages in order across the wrap of the ring, no minute lost or
+ doubled, the staged ones flushed before a power loss. The capacity is
+ measured for a sensor reading garbage, for a noisy chamber held by the
+ fan and for a steady one.
+ */
+
+#include "test.h"
+#include "flash_sim.h"
+#include "history.h"
+#include "plant.h"
+#include "usart.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LM35 10 mV/C, 3.3 V reference, as logic.c
+#define V_REF 3.3
+#define ADC_RES 4095
+
+#define DAY_S (24 * 3600)
+#define MINUTES_MAX (32 * 24 * 60)
+#define BOOTS_MAX 8
+#define DUMP_SIZE (4 * 1024 * 1024)
+
+#define SPREAD_MAX 15
+#define SPREAD_BAND 1
+#define FAN_BAND 4
+
+static UART_HandleTypeDef huart1;
+
+// what every minute should read back as, by the minutes fed since the
+// first boot
+static uint8_t expected[MINUTES_MAX][HIST_FIELDS];
+static uint32_t minutes;
+static uint32_t bootStart[BOOTS_MAX];
+static uint8_t boots;
+// the previous minute of the boot, the dead bands are around it
+static const uint8_t* kept;
+
+static uint8_t seconds;
+static uint8_t lo[2], hi[2];
+static uint16_t sum[3];
+
+static char dump[DUMP_SIZE];
+static uint32_t dumpLength;
+
+static void __dump_output(const uint8_t* data, uint16_t size)
+{
+    if (dumpLength + size < DUMP_SIZE) {
+        memcpy(dump + dumpLength, data, size);
+        dumpLength += size;
+    }
+}
+
+static void __boot()
+{
+    history_init();
+    bootStart[boots++] = minutes;
+    seconds = 0;
+    kept = NULL;
+}
+
+static void __reset()
+{
+    flash_sim_init();
+    minutes = 0;
+    boots = 0;
+    __boot();
+}
+
+static int __band(int v, int keptV, int band)
+{
+    return (kept && abs(v - keptV) <= band) ? keptV : v;
+}
+
+static int __min(int a, int b)
+{
+    return (a < b) ? a : b;
+}
+
+static void __expect(uint8_t field, uint8_t i)
+{
+    int avg = sum[i] / 60;
+    uint8_t* rec = expected[minutes];
+    int below = kept ? kept[field + 1] - kept[field] : 0;
+    int above = kept ? kept[field + 2] - kept[field + 1] : 0;
+
+    below = __min(__band(avg - lo[i], below, SPREAD_BAND), SPREAD_MAX);
+    above = __min(__band(hi[i] - avg, above, SPREAD_BAND), SPREAD_MAX);
+    rec[field] = (below > avg) ? 0 : avg - below;
+    rec[field + 1] = avg;
+    rec[field + 2] = __min(avg + above, 0xFF);
+}
+
+// a second of logic_update()
+static void __sample(uint8_t chamber, uint8_t ambient, uint8_t fan)
+{
+    const uint8_t v[2] = { chamber, ambient };
+
+    history_sample(chamber, ambient, fan);
+
+    if (!seconds) {
+        memset(sum, 0, sizeof(sum));
+        for (int i = 0; i < 2; ++i) {
+            lo[i] = hi[i] = v[i];
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        lo[i] = (v[i] < lo[i]) ? v[i] : lo[i];
+        hi[i] = (v[i] > hi[i]) ? v[i] : hi[i];
+        sum[i] += v[i];
+    }
+    sum[2] += fan;
+
+    if (++seconds < 60) {
+        return;
+    }
+    seconds = 0;
+    if (minutes < MINUTES_MAX) {
+        __expect(HIST_CHAMBER_MIN, 0);
+        __expect(HIST_AMBIENT_MIN, 1);
+        expected[minutes][HIST_FAN_AVG] = 
+            __band(sum[2] / 60, kept ? kept[HIST_FAN_AVG] : 0, FAN_BAND);
+        kept = expected[minutes];
+    }
+    ++minutes;
+}
+
+static uint8_t __conv_temp(uint16_t adc)
+{
+    float tf = (((float)adc) / ADC_RES) * V_REF;
+    uint16_t t = 100 * tf;
+
+    return t;
+}
+
+// the minutes from the first page in the ring to the last one, both
+// written in the same boot, by the page
+static double __minutes_per_page()
+{
+    uint32_t first = UINT32_MAX, last = 0, pages = 0;
+
+    for (int i = 0; i < FLASH_HISTORY_PAGES; ++i) {
+        const uint32_t* h = (const uint32_t*)
+            FLASH_PAGE_ADDRESS(FLASH_HISTORY_FIRST_PAGE + i);
+
+        if (h[0] == HIST_MAGIC) {
+            // magic, seq, boot, minute
+            first = (h[3] < first) ? h[3] : first;
+            last = (h[3] > last) ? h[3] : last;
+            ++pages;
+        }
+    }
+    return (pages > 1) ? (double)(last - first) / (pages - 1) : 0;
+}
+
+static uint8_t __check_record(uint32_t minute, const uint8_t* rec)
+{
+    return (minute < MINUTES_MAX)
+        && !memcmp(expected[minute], rec, HIST_FIELDS);
+}
+
+/*
+ Dumps the history and checks it line by line. Returns the minute the
+ dump starts with, *end is the one after its last.
+ */
+static uint32_t __check_dump(uint32_t* end)
+{
+    uint32_t start = UINT32_MAX, minute = 0, seq = 0, pages = 0, boot = 0;
+    uint8_t rec[HIST_FIELDS] = { 0 };
+    uint8_t ended = 0;
+
+    dumpLength = 0;
+    history_dump_start();
+    while (history_dump_update());
+
+    dump[dumpLength] = 0;
+    for (char* line = strtok(dump, "\r\n"); line; 
+         line = strtok(NULL, "\r\n")) {
+        unsigned a, b, c;
+
+        CHECK(!ended);
+        if (sscanf(line, "H %u %u %u", &a, &b, &c) == 3) {
+            CHECK(b < boots);
+            uint32_t at = bootStart[b % BOOTS_MAX] + c;
+
+            if (pages++) {
+                // in the order written, a page of the same boot goes
+                // on where the previous one ended
+                CHECK(a == seq + 1);
+                CHECK(b >= boot);
+                CHECK((b == boot) ? (at == minute) : (at >= minute));
+            } else {
+                start = at;
+            }
+            seq = a;
+            boot = b;
+            minute = at;
+        } else if (line[0] == 'M') {
+            char* p = line + 1;
+            for (int i = 0; i < HIST_FIELDS; ++i) {
+                rec[i] = strtoul(p, &p, 10);
+            }
+            CHECK(__check_record(minute, rec));
+            ++minute;
+        } else if (sscanf(line, "R %u", &a) == 1) {
+            for (unsigned i = 0; i < a; ++i) {
+                CHECK(__check_record(minute++, rec));
+            }
+        } else if (!strcmp(line, "E")) {
+            ended = 1;
+        } else {
+            printf("  unexpected dump line \"%s\"\n", line);
+            CHECK(0);
+        }
+    }
+    CHECK(ended);
+
+    *end = minute;
+    return start;
+}
+
+// a sensor reading garbage, every minute at a new level with a new
+// spread and fan power, all of the record changes, the most Flash wear
+static void test_worst_case()
+{
+    uint32_t seed = 0x4157;
+
+    __reset();
+    for (uint32_t m = 0; m < 24 * 60; ++m) {
+        uint8_t level[2], below[2], above[2];
+        uint8_t fan = test_rand(&seed) % 101;
+
+        for (int i = 0; i < 2; ++i) {
+            level[i] = 20 + test_rand(&seed) % 200;
+            below[i] = test_rand(&seed) % 16;
+            above[i] = test_rand(&seed) % 16;
+        }
+        for (int s = 0; s < 60; ++s) {
+            int d = (s == 0) ? 1 : (s == 1) ? 2 : 0;
+            uint8_t v[2];
+
+            for (int i = 0; i < 2; ++i) {
+                v[i] = (d == 1) ? level[i] - below[i]
+                    : (d == 2) ? level[i] + above[i] : level[i];
+            }
+            __sample(v[0], v[1], fan);
+        }
+    }
+
+    double perPage = __minutes_per_page();
+    printf("  sensor reading garbage  %5.1f h per page\n", perPage / 60);
+    // a page erased every few hours at most
+    CHECK_CMP(perPage, >=, 2.5 * 60);
+
+    uint32_t end;
+    uint32_t start = __check_dump(&end);
+    CHECK(end == minutes);
+    // the ring and the staging buffer
+    CHECK_CMP(end - start, >=, FLASH_HISTORY_PAGES * perPage);
+}
+
+/*
+ The chamber held at 30 C by the fan, a PI loop every 5 s as the PID of
+ logic.c, the ambient swinging over the day. The sensors have the noise
+ of the replay test. Three weeks, the ring wraps.
+ */
+static void test_noisy()
+{
+    struct Plant p;
+    uint32_t seed = 0x7015;
+    double integral = 0;
+    uint8_t fan = 0;
+
+    __reset();
+    plant_init(&p, 30, 22, 15, 1200, 3, 10);
+
+    for (uint32_t s = 0; s < 21 * DAY_S; ++s) {
+        p.ambient = 22 + 3 * sin(2 * M_PI * s / DAY_S);
+        plant_step(&p, fan);
+
+        if (s % 5 == 0) {
+            double e = plant_sensed(&p) + 0.1 * test_gauss(&seed) - 30;
+            integral += e * 5;
+            double u = 30 * e + integral / 20;
+            fan = (u < 0) ? 0 : (u > 100) ? 100 : u;
+        }
+
+        __sample(__conv_temp(plant_adc(plant_sensed(&p), 0.2, &seed)),
+                 __conv_temp(plant_adc(p.ambient, 0.2, &seed)), fan);
+    }
+
+    double perPage = __minutes_per_page();
+    printf("  noisy chamber under PID %5.2f days per page, the ring %.1f "
+           "days\n", perPage / 1440, FLASH_HISTORY_PAGES * perPage / 1440);
+    CHECK_CMP(perPage, >=, 2.5 * 1440);
+
+    // wrapped, the oldest minutes are gone, the rest up to now is there
+    uint32_t end;
+    uint32_t start = __check_dump(&end);
+    CHECK(start > 0);
+    CHECK(end == minutes);
+    CHECK_CMP(end - start, >=, FLASH_HISTORY_PAGES * perPage);
+}
+
+// nothing changes, the runs fill the staging buffer only
+static void test_steady()
+{
+    __reset();
+    uint32_t ops = flash_sim_ops();
+    for (uint32_t s = 0; s < 21 * DAY_S; ++s) {
+        __sample(30, 22, 25);
+    }
+    // three weeks and not a page full
+    CHECK(flash_sim_ops() == ops);
+
+    uint32_t end;
+    CHECK(__check_dump(&end) == 0);
+    CHECK(end == minutes);
+}
+
+// the supply fails, the staged minutes are flushed and the next boot
+// goes on after them
+static void test_power_loss()
+{
+    uint32_t seed = 0xB0F;
+
+    __reset();
+    for (int boot = 0; boot < 3; ++boot) {
+        for (uint32_t s = 0; s < 3 * 3600 + 17; ++s) {
+            __sample(30 + (test_rand(&seed) & 1), 22, 40);
+        }
+        history_flush();
+        // the minute in progress is lost
+        minutes += (seconds != 0);
+        __boot();
+    }
+
+    uint32_t end;
+    CHECK(__check_dump(&end) == 0);
+    CHECK(end == bootStart[boots - 1]);
+
+    // no flush, what was staged is gone, the pages stay readable
+    for (uint32_t s = 0; s < 3600; ++s) {
+        __sample(31, 22, 40);
+    }
+    __boot();
+    CHECK(__check_dump(&end) == 0);
+    CHECK(end == bootStart[boots - 2]);
+}
+
+int main()
+{
+    huart1.Instance = USART1;
+    usart_config(&huart1);
+    stub_uart_tx_hook = __dump_output;
+
+    test_worst_case();
+    test_noisy();
+    test_steady();
+    test_power_loss();
+
+    return test_result("history");
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Modbus RTU slave with its reception path. Requests are put on the line
+ byte by byte into the receive DMA's circular buffer, the idle line
+ interrupt closes the frame, the main loop serves it and the response
+ is taken from the transmit DMA. The framing, the CRC and every
+ exception path are exercised against a small register map.
+ */
+
+#include "test.h"
+#include "modbus.h"
+#include "uart_rx.h"
+#include "usart.h"
+
+#include <string.h>
+
+static DMA_HandleTypeDef hdmarx = { .Instance = DMA1_Channel5 };
+static UART_HandleTypeDef huart = { .Instance = USART1, .hdmarx = &hdmarx };
+
+// the application's registers
+static uint8_t u8 = 42;
+static uint16_t u16 = 0x1234;
+static int32_t s32 = -100000;
+static uint8_t level = 10;
+static uint16_t limit = 20;
+static uint16_t limitMax = 500;
+static uint16_t readOnly = 0xBEEF;
+static int32_t gain = 0x00010002;
+static uint32_t writes = 0;
+
+static uint16_t __seven()
+{
+    return 7;
+}
+
+static uint16_t __limit_max()
+{
+    return limitMax;
+}
+
+static void __on_write(uint32_t now_ms)
+{
+    ++writes;
+}
+
+static const struct ModbusRegister input[] = {
+    { "u8", MB_U8, &u8 },
+    { "u16", MB_U16, &u16 },
+    { "s32", MB_S32_HI, &s32 },
+    { "s32", MB_S32_LO, &s32 },
+    { "fn", MB_FN, NULL, __seven }
+};
+
+static const struct ModbusRegister holding[] = {
+    { "level", MB_U8, &level, NULL, 1, 0, 100, NULL },
+    { "limit", MB_U16, &limit, NULL, 1, 10, 1000, __limit_max },
+    { "ro", MB_U16, &readOnly, NULL, 0, 0, 0xFFFF, NULL },
+    { "gain", MB_S32_HI, &gain, NULL, 1, 0, 0xFFFF, NULL },
+    { "gain", MB_S32_LO, &gain, NULL, 1, 0, 0xFFFF, NULL }
+};
+
+static const struct ModbusMap map = {
+    .input = input,
+    .inputCount = sizeof(input) / sizeof(input[0]),
+    .holding = holding,
+    .holdingCount = sizeof(holding) / sizeof(holding[0]),
+    .on_write = __on_write
+};
+
+// a frame on the line followed by the idle interrupt
+static void __line(const uint8_t* data, uint16_t length)
+{
+    stub_uart_receive(&huart, data, length);
+    stub_uart_idle(&huart);
+
+    stub_ipsr = 1;
+    uart_rx_idle_int();
+    stub_ipsr = 0;
+}
+
+// the main loop, serves the frames received, the response is in
+// stub_uart_tx, returns the number of frames Modbus took
+static uint8_t __serve()
+{
+    struct UartFrame f;
+    uint8_t served = 0;
+
+    stub_uart_tx_length = 0;
+    while (uart_rx_frame(&f)) {
+        served += modbus_frame(&f, stub_tick);
+    }
+    while (stub_uart_tx_complete(&huart));
+
+    return served;
+}
+
+static uint16_t __with_crc(uint8_t* frame, uint16_t length)
+{
+    uint16_t crc = modbus_crc16(frame, length);
+    frame[length] = crc & 0xFF;
+    frame[length + 1] = crc >> 8;
+    return length + 2;
+}
+
+// address, function and two 16-bit fields, the common request shape
+static uint16_t __request(uint8_t* frame, uint8_t address, uint8_t function,
+                          uint16_t a, uint16_t b)
+{
+    frame[0] = address;
+    frame[1] = function;
+    frame[2] = a >> 8;
+    frame[3] = a & 0xFF;
+    frame[4] = b >> 8;
+    frame[5] = b & 0xFF;
+    return __with_crc(frame, 6);
+}
+
+// sends the request and checks the response is well formed, returns
+// its length without the CRC
+static uint16_t __transact(const uint8_t* frame, uint16_t length)
+{
+    __line(frame, length);
+    CHECK(__serve() == 1);
+
+    if (stub_uart_tx_length) {
+        CHECK(modbus_crc16(stub_uart_tx, stub_uart_tx_length) == 0);
+        return stub_uart_tx_length - 2;
+    }
+    return 0;
+}
+
+static uint8_t __exception_of(const uint8_t* frame, uint16_t length)
+{
+    uint16_t n = __transact(frame, length);
+
+    CHECK(n == 3);
+    CHECK(stub_uart_tx[1] == (frame[1] | 0x80));
+    return stub_uart_tx[2];
+}
+
+static uint16_t __reg(uint16_t i)
+{
+    return ((uint16_t)stub_uart_tx[3 + 2 * i] << 8) | stub_uart_tx[4 + 2 * i];
+}
+
+static void test_crc()
+{
+    // the check value of CRC-16/MODBUS
+    CHECK(modbus_crc16((const uint8_t*)"123456789", 9) == 0x4B37);
+
+    // every single bit error is caught, nothing is answered
+    uint8_t frame[8];
+    uint16_t n = __request(frame, MODBUS_ADDRESS, 0x03, 0, 1);
+
+    for (uint16_t bit = 0; bit < n * 8; ++bit) {
+        frame[bit / 8] ^= 1 << (bit % 8);
+        __line(frame, n);
+        CHECK(__serve() == 0);
+        CHECK(stub_uart_tx_length == 0);
+        frame[bit / 8] ^= 1 << (bit % 8);
+    }
+}
+
+static void test_read()
+{
+    uint8_t frame[8];
+
+    uint16_t n = __transact(frame, 
+        __request(frame, MODBUS_ADDRESS, 0x04, 0, 5));
+    CHECK(n == 3 + 10);
+    CHECK(stub_uart_tx[0] == MODBUS_ADDRESS);
+    CHECK(stub_uart_tx[1] == 0x04);
+    CHECK(stub_uart_tx[2] == 10);
+    CHECK(__reg(0) == 42);
+    CHECK(__reg(1) == 0x1234);
+    CHECK((int32_t)(((uint32_t)__reg(2) << 16) | __reg(3)) == -100000);
+    CHECK(__reg(4) == 7);
+
+    // from the middle
+    n = __transact(frame, __request(frame, MODBUS_ADDRESS, 0x03, 2, 1));
+    CHECK(n == 3 + 2);
+    CHECK(__reg(0) == 0xBEEF);
+}
+
+static void test_write()
+{
+    uint8_t frame[32];
+    uint32_t before = writes;
+
+    // write single, echoed
+    uint16_t n = __request(frame, MODBUS_ADDRESS, 0x06, 0, 55);
+    CHECK(__transact(frame, n) == 6);
+    CHECK(memcmp(stub_uart_tx, frame, 6) == 0);
+    CHECK(level == 55);
+    CHECK(writes == before + 1);
+
+    // write multiple, the 32-bit pair
+    frame[0] = MODBUS_ADDRESS;
+    frame[1] = 0x10;
+    frame[2] = 0; frame[3] = 3;
+    frame[4] = 0; frame[5] = 2;
+    frame[6] = 4;
+    frame[7] = 0xFF; frame[8] = 0xFF;
+    frame[9] = 0xFF; frame[10] = 0xFE;
+    n = __with_crc(frame, 11);
+    CHECK(__transact(frame, n) == 6);
+    // start and count echoed
+    CHECK(memcmp(&stub_uart_tx[2], &frame[2], 4) == 0);
+    CHECK(gain == -2);
+    CHECK(writes == before + 2);
+}
+
+static void test_exceptions()
+{
+    uint8_t frame[32];
+    uint32_t before = writes;
+
+    // illegal function
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x05, 0, 0xFF00)) == 0x01);
+
+    // illegal address, past the end, read only, dynamic bound
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x04, 3, 3)) == 0x02);
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x06, 5, 0)) == 0x02);
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x06, 2, 1)) == 0x02);
+
+    // illegal value, count, range, the state dependent maximum
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x03, 0, 0)) == 0x03);
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x03, 0,
+                  MODBUS_MAX_REGISTERS + 1)) == 0x03);
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x06, 0, 101)) == 0x03);
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x06, 1, 9)) == 0x03);
+    limitMax = 100;
+    CHECK(__exception_of(frame,
+        __request(frame, MODBUS_ADDRESS, 0x06, 1, 200)) == 0x03);
+    limitMax = 500;
+
+    // a read with trailing bytes
+    frame[0] = MODBUS_ADDRESS;
+    frame[1] = 0x03;
+    memset(&frame[2], 0, 5);
+    frame[5] = 1;
+    CHECK(__exception_of(frame, __with_crc(frame, 7)) == 0x03);
+
+    // write multiple, the byte count not matching
+    frame[0] = MODBUS_ADDRESS;
+    frame[1] = 0x10;
+    frame[2] = 0; frame[3] = 0;
+    frame[4] = 0; frame[5] = 2;
+    frame[6] = 2;
+    frame[7] = 0; frame[8] = 1;
+    CHECK(__exception_of(frame, __with_crc(frame, 9)) == 0x03);
+
+    // all or nothing, the second value is out of range
+    uint8_t levelBefore = level;
+    uint16_t limitBefore = limit;
+    frame[6] = 4;
+    frame[7] = 0; frame[8] = 1;
+    frame[9] = 0x10; frame[10] = 0;
+    CHECK(__exception_of(frame, __with_crc(frame, 11)) == 0x03);
+    CHECK(level == levelBefore);
+    CHECK(limit == limitBefore);
+
+    CHECK(writes == before);
+}
+
+static void test_addressing()
+{
+    uint8_t frame[8];
+    uint32_t before = writes;
+
+    // broadcast, executed without a response
+    __line(frame, __request(frame, 0, 0x06, 0, 77));
+    CHECK(__serve() == 1);
+    CHECK(stub_uart_tx_length == 0);
+    CHECK(level == 77);
+    CHECK(writes == before + 1);
+
+    // someone else's, taken but not answered nor executed
+    __line(frame, __request(frame, MODBUS_ADDRESS + 1, 0x06, 0, 5));
+    CHECK(__serve() == 1);
+    CHECK(stub_uart_tx_length == 0);
+    CHECK(level == 77);
+
+    // not Modbus, left to the shell
+    __line((const uint8_t*)"status\r", 7);
+    CHECK(__serve() == 0);
+}
+
+static void test_framing()
+{
+    uint8_t frame[8];
+    uint16_t n = __request(frame, MODBUS_ADDRESS, 0x03, 0, 1);
+
+    // the frames cross the end of the circular buffer many times over
+    for (int i = 0; i < 100; ++i) {
+        CHECK(__transact(frame, n) == 5);
+        CHECK(__reg(0) == level);
+    }
+
+    // back to back, each closed by its idle line, served in one pass
+    for (int i = 0; i < UART_RX_QUEUE_SIZE - 1; ++i) {
+        __line(frame, n);
+    }
+    CHECK(__serve() == UART_RX_QUEUE_SIZE - 1);
+    CHECK(stub_uart_tx_length == (UART_RX_QUEUE_SIZE - 1) * 7);
+
+    // the main loop late, the frames past the queue are dropped
+    for (int i = 0; i < UART_RX_QUEUE_SIZE + 2; ++i) {
+        __line(frame, n);
+    }
+    CHECK(__serve() == UART_RX_QUEUE_SIZE - 1);
+
+    // two requests without a gap are one frame failing the CRC
+    uint8_t twice[16];
+    memcpy(twice, frame, n);
+    memcpy(twice + n, frame, n);
+    __line(twice, 2 * n);
+    CHECK(__serve() == 0);
+    CHECK(stub_uart_tx_length == 0);
+
+    // a spurious idle interrupt, nothing received
+    stub_uart_idle(&huart);
+    uart_rx_idle_int();
+    CHECK(__serve() == 0);
+}
+
+// the logs would corrupt the responses on the shared line
+static void test_mute()
+{
+    uint8_t frame[8];
+
+    stub_tick = 100000;
+    __transact(frame, __request(frame, MODBUS_ADDRESS, 0x03, 0, 1));
+
+    stub_uart_tx_length = 0;
+    send_string("log");
+    while (stub_uart_tx_complete(&huart));
+    CHECK(stub_uart_tx_length == 0);
+
+    stub_tick += MODBUS_QUIET_MS;
+    send_string("log");
+    while (stub_uart_tx_complete(&huart));
+    CHECK(stub_uart_tx_length == 3);
+
+    // a raw write waiting behind the log stays, the log after it goes
+    stub_tick += MODBUS_QUIET_MS;
+    stub_uart_tx_length = 0;
+    send_string("log");
+    usart_write((const uint8_t*)"raw", 3);
+    send_string("log");
+    usart_mute(MODBUS_QUIET_MS);
+    while (stub_uart_tx_complete(&huart));
+    CHECK(stub_uart_tx_length == 6);
+    CHECK(memcmp(stub_uart_tx, "lograw", 6) == 0);
+}
+
+int main()
+{
+    usart_config(&huart);
+    uart_rx_init(&huart);
+    modbus_init(&map);
+
+    test_crc();
+    test_read();
+    test_write();
+    test_exceptions();
+    test_addressing();
+    test_framing();
+    test_mute();
+
+    return test_result("modbus");
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Modbus RTU slave against the real master. uart_rx.c, modbus.c and 
+ usart.c run in a thread as on the MCU, the USART is the master side of
+ a pty, tools/modbus_poll.py polls the slave side as it would the USB
+ adapter and measures the request/response latency, at 115200 and at
+ 1 Mbaud.
+
+ A pty does not care about the baud rate, the thread puts the line back
+ in: a request is handed to the receive DMA only once its last byte 
+ would have arrived, the idle interrupt comes one character later, and
+ a response reaches the pty after the time its bytes take on the line.
+ What the master measures is then the line plus the slave's and the 
+ host's own delays.
+ */
+
+// the pty functions
+#define _GNU_SOURCE
+
+#include "test.h"
+#include "modbus.h"
+#include "uart_rx.h"
+#include "usart.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MASTER "../tools/modbus_poll.py"
+#define REQUESTS 300
+
+// the registers read by the bench, 6 from address 0
+#define INPUT_REGISTERS 6
+// 0x04 request and its response, in bytes
+#define REQUEST_LENGTH 8
+#define RESPONSE_LENGTH (5 + 2 * INPUT_REGISTERS)
+
+// the slave's and the host's share of the latency, the pty, the
+// scheduler and the Python master included
+#define OVERHEAD_MAX_MS 1.0
+
+static DMA_HandleTypeDef hdmarx = { .Instance = DMA1_Channel5 };
+static UART_HandleTypeDef huart = { .Instance = USART1, .hdmarx = &hdmarx };
+
+static int master;
+static char slave[64];
+
+// of the line, set before each run of the master
+static volatile uint32_t baud;
+
+static uint16_t values[INPUT_REGISTERS] = { 215, 230, 218, 65, 1, 0 };
+
+static const struct ModbusRegister input[] = {
+    { "r0", MB_U16, &values[0] },
+    { "r1", MB_U16, &values[1] },
+    { "r2", MB_U16, &values[2] },
+    { "r3", MB_U16, &values[3] },
+    { "r4", MB_U16, &values[4] },
+    { "r5", MB_U16, &values[5] }
+};
+
+static const struct ModbusMap map = {
+    .input = input,
+    .inputCount = sizeof(input) / sizeof(input[0])
+};
+
+static double __now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void __wait_until(double t)
+{
+    struct timespec ts = { .tv_sec = (time_t)t };
+
+    ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+// start, 8 data bits and stop
+static double __char_time()
+{
+    return 10.0 / baud;
+}
+
+// the transmit DMA, the last byte is out after the whole transfer
+static void __transmit(const uint8_t* data, uint16_t size)
+{
+    __wait_until(__now() + size * __char_time());
+    if (write(master, data, size) != size) {
+        perror("pty");
+    }
+}
+
+// the main() of the firmware as far as the line is concerned
+static void* __mcu(void* arg)
+{
+    struct pollfd p = { .fd = master, .events = POLLIN };
+    uint8_t data[UART_RX_BUFFER_SIZE];
+
+    UNUSED(arg);
+    for (;;) {
+        if (poll(&p, 1, -1) <= 0) {
+            continue;
+        }
+
+        // the first byte started on the line when it got here, the
+        // frame is over one character after the last byte
+        double start = __now();
+        ssize_t length = 0;
+        for (;;) {
+            ssize_t n = read(master, data + length, sizeof(data) - length);
+            if (n > 0) {
+                length += n;
+            }
+            __wait_until(start + (length + 1) * __char_time());
+            if ((length == sizeof(data)) || (poll(&p, 1, 0) <= 0)) {
+                break;
+            }
+        }
+
+        stub_uart_receive(&huart, data, length);
+        stub_uart_idle(&huart);
+        stub_ipsr = 1;
+        uart_rx_idle_int();
+        stub_ipsr = 0;
+
+        struct UartFrame f;
+        while (uart_rx_frame(&f)) {
+            modbus_frame(&f, (uint32_t)(__now() * 1000));
+        }
+    }
+    return NULL;
+}
+
+// runs the master's bench at the baud rate, checks its report
+static void __bench(uint32_t baud_)
+{
+    char cmd[256];
+    char log[64];
+    char line[128];
+    uint32_t requests = 0;
+    uint32_t errors = REQUESTS;
+    double min = 0, avg = 0, p99 = 0, max = 0;
+
+    baud = baud_;
+    snprintf(log, sizeof(log), "build/modbus_poll_%u.log", baud);
+    snprintf(cmd, sizeof(cmd), "python3 " MASTER " -d %s -b %u -n %u "
+             "bench > %s 2>&1", slave, baud, REQUESTS, log);
+    CHECK(system(cmd) == 0);
+
+    FILE* f = fopen(log, "r");
+    CHECK(f != NULL);
+    if (!f) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "requests %u, errors %u", &requests, &errors);
+        sscanf(line, "latency [ms] min %lf avg %lf p99 %lf max %lf",
+               &min, &avg, &p99, &max);
+    }
+    fclose(f);
+
+    double wire = (REQUEST_LENGTH + 1 + RESPONSE_LENGTH)
+                  * __char_time() * 1000;
+    printf("  %7u baud: %u requests, %u errors, latency [ms] min %.2f "
+           "avg %.2f p99 %.2f max %.2f, line %.2f\n", baud, requests,
+           errors, min, avg, p99, max, wire);
+
+    CHECK(requests == REQUESTS);
+    CHECK(errors == 0);
+    // never faster than the line, and not much slower
+    CHECK_CMP(min, >=, wire);
+    CHECK_CMP(avg, <, wire + OVERHEAD_MAX_MS);
+}
+
+static void test_latency()
+{
+    __bench(115200);
+    __bench(1000000);
+}
+
+int main()
+{
+    struct termios attr;
+    pthread_t mcu;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || grantpt(master) || unlockpt(master)) {
+        perror("pty");
+        return 1;
+    }
+    snprintf(slave, sizeof(slave), "%s", ptsname(master));
+
+    // kept open, the master sees no hang-up between the runs, and raw
+    // from the start, no echo of what the slave sends
+    int fd = open(slave, O_RDWR | O_NOCTTY);
+    tcgetattr(fd, &attr);
+    cfmakeraw(&attr);
+    tcsetattr(fd, TCSANOW, &attr);
+
+    baud = 115200;
+    stub_uart_tx_hook = __transmit;
+    usart_config(&huart);
+    uart_rx_init(&huart);
+    modbus_init(&map);
+    pthread_create(&mcu, NULL, __mcu, NULL);
+
+    test_latency();
+
+    close(fd);
+    return test_result("modbus_pty");
+}
@@ -0,0 +1,807 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Input recorder and its replay, logic.c with the modules it drives on
+ the stub HAL. First as the device, in a child process: a chamber of
+ plant.c heated by the printer and cooled by the fan, the mains 
+ crossing zero every 10 ms with jitter, button events now and then and
+ a Modbus master writing the configuration, recorded from the boot as
+ "record boot" does. Then the replay, in a fresh process: the
+ configuration of the first ~C goes to the Flash, the recorded inputs
+ are fed at their ticks and the recording is done again, every record
+ has to come out bit for bit, the fan power and the display among them.
+
+ The device follows main.c and calls logic_update() once a 
+ millisecond, the crossings come in between at their DWT stamps. An 
+ input is stamped when logic.c takes it, after the 1 ms HAL_Delay() of
+ a temperature conversion in that pass, the replay knows a pass delays
+ from its ~A. The replay runs a pass only where something happens: in
+ the millisecond of a crossing and where the next record is due, a 
+ pass earlier for a ~A, HAL_GetTick() jumps over the rest. logic.c 
+ acting on its own in between without a record, or the mains missing
+ for long, shows as a mismatch.
+
+ The replay of a recording, e.g. one captured in the field:
+    build/test_replay <log>
+ reports the first record which differs. The DWT is taken to be 
+ HAL_GetTick() at ~S there, the crossings may move by a millisecond.
+ */
+
+#include "test.h"
+#include "flash_sim.h"
+#include "plant.h"
+#include "logic.h"
+#include "buttons.h"
+#include "config_store.h"
+#include "fan_driver.h"
+#include "modbus.h"
+#include "record.h"
+#include "uart_rx.h"
+#include "usart.h"
+#include "vfd_driver.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DEVICE_MS (2UL * 3600 * 1000)
+#define BOOT_MS 20
+#define LOG_FILE "build/replay.log"
+
+// a ~Z comes up to RECORD_ZC_MAX_MS after its crossings, the replay
+// reads that far ahead
+#define LOOKAHEAD_MS 1000
+
+_Static_assert(LOOKAHEAD_MS > RECORD_ZC_MAX_MS + 2,
+               "the replay would jump over crossings not read yet");
+
+#define LINE_MAX 256
+#define CONFIG_VALUES 13
+// fan_speed to pid_td, the rest is learned
+#define CONFIG_WRITABLE 6
+
+// fixed size FIFOs
+#define QUEUE(type, n) struct { type items[n]; uint32_t head, tail; }
+#define Q_SIZE(q) (sizeof((q).items) / sizeof((q).items[0]))
+#define Q_EMPTY(q) ((q).head == (q).tail)
+#define Q_FULL(q) ((q).tail - (q).head == Q_SIZE(q))
+#define Q_FRONT(q) ((q).items[(q).head % Q_SIZE(q)])
+#define Q_POP(q) ((q).items[(q).head++ % Q_SIZE(q)])
+#define Q_PUSH(q, v) ((q).items[(q).tail++ % Q_SIZE(q)] = (v))
+
+struct Sample
+{
+    uint32_t tick;
+    uint16_t value[2];
+};
+
+struct Buttons
+{
+    uint32_t tick;
+    uint8_t ev[BTN_COUNT];
+};
+
+struct Frame
+{
+    uint32_t tick;
+    uint8_t length;
+    uint8_t data[32];
+};
+
+struct Record
+{
+    uint32_t tick;
+    char text[LINE_MAX];
+};
+
+static ADC_HandleTypeDef adcTemp = { .Instance = ADC1 };
+static ADC_HandleTypeDef adcLight = { .Instance = ADC2 };
+static TIM_HandleTypeDef htim3 = { .Instance = TIM3 };
+static CRC_HandleTypeDef hcrc;
+static DMA_HandleTypeDef hdmarx = { .Instance = DMA1_Channel5 };
+static DMA_HandleTypeDef hdmatx = { .Instance = DMA1_Channel4 };
+static UART_HandleTypeDef huart = { .Instance = USART1, .hdmatx = &hdmatx,
+                                    .hdmarx = &hdmarx };
+
+static uint8_t replaying;
+
+static void __read(uint32_t tick);
+static void __skip(uint32_t readUpTo);
+
+// inputs due, the device's made up, the replay's read
+static QUEUE(uint64_t, 1024) crossings;
+static QUEUE(struct Sample, 256) temps;
+static QUEUE(struct Sample, 256) lights;
+static QUEUE(struct Buttons, 64) buttons;
+static QUEUE(struct Frame, 64) frames;
+
+// ----------------------------------------
+// The configuration in the Flash, a copy of logic.c's schema. Should
+// they part, the ~C of the replay differs.
+// ----------------------------------------
+struct Configuration
+{
+    uint8_t fanSpeed;
+    uint8_t tempThreshold;
+    uint16_t fastBoot;
+    uint16_t pidKp;
+    uint16_t pidTi;
+    uint16_t pidTd;
+    uint16_t modelSaved;
+    int32_t model[3];
+};
+
+#define CONF_FIELD(tag, field) \
+    { tag, sizeof(((struct Configuration*)0)->field), \
+      offsetof(struct Configuration, field) }
+
+static const struct ConfigField schema[] = {
+    CONF_FIELD(1, fanSpeed),
+    CONF_FIELD(2, tempThreshold),
+    CONF_FIELD(3, pidKp),
+    CONF_FIELD(4, pidTi),
+    CONF_FIELD(5, pidTd),
+    CONF_FIELD(6, modelSaved),
+    CONF_FIELD(7, model),
+    CONF_FIELD(8, fastBoot)
+};
+
+// the holding registers as in ~C
+static void __store_config(const uint32_t* v)
+{
+    struct Configuration c = {
+        .fanSpeed = v[0], .tempThreshold = v[1], .fastBoot = v[2],
+        .pidKp = v[3], .pidTi = v[4], .pidTd = v[5], .modelSaved = v[6]
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        c.model[i] = (int32_t)((v[7 + 2 * i] << 16) | v[8 + 2 * i]);
+    }
+    CHECK(config_store_save(schema, sizeof(schema) / sizeof(schema[0]),
+                            &c, 1) == HAL_OK);
+}
+
+// ----------------------------------------
+// What logic.c sees of the hardware
+// ----------------------------------------
+
+// the button events, logic.c takes both once a pass, MODE first
+static enum ButtonEvent taken[BTN_COUNT];
+
+void buttons_init()
+{
+}
+
+void buttons_exti_int(uint16_t pin)
+{
+    UNUSED(pin);
+}
+
+enum ButtonEvent buttons_get_event(enum ButtonId id)
+{
+    if (id == BTN_MODE) {
+        taken[BTN_MODE] = taken[BTN_SELECT] = BTN_EV_NONE;
+        if (!Q_EMPTY(buttons) && (Q_FRONT(buttons).tick <= stub_tick)) {
+            struct Buttons b = Q_POP(buttons);
+
+            taken[BTN_MODE] = b.ev[BTN_MODE];
+            taken[BTN_SELECT] = b.ev[BTN_SELECT];
+        }
+    }
+
+    return taken[id];
+}
+
+// no crash log here
+void crash_log_dump()
+{
+}
+
+static struct Plant plant;
+static uint32_t seed = 0x5EC0;
+static uint32_t missing;
+
+static uint16_t __light_adc()
+{
+    // a day and a night in an hour, the display dims
+    double light = 0.5 + 0.45 * sin(2 * M_PI * stub_tick / 3600000.0) 
+        + 0.01 * test_gauss(&seed);
+
+    return fmin(fmax(light, 0), 1) * 4095;
+}
+
+static void __adc(ADC_HandleTypeDef* hadc, uint16_t* data, uint32_t length)
+{
+    if (hadc == &adcLight) {
+        if (!replaying) {
+            data[0] = __light_adc();
+        } else if (!Q_EMPTY(lights)) {
+            data[0] = Q_POP(lights).value[0];
+        } else {
+            data[0] = 0;
+            ++missing;
+        }
+        return;
+    }
+
+    if (!replaying) {
+        data[0] = plant_adc(plant.ambient, 0.2, &seed);
+        data[1] = plant_adc(plant_sensed(&plant), 0.2, &seed);
+    } else if (!Q_EMPTY(temps)) {
+        struct Sample s = Q_POP(temps);
+
+        data[0] = s.value[0];
+        data[1] = s.value[1];
+    } else {
+        data[0] = data[1] = 0;
+        ++missing;
+    }
+
+    // the DMA interrupt
+    dma_conv_int();
+}
+
+// ----------------------------------------
+// The main loop
+// ----------------------------------------
+static uint32_t __cycles_per_ms()
+{
+    return SystemCoreClock / 1000;
+}
+
+static void __receive(const struct Frame* f)
+{
+    stub_uart_receive(&huart, f->data, f->length);
+    stub_uart_idle(&huart);
+    stub_ipsr = 1;
+    uart_rx_idle_int();
+    stub_ipsr = 0;
+}
+
+// one pass of the main loop
+static void __pass()
+{
+    uint64_t end = ((uint64_t)stub_tick + 1) * __cycles_per_ms();
+    // where the pass ends, the inputs stamped up to it are taken
+    uint32_t last = stub_tick;
+    uint32_t readUpTo = stub_tick + LOOKAHEAD_MS;
+
+    if (replaying) {
+        __read(readUpTo);
+        if (!Q_EMPTY(temps) && (Q_FRONT(temps).tick == stub_tick + 1)) {
+            ++last;
+        }
+    }
+
+    while (!Q_EMPTY(crossings) && (Q_FRONT(crossings) < end)) {
+        DWT->CYCCNT = (uint32_t)Q_POP(crossings);
+        stub_ipsr = 1;
+        HAL_GPIO_EXTI_Callback(ZERO_CROSS_Pin);
+        stub_ipsr = 0;
+    }
+    DWT->CYCCNT = (uint32_t)((uint64_t)stub_tick * __cycles_per_ms());
+
+    while (!Q_EMPTY(frames) && (Q_FRONT(frames).tick <= last)) {
+        struct Frame f = Q_POP(frames);
+        __receive(&f);
+    }
+
+    logic_update();
+    ++stub_tick;
+
+    if (replaying) {
+        __skip(readUpTo);
+    }
+}
+
+// main.c's sequence with the recording from the boot
+static void __boot(uint32_t tick)
+{
+    stub_tick = tick;
+    DWT->CYCCNT = (uint32_t)((uint64_t)tick * __cycles_per_ms());
+    stub_adc_hook = __adc;
+    record_boot_request();
+
+    usart_config(&huart);
+    vfd_driver_init();
+    fan_driver_init(&htim3);
+    config_store_init(&hcrc);
+    logic_init(&adcTemp, &adcLight);
+
+    __pass();
+
+    uart_rx_init(&huart);
+    logic_init_selfcheck();
+}
+
+static void __frame(struct Frame* f, uint8_t function, uint16_t address,
+                    const uint16_t* values, uint8_t count)
+{
+    uint8_t* d = f->data;
+
+    d[0] = MODBUS_ADDRESS;
+    d[1] = function;
+    d[2] = address >> 8;
+    d[3] = address & 0xFF;
+    f->length = 4;
+    if (function == 0x10) {
+        d[f->length++] = 0;
+        d[f->length++] = count;
+        d[f->length++] = 2 * count;
+    }
+    for (uint8_t i = 0; i < count; ++i) {
+        d[f->length++] = values[i] >> 8;
+        d[f->length++] = values[i] & 0xFF;
+    }
+
+    uint16_t crc = modbus_crc16(d, f->length);
+    d[f->length++] = crc & 0xFF;
+    d[f->length++] = crc >> 8;
+}
+
+// ----------------------------------------
+// The device
+// ----------------------------------------
+static FILE* logFile;
+
+static void __device_output(const uint8_t* data, uint16_t size)
+{
+    fwrite(data, 1, size, logFile);
+}
+
+static uint32_t __random(uint32_t min, uint32_t max)
+{
+    return min + test_rand(&seed) % (max - min + 1);
+}
+
+static void __device()
+{
+    // PID tuned, the visual selfcheck
+    static const uint32_t config[CONFIG_VALUES] = {
+        3, 45, 0, 1500, 400, 20, 0xFFFF
+    };
+    uint64_t crossing = (uint64_t)BOOT_MS * __cycles_per_ms();
+    uint32_t buttonsAt = 30000;
+    uint32_t frameAt = 60000;
+
+    logFile = fopen(LOG_FILE, "wb");
+    stub_uart_tx_hook = __device_output;
+
+    flash_sim_init();
+    config_store_init(&hcrc);
+    __store_config(config);
+    plant_init(&plant, 22, 22, 45, 1200, 3, 5);
+
+    __boot(BOOT_MS);
+
+    for (uint32_t s = stub_tick / 1000; stub_tick < DEVICE_MS; ) {
+        // the mains, 50 Hz with some jitter, at whole microseconds
+        while (crossing < ((uint64_t)stub_tick + 2) * __cycles_per_ms()) {
+            Q_PUSH(crossings, crossing);
+            crossing += (10000 + __random(0, 60) - 30) 
+                * (SystemCoreClock / 1000000);
+        }
+
+        if (stub_tick >= buttonsAt) {
+            struct Buttons b = { .tick = stub_tick };
+
+            b.ev[__random(0, 1)] = __random(BTN_EV_CLICK, BTN_EV_REPEAT);
+            Q_PUSH(buttons, b);
+            buttonsAt = stub_tick + __random(5000, 60000);
+        }
+
+        // the threshold, sometimes the fan mode
+        if (stub_tick >= frameAt) {
+            struct Frame f = { .tick = stub_tick };
+            uint16_t v = __random(35, 55);
+
+            if (v & 1) {
+                __frame(&f, 0x06, 1, &v, 1);
+            } else {
+                uint16_t w[2] = { __random(0, 3), v };
+                __frame(&f, 0x10, 0, w, 2);
+            }
+            Q_PUSH(frames, f);
+            frameAt = stub_tick + __random(60000, 600000);
+        }
+
+        __pass();
+
+        for (; s < stub_tick / 1000; ++s) {
+            plant_step(&plant, fan_driver_get_power());
+        }
+    }
+
+    fclose(logFile);
+}
+
+// ----------------------------------------
+// The replay
+// ----------------------------------------
+static FILE* replayFile;
+static uint8_t replayEnd;
+// the tick of the last record read
+static uint32_t readTick;
+static uint32_t boots;
+static uint8_t configRead;
+static uint32_t bootConfig[CONFIG_VALUES];
+// the stamp of the last crossing read
+static uint64_t stamp;
+static uint32_t lost;
+// the size of the recording, and of its crossings
+static uint64_t recordBytes;
+static uint64_t crossingBytes;
+// [bytes/min]
+static double recordRate;
+static uint32_t lastConfig_ms;
+static uint32_t mutedRecords;
+
+static QUEUE(struct Record, 4096) expected;
+
+static uint32_t records;
+static uint32_t mismatches;
+static uint32_t outputs;
+
+// the record in a line of the UART, the log and the Modbus responses
+// around it, the line ends after it, NULL if there is none
+static const char* __find_record(char* line, size_t length)
+{
+    for (size_t i = 0; i + 2 < length; ++i) {
+        if ((line[i] == '~') && line[i + 1] 
+            && strchr("SCALBZFD", line[i + 1]) && (line[i + 2] == ' ')) {
+            line[i + strcspn(&line[i], "\r\n")] = '\0';
+            return &line[i];
+        }
+    }
+    return NULL;
+}
+
+// the numbers after the tag, of a ~Z only the dt
+static uint8_t __parse(const char* text, int64_t* values, uint8_t max)
+{
+    uint8_t n = 0;
+    const char* p = text + 2;
+
+    while (*p == ' ' && n < max) {
+        ++p;
+        values[n++] = strtoll(p, (char**)&p, 10);
+        if (text[1] == 'Z') {
+            break;
+        }
+    }
+    return n;
+}
+
+static void __crossing(uint32_t us)
+{
+    stamp += us * (SystemCoreClock / 1000000);
+    for (; lost; --lost) {
+        Q_PUSH(crossings, stamp);
+    }
+    Q_PUSH(crossings, stamp);
+}
+
+// the intervals of a ~Z after its dt, see record.h
+static void __read_crossings(const char* p)
+{
+    uint32_t reference = 0;
+
+    p += 3;
+    p += strcspn(p, " ");
+    while (*p) {
+        if (*p == ' ') {
+            ++p;
+        } else if ((*p == 'x') && (p[-1] == ' ')) {
+            // untimed, with the next one
+            lost += strtoul(p + 1, (char**)&p, 10);
+        } else if ((*p >= '0') && (*p <= '9')) {
+            reference = strtoul(p, (char**)&p, 10);
+        } else if (*p == '#') {
+            __crossing(strtoul(p + 1, (char**)&p, 10));
+        } else {
+            uint32_t us = reference + *p++ - RECORD_ZC_ZERO;
+            uint32_t n = 1;
+
+            if ((*p >= '0') && (*p <= '9')) {
+                n = strtoul(p, (char**)&p, 10);
+            }
+            for (; n; --n) {
+                __crossing(us);
+            }
+        }
+    }
+}
+
+static void __read_record(const char* text)
+{
+    int64_t v[LINE_MAX / 2];
+    uint8_t n = __parse(text, v, LINE_MAX / 2);
+    char tag = text[1];
+
+    if (tag == 'S') {
+        // a reset in the recording, the replay ends there
+        if (boots++) {
+            replayEnd = 1;
+            return;
+        }
+        readTick = v[0];
+        stamp = (uint64_t)readTick * __cycles_per_ms();
+    } else if (!boots || !n) {
+        return;
+    } else {
+        readTick += v[0];
+    }
+
+    if (Q_FULL(expected)) {
+        printf("  more than %zu records within %u ms\n", Q_SIZE(expected),
+               LOOKAHEAD_MS);
+        replayEnd = 1;
+        return;
+    }
+
+    struct Record r = { .tick = readTick };
+    snprintf(r.text, sizeof(r.text), "%s", text);
+    Q_PUSH(expected, r);
+
+    // the record and its line end
+    recordBytes += strlen(text) + 2;
+    if (tag == 'Z') {
+        crossingBytes += strlen(text) + 2;
+    }
+
+    if ((readTick - lastConfig_ms < MODBUS_QUIET_MS) && (tag != 'C')) {
+        ++mutedRecords;
+    }
+
+    if (tag == 'A' && n == 3) {
+        struct Sample s = { readTick, { v[1], v[2] } };
+        Q_PUSH(temps, s);
+    } else if (tag == 'L' && n == 2) {
+        struct Sample s = { readTick, { v[1] } };
+        Q_PUSH(lights, s);
+    } else if (tag == 'B' && n == 3) {
+        struct Buttons b = { readTick, { v[1], v[2] } };
+        Q_PUSH(buttons, b);
+    } else if (tag == 'C' && n == CONFIG_VALUES + 1) {
+        if (!configRead) {
+            // the configuration the MCU booted with
+            configRead = 1;
+            for (int i = 0; i < CONFIG_VALUES; ++i) {
+                bootConfig[i] = v[1 + i];
+            }
+            return;
+        }
+
+        uint16_t w[CONFIG_WRITABLE];
+        struct Frame f = { .tick = readTick };
+
+        for (int i = 0; i < CONFIG_WRITABLE; ++i) {
+            w[i] = v[1 + i];
+        }
+        __frame(&f, 0x10, 0, w, CONFIG_WRITABLE);
+        Q_PUSH(frames, f);
+        lastConfig_ms = readTick;
+    } else if (tag == 'Z') {
+        __read_crossings(text);
+    }
+}
+
+// the tick of the next pass which has something to do, the records up
+// to readUpTo are read
+static void __skip(uint32_t readUpTo)
+{
+    if (Q_EMPTY(expected)) {
+        return;
+    }
+
+    // a ~A is stamped after the conversion's delay
+    const struct Record* r = &Q_FRONT(expected);
+    uint32_t next = r->tick - (r->text[1] == 'A');
+
+    if (!Q_EMPTY(crossings)) {
+        uint32_t ms = Q_FRONT(crossings) / __cycles_per_ms();
+
+        if ((int32_t)(ms - next) < 0) {
+            next = ms;
+        }
+    }
+
+    // the crossings not read yet are later than this
+    uint32_t unread = readUpTo - RECORD_ZC_MAX_MS - 1;
+    if ((int32_t)(next - unread) > 0) {
+        next = unread;
+    }
+
+    if ((int32_t)(next - stub_tick) > 0) {
+        stub_tick = next;
+    }
+}
+
+// reads the records up to the tick
+static void __read(uint32_t tick)
+{
+    static char* line = NULL;
+    static size_t size = 0;
+
+    while (!replayEnd && (!boots || !configRead 
+                          || (int32_t)(readTick - tick) <= 0)) {
+        // the Modbus responses have zeroes in them
+        ssize_t length = getline(&line, &size, replayFile);
+
+        if (length < 0) {
+            replayEnd = 1;
+            break;
+        }
+
+        const char* r = __find_record(line, length);
+
+        if (r) {
+            __read_record(r);
+        }
+    }
+}
+
+static char replayed[LINE_MAX];
+static uint32_t replayedLength;
+
+static void __compare(const char* text)
+{
+    ++records;
+    if (Q_EMPTY(expected)) {
+        if (!mismatches++) {
+            printf("  at %u ms an extra record: %s\n", stub_tick, text);
+        }
+        return;
+    }
+
+    struct Record r = Q_POP(expected);
+
+    if (strcmp(r.text, text) != 0) {
+        if (!mismatches++) {
+            printf("  at %u ms expected: %s\n  replayed: %s\n", r.tick,
+                   r.text, text);
+        }
+    } else if (text[1] == 'F' || text[1] == 'D') {
+        ++outputs;
+    }
+}
+
+static void __replay_output(const uint8_t* data, uint16_t size)
+{
+    for (uint16_t i = 0; i < size; ++i) {
+        if (data[i] == '\n') {
+            const char* r = __find_record(replayed, replayedLength);
+
+            if (r) {
+                __compare(r);
+            }
+            replayedLength = 0;
+        } else if (replayedLength < sizeof(replayed) - 1) {
+            replayed[replayedLength++] = data[i];
+        }
+        replayed[replayedLength] = '\0';
+    }
+}
+
+static double __now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// 1 if every record came out the same
+static uint8_t __replay(const char* file)
+{
+    replaying = 1;
+    replayFile = fopen(file, "r");
+    if (!replayFile) {
+        perror(file);
+        return 0;
+    }
+
+    stub_uart_tx_hook = __replay_output;
+    flash_sim_init();
+    config_store_init(&hcrc);
+
+    __read(0);
+    if (!configRead) {
+        printf("  no ~S and ~C in %s\n", file);
+        return 0;
+    }
+    __store_config(bootConfig);
+
+    uint32_t start_ms = readTick;
+    double start = __now();
+
+    __boot(start_ms);
+    for (;;) {
+        if (Q_EMPTY(expected) && replayEnd) {
+            break;
+        }
+        // the MCU went on to what the replay does not get to
+        if ((int32_t)(stub_tick - readTick) > LOOKAHEAD_MS) {
+            break;
+        }
+        __pass();
+    }
+
+    double wall = __now() - start;
+    double hours = (stub_tick - start_ms) / 3600e3;
+
+    printf("  %u records, %u outputs, %.2f h replayed in %.2f s, "
+           "a week in %.0f s\n", records, outputs, hours, wall,
+           wall / hours * 24 * 7);
+
+    recordRate = recordBytes / (hours * 60);
+    printf("  %.1f kB a minute recorded, %.1f kB of it the crossings, "
+           "%.0f MB a week\n", recordRate / 1000,
+           crossingBytes / (hours * 60) / 1000,
+           recordRate * 60 * 24 * 7 / 1e6);
+    if (missing) {
+        printf("  %u readings missing\n", missing);
+    }
+    if (!Q_EMPTY(expected)) {
+        printf("  %u records not replayed, next: %s\n", 
+               expected.tail - expected.head, Q_FRONT(expected).text);
+    }
+
+    fclose(replayFile);
+    return !mismatches && !missing && Q_EMPTY(expected);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        CHECK(__replay(argv[1]));
+        return test_result("replay");
+    }
+
+    // logic.c starts once per process
+    pid_t device = fork();
+
+    if (device == 0) {
+        __device();
+        exit(test_failures ? 1 : 0);
+    }
+
+    int status;
+    waitpid(device, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    CHECK(__replay(LOG_FILE));
+    CHECK_CMP(outputs, >, 100);
+    // the recording goes on while a Modbus master mutes the log
+    CHECK_CMP(mutedRecords, >, 100);
+    // 1.5 % of the line at 115200
+    CHECK_CMP(recordRate, <, 11000);
+
+    return test_result("replay");
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Command shell on the reception path. Lines are put on the line byte
+ by byte into the receive DMA's circular buffer, split over several
+ frames and starting at every offset so that the tokens cross the wrap
+ of the buffer, the shell tokenizes them in place. Every entry of a 
+ sorted table is found by the binary search, for every table size, 
+ and a name between two entries is not. A line too long or with too
+ many tokens is refused and the next one works again.
+
+ The output goes through the transmit ring, which is checked too: 
+ chunks of any size, the DMA completing late, over 65 KB so that the
+ ring and its 16-bit counters go round many times.
+ */
+
+#include "test.h"
+#include "shell.h"
+#include "uart_rx.h"
+#include "usart.h"
+
+#include <string.h>
+
+static DMA_HandleTypeDef hdmarx = { .Instance = DMA1_Channel5 };
+static UART_HandleTypeDef huart = { .Instance = USART1, .hdmarx = &hdmarx };
+
+// what the shell printed
+static char output[4096];
+static uint16_t outputLength;
+
+// the command run last and its arguments, as text
+static const char* ran;
+static uint8_t argCount;
+static char argText[SHELL_MAX_TOKENS][SHELL_MAX_LINE + 1];
+static uint32_t argValue;
+static uint8_t argIsNumber;
+
+// sorted as strcmp orders them, prefixes of each other included
+#define COMMANDS \
+    X(config) \
+    X(fan) \
+    X(get) \
+    X(help) \
+    X(history) \
+    X(log) \
+    X(reset) \
+    X(set) \
+    X(setpoint) \
+    X(stat) \
+    X(stats) \
+    X(status) \
+    X(trace) \
+    X(tune)
+
+static void __record(const char* name, const struct ShellArgs* args)
+{
+    ran = name;
+    argCount = args->count;
+    for (uint8_t i = 0; i < args->count; ++i) {
+        const struct ShellToken* t = &args->tokens[i];
+        for (uint8_t j = 0; j < t->length; ++j) {
+            argText[i][j] = uart_rx_buffer[(uint8_t)(t->start + j)];
+        }
+        argText[i][t->length] = '\0';
+    }
+    argIsNumber = (args->count > 1)
+        && shell_token_uint(&args->tokens[args->count - 1], &argValue);
+}
+
+#define X(name) \
+    static void __run_##name(const struct ShellArgs* args) \
+    { \
+        __record(#name, args); \
+    }
+COMMANDS
+#undef X
+
+#define X(name) { #name, "", __run_##name },
+static const struct ShellCommand commands[] = {
+    COMMANDS
+};
+#undef X
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static uint8_t __ran(const char* name)
+{
+    return ran && !strcmp(ran, name);
+}
+
+static void __capture(const uint8_t* data, uint16_t size)
+{
+    for (uint16_t i = 0; i < size && outputLength < sizeof(output) - 1; 
+         ++i) {
+        output[outputLength++] = data[i];
+    }
+    output[outputLength] = '\0';
+}
+
+// bytes on the line, the idle interrupt and the main loop
+static void __frame(const char* data, uint16_t length)
+{
+    struct UartFrame f;
+
+    stub_uart_receive(&huart, (const uint8_t*)data, length);
+    stub_uart_idle(&huart);
+
+    stub_ipsr = 1;
+    uart_rx_idle_int();
+    stub_ipsr = 0;
+
+    while (uart_rx_frame(&f)) {
+        shell_frame(&f);
+    }
+}
+
+static void __line(const char* s)
+{
+    ran = NULL;
+    outputLength = 0;
+    output[0] = '\0';
+    __frame(s, strlen(s));
+}
+
+// where the DMA writes the next byte
+static uint8_t __rx_offset()
+{
+    return UART_RX_BUFFER_SIZE - hdmarx.Instance->CNDTR;
+}
+
+// empty lines up to the offset, the shell ignores them
+static void __move_to(uint8_t offset)
+{
+    static const char empty[UART_RX_BUFFER_SIZE] = { [0 ... 255] = '\r' };
+    uint8_t n = offset - __rx_offset();
+
+    if (n) {
+        __frame(empty, n);
+    }
+}
+
+static void test_lookup()
+{
+    shell_init(commands, COMMAND_COUNT);
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; ++i) {
+        char line[32];
+
+        snprintf(line, sizeof(line), "%s\r", commands[i].name);
+        __line(line);
+        CHECK(__ran(commands[i].name));
+        CHECK(argCount == 1);
+    }
+
+    // before, between and after the entries, and their prefixes
+    static const char* unknown[] = {
+        "a\r", "con\r", "configs\r", "g\r", "hel\r", "s\r", "se\r",
+        "seta\r", "sta\r", "stata\r", "statu\r", "statuss\r", "zz\r",
+        "\x01\r", "\xFF\r"
+    };
+    for (uint8_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); ++i) {
+        __line(unknown[i]);
+        CHECK(ran == NULL);
+        CHECK(strstr(output, "Unknown command") != NULL);
+    }
+
+    // every table size, odd and even, the entries past it are unknown
+    for (uint8_t count = 0; count <= COMMAND_COUNT; ++count) {
+        shell_init(commands, count);
+        for (uint8_t i = 0; i < COMMAND_COUNT; ++i) {
+            char line[32];
+
+            snprintf(line, sizeof(line), "%s\r", commands[i].name);
+            __line(line);
+            CHECK((i < count) ? __ran(commands[i].name) : (ran == NULL));
+        }
+    }
+
+    shell_init(commands, COMMAND_COUNT);
+}
+
+static void test_wrap()
+{
+    static const char line[] = "  set\tlevel  4095 \r";
+    const uint8_t length = sizeof(line) - 1;
+
+    // from every offset, in one frame or split in two at every byte,
+    // the tokens lie across the end of the buffer for some offsets
+    for (uint16_t offset = 0; offset < UART_RX_BUFFER_SIZE; ++offset) {
+        for (uint8_t split = 0; split < length; ++split) {
+            __move_to(offset);
+            ran = NULL;
+            if (split) {
+                __frame(line, split);
+                CHECK(ran == NULL);
+            }
+            __frame(line + split, length - split);
+
+            CHECK(__ran("set"));
+            CHECK(argCount == 3);
+            CHECK(!strcmp(argText[0], "set"));
+            CHECK(!strcmp(argText[1], "level"));
+            CHECK(!strcmp(argText[2], "4095"));
+            CHECK(argIsNumber && argValue == 4095);
+        }
+    }
+
+    // a line in three frames, the second one byte long
+    __move_to(250);
+    ran = NULL;
+    __frame("stat", 4);
+    __frame("u", 1);
+    __frame("s 7\n", 4);
+    CHECK(__ran("status"));
+    CHECK(argIsNumber && argValue == 7);
+
+    // several lines in one frame, CR LF in between
+    __move_to(240);
+    __line("fan 1\r\ntune 2\r\n");
+    CHECK(__ran("tune"));
+    CHECK(argIsNumber && argValue == 2);
+
+    // not numbers
+    __line("set a 12x\r");
+    CHECK(ran != NULL && !argIsNumber);
+    __line("set a 1234567890\r");
+    CHECK(ran != NULL && !argIsNumber);
+}
+
+static void test_overflow()
+{
+    char line[SHELL_MAX_LINE + 8];
+
+    // exactly as long as allowed, padded with spaces
+    memset(line, ' ', sizeof(line));
+    memcpy(line, "get", 3);
+    line[SHELL_MAX_LINE] = '\r';
+    line[SHELL_MAX_LINE + 1] = '\0';
+    __line(line);
+    CHECK(__ran("get"));
+    CHECK(outputLength == 0);
+
+    // one more, the whole line is dropped
+    line[SHELL_MAX_LINE] = ' ';
+    line[SHELL_MAX_LINE + 1] = '\r';
+    line[SHELL_MAX_LINE + 2] = '\0';
+    __line(line);
+    CHECK(ran == NULL);
+    CHECK(strstr(output, "Line too long") != NULL);
+
+    // much longer, across the end of the buffer and in pieces
+    __move_to(200);
+    ran = NULL;
+    outputLength = 0;
+    for (uint8_t i = 0; i < 5; ++i) {
+        __frame("set level 1 set level 2 ", 24);
+    }
+    __frame("\r", 1);
+    CHECK(ran == NULL);
+    CHECK(strstr(output, "Line too long") != NULL);
+
+    // the next line is fine again
+    __line("log 3\r");
+    CHECK(__ran("log"));
+    CHECK(argIsNumber && argValue == 3);
+
+    __line("set a b c d\r");
+    CHECK(ran == NULL);
+    CHECK(strstr(output, "Too many arguments") != NULL);
+
+    __line("set a b c\r");
+    CHECK(ran != NULL && argCount == SHELL_MAX_TOKENS);
+}
+
+static void test_tx_ring()
+{
+    uint32_t seed = 0x5E11;
+    uint8_t chunk[USART_TX_BUFFER_SIZE];
+    uint8_t sent = 0;
+    uint8_t received = 0;
+    uint32_t total = 0;
+    uint32_t errors = 0;
+
+    // the DMA takes the bytes, a transfer completes when the test says
+    stub_uart_tx_hook = NULL;
+    stub_uart_tx_length = 0;
+
+    while (total < 70000) {
+        uint16_t size = test_rand(&seed) % (usart_tx_free() + 1);
+
+        for (uint16_t i = 0; i < size; ++i) {
+            chunk[i] = sent++;
+        }
+        usart_write(chunk, size);
+        total += size;
+
+        // none, one or two transfers done, a transfer ends at the wrap
+        for (uint8_t n = test_rand(&seed) % 3; n; --n) {
+            stub_uart_tx_complete(&huart);
+        }
+        for (uint16_t i = 0; i < stub_uart_tx_length; ++i) {
+            errors += (stub_uart_tx[i] != received++);
+        }
+        stub_uart_tx_length = 0;
+    }
+
+    while (stub_uart_tx_complete(&huart));
+    for (uint16_t i = 0; i < stub_uart_tx_length; ++i) {
+        errors += (stub_uart_tx[i] != received++);
+    }
+
+    CHECK(errors == 0);
+    CHECK(received == sent);
+    CHECK(usart_tx_free() == USART_TX_BUFFER_SIZE - 1);
+    printf("  %u bytes through the ring\n", total);
+
+    stub_uart_tx_hook = __capture;
+}
+
+int main()
+{
+    stub_uart_tx_hook = __capture;
+    usart_config(&huart);
+    uart_rx_init(&huart);
+
+    test_lookup();
+    test_wrap();
+    test_overflow();
+    test_tx_ring();
+
+    return test_result("shell");
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Rolling statistics against brute force. The chamber is a random walk,
+ the fan noise around a level, both sampled every 5 s as logic.c does,
+ for 60 h, so both windows roll over several times. At checkpoints, many of them on bucket and period edges, the
+ summary of every channel and window is compared with the same figures
+ computed from all the samples kept by the test:
+ - min/max over the buckets of the window ending with the latest one,
+ - mean, standard deviation and the 95th percentile over the last
+   complete period, or over the current one before the first ends.
+ The percentile is an estimate (P^2), for the noise it has to lie
+ between the 92nd and the 98th percentile of the samples. P^2 assumes
+ a stationary input, the walk is checked for the range only.
+ */
+
+#include "test.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_MS 5000
+#define SAMPLES (60UL * 3600 * 1000 / SAMPLE_MS)
+
+struct Sample
+{
+    uint32_t t;
+    int16_t v;
+};
+
+static const uint32_t bucketMs[STATS_WINDOWS] = {
+    STATS_HOUR_BUCKET_MS, STATS_DAY_BUCKET_MS
+};
+static const uint32_t buckets[STATS_WINDOWS] = {
+    STATS_HOUR_BUCKETS, STATS_DAY_BUCKETS
+};
+
+// the range the estimated 95th percentile has to be in, by the channel
+static const double p95Low[STATS_CHANNELS] = { 0, 0.92 };
+static const double p95High[STATS_CHANNELS] = { 1.0, 0.98 };
+
+static struct Sample samples[STATS_CHANNELS][SAMPLES];
+static uint32_t count;
+static uint32_t checks;
+
+static int __compare(const void* a, const void* b)
+{
+    return *(const int16_t*)a - *(const int16_t*)b;
+}
+
+static void __check(enum StatsChannel ch, enum StatsWindow win)
+{
+    static int16_t sorted[SAMPLES];
+    const struct Sample* s = samples[ch];
+    uint32_t now = s[count - 1].t;
+    uint32_t bucket = now / bucketMs[win];
+    uint32_t period = bucket / buckets[win];
+    int16_t min = INT16_MAX, max = INT16_MIN;
+    // the period reported, the last one with samples before the current
+    // if there is one
+    uint32_t reported = period;
+    uint8_t complete = 0;
+
+    for (uint32_t i = count; i-- > 0;) {
+        uint32_t b = s[i].t / bucketMs[win];
+
+        if (bucket - b < buckets[win]) {
+            min = (s[i].v < min) ? s[i].v : min;
+            max = (s[i].v > max) ? s[i].v : max;
+        }
+        if (!complete && (b / buckets[win] != period)) {
+            reported = b / buckets[win];
+            complete = 1;
+        }
+    }
+
+    double sum = 0, sum2 = 0;
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (s[i].t / bucketMs[win] / buckets[win] == reported) {
+            sorted[n++] = s[i].v;
+            sum += s[i].v;
+        }
+    }
+    double mean = sum / n;
+    for (uint32_t i = 0; i < n; ++i) {
+        sum2 += (sorted[i] - mean) * (sorted[i] - mean);
+    }
+    double sd = (n > 1) ? sqrt(sum2 / (n - 1)) : 0;
+    qsort(sorted, n, sizeof(sorted[0]), __compare);
+
+    struct StatsSummary sum_;
+    stats_summary(ch, win, &sum_);
+
+    CHECK(sum_.min == min);
+    CHECK(sum_.max == max);
+    CHECK(sum_.count == n);
+    CHECK_CMP(fabs(sum_.mean - mean), <=, 0.6);
+    CHECK_CMP(fabs(sum_.stddev - sd), <=, 0.6);
+    if (n >= 20) {
+        CHECK_CMP(sum_.p95, >=, sorted[(uint32_t)(p95Low[ch] * (n - 1))]);
+        CHECK_CMP(sum_.p95, <=, sorted[(uint32_t)(p95High[ch] * (n - 1))]);
+    }
+    ++checks;
+}
+
+// a checkpoint, on the edges of the buckets and periods too
+static uint8_t __checkpoint(uint32_t t)
+{
+    for (uint8_t w = 0; w < STATS_WINDOWS; ++w) {
+        uint32_t inBucket = t % bucketMs[w];
+        uint32_t inPeriod = t % (bucketMs[w] * buckets[w]);
+
+        if ((inBucket < SAMPLE_MS) || (inBucket >= bucketMs[w] - SAMPLE_MS)
+            || (inPeriod < 2 * SAMPLE_MS)) {
+            // the hour buckets are too many to check them all
+            if ((w == STATS_DAY) || (t / bucketMs[w]) % 7 == 0) {
+                return 1;
+            }
+        }
+    }
+    return (count % 997) == 0;
+}
+
+static void test_random_walk()
+{
+    uint32_t seed = 0x57A7;
+    int16_t chamber = 300;
+
+    stats_init();
+
+    for (count = 0; count < SAMPLES;) {
+        // a little after the start of the tick, as the main loop
+        uint32_t t = 1000 + count * SAMPLE_MS + test_rand(&seed) % 50;
+
+        chamber += (int16_t)(test_rand(&seed) % 3) - 1;
+        chamber = (chamber < 0) ? 0 : (chamber > 1000) ? 1000 : chamber;
+        int16_t v[STATS_CHANNELS] = {
+            chamber, 500 + (int16_t)(40 * test_gauss(&seed))
+        };
+
+        for (uint8_t c = 0; c < STATS_CHANNELS; ++c) {
+            samples[c][count].t = t;
+            samples[c][count].v = v[c];
+            stats_sample(c, v[c], t);
+        }
+        ++count;
+
+        if (__checkpoint(t)) {
+            for (uint8_t c = 0; c < STATS_CHANNELS; ++c) {
+                __check(c, STATS_HOUR);
+                __check(c, STATS_DAY);
+            }
+        }
+    }
+    printf("  %u checks over %lu samples\n", checks, SAMPLES);
+}
+
+// a constant, nothing to estimate
+static void test_constant()
+{
+    struct StatsSummary sum;
+
+    stats_init();
+    stats_summary(STATS_FAN, STATS_HOUR, &sum);
+    CHECK(sum.count == 0);
+
+    for (uint32_t i = 0; i < 2000; ++i) {
+        stats_sample(STATS_FAN, 450, i * SAMPLE_MS);
+    }
+    stats_summary(STATS_FAN, STATS_HOUR, &sum);
+    CHECK(sum.min == 450 && sum.max == 450 && sum.mean == 450);
+    CHECK(sum.stddev == 0 && sum.p95 == 450);
+    CHECK(sum.count == 3600 * 1000 / SAMPLE_MS);
+}
+
+int main()
+{
+    test_random_walk();
+    test_constant();
+
+    return test_result("stats");
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Thermal model and its feed-forward in the closed loop. The plant runs
+ with the estimator every second and the PID every 5 s as in logic.c,
+ first to let the model learn from a slowly swinging ambient, then the
+ ambient steps up and the chamber's excursion over the setpoint is
+ compared with the same loop without the feed-forward, once with the
+ slow PID the feed-forward is meant for and once with the tuned one it
+ must not disturb. The learned model is checked by the fan power it
+ predicts for holding the setpoint.
+ */
+
+#include "test.h"
+#include "plant.h"
+#include "estimator.h"
+#include "thermal_model.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define SETPOINT 70
+#define RISE 80
+#define NOISE 0.4
+
+#define LEARN_S (6 * 3600)
+#define STEP_S (2 * 3600)
+#define AMBIENT 25
+#define AMBIENT_STEP 8
+
+struct Case
+{
+    const char* name;
+    double tau;
+    double fanFactor;
+    uint8_t delay;
+};
+
+// PID gains [%/C * 100], [s], [s]
+struct Gains
+{
+    const char* name;
+    uint16_t kp;
+    uint16_t ti;
+    uint16_t td;
+};
+
+// as the auto-tune sets them for the middle plant, and a slow loop
+// which leaves the ambient changes to the feed-forward
+static const struct Gains tuned = { "tuned", 1300, 60, 10 };
+static const struct Gains slow = { "slow", 500, 600, 0 };
+
+struct Loop
+{
+    struct Plant plant;
+    uint32_t seed;
+    const struct Gains* gains;
+    int32_t integral;
+    uint8_t power;
+    uint8_t feedForward;
+};
+
+// the control law of __pid_fan_power() in logic.c
+static uint8_t __pid(struct Loop* l, uint32_t dt_ms, uint8_t bias)
+{
+    int32_t e = estimator_temp() - EST_FROM_INT(SETPOINT);
+    int32_t dI = (int32_t)(((int64_t)e * dt_ms) / 1000);
+
+    int32_t u = e
+        + (l->integral + dI) / l->gains->ti
+        + estimator_rate() * l->gains->td;
+    int32_t power = bias 
+        + (int32_t)(((int64_t)u * l->gains->kp / 100) >> EST_Q);
+
+    if ((power > 100 && dI > 0) || (power < 0 && dI < 0)) {
+        dI = 0;
+    }
+    l->integral += dI;
+
+    if (power > 100) {
+        return 100;
+    } else if (power < 0) {
+        return 0;
+    }
+    return power;
+}
+
+// one second of the loop, the model is updated and the PID run every
+// 5 s, the same order as logic_update()
+static void __second(struct Loop* l, uint32_t t, double ambient)
+{
+    l->plant.ambient = ambient;
+    plant_step(&l->plant, l->power);
+
+    int32_t chamber = plant_adc_to_q(
+        plant_adc(plant_sensed(&l->plant), NOISE, &l->seed));
+    int32_t amb = plant_adc_to_q(plant_adc(ambient, NOISE, &l->seed));
+
+    estimator_predict(l->power, amb, 1000);
+    estimator_update(chamber);
+
+    if (t % 5 == 0) {
+        thermal_model_update(estimator_temp(), estimator_rate(), amb,
+                             l->power);
+
+        uint8_t ff = l->feedForward
+            ? thermal_model_feed_forward(EST_FROM_INT(SETPOINT), amb) : 0;
+        l->power = __pid(l, 5000, ff);
+    }
+}
+
+// fan power holding the setpoint [%]
+static double __holding_power(const struct Case* c, double ambient)
+{
+    return 100 * (RISE / (SETPOINT - ambient) - 1) / c->fanFactor;
+}
+
+// excursion over the setpoint and the mean absolute error after the
+// ambient step, the loop starts from the learned state. The minute
+// average of the chamber is taken, the excursion is about the slow
+// response, not the PID chasing the sensor noise.
+static void __step(const struct Case* c, const int32_t* params,
+                   const struct Gains* gains, uint8_t feedForward,
+                   double* peak, double* iae)
+{
+    struct Loop l = { .seed = 0xBEEF, .gains = gains,
+                      .feedForward = feedForward };
+    double avg = SETPOINT;
+
+    plant_init(&l.plant, SETPOINT, AMBIENT, RISE, c->tau, c->fanFactor,
+               c->delay);
+    estimator_init(EST_FROM_INT(SETPOINT));
+    thermal_model_init(params);
+    l.power = __holding_power(c, AMBIENT) + 0.5;
+    l.integral = 0;
+
+    // settle
+    for (uint32_t t = 1; t < 3600; ++t) {
+        __second(&l, t, AMBIENT);
+    }
+
+    *peak = 0;
+    *iae = 0;
+    for (uint32_t t = 3600; t < 3600 + STEP_S; ++t) {
+        __second(&l, t, AMBIENT + AMBIENT_STEP);
+        avg += (l.plant.temp - avg) / 60;
+        *peak = fmax(*peak, avg - SETPOINT);
+        *iae += fabs(avg - SETPOINT) / STEP_S;
+    }
+}
+
+static void __run(const struct Case* c)
+{
+    struct Loop l = { .seed = 0x5EED, .gains = &tuned, .feedForward = 1 };
+
+    plant_init(&l.plant, AMBIENT, AMBIENT, RISE, c->tau, c->fanFactor,
+               c->delay);
+    estimator_init(EST_FROM_INT(AMBIENT));
+    thermal_model_init(NULL);
+
+    // heat-up and regulation while the ambient swings by a few degrees
+    for (uint32_t t = 1; t < LEARN_S; ++t) {
+        __second(&l, t, AMBIENT + 5 * sin(2 * M_PI * t / 7200.0));
+    }
+
+    CHECK(thermal_model_valid());
+
+    int32_t params[TM_PARAMS];
+    const int32_t* theta = thermal_model_params();
+    for (int i = 0; i < TM_PARAMS; ++i) {
+        params[i] = theta[i];
+    }
+
+    // in the closed loop the gradient hardly moves, q and k0 are not
+    // told apart, what the feed-forward has to get right is the power
+    // holding the setpoint around the gradients seen
+    double ff0 = thermal_model_feed_forward(EST_FROM_INT(SETPOINT),
+                                            EST_FROM_INT(AMBIENT));
+    double ff1 = thermal_model_feed_forward(EST_FROM_INT(SETPOINT),
+                                  EST_FROM_INT(AMBIENT + AMBIENT_STEP));
+    double hold0 = __holding_power(c, AMBIENT);
+    double hold1 = __holding_power(c, AMBIENT + AMBIENT_STEP);
+
+    printf("  %-22s holding power %.0f (%.1f) %%, after the step "
+           "%.0f (%.1f) %%\n", c->name, ff0, hold0, ff1, hold1);
+
+    CHECK_CMP(fabs(ff0 - hold0), <, 2 + hold0 * 0.2);
+    CHECK_CMP(fabs(ff1 - hold1), <, 2 + hold1 * 0.2);
+
+    const struct Gains* loops[] = { &slow, &tuned };
+    for (int i = 0; i < 2; ++i) {
+        double peakFf, iaeFf, peak, iae;
+        __step(c, params, loops[i], 1, &peakFf, &iaeFf);
+        __step(c, params, loops[i], 0, &peak, &iae);
+
+        printf("  %-22s %-5s loop, excursion %.2f C, error %.3f C, "
+               "without feed-forward %.2f C, %.3f C\n",
+               "", loops[i]->name, peakFf, iaeFf, peak, iae);
+
+        if (loops[i] == &slow) {
+            CHECK_CMP(peakFf, <, peak * 0.6);
+            CHECK_CMP(iaeFf, <, iae);
+        } else {
+            // little left to gain, but it must not get in the way, the
+            // margin is about the noise of the ambient reading
+            CHECK_CMP(peakFf, <, peak * 1.1 + 0.02);
+            CHECK_CMP(iaeFf, <, iae * 1.1 + 0.01);
+        }
+    }
+}
+
+static void test_closed_loop()
+{
+    static const struct Case cases[] = {
+        { "tau 1200 s, delay 10 s", 1200, 10, 10 },
+        { "tau 600 s, delay 5 s", 600, 10, 5 },
+        { "tau 2400 s, delay 20 s", 2400, 10, 20 },
+        { "weak fan", 1200, 4, 10 },
+        { "strong fan", 1200, 20, 10 }
+    };
+
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        __run(&cases[i]);
+    }
+}
+
+// parameters restored from the flash are trusted at once, no excitation
+// is needed before the feed-forward helps
+static void test_restored()
+{
+    int32_t params[TM_PARAMS] = {
+        (int32_t)(4.0 * EST_ONE), (int32_t)(1.6 * EST_ONE),
+        (int32_t)(16.0 * EST_ONE)
+    };
+
+    thermal_model_init(params);
+    CHECK(thermal_model_valid());
+    // 0 = 4 + 1.6 * g + 16 * u * g with g = -45 / 32
+    CHECK(abs(thermal_model_feed_forward(EST_FROM_INT(70),
+                                         EST_FROM_INT(25)) - 8) <= 1);
+    // ambient above the setpoint, the fan cannot help
+    CHECK(thermal_model_feed_forward(EST_FROM_INT(20),
+                                     EST_FROM_INT(25)) == 0);
+
+    thermal_model_init(NULL);
+    CHECK(!thermal_model_valid());
+    CHECK(thermal_model_feed_forward(EST_FROM_INT(70),
+                                     EST_FROM_INT(25)) == 0);
+}
+
+int main()
+{
+    test_closed_loop();
+    test_restored();
+
+    return test_result("thermal_model");
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Event trace ring, built with TRACE. Records are written with the DWT
+ counter running, a trigger freezes the ring TRACE_POST_TRIGGER records
+ later and the dump streams it oldest first in the format read by 
+ tools/trace_export.py. The dump runs with the log muted, as it is 
+ while a Modbus master polls, and must come out whole all the same.
+ */
+
+#include "test.h"
+#include "modbus.h"
+#include "trace.h"
+#include "usart.h"
+
+#include <string.h>
+
+static UART_HandleTypeDef huart = { .Instance = USART1 };
+
+static char output[64 * 1024];
+static uint32_t outputLength;
+
+static void __capture(const uint8_t* data, uint16_t size)
+{
+    for (uint16_t i = 0; i < size && outputLength < sizeof(output) - 1;
+         ++i) {
+        output[outputLength++] = data[i];
+    }
+    output[outputLength] = '\0';
+}
+
+// records with arg counting up from first, a cycle apart
+static void __record(uint16_t first, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; ++i) {
+        ++DWT->CYCCNT;
+        trace_record(TRACE_MARK, TRACE_MARK_FAN_POWER, first + i);
+    }
+}
+
+// the shell command and the main loop until the dump is over, the 
+// number of T lines, -1 if the output is malformed
+static int32_t __dump(uint16_t* firstArg, uint16_t* lastArg)
+{
+    uint32_t count = 0;
+    uint32_t clock = 0;
+    int32_t lines = 0;
+
+    outputLength = 0;
+    output[0] = '\0';
+    trace_dump_start();
+    for (uint32_t i = 0; trace_dump_update(); ++i) {
+        if (i > 10 * TRACE_BUFFER_SIZE) {
+            return -1;
+        }
+    }
+
+    char* s = output;
+    if (sscanf(s, "TS %u %u\r\n", &count, &clock) != 2
+        || clock != SystemCoreClock) {
+        return -1;
+    }
+    s = strchr(s, '\n') + 1;
+
+    uint32_t cycles;
+    uint32_t value;
+    while (sscanf(s, "T 0x%8x 0x%8x\r\n", &cycles, &value) == 2) {
+        uint16_t arg = value & 0xFFFF;
+
+        if (lines == 0) {
+            *firstArg = arg;
+        }
+        *lastArg = arg;
+        ++lines;
+        s = strchr(s, '\n') + 1;
+    }
+
+    if (strcmp(s, "TE\r\n") || (lines != (int32_t)count)) {
+        return -1;
+    }
+    return lines;
+}
+
+static void test_dump_muted()
+{
+    uint16_t first = 0;
+    uint16_t last = 0;
+
+    trace_arm(TRACE_TRIG_ALL);
+    __record(0, 1000);
+    trace_trigger(TRACE_TRIG_FLASH);
+    __record(1000, 1000);
+
+    // a master polls, the log is dropped, the dump must not be
+    usart_mute(MODBUS_QUIET_MS);
+    send_string("dropped");
+    CHECK(outputLength == 0);
+
+    CHECK(__dump(&first, &last) == TRACE_BUFFER_SIZE);
+    // the ring froze TRACE_POST_TRIGGER records after the trigger's 
+    // mark, the records before the mark fill the rest
+    CHECK(last == 1000 + TRACE_POST_TRIGGER - 1);
+    CHECK(first == 1000 - (TRACE_BUFFER_SIZE - 1 - TRACE_POST_TRIGGER));
+
+    // recording again, nothing to dump until the next trigger
+    outputLength = 0;
+    __record(0, 10);
+    trace_dump_start();
+    CHECK(!trace_dump_update());
+    CHECK(outputLength == 0);
+
+    stub_tick += MODBUS_QUIET_MS + 1;
+    trace_dump_start();
+    CHECK(strstr(output, "Trace not triggered") != NULL);
+
+    // the next trigger is caught as the first one
+    trace_trigger(TRACE_TRIG_FAN_STEP);
+    __record(2000, 1000);
+    usart_mute(MODBUS_QUIET_MS);
+    CHECK(__dump(&first, &last) == TRACE_BUFFER_SIZE);
+    CHECK(last == 2000 + TRACE_POST_TRIGGER - 1);
+}
+
+int main()
+{
+    stub_uart_tx_hook = __capture;
+    usart_config(&huart);
+
+    test_dump_muted();
+
+    return test_result("trace");
+}
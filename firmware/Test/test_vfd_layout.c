@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Layout of the readings on the display, vfd_layout.c with a stubbed 
+ driver which keeps the digits and the dots. Every format, the edges 
+ between them, and the hysteresis: a reading jittering around a 
+ rounding edge of what is shown, in the pairs and in tenths, must not
+ flicker, and a reading drifting by a tenth at a time must be shown 
+ once it is past the edge by the margin.
+ */
+
+#include "test.h"
+#include "vfd_layout.h"
+#include "vfd_driver.h"
+#include "vfd_text.h"
+
+#include <math.h>
+#include <string.h>
+
+#define DIGITS 4
+#define FRAC_BITS 16
+
+// digit 3 is the leftmost one, as on the board
+static uint8_t digits[DIGITS];
+static uint8_t dots;
+
+void vfd_driver_clear()
+{
+    memset(digits, 0, sizeof(digits));
+    dots = 0;
+}
+
+void vfd_driver_light_cust(uint8_t dig_num, uint8_t segs)
+{
+    digits[dig_num] = segs;
+}
+
+void vfd_driver_light_dots(uint8_t dots_)
+{
+    dots = dots_;
+}
+
+static struct VfdLayout layout;
+
+static int32_t __fixed(double t)
+{
+    return (int32_t)lround(t * (1 << FRAC_BITS));
+}
+
+static void __render(double left, double right)
+{
+    vfd_layout_render(&layout, __fixed(left), __fixed(right), FRAC_BITS);
+}
+
+// the display as text, '.' for the decimal point, 'o' for the degree
+static const char* __text()
+{
+    static char text[DIGITS + 2];
+    uint8_t n = 0;
+
+    for (int8_t d = DIGITS - 1; d >= 0; --d) {
+        char c = ' ';
+
+        if (digits[d] == (VFD_SEG_A | VFD_SEG_B | VFD_SEG_F | VFD_SEG_G)) {
+            c = 'o';
+        } else {
+            for (char g = '-'; g <= 'Z'; ++g) {
+                if (digits[d] && (vfd_text_glyph(g) == digits[d])) {
+                    c = g;
+                    break;
+                }
+            }
+        }
+        text[n++] = c;
+        if ((d == 2) && (dots & VFD_DOT_L)) {
+            text[n++] = '.';
+        }
+    }
+    text[n] = '\0';
+    return text;
+}
+
+static uint8_t __shows(double left, double right, const char* text)
+{
+    vfd_layout_init(&layout);
+    __render(left, right);
+    if (strcmp(__text(), text)) {
+        printf("  %.2f %.2f shows \"%s\", not \"%s\"\n", left, right,
+               __text(), text);
+        return 0;
+    }
+    return 1;
+}
+
+static void test_formats()
+{
+    CHECK(__shows(23.4, 41.2, "2341"));
+    CHECK(__shows(-9.0, 5.0, "-905"));
+    CHECK(__shows(0.4, 99.4, "0099"));
+    CHECK(__shows(23.0, 99.5, "99.5o"));
+    CHECK(__shows(23.0, 105.2, " 105"));
+    CHECK(__shows(23.0, 999.4, " 999"));
+    CHECK(__shows(23.0, 999.5, "HI  "));
+    CHECK(__shows(120.0, 23.44, "23.4o"));
+    CHECK(__shows(120.0, 23.46, "23.5o"));
+    CHECK(__shows(120.0, 5.0, " 5.0o"));
+    CHECK(__shows(120.0, -5.3, "-5.3o"));
+    CHECK(__shows(120.0, -9.94, "-9.9o"));
+    CHECK(__shows(120.0, -12.0, " -12"));
+    CHECK(__shows(120.0, -99.4, " -99"));
+    // "O" and "0" share a glyph
+    CHECK(__shows(120.0, -99.5, "L0  "));
+}
+
+// the shown value of the right reading [degrees]
+static double __right()
+{
+    return layout.right / 100.0;
+}
+
+static void test_jitter()
+{
+    uint32_t seed = 0x1A70;
+    uint32_t changes = 0;
+
+    // +-0.25 around the edge between 23 and 24 in the pairs
+    vfd_layout_init(&layout);
+    __render(21.0, 23.5);
+    double shown = __right();
+    for (int i = 0; i < 100000; ++i) {
+        double jitter = ((int32_t)(test_rand(&seed) % 501) - 250) / 1000.0;
+
+        __render(21.0 + jitter, 23.5 + jitter);
+        changes += (__right() != shown);
+        shown = __right();
+    }
+    CHECK(changes == 0);
+    CHECK(!layout.single);
+
+    // +-0.025 around the edge between 23.4 and 23.5 in tenths
+    changes = 0;
+    vfd_layout_init(&layout);
+    __render(120.0, 23.45);
+    shown = __right();
+    for (int i = 0; i < 100000; ++i) {
+        double jitter = ((int32_t)(test_rand(&seed) % 51) - 25) / 1000.0;
+
+        __render(120.0, 23.45 + jitter);
+        changes += (__right() != shown);
+        shown = __right();
+    }
+    CHECK(changes == 0);
+    CHECK(layout.single);
+}
+
+// up and down by step from a to b and back, the shown value never 
+// further than half a unit and the margin from the reading, and on it
+// at both ends
+static void __drift(double left, double a, double b, double step, 
+                    double unit)
+{
+    const double limit = unit * (0.5 + VFD_LAYOUT_HYST / 100.0) + 1e-6;
+    uint32_t far = 0;
+    uint32_t changes = 0;
+    double shown;
+    int n = (int)lround((b - a) / step);
+
+    vfd_layout_init(&layout);
+    __render(left, a);
+    shown = __right();
+    for (int i = 0; i <= 2 * n; ++i) {
+        double t = a + ((i <= n) ? i : 2 * n - i) * step;
+
+        __render(left, t);
+        far += (fabs(__right() - t) > limit);
+        changes += (__right() != shown);
+        shown = __right();
+        if (i == n) {
+            CHECK_CMP(fabs(shown - b), <, limit);
+        }
+    }
+    CHECK(far == 0);
+    CHECK_CMP(fabs(shown - a), <, limit);
+    // no more changes than units crossed
+    CHECK_CMP(changes, <=, 2 * fabs(b - a) / unit + 2);
+    CHECK_CMP(changes, >=, 2 * fabs(b - a) / unit - 2);
+}
+
+static void test_drift()
+{
+    // a steady tenth at a time, in the pairs and in tenths
+    __drift(21.0, 20.0, 30.0, 0.1, 1.0);
+    __drift(120.0, 20.0, 30.0, 0.1, 0.1);
+    // slower than the resolution
+    __drift(21.0, 20.0, 22.0, 0.01, 1.0);
+    __drift(120.0, 20.0, 21.0, 0.01, 0.1);
+}
+
+static void test_edges()
+{
+    // the end of the tenths, 99.9 and 100 on either side of it
+    vfd_layout_init(&layout);
+    __render(120.0, 99.9);
+    CHECK(!strcmp(__text(), "99.9o"));
+    __render(120.0, 100.2);
+    CHECK(!strcmp(__text(), " 100"));
+    __render(120.0, 99.8);
+    CHECK(!strcmp(__text(), " 100"));
+    __render(120.0, 99.3);
+    CHECK(!strcmp(__text(), " 100"));
+    __render(120.0, 99.1);
+    CHECK(!strcmp(__text(), "99.1o"));
+
+    // the pairs come back a degree inside their range
+    vfd_layout_init(&layout);
+    __render(21.0, 99.4);
+    CHECK(!strcmp(__text(), "2199"));
+    __render(21.0, 99.6);
+    CHECK(!strcmp(__text(), "99.6o"));
+    __render(21.0, 99.4);
+    CHECK(!strcmp(__text(), "99.4o"));
+    __render(21.0, 98.4);
+    CHECK(!strcmp(__text(), "2198"));
+
+    // the left value is tracked while it is not shown
+    vfd_layout_init(&layout);
+    __render(-12.0, 30.0);
+    CHECK(!strcmp(__text(), "30.0o"));
+    __render(-8.4, 30.0);
+    CHECK(!strcmp(__text(), "-830"));
+}
+
+int main()
+{
+    test_formats();
+    test_jitter();
+    test_drift();
+    test_edges();
+
+    return test_result("vfd_layout");
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Text messages on the display, vfd_text.c with a stubbed driver which
+ keeps the four digits. The queue by priority and age, the eviction 
+ when it is full, the marquee of a long text step by step, the pause
+ while the menu owns the display, and a Modbus master writing faster
+ than a message lasts, which must not keep the readings off the 
+ display for longer than one message.
+ */
+
+#include "test.h"
+#include "vfd_text.h"
+#include "vfd_driver.h"
+
+#include <string.h>
+
+#define DIGITS 4
+
+// digit 3 is the leftmost one, as on the board
+static uint8_t digits[DIGITS];
+
+void vfd_driver_clear()
+{
+    memset(digits, 0, sizeof(digits));
+}
+
+void vfd_driver_light_cust(uint8_t dig_num, uint8_t segs)
+{
+    digits[dig_num] = segs;
+}
+
+static uint32_t now_ms;
+
+// 1 if the display reads text, padded with blanks
+static uint8_t __shows(const char* text)
+{
+    for (uint8_t d = 0; d < DIGITS; ++d) {
+        char c = *text ? *text++ : ' ';
+
+        if (digits[DIGITS - 1 - d] != vfd_text_glyph(c)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the main loop for a while, 1 if the last message went meanwhile
+static uint8_t __run(uint32_t ms)
+{
+    uint8_t redraw = 0;
+
+    for (uint32_t end = now_ms + ms; now_ms != end; ++now_ms) {
+        redraw |= vfd_text_update(now_ms, 0);
+    }
+    return redraw;
+}
+
+static void __drain()
+{
+    while (vfd_text_active()) {
+        __run(1);
+    }
+}
+
+static void test_glyphs()
+{
+    CHECK(vfd_text_glyph('0') == 0x3F);
+    CHECK(vfd_text_glyph('8') == 0x7F);
+    CHECK(vfd_text_glyph(' ') == 0);
+    CHECK(vfd_text_glyph('\n') == 0);
+    CHECK(vfd_text_glyph(0x7F) == 0);
+
+    vfd_text_show("Hello");
+    CHECK(__shows("Hell"));
+    vfd_text_show("Hi");
+    CHECK(__shows("Hi"));
+}
+
+static void test_queue()
+{
+    CHECK(vfd_text_post("inFo", VFD_TEXT_INFO, 1000));
+    CHECK(vfd_text_post("ntc1", VFD_TEXT_NOTICE, 500));
+    CHECK(vfd_text_post("ntc2", VFD_TEXT_NOTICE, 500));
+
+    // the highest priority first, the oldest among equal ones
+    __run(1);
+    CHECK(__shows("ntc1"));
+    __run(499);
+    CHECK(__shows("ntc1"));
+    __run(1);
+    CHECK(__shows("ntc2"));
+
+    // an error takes over at once, the notice starts over after it
+    __run(200);
+    CHECK(vfd_text_post("Err", VFD_TEXT_ERROR, 300));
+    __run(1);
+    CHECK(__shows("Err"));
+    __run(300);
+    CHECK(__shows("ntc2"));
+    __run(499);
+    CHECK(__shows("ntc2"));
+    __run(1);
+    CHECK(__shows("inFo"));
+
+    // the readings are redrawn once the last one is gone
+    CHECK(!__run(999));
+    CHECK(__run(1));
+    CHECK(!vfd_text_active());
+}
+
+static void test_eviction()
+{
+    CHECK(vfd_text_post("n1", VFD_TEXT_NOTICE, 100));
+    __run(1);
+    CHECK(vfd_text_post("i1", VFD_TEXT_INFO, 100));
+    CHECK(vfd_text_post("i2", VFD_TEXT_INFO, 100));
+    CHECK(vfd_text_post("n2", VFD_TEXT_NOTICE, 100));
+
+    // full, the oldest info goes, not the notice on the display
+    CHECK(vfd_text_post("n3", VFD_TEXT_NOTICE, 100));
+    CHECK(__shows("n1"));
+
+    // an info replaces the oldest info, the last one left
+    CHECK(vfd_text_post("i3", VFD_TEXT_INFO, 100));
+    CHECK(vfd_text_post("i4", VFD_TEXT_INFO, 100));
+
+    // a notice takes its place, then only notices are left and an info
+    // is refused
+    CHECK(vfd_text_post("n4", VFD_TEXT_NOTICE, 100));
+    CHECK(!vfd_text_post("i5", VFD_TEXT_INFO, 100));
+
+    static const char* order[] = { "n1", "n2", "n3", "n4" };
+    for (uint8_t i = 0; i < 4; ++i) {
+        __run(1);
+        CHECK(__shows(order[i]));
+        __run(99);
+    }
+    __run(1);
+    CHECK(!vfd_text_active());
+}
+
+static void test_scroll()
+{
+    static const char text[] = "Hello world";
+    const uint8_t span = sizeof(text) - 1 + 3;
+
+    CHECK(vfd_text_post(text, VFD_TEXT_INFO, 30000));
+    __run(1);
+
+    // one character a step, three blanks between the end and the start
+    for (uint8_t step = 0; step < 2 * span; ++step) {
+        char window[DIGITS + 1] = { 0 };
+
+        for (uint8_t d = 0; d < DIGITS; ++d) {
+            uint8_t i = (step + d) % span;
+            window[d] = (i < sizeof(text) - 1) ? text[i] : ' ';
+        }
+        CHECK(__shows(window));
+        __run(VFD_TEXT_SCROLL_MS - 1);
+        CHECK(__shows(window));
+        __run(1);
+    }
+
+    // the menu takes the display, the text starts over after it
+    vfd_text_update(now_ms, 1);
+    vfd_driver_clear();
+    CHECK(__shows(""));
+    now_ms += 5000;
+    __run(1);
+    CHECK(__shows("Hell"));
+    __drain();
+
+    // cut at VFD_TEXT_MAX
+    CHECK(vfd_text_post("0123456789abcdefXYZ", VFD_TEXT_INFO, 30000));
+    __run(1 + (VFD_TEXT_MAX - 3) * VFD_TEXT_SCROLL_MS);
+    CHECK(__shows("def"));
+    __drain();
+}
+
+static void test_repeated()
+{
+    uint32_t shown = 0;
+    uint32_t longest = 0;
+    uint32_t since = 0;
+    uint32_t redraws = 0;
+
+    // a master writes a register 5 times a second for 10 s, the
+    // readings take the display back between the messages
+    for (uint32_t t = 0; t < 10000; t += 200) {
+        CHECK(vfd_text_post("SEt", VFD_TEXT_NOTICE, 1000));
+        for (uint32_t i = 0; i < 200; ++i) {
+            if (vfd_text_update(now_ms, 0)) {
+                vfd_driver_clear();
+                ++redraws;
+            }
+            if (__shows("SEt")) {
+                ++shown;
+                ++since;
+                longest = (since > longest) ? since : longest;
+            } else {
+                since = 0;
+            }
+            ++now_ms;
+        }
+    }
+    printf("  SEt on %u of 10000 ms, at most %u ms in a row, %u "
+           "redraws\n", shown, longest, redraws);
+
+    // one message at a time, never a backlog of them
+    CHECK_CMP(longest, <=, 1000);
+    CHECK_CMP(redraws, >=, 8);
+    CHECK(__run(1000));
+    CHECK(!vfd_text_active());
+
+    // the same text with another priority is another message
+    CHECK(vfd_text_post("SEt", VFD_TEXT_NOTICE, 100));
+    CHECK(vfd_text_post("SEt", VFD_TEXT_ERROR, 100));
+    CHECK(vfd_text_post("SEt", VFD_TEXT_NOTICE, 100));
+    __run(1);
+    __run(100);
+    CHECK(__shows("SEt"));
+    __run(100);
+    CHECK(!vfd_text_active());
+}
+
+int main()
+{
+    test_glyphs();
+    test_queue();
+    test_eviction();
+    test_scroll();
+    test_repeated();
+
+    return test_result("vfd_text");
+}
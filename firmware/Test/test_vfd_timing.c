@@ -0,0 +1,642 @@
+/*
+ * Copyright (c) 2019 Rafal Rowniak rrowniak.com
+ * 
+ * The author hereby grant you a non-exclusive, non-transferable,
+ * free of charge right to copy, modify, merge, publish and distribute,
+ * the Software for the sole purpose of performing non-commercial
+ * scientific research, non-commercial education, or non-commercial 
+ * artistic projects.
+ * 
+ * Any other use, in particular any use for commercial purposes,
+ * is prohibited. This includes, without limitation, incorporation
+ * in a commercial product, use in a commercial service, or production
+ * of other artefacts for commercial purposes.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR
+ * THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+/*
+ Pin timing of the VFD multiplexing and of the triac gate, as a logic
+ analyser on the grid pins and PB6 would show it. vfd_driver.c and
+ fan_driver.c run on the stub HAL, which sees every pin change through
+ HAL_GPIO_WritePin() (fast_io.h without FAST_IO). The test stands in for
+ the interrupts: TIM4 and TIM3 fire at the periods their registers give
+ at 72 MHz, the mains crosses zero every 10 ms, one interrupt at a time
+ in the order they are due. Within an interrupt every HAL call takes
+ WRITE_CYCLES, the virtual clock stamps the transitions by that.
+
+ All transitions go to build/vfd_timing.vcd, to be looked at with
+ GTKWave, the checks run on the same stream of transitions.
+ */
+
+#include "test.h"
+#include "fan_driver.h"
+#include "usart.h"
+#include "vfd_driver.h"
+#include "vfd_pinmap.h"
+
+#include <math.h>
+#include <string.h>
+
+#define VCD_FILE "build/vfd_timing.vcd"
+
+#define CPU_HZ 72000000ULL
+// a HAL_GPIO_WritePin() call with its share of the ISR, roughly
+#define WRITE_CYCLES 12
+#define HALF_WAVE_CYCLES (CPU_HZ / 100)
+#define MS_CYCLES (CPU_HZ / 1000)
+
+// the writes of one section change, the tolerance of the edges
+#define EDGE_CYCLES (8 * WRITE_CYCLES)
+
+// as MX_TIM3_Init() and MX_TIM4_Init() set them
+#define TIM3_PRESCALER 7200
+#define TIM4_PRESCALER 1000
+#define TIM4_PERIOD 5
+
+// TIMER_DELAY_MAX of fan_driver.c, the firing delay at 1 % power
+#define TRIAC_DELAY_MAX 80
+
+TIM_HandleTypeDef htim3, htim4;
+UART_HandleTypeDef huart1;
+
+struct Signal
+{
+    const char* name;
+    GPIO_TypeDef* port;
+    uint16_t pin;
+    // the section of a grid, the segment bit of an anode
+    uint8_t bit;
+    uint8_t value;
+};
+
+#define __SIGNAL(name, bit, ...) \
+    { #name, name##_GPIO_Port, name##_Pin, bit, 0 },
+#define __COUNT(...) + 1
+
+// the grids first, by section, the mains is no pin, the test drives it
+static struct Signal signals[] = {
+    VFD_GRIDS(__SIGNAL)
+    VFD_DIGIT_ANODES(__SIGNAL)
+    VFD_DOT_ANODES(__SIGNAL)
+    { "DRIVE", DRIVE_GPIO_Port, DRIVE_Pin, 0, 0 },
+    { "MAINS", NULL, 0, 0, 0 }
+};
+
+#define DOTS_SIGNAL (VFD_SECTIONS + (0 VFD_DIGIT_ANODES(__COUNT)))
+
+#define SIGNALS (sizeof(signals) / sizeof(signals[0]))
+#define DRIVE_SIGNAL (SIGNALS - 2)
+#define MAINS_SIGNAL (SIGNALS - 1)
+
+// the anodes, digits then dots
+#define __is_anode(i) ((i) >= VFD_SECTIONS && (i) < DRIVE_SIGNAL)
+
+static const uint8_t section_dwell[VFD_SECTIONS] = VFD_SECTION_DWELL;
+static const uint8_t segment_dwell[8] = VFD_SEGMENT_DWELL;
+
+static FILE* vcd;
+static uint64_t vcdTime = ~0ULL;
+
+// the virtual clock, in CPU cycles
+static uint64_t now;
+static uint64_t isrStart;
+static uint32_t isrWrites;
+
+static uint64_t nextTim4;
+static uint64_t nextZeroCross;
+static uint64_t nextTim3;
+static uint8_t tim3Armed;
+
+// what the checks collect
+static uint8_t gridsOn;
+static uint32_t overlaps;
+static uint64_t gridOnAt[VFD_SECTIONS];
+static uint64_t litMin[VFD_SECTIONS];
+static uint64_t litMax[VFD_SECTIONS];
+static uint32_t litCount[VFD_SECTIONS];
+static uint32_t litAnodeChanges;
+static uint64_t gridOffAt;
+static uint64_t blankMin, blankMax;
+
+// lit time of every anode under every grid
+static uint64_t dutyStart;
+static uint64_t lastChangeAt;
+static uint64_t segmentLit[VFD_SECTIONS][SIGNALS];
+
+static uint64_t lastCrossAt;
+static uint64_t driveOnAt;
+static uint64_t delayMin, delayMax;
+static uint64_t widthMin, widthMax;
+static uint32_t pulses;
+static uint32_t lowAtCross;
+
+static uint64_t __tim_cycles(TIM_TypeDef* tim)
+{
+    return (uint64_t)(tim->PSC + 1) * (tim->ARR + 1);
+}
+
+static void __vcd_change(uint64_t t, uint32_t i)
+{
+    // the timescale is 1 ns
+    uint64_t ns = t * 125 / 9;
+
+    if (ns != vcdTime) {
+        fprintf(vcd, "#%llu\n", (unsigned long long)ns);
+        vcdTime = ns;
+    }
+    fprintf(vcd, "%u%c\n", signals[i].value, (char)('!' + i));
+}
+
+static void __vcd_open()
+{
+    vcd = fopen(VCD_FILE, "w");
+    fprintf(vcd, "$timescale 1 ns $end\n$scope module board $end\n");
+    for (uint32_t i = 0; i < SIGNALS; ++i) {
+        fprintf(vcd, "$var wire 1 %c %s $end\n", (char)('!' + i),
+                signals[i].name);
+    }
+    fprintf(vcd, "$upscope $end\n$enddefinitions $end\n$dumpvars\n");
+    for (uint32_t i = 0; i < SIGNALS; ++i) {
+        fprintf(vcd, "0%c\n", (char)('!' + i));
+    }
+    fprintf(vcd, "$end\n");
+}
+
+static void __grid_changed(uint64_t t, uint8_t s, uint8_t on)
+{
+    if (on) {
+        if (gridsOn++) {
+            ++overlaps;
+        }
+        uint64_t blank = t - gridOffAt;
+        if (blank < blankMin) {
+            blankMin = blank;
+        }
+        if (blank > blankMax) {
+            blankMax = blank;
+        }
+        gridOnAt[s] = t;
+        return;
+    }
+
+    --gridsOn;
+    gridOffAt = t;
+    uint64_t lit = t - gridOnAt[s];
+    if (lit < litMin[s]) {
+        litMin[s] = lit;
+    }
+    if (lit > litMax[s]) {
+        litMax[s] = lit;
+    }
+    ++litCount[s];
+}
+
+static void __drive_changed(uint64_t t, uint8_t on)
+{
+    if (on) {
+        uint64_t delay = t - lastCrossAt;
+
+        if (delay < delayMin) {
+            delayMin = delay;
+        }
+        if (delay > delayMax) {
+            delayMax = delay;
+        }
+        driveOnAt = t;
+        return;
+    }
+
+    uint64_t width = t - driveOnAt;
+    if (width < widthMin) {
+        widthMin = width;
+    }
+    if (width > widthMax) {
+        widthMax = width;
+    }
+    ++pulses;
+}
+
+// adds the time since the last change to the anodes lit then
+static void __account(uint64_t t)
+{
+    for (uint8_t s = 0; s < VFD_SECTIONS; ++s) {
+        if (!signals[s].value) {
+            continue;
+        }
+        for (uint32_t i = VFD_SECTIONS; __is_anode(i); ++i) {
+            if (signals[i].value) {
+                segmentLit[s][i] += t - lastChangeAt;
+            }
+        }
+    }
+    lastChangeAt = t;
+}
+
+static void __changed(uint64_t t, uint32_t i)
+{
+    __vcd_change(t, i);
+
+    if (i < VFD_SECTIONS) {
+        __grid_changed(t, i, signals[i].value);
+    } else if (__is_anode(i)) {
+        if (gridsOn) {
+            ++litAnodeChanges;
+        }
+    } else if (i == DRIVE_SIGNAL) {
+        __drive_changed(t, signals[i].value);
+    }
+}
+
+// every HAL_GPIO_WritePin(), pin may hold several pins
+static void __pin_written(GPIO_TypeDef* port, uint16_t pin,
+                          GPIO_PinState state)
+{
+    uint64_t t = isrStart + ++isrWrites * WRITE_CYCLES;
+
+    for (uint32_t i = 0; i < SIGNALS; ++i) {
+        uint8_t value = (state == GPIO_PIN_SET);
+
+        if ((signals[i].port == port) && (signals[i].pin & pin)
+            && (signals[i].value != value)) {
+            __account(t);
+            signals[i].value = value;
+            __changed(t, i);
+        }
+    }
+}
+
+static void __isr_begin(uint64_t t)
+{
+    now = t;
+    isrStart = t;
+    isrWrites = 0;
+    stub_tick = t / MS_CYCLES;
+    DWT->CYCCNT = (uint32_t)t;
+}
+
+// TIM3 fires a period after fan_driver.c started it
+static void __follow_tim3()
+{
+    uint8_t running = (TIM3->CR1 & TIM_CR1_CEN) && (TIM3->DIER & TIM_DIER_UIE);
+
+    if (running && !tim3Armed) {
+        nextTim3 = isrStart + __tim_cycles(TIM3);
+    }
+    tim3Armed = running;
+}
+
+static void __zero_cross()
+{
+    signals[MAINS_SIGNAL].value ^= 1;
+    __vcd_change(now, MAINS_SIGNAL);
+    // below 100 % the gate fired in the half-wave ending now
+    if (!signals[DRIVE_SIGNAL].value) {
+        ++lowAtCross;
+    }
+    lastCrossAt = now;
+    fan_driver_zero_cross_int();
+}
+
+// runs the interrupts for the given time
+static void __run(uint64_t cycles)
+{
+    uint64_t end = now + cycles;
+
+    for (;;) {
+        uint64_t t = nextTim4;
+
+        if (nextZeroCross < t) {
+            t = nextZeroCross;
+        }
+        if (tim3Armed && nextTim3 < t) {
+            t = nextTim3;
+        }
+        if (t >= end) {
+            break;
+        }
+
+        __isr_begin(t);
+        if (t == nextZeroCross) {
+            __zero_cross();
+            nextZeroCross += HALF_WAVE_CYCLES;
+        } else if (tim3Armed && t == nextTim3) {
+            fan_driver_launch_triac_int();
+            nextTim3 += __tim_cycles(TIM3);
+        } else {
+            vfd_driver_int();
+            nextTim4 += __tim_cycles(TIM4);
+        }
+        __follow_tim3();
+    }
+    now = end;
+}
+
+static void __discard(const uint8_t* data, uint16_t size)
+{
+    UNUSED(data);
+    UNUSED(size);
+}
+
+// from the main loop, between the interrupts
+static void __set_power(uint8_t power)
+{
+    __isr_begin(now);
+    fan_driver_set_power(power);
+    __follow_tim3();
+}
+
+static void __reset_checks()
+{
+    overlaps = 0;
+    for (uint8_t s = 0; s < VFD_SECTIONS; ++s) {
+        litMin[s] = UINT64_MAX;
+        litMax[s] = 0;
+        litCount[s] = 0;
+    }
+    litAnodeChanges = 0;
+    blankMin = UINT64_MAX;
+    blankMax = 0;
+    __account(now);
+    memset(segmentLit, 0, sizeof(segmentLit));
+    dutyStart = now;
+    delayMin = widthMin = UINT64_MAX;
+    delayMax = widthMax = 0;
+    pulses = 0;
+    lowAtCross = 0;
+}
+
+static uint8_t __segments(uint8_t value)
+{
+    return __builtin_popcount(value & 0x7F);
+}
+
+// the calibrated lit time of a section, in TIM4 ticks
+static uint8_t __dwell(uint8_t s, uint8_t value)
+{
+    return section_dwell[s] + segment_dwell[__segments(value)];
+}
+
+static uint64_t __dwell_cycles(uint8_t s, uint8_t value)
+{
+    return __dwell(s, value) * __tim_cycles(TIM4);
+}
+
+// the relative brightness of a level, the curve of vfd_driver.c
+static double __brightness(uint8_t level)
+{
+    return 0.2 + 0.8 * pow(level / (VFD_LEVELS - 1.0), 2.2);
+}
+
+/*
+ The share of the time every anode was lit under every grid. A lit
+ segment gets its section's dwell of the frame, the frame being all
+ dwells, each stretched by its dark phase, and the blanking intervals.
+ Anything else is a segment lit where it does not belong.
+ */
+static void __check_duty(const uint8_t* sections, uint8_t level,
+                         double tolerance)
+{
+    double dark = 1 / __brightness(level) - 1;
+    double frame = 0;
+
+    __account(now);
+    for (uint8_t s = 0; s < VFD_SECTIONS; ++s) {
+        frame += __dwell(s, sections[s]) * (1 + dark) + VFD_BLANK_TICKS;
+    }
+
+    for (uint8_t s = 0; s < VFD_SECTIONS; ++s) {
+        double expected = __dwell(s, sections[s]) / frame;
+
+        for (uint32_t i = VFD_SECTIONS; __is_anode(i); ++i) {
+            uint8_t dots = (i >= DOTS_SIGNAL);
+            uint8_t lit = (dots == (s == VFD_DOTS_SECTION))
+                && (sections[s] & signals[i].bit);
+            double duty = (double)segmentLit[s][i] / (now - dutyStart);
+
+            if (lit) {
+                CHECK_CMP(fabs(duty / expected - 1), <=, tolerance);
+            } else {
+                CHECK(segmentLit[s][i] == 0);
+            }
+        }
+    }
+}
+
+static void __check_on_time(const uint8_t* sections)
+{
+    for (uint8_t s = 0; s < VFD_SECTIONS; ++s) {
+        uint64_t expected = __dwell_cycles(s, sections[s]);
+
+        CHECK(litCount[s] > 0);
+        CHECK_CMP(litMin[s], >=, expected - EDGE_CYCLES);
+        CHECK_CMP(litMax[s], <=, expected + EDGE_CYCLES);
+    }
+}
+
+// one grid at a time, whatever is shown and at any brightness
+static void test_ghosting()
+{
+    uint32_t seed = 0x6405;
+
+    __reset_checks();
+    for (int i = 0; i < 200; ++i) {
+        vfd_driver_print_left(test_rand(&seed) % 100);
+        vfd_driver_print_right(test_rand(&seed) % 100);
+        vfd_driver_light_dots(test_rand(&seed) & 0x03);
+        if (i % 50 == 0) {
+            vfd_driver_fade_to(test_rand(&seed) % VFD_LEVELS);
+        }
+        __run(5 * MS_CYCLES);
+    }
+
+    CHECK(overlaps == 0);
+    CHECK(gridsOn <= 1);
+    for (uint8_t s = 0; s < VFD_SECTIONS; ++s) {
+        CHECK(litCount[s] > 0);
+    }
+}
+
+// every frame lights a digit for the same time, set by its calibrated
+// dwell, the brightness only stretches the dark phase
+static void test_on_time()
+{
+    uint8_t sections[VFD_SECTIONS];
+
+    vfd_driver_print_left(88);
+    vfd_driver_print_right(88);
+    vfd_driver_light_dots(VFD_DOT_H | VFD_DOT_L);
+    vfd_driver_get_sections(sections);
+
+    for (uint8_t level = VFD_LEVELS - 1; level < VFD_LEVELS; level -= 10) {
+        vfd_driver_set_level(level);
+        __run(10 * MS_CYCLES);
+        __reset_checks();
+        __run(200 * MS_CYCLES);
+        __check_on_time(sections);
+    }
+
+    // fewer segments, a shorter dwell
+    vfd_driver_print_left(11);
+    vfd_driver_print_right(17);
+    vfd_driver_light_dots(VFD_DOT_H);
+    vfd_driver_get_sections(sections);
+    vfd_driver_set_level(VFD_LEVELS - 1);
+    __run(10 * MS_CYCLES);
+    __reset_checks();
+    __run(200 * MS_CYCLES);
+    __check_on_time(sections);
+    CHECK(overlaps == 0);
+}
+
+// the grids are all off for the blanking interval between two sections
+// and the anodes change only then
+static void test_blanking()
+{
+    uint32_t seed = 0xB1A2;
+    uint64_t blank = VFD_BLANK_TICKS * __tim_cycles(TIM4);
+
+    vfd_driver_set_level(VFD_LEVELS - 1);
+    __reset_checks();
+    for (int i = 0; i < 100; ++i) {
+        vfd_driver_print_left(test_rand(&seed) % 100);
+        vfd_driver_print_right(test_rand(&seed) % 100);
+        vfd_driver_light_dots(test_rand(&seed) & 0x03);
+        __run(5 * MS_CYCLES);
+    }
+    CHECK(litAnodeChanges == 0);
+    CHECK_CMP(blankMin, >=, blank - EDGE_CYCLES);
+    // at the full brightness nothing but the blanking
+    CHECK_CMP(blankMax, <=, blank + EDGE_CYCLES);
+
+    // dimmed, the dark phase adds to it
+    __reset_checks();
+    for (int i = 0; i < 100; ++i) {
+        vfd_driver_fade_to(test_rand(&seed) % VFD_LEVELS);
+        vfd_driver_print_left(test_rand(&seed) % 100);
+        __run(5 * MS_CYCLES);
+    }
+    CHECK(litAnodeChanges == 0);
+    CHECK_CMP(blankMin, >=, blank - EDGE_CYCLES);
+}
+
+// per segment duty from the pin trace, by the calibration table and by
+// the brightness curve
+static void test_segment_duty()
+{
+    static const uint8_t levels[] = { 31, 24, 16, 8, 0 };
+    uint8_t sections[VFD_SECTIONS];
+
+    // 1 and 7 few segments, 8 all, the dots both
+    vfd_driver_print_left(18);
+    vfd_driver_print_right(78);
+    vfd_driver_light_dots(VFD_DOT_H | VFD_DOT_L);
+    vfd_driver_get_sections(sections);
+
+    for (uint32_t i = 0; i < sizeof(levels); ++i) {
+        vfd_driver_set_level(levels[i]);
+        __run(10 * MS_CYCLES);
+        __reset_checks();
+        __run(500 * MS_CYCLES);
+        // a part frame at the end and the write delays, 1 %, the level
+        // table is rounded to 1/16 of a tick on top
+        __check_duty(sections, levels[i], (i == 0) ? 0.01 : 0.03);
+        CHECK(litAnodeChanges == 0);
+    }
+
+    // one dot and an empty section
+    vfd_driver_clear();
+    vfd_driver_print_right(5);
+    vfd_driver_light_dots(VFD_DOT_L);
+    vfd_driver_get_sections(sections);
+    vfd_driver_set_level(VFD_LEVELS - 1);
+    __run(10 * MS_CYCLES);
+    __reset_checks();
+    __run(500 * MS_CYCLES);
+    __check_duty(sections, VFD_LEVELS - 1, 0.01);
+}
+
+// the gate goes high the timer's delay after the crossing and stays
+// until the next one, a missed or early pulse is a wrong power
+static void test_triac_pulse()
+{
+    static const uint8_t powers[] = { 1, 25, 50, 75, 99 };
+
+    for (uint32_t i = 0; i < sizeof(powers); ++i) {
+        uint8_t power = powers[i];
+        uint32_t period = TRIAC_DELAY_MAX * (100 - power) / 100;
+        uint64_t delay = (uint64_t)(period + 1) * (TIM3_PRESCALER + 1);
+
+        __set_power(power);
+        __run(3 * HALF_WAVE_CYCLES);
+        __reset_checks();
+        __run(50 * HALF_WAVE_CYCLES);
+
+        CHECK(pulses == 50);
+        CHECK(lowAtCross == 0);
+        CHECK_CMP(delayMin, >=, delay);
+        CHECK_CMP(delayMax, <=, delay + EDGE_CYCLES);
+        CHECK_CMP(widthMin, >=, HALF_WAVE_CYCLES - delay - EDGE_CYCLES);
+        CHECK_CMP(widthMax, <=, HALF_WAVE_CYCLES - delay + EDGE_CYCLES);
+    }
+
+    // off, no pulse at all
+    __set_power(0);
+    __reset_checks();
+    __run(20 * HALF_WAVE_CYCLES);
+    CHECK(pulses == 0);
+    CHECK(lowAtCross == 20);
+    CHECK(!tim3Armed);
+
+    // full, the gate held high across the crossings
+    __set_power(100);
+    __reset_checks();
+    __run(20 * HALF_WAVE_CYCLES);
+    CHECK(signals[DRIVE_SIGNAL].value);
+    CHECK(lowAtCross == 0);
+    CHECK(!tim3Armed);
+}
+
+int main()
+{
+    htim3.Instance = TIM3;
+    htim3.Init.Prescaler = TIM3_PRESCALER;
+    htim3.Init.Period = 10;
+    HAL_TIM_Base_Init(&htim3);
+    htim4.Instance = TIM4;
+    htim4.Init.Prescaler = TIM4_PRESCALER;
+    htim4.Init.Period = TIM4_PERIOD;
+    HAL_TIM_Base_Init(&htim4);
+
+    // the LOG of fan_driver.c goes nowhere
+    huart1.Instance = USART1;
+    usart_config(&huart1);
+    stub_uart_tx_hook = __discard;
+
+    __vcd_open();
+    stub_gpio_hook = __pin_written;
+
+    nextTim4 = __tim_cycles(TIM4);
+    nextZeroCross = HALF_WAVE_CYCLES / 2;
+    vfd_driver_init();
+    fan_driver_init(&htim3);
+
+    test_ghosting();
+    test_on_time();
+    test_blanking();
+    test_segment_duty();
+    test_triac_pulse();
+
+    fclose(vcd);
+    printf("  %.2f s of pin transitions in " VCD_FILE "\n",
+           (double)now / CPU_HZ);
+    return test_result("vfd_timing");
+}
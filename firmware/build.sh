@@ -3,3 +3,4 @@
 sed -i  '/^\/Src\/system_stm32f1xx.c/d' Makefile
 
 make -j4
+make -j4 bootloader
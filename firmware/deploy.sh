@@ -1,3 +1,11 @@
 #!/bin/bash
 
-sudo stm32flash  -w build/temp_meter.hex -v -g 0x0 /dev/ttyUSB0 
+# ./deploy.sh rom - the bootloader through the ROM loader (BOOT0 high),
+#                   needed once
+# ./deploy.sh     - the application through the bootloader
+
+if [ "$1" == "rom" ]; then
+    sudo stm32flash -w build/boot/bootloader.hex -v -g 0x0 /dev/ttyUSB0
+else
+    sudo tools/boot_upload.py -d /dev/ttyUSB0 build/temp_meter.bin
+fi
@@ -78,6 +78,9 @@ defined in linker script */
   .type Reset_Handler, %function
 Reset_Handler:
 
+/* Start the cycle counter for the boot time measurement */
+  bl boot_time_start
+
 /* Copy the data segment initializers from flash to SRAM */
   movs r1, #0
   b LoopCopyDataInit
@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Rafal Rowniak rrowniak.com
+#
+# Uploads the application through the resident bootloader (see
+# Inc/boot.h). The running application is asked to reset into the
+# bootloader with the shell command "update", then only the pages whose
+# CRC differs from the image are sent, compressed. An upload cut off
+# is resumed simply by running it again.
+#
+# usage: boot_upload.py [-d /dev/ttyUSB0] [-b 460800] build/temp_meter.bin
+#        boot_upload.py --no-app ...   the bootloader is already waiting
+#
+
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+
+APP_BAUD = 115200
+
+CMD_INFO = ord("I")
+CMD_CRCS = ord("C")
+CMD_WRITE = ord("W")
+CMD_DONE = ord("D")
+CMD_RUN = ord("R")
+
+STATUS = {
+    0: "ok",
+    1: "frame error",
+    2: "unknown command",
+    3: "page out of range",
+    4: "decompression failed",
+    5: "page CRC mismatch",
+    6: "Flash error",
+    7: "image check failed",
+}
+
+RETRIES = 3
+
+
+class BootError(Exception):
+    pass
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def stm32_crc32(data):
+    """The STM32 CRC unit, 32-bit words, no reflection"""
+    crc = 0xFFFFFFFF
+    for (word,) in struct.iter_unpack("<I", data):
+        crc ^= word
+        for _ in range(32):
+            if crc & 0x80000000:
+                crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+            else:
+                crc = (crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def lz_compress(page):
+    """Greedy LZ of boot_lz_decode() in Bootloader/boot_proto.c"""
+    out = bytearray()
+    literals = bytearray()
+    chains = {}
+
+    def flush():
+        for k in range(0, len(literals), 128):
+            chunk = literals[k:k + 128]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        literals.clear()
+
+    def remember(pos):
+        if pos + 3 <= len(page):
+            chains.setdefault(page[pos:pos + 3], []).append(pos)
+
+    i = 0
+    while i < len(page):
+        best_len, best_off = 0, 0
+        longest = min(34, len(page) - i)
+
+        for j in reversed(chains.get(page[i:i + 3], [])[-64:]):
+            offset = i - j
+            if offset > 1024:
+                break
+            n = 0
+            while n < longest and page[j + n] == page[i + n]:
+                n += 1
+            if n > best_len:
+                best_len, best_off = n, offset
+                if n == longest:
+                    break
+
+        if best_len >= 3:
+            flush()
+            out.append(0x80 | ((best_len - 3) << 2) | ((best_off - 1) >> 8))
+            out.append((best_off - 1) & 0xFF)
+            for k in range(i, i + best_len):
+                remember(k)
+            i += best_len
+        else:
+            literals.append(page[i])
+            remember(i)
+            i += 1
+
+    flush()
+    return bytes(out)
+
+
+def open_tty(path, baud):
+    speed = getattr(termios, "B%d" % baud, None)
+    if speed is None:
+        sys.exit("unsupported baud rate %d" % baud)
+
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                     # iflag
+    attr[1] = 0                                     # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                     # lflag
+    attr[4] = attr[5] = speed
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+class Bootloader:
+    def __init__(self, fd):
+        self.fd = fd
+        self.sent = 0
+
+    def _read(self, n, deadline):
+        data = b""
+        while len(data) < n:
+            left = deadline - time.monotonic()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                raise BootError("timeout after %d bytes" % len(data))
+            data += os.read(self.fd, n - len(data))
+        return data
+
+    def transact(self, cmd, payload=b"", timeout=1.0):
+        body = struct.pack("<BH", cmd, len(payload)) + payload
+        request = body + struct.pack("<H", crc16(body))
+
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+        os.write(self.fd, request)
+        self.sent += len(request)
+        deadline = time.monotonic() + timeout
+
+        head = self._read(3, deadline)
+        status, length = struct.unpack("<BH", head)
+        rest = self._read(length + 2, deadline)
+        if crc16(head + rest) != 0:
+            raise BootError("bad CRC " + (head + rest).hex())
+        if status != 0:
+            raise BootError(STATUS.get(status, "status %d" % status))
+        return rest[:-2]
+
+    def retry(self, cmd, payload=b"", timeout=1.0):
+        for attempt in range(RETRIES):
+            try:
+                return self.transact(cmd, payload, timeout)
+            except BootError as e:
+                if attempt == RETRIES - 1:
+                    raise
+                print("  %s, retrying" % e, file=sys.stderr)
+
+
+def enter_bootloader(path):
+    fd = open_tty(path, APP_BAUD)
+    # a CR first ends whatever is left in the shell line
+    os.write(fd, b"\rupdate\r")
+    termios.tcdrain(fd)
+    os.close(fd)
+    # the application commits the configuration before it resets
+    time.sleep(0.2)
+
+
+def connect(path, baud, attempts):
+    fd = open_tty(path, baud)
+    boot = Bootloader(fd)
+    for _ in range(attempts):
+        try:
+            return boot, boot.transact(CMD_INFO, timeout=0.3)
+        except BootError:
+            pass
+    sys.exit("no answer from the bootloader on %s" % path)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-d", "--device", default="/dev/ttyUSB0")
+    parser.add_argument("-b", "--baud", type=int, default=460800)
+    parser.add_argument("--no-app", action="store_true",
+                        help="do not ask the application to reset")
+    parser.add_argument("--no-run", action="store_true",
+                        help="stay in the bootloader after the upload")
+    parser.add_argument("image")
+    args = parser.parse_args()
+
+    image = open(args.image, "rb").read()
+    image += b"\xff" * (-len(image) % 4)
+
+    start = time.monotonic()
+    if not args.no_app:
+        enter_bootloader(args.device)
+    boot, info = connect(args.device, args.baud, 10)
+
+    version, page_size, pages, valid = struct.unpack("<BHBB", info)
+    print("bootloader v%d, %d pages of %d bytes, image %s"
+          % (version, pages, page_size, "valid" if valid else "invalid"))
+
+    if len(image) > pages * page_size:
+        sys.exit("the image takes %d bytes, only %d fit"
+                 % (len(image), pages * page_size))
+
+    crcs = struct.unpack("<%dI" % pages, boot.retry(CMD_CRCS))
+    padded = image + b"\xff" * (-len(image) % page_size)
+
+    written = skipped = compressed = 0
+    for page in range(len(padded) // page_size):
+        data = padded[page * page_size:(page + 1) * page_size]
+        crc = stm32_crc32(data)
+        if crc == crcs[page]:
+            skipped += 1
+            continue
+
+        packed = lz_compress(data)
+        boot.retry(CMD_WRITE, struct.pack("<BI", page, crc) + packed)
+        written += 1
+        compressed += len(packed)
+        print("\r  page %d/%d" % (page + 1, len(padded) // page_size),
+              end="", flush=True)
+    if written:
+        print()
+
+    boot.retry(CMD_DONE, struct.pack("<II", len(image), stm32_crc32(image)))
+    if not args.no_run:
+        boot.retry(CMD_RUN)
+
+    elapsed = time.monotonic() - start
+    print("%d pages written, %d unchanged, %.2f s" % (written, skipped, elapsed))
+    print("%d bytes sent for %d of image" % (boot.sent, len(image)), end="")
+    if written:
+        print(", pages compressed to %.0f%%"
+              % (100 * compressed / (written * page_size)), end="")
+    print()
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except BootError as e:
+        sys.exit("upload failed: %s, run it again to resume" % e)
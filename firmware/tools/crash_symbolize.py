@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Rafal Rowniak rrowniak.com
+#
+# Resolves the CRASH lines printed by the firmware (see Inc/crash.h)
+# against the ELF image.
+#
+# usage: crash_symbolize.py [-e build/temp_meter.elf] [log]
+#        the log defaults to stdin
+#
+
+import argparse
+import re
+import subprocess
+import sys
+
+ADDR2LINE = "arm-none-eabi-addr2line"
+
+TYPES = {
+    1: "HardFault",
+    2: "MemManage",
+    3: "BusFault",
+    4: "UsageFault",
+    5: "_Error_Handler",
+}
+
+CFSR_BITS = [
+    (0, "IACCVIOL instruction access violation"),
+    (1, "DACCVIOL data access violation"),
+    (3, "MUNSTKERR unstacking"),
+    (4, "MSTKERR stacking"),
+    (7, "MMARVALID mmfar valid"),
+    (8, "IBUSERR instruction bus error"),
+    (9, "PRECISERR precise data bus error"),
+    (10, "IMPRECISERR imprecise data bus error"),
+    (11, "UNSTKERR unstacking"),
+    (12, "STKERR stacking"),
+    (15, "BFARVALID bfar valid"),
+    (16, "UNDEFINSTR undefined instruction"),
+    (17, "INVSTATE invalid state"),
+    (18, "INVPC invalid pc load"),
+    (19, "NOCP no coprocessor"),
+    (24, "UNALIGNED unaligned access"),
+    (25, "DIVBYZERO divide by zero"),
+]
+
+HFSR_BITS = [
+    (1, "VECTTBL vector table read"),
+    (30, "FORCED escalated"),
+    (31, "DEBUGEVT debug event"),
+]
+
+
+def symbolize(elf, addrs):
+    if not addrs:
+        return []
+    # thumb bit off, addr2line wants the instruction address
+    args = [ADDR2LINE, "-e", elf, "-f", "-p", "-C"]
+    args += ["0x%08x" % (a & ~1) for a in addrs]
+    out = subprocess.run(args, check=True, capture_output=True, text=True)
+    return out.stdout.strip().splitlines()
+
+
+def bits(value, table):
+    return [name for bit, name in table if value & (1 << bit)]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-e", "--elf", default="build/temp_meter.elf")
+    parser.add_argument("log", nargs="?")
+    args = parser.parse_args()
+
+    log = open(args.log) if args.log else sys.stdin
+    line_re = re.compile(r"CRASH (\d+) (.*)")
+
+    for line in log:
+        m = line_re.search(line)
+        if not m:
+            continue
+
+        slot, tokens = m.group(1), m.group(2).split()
+        kind, rest = tokens[0], tokens[1:]
+        # key value pairs for the type and cfsr lines
+        fields = dict(zip(tokens[0::2], tokens[1::2]))
+
+        if kind == "type":
+            t = int(rest[0])
+            print("crash #%s: %s" % (slot, TYPES.get(t, "type %d" % t)))
+            pc, lr = int(fields["pc"], 16), int(fields["lr"], 16)
+            for name, sym in zip(("pc", "lr"), symbolize(args.elf, [pc, lr])):
+                print("  %-5s %s" % (name, sym))
+        elif kind == "cfsr":
+            cfsr, hfsr = int(fields["cfsr"], 16), int(fields["hfsr"], 16)
+            for name in bits(cfsr, CFSR_BITS) + bits(hfsr, HFSR_BITS):
+                print("  fault %s" % name)
+            if cfsr & (1 << 7):
+                print("  mmfar %s" % fields["mmfar"])
+            if cfsr & (1 << 15):
+                print("  bfar  %s" % fields["bfar"])
+        elif kind == "stack":
+            addrs = [int(a, 16) for a in rest]
+            for i, sym in enumerate(symbolize(args.elf, addrs)):
+                print("  #%-4d %s" % (i, sym))
+        elif kind == "uptime":
+            print("  uptime %s ms" % rest[0])
+
+
+if __name__ == "__main__":
+    main()
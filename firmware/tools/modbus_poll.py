@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Rafal Rowniak rrowniak.com
+#
+# Minimal Modbus RTU master for the register map in Src/logic.c (see
+# Inc/modbus.h). Works on any tty, a USB-UART adapter or a pty.
+#
+# usage: modbus_poll.py [-d /dev/ttyUSB0] [-b 115200] [-a 1] read-input 0 6
+#        modbus_poll.py read-holding 0 13
+#        modbus_poll.py write 1 65
+#        modbus_poll.py bench [-n 1000]
+#
+# bench polls all the input registers and prints the request/response
+# latency, measured from the first byte sent to the last byte received.
+#
+
+import argparse
+import os
+import select
+import statistics
+import struct
+import sys
+import termios
+import time
+
+INPUT_REGISTERS = 6
+
+EXCEPTIONS = {
+    1: "illegal function",
+    2: "illegal data address",
+    3: "illegal data value",
+}
+
+
+class ModbusError(Exception):
+    pass
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def frame(address, function, payload):
+    body = bytes([address, function]) + payload
+    return body + struct.pack("<H", crc16(body))
+
+
+def open_tty(path, baud):
+    speed = getattr(termios, "B%d" % baud, None)
+    if speed is None:
+        sys.exit("unsupported baud rate %d" % baud)
+
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                     # iflag
+    attr[1] = 0                                     # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                     # lflag
+    attr[4] = attr[5] = speed
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+class Master:
+    def __init__(self, fd, address, timeout):
+        self.fd = fd
+        self.address = address
+        self.timeout = timeout
+
+    def _read(self, n, deadline):
+        data = b""
+        while len(data) < n:
+            left = deadline - time.monotonic()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                raise ModbusError("timeout after %d bytes" % len(data))
+            data += os.read(self.fd, n - len(data))
+        return data
+
+    def transact(self, function, payload, length):
+        """Sends a request, returns the response payload and latency [s]
+        length - payload length of a normal response"""
+        request = frame(self.address, function, payload)
+
+        # log lines sent before the first request are not a response
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+
+        start = time.monotonic()
+        os.write(self.fd, request)
+        deadline = start + self.timeout
+
+        head = self._read(2, deadline)
+        if head[1] & 0x80:
+            rest = self._read(3, deadline)
+        else:
+            rest = self._read(length + 2, deadline)
+        latency = time.monotonic() - start
+
+        response = head + rest
+        if crc16(response) != 0:
+            raise ModbusError("bad CRC " + response.hex())
+        if head[0] != self.address or (head[1] & 0x7F) != function:
+            raise ModbusError("unexpected response " + response.hex())
+        if head[1] & 0x80:
+            raise ModbusError(EXCEPTIONS.get(rest[0], "exception %d" % rest[0]))
+
+        return response[2:-2], latency
+
+    def read(self, function, start, count):
+        payload, latency = self.transact(
+            function, struct.pack(">HH", start, count), 1 + 2 * count)
+        return list(struct.unpack(">%dH" % count, payload[1:])), latency
+
+    def write(self, register, value):
+        return self.transact(0x06, struct.pack(">HH", register, value), 4)
+
+
+def bench(master, n):
+    latencies = []
+    errors = 0
+
+    for _ in range(n):
+        try:
+            _, latency = master.read(0x04, 0, INPUT_REGISTERS)
+            latencies.append(latency * 1000)
+        except ModbusError as e:
+            if not errors:
+                print("error:", e, file=sys.stderr)
+            errors += 1
+
+    if not latencies:
+        sys.exit("no response")
+
+    latencies.sort()
+    p99 = latencies[min(len(latencies) - 1, int(len(latencies) * 0.99))]
+    print("requests %d, errors %d" % (n, errors))
+    print("latency [ms] min %.2f avg %.2f p99 %.2f max %.2f" % (
+        latencies[0], statistics.mean(latencies), p99, latencies[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("-d", "--device", default="/dev/ttyUSB0")
+    parser.add_argument("-b", "--baud", type=int, default=115200)
+    parser.add_argument("-a", "--address", type=int, default=1)
+    parser.add_argument("-t", "--timeout", type=float, default=0.5,
+                        help="response timeout [s]")
+    parser.add_argument("-n", "--count", type=int, default=1000,
+                        help="bench requests")
+    parser.add_argument("command", 
+                        choices=["read-input", "read-holding", "write", 
+                                 "bench"])
+    parser.add_argument("args", type=int, nargs="*")
+    args = parser.parse_args()
+
+    master = Master(open_tty(args.device, args.baud), args.address, 
+                    args.timeout)
+
+    try:
+        if args.command == "bench":
+            bench(master, args.count)
+        elif args.command == "write":
+            register, value = args.args
+            _, latency = master.write(register, value)
+            print("ok (%.2f ms)" % (latency * 1000))
+        else:
+            start, count = args.args
+            function = 0x04 if args.command == "read-input" else 0x03
+            values, latency = master.read(function, start, count)
+            for i, v in enumerate(values):
+                print("%3d: %5d 0x%04x" % (start + i, v, v))
+            print("(%.2f ms)" % (latency * 1000))
+    except ModbusError as e:
+        sys.exit("error: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
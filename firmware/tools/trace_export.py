@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Rafal Rowniak rrowniak.com
+#
+# Converts the trace dump printed by the shell command "trace" (see
+# Inc/trace.h, build with TRACE=1) into the Chrome trace JSON format,
+# opened by chrome://tracing and https://ui.perfetto.dev
+#
+# usage: trace_export.py [-o trace.json] [log]
+#        the log defaults to stdin, the last complete dump is taken
+#
+
+import argparse
+import json
+import re
+import sys
+
+# enum TraceType
+ISR_ENTER, ISR_EXIT, TASK_BEGIN, TASK_END, MARK = range(5)
+
+# enum IsrId
+ISRS = [
+    "TIM3 fan_driver_launch_triac_int",
+    "TIM4 vfd_driver_int",
+    "EXTI9_5 fan_driver_zero_cross_int",
+    "DMA1_CH1 dma_conv_int",
+    "USART1 uart_rx_idle_int",
+]
+
+# enum TraceTask
+TASKS = [
+    "sampling",
+    "control",
+    "ui",
+    "uart",
+    "flash",
+]
+
+# enum TraceMark
+MARK_FAN_POWER, MARK_CONFIG_SAVE, MARK_TRIGGER = range(3)
+
+# enum TraceTrigger
+TRIGGERS = ["fan power step", "flash", "missed zero cross"]
+
+PID = 1
+MAIN_TID = 0
+
+
+def parse(log):
+    """Returns (clock, records) of the last complete dump"""
+    dump = None
+    result = None
+    for line in log:
+        m = re.search(r"TS (\d+) (\d+)", line)
+        if m:
+            dump = (int(m.group(2)), [])
+            continue
+        m = re.search(r"T (0x[0-9a-f]{8}) (0x[0-9a-f]{8})", line)
+        if m and dump:
+            dump[1].append((int(m.group(1), 16), int(m.group(2), 16)))
+            continue
+        if re.search(r"\bTE\b", line) and dump:
+            result, dump = dump, None
+    if result is None:
+        sys.exit("no complete trace dump found")
+    return result
+
+
+def isr_name(i):
+    return ISRS[i] if i < len(ISRS) else "ISR %d" % i
+
+
+def task_name(i):
+    return TASKS[i] if i < len(TASKS) else "task %d" % i
+
+
+def convert(clock, records):
+    events = [
+        {"ph": "M", "pid": PID, "name": "process_name",
+         "args": {"name": "temp_meter"}},
+        {"ph": "M", "pid": PID, "tid": MAIN_TID, "name": "thread_name",
+         "args": {"name": "main loop"}},
+    ]
+    for i, name in enumerate(ISRS):
+        events.append({"ph": "M", "pid": PID, "tid": i + 1,
+                       "name": "thread_name", "args": {"name": name}})
+
+    # open B events per thread, an E whose B fell out of the ring is
+    # dropped
+    open_events = {}
+    cycles = 0
+    prev = None
+
+    for stamp, word in records:
+        # the DWT counter wraps, records are in order but the begin of a
+        # stage recorded at its end (trace_span()), a step back
+        if prev is not None:
+            step = (stamp - prev) & 0xFFFFFFFF
+            cycles += step - (1 << 32) if step & 0x80000000 else step
+        prev = stamp
+        ts = cycles * 1e6 / clock
+
+        kind, ident, arg = word >> 24, (word >> 16) & 0xFF, word & 0xFFFF
+
+        if kind in (ISR_ENTER, ISR_EXIT):
+            tid, name = ident + 1, isr_name(ident)
+        elif kind in (TASK_BEGIN, TASK_END):
+            tid, name = MAIN_TID, task_name(ident)
+        else:
+            tid, name = MAIN_TID, None
+
+        if kind in (ISR_ENTER, TASK_BEGIN):
+            open_events.setdefault(tid, []).append(name)
+            events.append({"ph": "B", "pid": PID, "tid": tid, "ts": ts,
+                           "name": name})
+        elif kind in (ISR_EXIT, TASK_END):
+            stack = open_events.get(tid, [])
+            if name not in stack:
+                continue
+            # unwind what did not end, i.e. cut by the ring
+            while stack:
+                top = stack.pop()
+                events.append({"ph": "E", "pid": PID, "tid": tid, "ts": ts,
+                               "name": top})
+                if top == name:
+                    break
+        elif ident == MARK_FAN_POWER:
+            events.append({"ph": "C", "pid": PID, "ts": ts,
+                           "name": "fan power", "args": {"%": arg}})
+        elif ident == MARK_CONFIG_SAVE:
+            events.append({"ph": "i", "pid": PID, "tid": MAIN_TID, "ts": ts,
+                           "s": "t", "name": "config save"})
+        elif ident == MARK_TRIGGER:
+            name = TRIGGERS[arg] if arg < len(TRIGGERS) else "%d" % arg
+            events.append({"ph": "i", "pid": PID, "ts": ts, "s": "g",
+                           "name": "trigger: " + name})
+        else:
+            events.append({"ph": "i", "pid": PID, "tid": MAIN_TID, "ts": ts,
+                           "s": "t", "name": "mark %d" % ident,
+                           "args": {"arg": arg}})
+
+    # the metadata first, then by time
+    events.sort(key=lambda e: ("ts" in e, e.get("ts", 0)))
+    trace = {"traceEvents": events, "displayTimeUnit": "ns"}
+    return trace, cycles * 1e3 / clock
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-o", "--output", default="trace.json")
+    parser.add_argument("log", nargs="?")
+    args = parser.parse_args()
+
+    log = open(args.log) if args.log else sys.stdin
+    clock, records = parse(log)
+    trace, span = convert(clock, records)
+
+    with open(args.output, "w") as f:
+        json.dump(trace, f)
+
+    print("%d records, %.1f ms, written to %s"
+          % (len(records), span, args.output))
+
+
+if __name__ == "__main__":
+    main()